@@ -15,6 +15,20 @@
 #define END_OF_FILE_ERROR -12
 #define READ_ERROR -13
 #define NAME_LENGTH_ERROR -14
+#define DIRECTORY_FULL_ERROR -15
+#define CHECKSUM_ERROR -16
+#define READ_ONLY_ERROR -17
+#define SNAPSHOT_NOT_FOUND_ERROR -18
+#define SNAPSHOT_EXISTS_ERROR -19
+#define NOT_A_DIRECTORY_ERROR -20
+#define IS_A_DIRECTORY_ERROR -21
+#define DIRECTORY_NOT_EMPTY_ERROR -22
+#define FILE_EXISTS_ERROR -23
+#define SPARSE_MAP_FULL_ERROR -24
+#define ADVICE_ERROR -25
+#define QUOTA_ERROR -26
+#define TRACE_ERROR -27
+#define RANGE_ERROR -28
 #define MKFS_SUCCESS 1
 #define MOUNT_SUCCESS 2
 #define UNMOUNT_SUCCESS 3
@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HEADER ALIGN_UP(sizeof(ArenaChunk))
+#define SLAB_HEADER ALIGN_UP(sizeof(PoolSlab))
+
+// zeroed memory that stays valid until the arena is reset, NULL if out of memory
+void *arenaAlloc(Arena *arena, size_t size)
+{
+    size = ALIGN_UP(size);
+    ArenaChunk *chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < size)
+    {
+        size_t length = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = (ArenaChunk *)malloc(ARENA_HEADER + length);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+        chunk->size = length;
+        chunk->used = 0;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    void *memory = (unsigned char *)chunk + ARENA_HEADER + chunk->used;
+    chunk->used += size;
+    memset(memory, 0, size);
+    return memory;
+}
+
+char *arenaStrdup(Arena *arena, const char *string)
+{
+    char *copy = (char *)arenaAlloc(arena, strlen(string) + 1);
+    if (copy != NULL)
+    {
+        strcpy(copy, string);
+    }
+    return copy;
+}
+
+// drop everything allocated so far, one standard chunk is kept for the next mount
+void arenaReset(Arena *arena)
+{
+    ArenaChunk *keep = NULL;
+    ArenaChunk *chunk = arena->chunks;
+    while (chunk != NULL)
+    {
+        ArenaChunk *next = chunk->next;
+        if (keep == NULL && chunk->size == ARENA_CHUNK_SIZE)
+        {
+            keep = chunk;
+            keep->used = 0;
+            keep->next = NULL;
+        }
+        else
+        {
+            free(chunk);
+        }
+        chunk = next;
+    }
+    arena->chunks = keep;
+}
+
+void arenaRelease(Arena *arena)
+{
+    arenaReset(arena);
+    free(arena->chunks);
+    arena->chunks = NULL;
+}
+
+// an object from the free list, or from a new slab when it is empty. Not zeroed
+void *poolAlloc(Pool *pool)
+{
+    if (pool->freeList == NULL)
+    {
+        size_t size = ALIGN_UP(pool->objectSize > sizeof(void *) ? pool->objectSize : sizeof(void *));
+        PoolSlab *slab = (PoolSlab *)malloc(SLAB_HEADER + size * pool->perSlab);
+        if (slab == NULL)
+        {
+            return NULL;
+        }
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        unsigned char *objects = (unsigned char *)slab + SLAB_HEADER;
+        for (int i = pool->perSlab - 1; i >= 0; i--)
+        {
+            *(void **)(objects + i * size) = pool->freeList;
+            pool->freeList = objects + i * size;
+        }
+    }
+    void *object = pool->freeList;
+    pool->freeList = *(void **)object;
+    return object;
+}
+
+void poolFree(Pool *pool, void *object)
+{
+    if (object != NULL)
+    {
+        *(void **)object = pool->freeList;
+        pool->freeList = object;
+    }
+}
+
+// free every slab, only when no object from the pool is still in use
+void poolRelease(Pool *pool)
+{
+    while (pool->slabs != NULL)
+    {
+        PoolSlab *next = pool->slabs->next;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+    pool->freeList = NULL;
+}
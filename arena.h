@@ -0,0 +1,49 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// bump allocator for structures that live as long as a mount, released all at once on unmount
+
+#define ARENA_CHUNK_SIZE 16384 // bytes per chunk, larger requests get a chunk of their own
+
+typedef struct ArenaChunk
+{
+    struct ArenaChunk *next;
+    size_t size; // usable bytes after the header
+    size_t used;
+} ArenaChunk;
+
+typedef struct
+{
+    ArenaChunk *chunks; // newest first, allocations come from the head
+} Arena;
+
+void *arenaAlloc(Arena *arena, size_t size);
+char *arenaStrdup(Arena *arena, const char *string);
+void arenaReset(Arena *arena);
+void arenaRelease(Arena *arena);
+
+// fixed size objects handed out from slabs and recycled through a free list, for objects
+// created and dropped far more often than a mount, like open file entries
+
+typedef struct PoolSlab
+{
+    struct PoolSlab *next;
+} PoolSlab;
+
+typedef struct
+{
+    size_t objectSize; // bytes per object as requested
+    int perSlab;       // objects carved from each slab
+    void *freeList;    // free objects, each starts with the link to the next
+    PoolSlab *slabs;
+} Pool;
+
+#define POOL_INIT(objectSize, perSlab) {(objectSize), (perSlab), NULL, NULL}
+
+void *poolAlloc(Pool *pool);
+void poolFree(Pool *pool, void *object);
+void poolRelease(Pool *pool);
+
+#endif // ARENA_H
@@ -0,0 +1,515 @@
+/* TinyFS benchmark harness
+ * Runs a fixed set of seeded workloads against a fresh image and reports
+ * ops/sec, MB/s, p50/p99 latency and libDisk syscall counts as CSV or JSON.
+ *
+ * usage: TinyFSBench [-r rounds] [-s seed] [-f csv|json] [-o outfile] [-d disk] [-z] [-u] [-D]
+ *   -z  mount every image with compression on
+ *   -u  mount every image with deduplication on
+ *   -D  open every image with O_DIRECT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "libTinyFS.h"
+#include "libDisk.h"
+#include "TinyFS_errno.h"
+
+#define BENCH_DISK_NAME "bench.dsk"
+#define BENCH_DISK_SIZE (256 * BLOCKSIZE) // largest image the 1 byte extent pointer can address
+#define DIR_CAPACITY 124                  // inode slots in the root directory block
+#define LARGE_FILE_SIZE 48000             // ~190 blocks of payload
+#define SMALL_FILES 16
+#define CHURN_FILES 32
+#define TEMPLATE_FILES 24
+#define TEMPLATE_SIZE 1000
+
+typedef struct
+{
+    const char *name;
+    long ops;
+    long bytes;
+    double seconds;
+    double *latencies; // per op, in microseconds
+    int count;
+    int capacity;
+    DiskStats stats;
+} BenchResult;
+
+typedef struct
+{
+    struct timespec start;
+    DiskStats before;
+} BenchTimer;
+
+char *diskName = BENCH_DISK_NAME;
+unsigned int rngState = 1;
+int compressAll = 0;
+int dedupAll = 0;
+
+// xorshift32 so every run with the same seed issues the same operations
+unsigned int nextRandom(void)
+{
+    unsigned int x = rngState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rngState = x;
+    return x;
+}
+
+void fillPattern(char *buffer, int size, int salt)
+{
+    for (int i = 0; i < size; i++)
+    {
+        buffer[i] = 'a' + (i + salt) % 26;
+    }
+}
+
+void initResult(BenchResult *result, const char *name)
+{
+    memset(result, 0, sizeof(BenchResult));
+    result->name = name;
+}
+
+void startTimer(BenchTimer *timer)
+{
+    getDiskStats(&timer->before);
+    clock_gettime(CLOCK_MONOTONIC, &timer->start);
+}
+
+// folds the time and syscalls since the timer started into result, returns the seconds
+double chargeTimer(BenchTimer *timer, BenchResult *result)
+{
+    struct timespec end;
+    DiskStats after;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getDiskStats(&after);
+
+    double elapsed = (end.tv_sec - timer->start.tv_sec) + (end.tv_nsec - timer->start.tv_nsec) / 1e9;
+    result->seconds += elapsed;
+    result->stats.reads += after.reads - timer->before.reads;
+    result->stats.writes += after.writes - timer->before.writes;
+    result->stats.seeks += after.seeks - timer->before.seeks;
+    result->stats.others += after.others - timer->before.others;
+    return elapsed;
+}
+
+// closes one timed operation and folds its time and syscalls into result
+void stopTimer(BenchTimer *timer, BenchResult *result, long bytes)
+{
+    double elapsed = chargeTimer(timer, result);
+    result->ops++;
+    result->bytes += bytes;
+
+    if (result->count == result->capacity)
+    {
+        result->capacity = result->capacity ? result->capacity * 2 : 256;
+        result->latencies = (double *)realloc(result->latencies, result->capacity * sizeof(double));
+    }
+    result->latencies[result->count++] = elapsed * 1e6;
+}
+
+int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double percentile(BenchResult *result, double p)
+{
+    if (result->count == 0)
+    {
+        return 0.0;
+    }
+    int index = (int)(p * (result->count - 1) + 0.5);
+    return result->latencies[index];
+}
+
+void freshDisk(void)
+{
+    if (tfs_mkfs(diskName, BENCH_DISK_SIZE) < 0 || tfs_mount(diskName) < 0)
+    {
+        fprintf(stderr, "Error: Unable to create benchmark disk %s.\n", diskName);
+        exit(1);
+    }
+    tfs_setCompression(compressAll);
+    if (dedupAll)
+    {
+        tfs_setDedup(1);
+    }
+}
+
+void failOp(const char *workload, const char *op, int code)
+{
+    fprintf(stderr, "Error: %s: %s failed with %d.\n", workload, op, code);
+    exit(1);
+}
+
+// writes are buffered until a sync, so a workload that writes ends with a timed tfs_sync. Its
+// time and syscalls count towards the workload, but not as an operation or in the percentiles
+void timeFlush(BenchResult *result)
+{
+    BenchTimer timer;
+    startTimer(&timer);
+    int status = tfs_sync();
+    chargeTimer(&timer, result);
+    if (status < 0)
+    {
+        failOp(result->name, "tfs_sync", status);
+    }
+}
+
+// creates a full root directory of empty files on a fresh disk each round
+void benchCreate(BenchResult *result, int rounds)
+{
+    char name[9];
+    BenchTimer timer;
+    initResult(result, "create_small");
+    for (int r = 0; r < rounds; r++)
+    {
+        freshDisk();
+        for (int i = 0; i < DIR_CAPACITY; i++)
+        {
+            snprintf(name, sizeof(name), "f%d", i);
+            startTimer(&timer);
+            int fd = tfs_openFile(name);
+            stopTimer(&timer, result, 0);
+            if (fd < 0)
+            {
+                failOp(result->name, "tfs_openFile", fd);
+            }
+        }
+        timeFlush(result);
+        tfs_unmount();
+    }
+}
+
+// the same full root directory, created with one tfs_createMany call per round
+void benchCreateBatch(BenchResult *result, int rounds)
+{
+    char names[DIR_CAPACITY][9];
+    char *list[DIR_CAPACITY];
+    fileDescriptor fds[DIR_CAPACITY];
+    BenchTimer timer;
+    initResult(result, "create_batch");
+    for (int i = 0; i < DIR_CAPACITY; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "f%d", i);
+        list[i] = names[i];
+    }
+    for (int r = 0; r < rounds; r++)
+    {
+        freshDisk();
+        startTimer(&timer);
+        int created = tfs_createMany(list, DIR_CAPACITY, fds);
+        stopTimer(&timer, result, 0);
+        for (int i = 0; i < DIR_CAPACITY && created != DIR_CAPACITY; i++)
+        {
+            if (created < 0 || fds[i] < 0)
+            {
+                failOp(result->name, "tfs_createMany", created < 0 ? created : fds[i]);
+            }
+        }
+        result->ops += DIR_CAPACITY - 1; // one timed call, but it creates a directory's worth of files
+        timeFlush(result);
+        tfs_unmount();
+    }
+}
+
+// rewrites one large file, then reads it back byte by byte
+void benchSequential(BenchResult *write, BenchResult *read, int rounds)
+{
+    BenchTimer timer;
+    char byte;
+    char *data = (char *)malloc(LARGE_FILE_SIZE);
+    initResult(write, "seq_write");
+    initResult(read, "seq_read");
+    freshDisk();
+    int fd = tfs_openFile("large");
+    for (int r = 0; r < rounds; r++)
+    {
+        fillPattern(data, LARGE_FILE_SIZE, r);
+        startTimer(&timer);
+        int status = tfs_writeFile(fd, data, LARGE_FILE_SIZE);
+        stopTimer(&timer, write, LARGE_FILE_SIZE);
+        if (status < 0)
+        {
+            failOp(write->name, "tfs_writeFile", status);
+        }
+        timeFlush(write);
+
+        startTimer(&timer);
+        tfs_seek(fd, 0);
+        int i = 0;
+        while (tfs_readByte(fd, &byte) >= 0)
+        {
+            if (byte != data[i])
+            {
+                fprintf(stderr, "Error: %s: byte %d read back wrong.\n", read->name, i);
+                exit(1);
+            }
+            i++;
+        }
+        stopTimer(&timer, read, LARGE_FILE_SIZE);
+        if (i != LARGE_FILE_SIZE)
+        {
+            fprintf(stderr, "Error: %s: read %d of %d bytes.\n", read->name, i, LARGE_FILE_SIZE);
+            exit(1);
+        }
+    }
+    tfs_unmount();
+    free(data);
+}
+
+// overwrites randomly chosen small files with new content of random size
+void benchRandomOverwrite(BenchResult *result, int rounds)
+{
+    BenchTimer timer;
+    char name[9];
+    char data[2048];
+    fileDescriptor fds[SMALL_FILES];
+    initResult(result, "rand_overwrite");
+    freshDisk();
+    for (int i = 0; i < SMALL_FILES; i++)
+    {
+        snprintf(name, sizeof(name), "s%d", i);
+        fds[i] = tfs_openFile(name);
+        fillPattern(data, 1024, i);
+        tfs_writeFile(fds[i], data, 1024);
+    }
+    for (int r = 0; r < rounds * SMALL_FILES; r++)
+    {
+        int target = nextRandom() % SMALL_FILES;
+        int size = 256 + nextRandom() % (sizeof(data) - 256);
+        fillPattern(data, size, r);
+        startTimer(&timer);
+        int status = tfs_writeFile(fds[target], data, size);
+        stopTimer(&timer, result, size);
+        if (status < 0)
+        {
+            failOp(result->name, "tfs_writeFile", status);
+        }
+    }
+    timeFlush(result);
+    tfs_unmount();
+}
+
+// deletes and recreates files of random sizes so the bitmap fragments
+void benchChurn(BenchResult *result, int rounds)
+{
+    BenchTimer timer;
+    char name[9];
+    char data[1200];
+    fileDescriptor fds[CHURN_FILES];
+    int generation = 0;
+    initResult(result, "delete_churn");
+    freshDisk();
+    for (int i = 0; i < CHURN_FILES; i++)
+    {
+        int size = 1 + nextRandom() % sizeof(data);
+        snprintf(name, sizeof(name), "c%d", generation++);
+        fds[i] = tfs_openFile(name);
+        fillPattern(data, size, i);
+        tfs_writeFile(fds[i], data, size);
+    }
+    for (int r = 0; r < rounds * CHURN_FILES; r++)
+    {
+        int target = nextRandom() % CHURN_FILES;
+        int size = 1 + nextRandom() % sizeof(data);
+        snprintf(name, sizeof(name), "c%d", generation++);
+        fillPattern(data, size, r);
+        startTimer(&timer);
+        int status = tfs_deleteFile(fds[target]);
+        if (status >= 0)
+        {
+            fds[target] = status = tfs_openFile(name);
+        }
+        if (status >= 0)
+        {
+            status = tfs_writeFile(fds[target], data, size);
+        }
+        stopTimer(&timer, result, size);
+        if (status < 0)
+        {
+            failOp(result->name, "delete/create/write", status);
+        }
+    }
+    timeFlush(result);
+    tfs_unmount();
+}
+
+// writes the same template content to many files, the duplicate heavy case
+void benchTemplate(BenchResult *result, int rounds)
+{
+    BenchTimer timer;
+    char name[9];
+    char data[TEMPLATE_SIZE];
+    fileDescriptor fds[TEMPLATE_FILES];
+    initResult(result, "template_write");
+    freshDisk();
+    for (int i = 0; i < TEMPLATE_FILES; i++)
+    {
+        snprintf(name, sizeof(name), "t%d", i);
+        fds[i] = tfs_openFile(name);
+    }
+    for (int r = 0; r < rounds; r++)
+    {
+        fillPattern(data, TEMPLATE_SIZE, r);
+        for (int i = 0; i < TEMPLATE_FILES; i++)
+        {
+            startTimer(&timer);
+            int status = tfs_writeFile(fds[i], data, TEMPLATE_SIZE);
+            stopTimer(&timer, result, TEMPLATE_SIZE);
+            if (status < 0)
+            {
+                failOp(result->name, "tfs_writeFile", status);
+            }
+        }
+    }
+    timeFlush(result);
+    tfs_unmount();
+}
+
+// lists a root directory that has every inode slot in use
+void benchReaddir(BenchResult *result, int rounds)
+{
+    BenchTimer timer;
+    char name[9];
+    initResult(result, "readdir_full");
+    freshDisk();
+    for (int i = 0; i < DIR_CAPACITY; i++)
+    {
+        snprintf(name, sizeof(name), "d%d", i);
+        tfs_openFile(name);
+    }
+    for (int r = 0; r < rounds; r++)
+    {
+        startTimer(&timer);
+        int status = tfs_readdir();
+        stopTimer(&timer, result, 0);
+        if (status < 0)
+        {
+            failOp(result->name, "tfs_readdir", status);
+        }
+    }
+    tfs_unmount();
+}
+
+void printResult(FILE *out, BenchResult *result, int json, int last)
+{
+    qsort(result->latencies, result->count, sizeof(double), compareDoubles);
+    double opsPerSec = result->seconds > 0 ? result->ops / result->seconds : 0.0;
+    double mbPerSec = result->seconds > 0 ? result->bytes / result->seconds / (1024.0 * 1024.0) : 0.0;
+    if (json)
+    {
+        fprintf(out, "  {\"workload\": \"%s\", \"ops\": %ld, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+                     "\"mb_per_sec\": %.3f, \"p50_us\": %.2f, \"p99_us\": %.2f, \"reads\": %lu, "
+                     "\"writes\": %lu, \"seeks\": %lu, \"other_syscalls\": %lu}%s\n",
+                result->name, result->ops, result->seconds, opsPerSec, mbPerSec,
+                percentile(result, 0.50), percentile(result, 0.99), result->stats.reads,
+                result->stats.writes, result->stats.seeks, result->stats.others, last ? "" : ",");
+    }
+    else
+    {
+        fprintf(out, "%s,%ld,%.6f,%.1f,%.3f,%.2f,%.2f,%lu,%lu,%lu,%lu\n",
+                result->name, result->ops, result->seconds, opsPerSec, mbPerSec,
+                percentile(result, 0.50), percentile(result, 0.99), result->stats.reads,
+                result->stats.writes, result->stats.seeks, result->stats.others);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = 20;
+    int json = 0;
+    char *outName = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:s:f:o:d:zuD")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 's':
+            rngState = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            json = strcmp(optarg, "json") == 0;
+            break;
+        case 'o':
+            outName = optarg;
+            break;
+        case 'd':
+            diskName = optarg;
+            break;
+        case 'z':
+            compressAll = 1;
+            break;
+        case 'u':
+            dedupAll = 1;
+            break;
+        case 'D':
+            tfs_setDirectIO(1);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r rounds] [-s seed] [-f csv|json] [-o outfile] [-d disk] [-z] [-u] [-D]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (rounds < 1 || rngState == 0)
+    {
+        fprintf(stderr, "Error: rounds and seed must be positive.\n");
+        return 1;
+    }
+
+    // keep the report on the real stdout and send library chatter to /dev/null
+    FILE *out = outName ? fopen(outName, "w") : fdopen(dup(STDOUT_FILENO), "w");
+    if (out == NULL)
+    {
+        perror("Error opening report file");
+        return 1;
+    }
+    fflush(stdout);
+    if (freopen("/dev/null", "w", stdout) == NULL)
+    {
+        perror("Error silencing stdout");
+        return 1;
+    }
+
+    BenchResult results[8];
+    benchCreate(&results[0], rounds);
+    benchCreateBatch(&results[1], rounds);
+    benchSequential(&results[2], &results[3], rounds);
+    benchRandomOverwrite(&results[4], rounds);
+    benchChurn(&results[5], rounds);
+    benchReaddir(&results[6], rounds);
+    benchTemplate(&results[7], rounds);
+
+    int count = sizeof(results) / sizeof(results[0]);
+    if (json)
+    {
+        fprintf(out, "[\n");
+    }
+    else
+    {
+        fprintf(out, "workload,ops,seconds,ops_per_sec,mb_per_sec,p50_us,p99_us,reads,writes,seeks,other_syscalls\n");
+    }
+    for (int i = 0; i < count; i++)
+    {
+        printResult(out, &results[i], json, i == count - 1);
+        free(results[i].latencies);
+    }
+    if (json)
+    {
+        fprintf(out, "]\n");
+    }
+    fclose(out);
+    unlink(diskName);
+    return 0;
+}
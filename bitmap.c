@@ -83,12 +83,28 @@ void free_num_blocks(Bitmap *bitmap, int start_block_index, int num_blocks)
 
 // function to see if there are contigious blocks of memory of a set size
 int find_free_blocks_of_size(Bitmap *bitmap, int block_size)
+{
+    return find_free_run(bitmap, NULL, block_size);
+}
+
+// same search, but blocks allocated in pinned (if given) are skipped even when free in bitmap
+int find_free_run(Bitmap *bitmap, Bitmap *pinned, int block_size)
+{
+    return find_free_run_below(bitmap, pinned, block_size, bitmap->num_blocks);
+}
+
+// same search, limited to runs that start before block limit
+int find_free_run_below(Bitmap *bitmap, Bitmap *pinned, int block_size, int limit)
 {
     int free_blocks = 0;
     int num_blocks = bitmap->num_blocks;
+    if (num_blocks > limit + block_size - 1)
+    {
+        num_blocks = limit + block_size - 1;
+    }
     for (int i = 0; i < num_blocks; i++)
     {
-        if (is_block_free(bitmap, i))
+        if (is_block_free(bitmap, i) && (pinned == NULL || is_block_free(pinned, i)))
         {
             free_blocks++;
             if (free_blocks == block_size)
@@ -103,3 +119,42 @@ int find_free_blocks_of_size(Bitmap *bitmap, int block_size)
     }
     return -2; // make valuable error code for no free blocks found
 }
+
+// function to release a bitmap and its free block array
+// collect up to count free blocks (not allocated in pinned either) into blocks in one pass,
+// handing back a contiguous run when the disk has one. Returns how many were found, ascending
+int find_free_list(Bitmap *bitmap, Bitmap *pinned, int count, int *blocks)
+{
+    int found = 0;
+    int run = 0;
+    for (int i = 0; i < bitmap->num_blocks; i++)
+    {
+        if (!is_block_free(bitmap, i) || (pinned != NULL && !is_block_free(pinned, i)))
+        {
+            run = 0;
+            continue;
+        }
+        if (found < count)
+        {
+            blocks[found++] = i;
+        }
+        if (++run == count)
+        {
+            for (int j = 0; j < count; j++)
+            {
+                blocks[j] = i - count + 1 + j;
+            }
+            return count;
+        }
+    }
+    return found;
+}
+
+void free_bitmap(Bitmap *bitmap)
+{
+    if (bitmap != NULL)
+    {
+        free(bitmap->free_blocks);
+        free(bitmap);
+    }
+}
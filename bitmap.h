@@ -18,7 +18,11 @@ void initialize_free_blocks(Bitmap *bitmap);
 bool is_block_free(Bitmap *bitmap, int block_index);
 void allocate_block(Bitmap *bitmap, int block_index);
 void free_block(Bitmap *bitmap, int block_index);
+void free_num_blocks(Bitmap *bitmap, int start_block_index, int num_blocks);
 int find_free_blocks_of_size(Bitmap *bitmap, int block_size);
+int find_free_run(Bitmap *bitmap, Bitmap *pinned, int block_size);
+int find_free_run_below(Bitmap *bitmap, Bitmap *pinned, int block_size, int limit);
+int find_free_list(Bitmap *bitmap, Bitmap *pinned, int count, int *blocks);
 void free_bitmap(Bitmap *bitmap);
 
 #endif // BITMAP_H
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "crc32c.h"
+#include <string.h>
+#include <pthread.h>
+
+#define CRC32C_POLY 0x82F63B78 // Castagnoli polynomial, bit reflected
+
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT; // tinyfsck checksums from several threads at once
+static int crc32c_hardware = 0;
+
+// build the slicing-by-8 tables and check once for the SSE4.2 crc32 instruction
+static void crc32c_init(void)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++)
+        {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        for (int k = 1; k < 8; k++)
+        {
+            uint32_t prev = crc32c_table[k - 1][i];
+            crc32c_table[k][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    crc32c_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+// table driven fallback, consumes 8 bytes per step
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len >= 8)
+    {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+              crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+              crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+    {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t crc64 = crc;
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (len--)
+    {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    }
+    return crc;
+}
+#elif defined(__i386__)
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len >= 4)
+    {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        crc = __builtin_ia32_crc32si(crc, word);
+        p += 4;
+        len -= 4;
+    }
+    while (len--)
+    {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+// CRC32C of the bytes checksummed so far (crc) followed by data, so a block scattered over
+// several buffers can be checked piece by piece. crc32c_extend(0, ...) is crc32c
+uint32_t crc32c_extend(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+#if defined(__x86_64__) || defined(__i386__)
+    if (crc32c_hardware)
+    {
+        return ~crc32c_hw(~crc, (const unsigned char *)data, len);
+    }
+#endif
+    return ~crc32c_sw(~crc, (const unsigned char *)data, len);
+}
+
+// CRC32C of a buffer, uses the hardware instruction when the CPU has it
+uint32_t crc32c(const void *data, size_t len)
+{
+    return crc32c_extend(0, data, len);
+}
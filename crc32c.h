@@ -0,0 +1,10 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t crc32c(const void *data, size_t len);
+uint32_t crc32c_extend(uint32_t crc, const void *data, size_t len);
+
+#endif // CRC32C_H
@@ -39,7 +39,7 @@ int main()
 	    if (disks[index] < 0)
             {
                 printf("] openDisk() failed to create a disk. This should never happen. Exiting. \n");
-		exit(0); 
+		exit(1); 
 	    }
           
             memset(buffer,'$',BLOCKSIZE);
@@ -49,7 +49,7 @@ int main()
                 if (retValue < 0)
 		{
 		    printf("] Failed to write to block %i of disk %s. Exiting (%i).\n",testBlocks[index2],diskName,retValue);
-		    exit(0);
+		    exit(1);
 		}
                 printf("] Successfully wrote to block %i of disk %s.\n",testBlocks[index2],diskName);
             }
@@ -64,7 +64,7 @@ int main()
 		if (readBlock(disks[index],testBlocks[index2],buffer) < 0)
                 {
                     printf("] Failed to read block %i of disk %s. Exiting.\n",testBlocks[index2],diskName);
-                    exit(0);
+                    exit(1);
                 }
 
 		for (index3 =0; index3 < BLOCKSIZE; index3++)
@@ -73,7 +73,7 @@ int main()
                     {
                         printf("] Failed. Byte #%i of block %i of disk %s was supposed to be a \"$\". Exiting\n.",
                                index3,testBlocks[index2],diskName);
-                        exit(0);
+                        exit(1);
                     }
                 }
             }
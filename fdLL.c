@@ -1,15 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "libTinyFS.h"
-#define MAX_FILENAME_LENGTH 8
+#include "inodeCache.h"
+#include "arena.h"
 
 
 typedef struct FileEntry {
     char filename[MAX_FILENAME_LENGTH+1];  // File name
     fileDescriptor fileDescriptor;           // File descriptor
-    int file_size;                         // File size
+    Inode *inode;                          // Cached inode: size, flags and extent of the file
+    int compress;                          // Compress on write: 1 yes, 0 no, -1 follow the mount setting
+    unsigned char *chunk_cache;            // Decompressed chunk of a compressed file
+    int cached_chunk;                      // Index of the chunk in chunk_cache, -1 if none
+    unsigned char *readahead;              // Blocks of the extent read at or ahead of the file pointer
+    int ra_start;                          // First block held in readahead
+    int ra_count;                          // Blocks held in readahead, 0 if none
+    int ra_window;                         // Blocks to read on the next miss, grows while reads are sequential
+    int next_offset;                       // Offset a sequential reader asks for next
+    int advice;                            // Access pattern given to tfs_advise, TFS_ADVICE_NORMAL by default
     int inode_index;                       // Index of the inode
-    int file_index;                       // Index of the first block of file
+    int parent_index;                      // Block of the directory holding the file's entry
     int offset;                            // Offset of the file
     time_t creation_time;                    // Creation timestamp
     time_t modification_time;                 // Modification timestamp
@@ -17,9 +27,21 @@ typedef struct FileEntry {
     struct FileEntry* next;       // Pointer to the next file entry
 } FileEntry;
 
+// entries and their read buffers are recycled, files are opened and closed far more often than mounted
+Pool fileEntryPool = POOL_INIT(sizeof(FileEntry), 64);
+Pool readaheadPool = POOL_INIT(READAHEAD_MAX_BLOCKS * BLOCKSIZE, 4);
+Pool chunkCachePool = POOL_INIT(COMPRESS_CHUNK_SIZE, 4);
+
+// give an entry and its buffers back to their pools
+void releaseFileEntry(FileEntry *entry) {
+    poolFree(&chunkCachePool, entry->chunk_cache);
+    poolFree(&readaheadPool, entry->readahead);
+    poolFree(&fileEntryPool, entry);
+}
+
 // create a new FileEntry
 FileEntry *createFileEntry(char *filename, fileDescriptor fileDescriptor, int inode_index) {
-    FileEntry *newFileEntry = (FileEntry *)malloc(sizeof(FileEntry));
+    FileEntry *newFileEntry = (FileEntry *)poolAlloc(&fileEntryPool);
     if (newFileEntry == NULL) {
         fprintf(stderr, "Error: Memory allocation failed for new FileEntry.\n");
         return NULL;
@@ -27,14 +49,23 @@ FileEntry *createFileEntry(char *filename, fileDescriptor fileDescriptor, int in
     // Copy filename
     if (strcpy(newFileEntry->filename, filename) == NULL) {
         fprintf(stderr, "Error: Failed to copy filename.\n");
-        free(newFileEntry);
+        poolFree(&fileEntryPool, newFileEntry);
         return NULL;
     }
     newFileEntry->filename[MAX_FILENAME_LENGTH] = '\0'; // Ensure null termination
     newFileEntry->fileDescriptor = fileDescriptor;
-    newFileEntry->file_size = 0;
+    newFileEntry->inode = NULL;
+    newFileEntry->compress = -1;
+    newFileEntry->chunk_cache = NULL;
+    newFileEntry->cached_chunk = -1;
+    newFileEntry->readahead = NULL;
+    newFileEntry->ra_start = 0;
+    newFileEntry->ra_count = 0;
+    newFileEntry->ra_window = 1;
+    newFileEntry->next_offset = 0;
+    newFileEntry->advice = TFS_ADVICE_NORMAL;
     newFileEntry->inode_index = inode_index;
-    newFileEntry->file_index = -1;
+    newFileEntry->parent_index = 0;
     newFileEntry->offset = 0;
     newFileEntry->next = NULL;
     return newFileEntry;
@@ -54,17 +85,17 @@ void insertFileEntry(FileEntry **head, FileEntry *newFileEntry) {
 }
 
 // delete a FileEntry from the linked list
-int deleteFileEntry(FileEntry *head, fileDescriptor fileDescriptor) {
-    FileEntry *current = head;
+int deleteFileEntry(FileEntry **head, fileDescriptor fileDescriptor) {
+    FileEntry *current = *head;
     FileEntry *prev = NULL;
     while (current != NULL) {
         if (current->fileDescriptor == fileDescriptor) {
             if (prev == NULL) {
-                head = current->next;
+                *head = current->next;
             } else {
                 prev->next = current->next;
             }
-            free(current);
+            releaseFileEntry(current);
             return 1;
         }
         prev = current;
@@ -88,7 +119,7 @@ void freeTable(FileEntry *head) {
     FileEntry *current = head;
     while (current != NULL) {
         FileEntry *next = current->next;
-        free(current);
+        releaseFileEntry(current);
         current = next;
     }
 }
@@ -0,0 +1,608 @@
+/* tinyfsck: consistency checker for TinyFS images
+ * Reads the whole image with large sequential reads and checks every block header and data
+ * checksum, both split across threads. Then walks the live directory tree and every snapshot to
+ * check that each inode, directory and extent block is owned once and agrees with the bitmap, and
+ * that the quota counters match what the files of each owner hold.
+ *
+ * usage: tinyfsck [-r] [-j threads] image
+ *   -r  repair: clear directory entries that do not point at inodes, scrub orphan inodes and
+ *       rewrite the bitmap and the quota counters from what is actually in use. Overlapping extents and checksum
+ *       mismatches are only reported.
+ *
+ * exit status: 0 clean, 1 every problem was repaired, 4 problems are left, 8 the image could not be read
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "libTinyFS.h"
+#include "libDisk.h"
+#include "crc32c.h"
+
+#define FSCK_READ_RUN 256   // blocks per read(), 64 KB
+#define FSCK_MAX_THREADS 16
+#define ENTRY_SLOTS 124     // inode slots in a directory block
+
+// who a block belongs to, kept in owner[] while walking
+#define OWNER_NONE 0
+#define OWNER_METADATA -1 // superblock, root directory, checksum table, dedup index, quota table
+#define OWNER_SNAPSHOT -2 // snapshot record or a block copied into a snapshot
+
+typedef struct
+{
+    int first; // first block of the slice
+    int last;  // one past the last block
+    int fd;    // descriptor of its own for the reader, so no file offset is shared
+    int failed;
+} Slice;
+
+char *imageName;
+unsigned char *image; // the whole image, numBlocks * BLOCKSIZE bytes
+int numBlocks;
+int features;
+int payload; // bytes of file content per data block
+int repair = 0;
+int problems = 0;
+int repaired = 0;
+uint32_t *blockCrc;         // CRC32C of every block, filled by the scan threads
+unsigned char *badHeader;   // 1 for a block whose header is not a TinyFS header
+int *owner;                 // OWNER_* or the inode block whose extent holds the block
+unsigned char *held;        // 1 for a block held by some snapshot
+unsigned char *dirtyBlocks; // blocks changed by a repair, written back at the end
+int files = 0;
+int directories = 0;
+int quotaUsage[QUOTA_MAX_OWNERS]; // data blocks the live files of each owner hold
+
+unsigned char *blockAt(int bNum)
+{
+    return image + (size_t)bNum * BLOCKSIZE;
+}
+
+// report one problem, repairable ones count as repaired when running with -r
+void problem(int repairable, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    problems++;
+    vprintf(format, args);
+    va_end(args);
+    if (repair && repairable)
+    {
+        printf(" (repaired)");
+        repaired++;
+    }
+    printf("\n");
+}
+
+int bitmapFree(int bNum)
+{
+    return (blockAt(0)[7 + bNum / 8] >> (bNum % 8)) & 1;
+}
+
+// each thread reads its slice in long runs
+void *readSlice(void *arg)
+{
+    Slice *slice = (Slice *)arg;
+    for (int b = slice->first; b < slice->last; b += FSCK_READ_RUN)
+    {
+        int count = slice->last - b < FSCK_READ_RUN ? slice->last - b : FSCK_READ_RUN;
+        if (readBlocks(slice->fd, b, count, blockAt(b)) == -1)
+        {
+            slice->failed = 1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+// header and checksum of every block in the slice; results go to per block arrays so threads never share a slot
+void *scanSlice(void *arg)
+{
+    Slice *slice = (Slice *)arg;
+    for (int b = slice->first; b < slice->last; b++)
+    {
+        unsigned char *block = blockAt(b);
+        badHeader[b] = block[1] != MAGIC_NUMBER || block[0] > QUOTA_TABLE;
+        blockCrc[b] = crc32c(block, BLOCKSIZE);
+    }
+    return NULL;
+}
+
+// run fn over numBlocks split into one contiguous slice per thread
+int runParallel(void *(*fn)(void *), int threads)
+{
+    pthread_t ids[FSCK_MAX_THREADS];
+    Slice slices[FSCK_MAX_THREADS];
+    int per = (numBlocks + threads - 1) / threads;
+    int failed = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        slices[t].first = t * per < numBlocks ? t * per : numBlocks;
+        slices[t].last = (t + 1) * per < numBlocks ? (t + 1) * per : numBlocks;
+        slices[t].failed = 0;
+        // libDisk keeps per disk state, so descriptors are opened and closed out here
+        slices[t].fd = openDisk(imageName, 0);
+        if (slices[t].fd < 0)
+        {
+            slices[t].failed = 1;
+        }
+        if (pthread_create(&ids[t], NULL, fn, &slices[t]) != 0)
+        {
+            fn(&slices[t]); // run it here rather than give up
+            ids[t] = 0;
+        }
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        if (ids[t] != 0)
+        {
+            pthread_join(ids[t], NULL);
+        }
+        failed |= slices[t].failed;
+        if (slices[t].fd >= 0)
+        {
+            closeDisk(slices[t].fd);
+        }
+    }
+    return failed ? -1 : 0;
+}
+
+// checksum table and dedup index blocks keep a check of their entries in [2..3] on newer images
+void checkRegion(int bNum, const char *what)
+{
+    unsigned char *block = blockAt(bNum);
+    if ((features & FEATURE_REGION_CHECKS) && ((block[2] << 8) | block[3]) != (int)(crc32c(block + 4, BLOCKSIZE - 4) & 0xFFFF))
+    {
+        problem(0, "%s block %d fails its region check", what, bNum);
+    }
+}
+
+uint32_t checksumEntry(int bNum)
+{
+    unsigned char *entry = blockAt(CHECKSUM_TABLE_BLOCK + bNum / CHECKSUMS_PER_BLOCK) + 4 + (bNum % CHECKSUMS_PER_BLOCK) * 4;
+    return (uint32_t)entry[0] | (uint32_t)entry[1] << 8 | (uint32_t)entry[2] << 16 | (uint32_t)entry[3] << 24;
+}
+
+int storedSize(unsigned char *inode)
+{
+    if (inode[3] & INODE_COMPRESSED)
+    {
+        return (inode[27] << 8) | inode[28];
+    }
+    return (inode[13] << 8) | inode[14];
+}
+
+// claim block b of the file in inodeBlock. link is the block the header has to point at, -1 for the
+// blocks of sparse files, which are found through the run list instead. The content of unwritten
+// blocks is never read, so only their ownership is checked. Header-free data blocks have no type or
+// link to check
+void claimBlock(int inodeBlock, char *path, unsigned char *snapshotHeld, int b, int link, int unwritten)
+{
+    unsigned char *inode = blockAt(inodeBlock);
+    unsigned char *block = blockAt(b);
+    int headers = !unwritten && !(features & FEATURE_RAW_DATA);
+    if (headers && (block[0] != FILE_EXTENT || badHeader[b]))
+    {
+        problem(0, "%s: block %d of the extent has type %d", path, b, block[0]);
+    }
+    else if (headers && link >= 0 && block[2] != link)
+    {
+        problem(0, "%s: block %d links to %d", path, b, block[2]);
+    }
+    if (!unwritten && (features & FEATURE_CHECKSUMS) && blockCrc[b] != checksumEntry(b))
+    {
+        problem(0, "%s: checksum mismatch on block %d", path, b);
+    }
+    if (snapshotHeld != NULL)
+    {
+        if ((snapshotHeld[b / 8] >> (b % 8)) & 1)
+        {
+            problem(0, "%s: block %d is not held by its snapshot", path, b);
+        }
+        return;
+    }
+    if (owner[b] == OWNER_NONE)
+    {
+        owner[b] = inodeBlock;
+        return;
+    }
+    unsigned char *other = owner[b] > 0 ? blockAt(owner[b]) : NULL;
+    if (other == NULL || !(other[3] & INODE_DEDUP) || !(inode[3] & INODE_DEDUP) || other[2] != inode[2])
+    {
+        problem(0, "%s: block %d overlaps the extent of inode %d", path, b, owner[b]);
+    }
+}
+
+// claim the run list of a sparse file, runs have to lie on the disk and inside the file
+void checkSparseRuns(int inodeBlock, char *path, unsigned char *snapshotHeld)
+{
+    unsigned char *inode = blockAt(inodeBlock);
+    int fileBlocks = (((inode[13] << 8) | inode[14]) + payload - 1) / payload;
+    if (inode[3] & INODE_PREALLOCATED)
+    {
+        fileBlocks = MAX_FILE_BLOCKS; // reserved blocks may lie past the end
+    }
+    int count = inode[SPARSE_MAP_LOC];
+    if (count > SPARSE_MAX_RUNS)
+    {
+        problem(0, "%s: %d runs do not fit in the inode", path, count);
+        return;
+    }
+    for (int r = 0; r < count; r++)
+    {
+        unsigned char *run = inode + SPARSE_MAP_LOC + 1 + r * SPARSE_RUN_SIZE;
+        int logical = ((run[0] << 8) | run[1]) & ~SPARSE_RUN_UNWRITTEN;
+        int unwritten = ((run[0] << 8) & SPARSE_RUN_UNWRITTEN) != 0;
+        int start = (run[2] << 8) | run[3];
+        int length = run[4];
+        if (start == 0 || start + length > numBlocks || logical + length > fileBlocks)
+        {
+            problem(0, "%s: run of %d blocks at block %d for file block %d is out of range", path, length, start, logical);
+            continue;
+        }
+        for (int b = start; b < start + length; b++)
+        {
+            claimBlock(inodeBlock, path, snapshotHeld, b, -1, unwritten);
+        }
+        if (snapshotHeld == NULL && inode[INODE_OWNER_LOC] < QUOTA_MAX_OWNERS)
+        {
+            quotaUsage[inode[INODE_OWNER_LOC]] += length;
+        }
+    }
+}
+
+// claim the extent of a file. Live extents may only be shared between dedup inodes with the same
+// start, snapshot extents have to be held by their snapshot
+void checkExtent(int inodeBlock, char *path, unsigned char *snapshotHeld)
+{
+    unsigned char *inode = blockAt(inodeBlock);
+    if (inode[3] & INODE_SPARSE)
+    {
+        checkSparseRuns(inodeBlock, path, snapshotHeld);
+        return;
+    }
+    int count = (storedSize(inode) + payload - 1) / payload;
+    int start = inode[2];
+    if (count == 0)
+    {
+        return;
+    }
+    if (start == 0 || start + count > numBlocks)
+    {
+        problem(0, "%s: extent at block %d with %d blocks runs off the disk", path, start, count);
+        return;
+    }
+    for (int b = start; b < start + count; b++)
+    {
+        claimBlock(inodeBlock, path, snapshotHeld, b, b + 1 < start + count ? b + 1 : 0, 0);
+    }
+    if (snapshotHeld == NULL && inode[INODE_OWNER_LOC] < QUOTA_MAX_OWNERS)
+    {
+        quotaUsage[inode[INODE_OWNER_LOC]] += count; // dedup extents count once per file
+    }
+}
+
+// walk a directory block, claiming every inode, directory block and extent below it.
+// snapshotHeld is NULL for the live tree, or the held bitmap of the snapshot being walked
+void walkDirectory(int dir, char *path, unsigned char *snapshotHeld)
+{
+    unsigned char *directory = blockAt(dir);
+    for (int slot = 0; slot < ENTRY_SLOTS; slot++)
+    {
+        int i = 4 + slot * 2;
+        int value = (directory[i] << 8) | directory[i + 1];
+        if (value == 0)
+        {
+            continue;
+        }
+        char child[1024];
+        if (value >= numBlocks || blockAt(value)[0] != INODE || badHeader[value])
+        {
+            snprintf(child, sizeof(child), "%s/#%d", path, slot);
+            problem(snapshotHeld == NULL, "%s: entry points at block %d, which is not an inode", child, value);
+            if (repair && snapshotHeld == NULL)
+            {
+                directory[i] = 0x00;
+                directory[i + 1] = 0x00;
+                dirtyBlocks[dir] = 1;
+            }
+            continue;
+        }
+        unsigned char *inode = blockAt(value);
+        char name[MAX_FILENAME_LENGTH + 1];
+        if (inode[INODE_NAME_LOC] != 0x00)
+        {
+            memcpy(name, inode + INODE_NAME_LOC, MAX_FILENAME_LENGTH);
+            name[MAX_FILENAME_LENGTH] = '\0';
+        }
+        else
+        {
+            memcpy(name, inode + 4, 8);
+            name[8] = '\0';
+        }
+        snprintf(child, sizeof(child), "%s/%s", path, name);
+        if (owner[value] != OWNER_NONE)
+        {
+            problem(snapshotHeld == NULL, "%s: inode %d is linked more than once", child, value);
+            if (repair && snapshotHeld == NULL)
+            {
+                directory[i] = 0x00;
+                directory[i + 1] = 0x00;
+                dirtyBlocks[dir] = 1;
+            }
+            continue;
+        }
+        owner[value] = snapshotHeld == NULL ? OWNER_METADATA : OWNER_SNAPSHOT;
+        if (inode[INODE_OWNER_LOC] >= QUOTA_MAX_OWNERS)
+        {
+            problem(0, "%s: owner %d is out of range", child, inode[INODE_OWNER_LOC]);
+        }
+        if (!(inode[3] & INODE_DIRECTORY))
+        {
+            files++;
+            checkExtent(value, child, snapshotHeld);
+            continue;
+        }
+        directories++;
+        int sub = inode[2];
+        if (sub == 0 || sub >= numBlocks || blockAt(sub)[0] != DIRECTORY)
+        {
+            problem(0, "%s: directory block %d is not a directory", child, sub);
+        }
+        else if (owner[sub] != OWNER_NONE)
+        {
+            problem(0, "%s: directory block %d is used twice", child, sub);
+        }
+        else
+        {
+            owner[sub] = snapshotHeld == NULL ? OWNER_METADATA : OWNER_SNAPSHOT;
+            walkDirectory(sub, child, snapshotHeld);
+        }
+    }
+}
+
+int checkSuperblock(off_t imageSize)
+{
+    unsigned char *superblock = blockAt(0);
+    if (superblock[0] != SUPERBLOCK || superblock[1] != MAGIC_NUMBER)
+    {
+        printf("block 0: not a TinyFS superblock\n");
+        return -1;
+    }
+    numBlocks = (superblock[5] << 8) | superblock[6];
+    features = superblock[3];
+    payload = (features & FEATURE_RAW_DATA) ? BLOCKSIZE : BLOCKSIZE - 4;
+    if (superblock[4] != (numBlocks + 7) / 8 || 7 + superblock[4] > SNAPSHOT_LIST_LOC)
+    {
+        printf("block 0: bitmap size %d does not match %d blocks\n", superblock[4], numBlocks);
+        return -1;
+    }
+    if (numBlocks < 2 || (off_t)numBlocks * BLOCKSIZE > imageSize)
+    {
+        printf("block 0: %d blocks do not fit in an image of %lld bytes\n", numBlocks, (long long)imageSize);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = online < 1 ? 1 : online > FSCK_MAX_THREADS ? FSCK_MAX_THREADS : (int)online;
+    int opt;
+    while ((opt = getopt(argc, argv, "rj:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            repair = 1;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r] [-j threads] image\n", argv[0]);
+            return 8;
+        }
+    }
+    if (optind != argc - 1 || threads < 1 || threads > FSCK_MAX_THREADS)
+    {
+        fprintf(stderr, "usage: %s [-r] [-j threads] image\n", argv[0]);
+        return 8;
+    }
+    imageName = argv[optind];
+
+    int disk = openDisk(imageName, 0);
+    off_t imageSize = disk < 0 ? -1 : diskBytes(disk);
+    if (imageSize < BLOCKSIZE)
+    {
+        fprintf(stderr, "Error: Unable to open %s.\n", imageName);
+        return 8;
+    }
+    image = (unsigned char *)malloc(BLOCKSIZE);
+    if (readBlock(disk, 0, image) == -1 || checkSuperblock(imageSize) < 0)
+    {
+        closeDisk(disk);
+        return 8;
+    }
+    if (threads > numBlocks)
+    {
+        threads = numBlocks;
+    }
+    image = (unsigned char *)realloc(image, (size_t)numBlocks * BLOCKSIZE);
+    blockCrc = (uint32_t *)malloc(numBlocks * sizeof(uint32_t));
+    badHeader = (unsigned char *)calloc(numBlocks, 1);
+    owner = (int *)calloc(numBlocks, sizeof(int));
+    held = (unsigned char *)calloc(numBlocks, 1);
+    dirtyBlocks = (unsigned char *)calloc(numBlocks, 1);
+    if (image == NULL || blockCrc == NULL || badHeader == NULL || owner == NULL || held == NULL || dirtyBlocks == NULL)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for %d blocks.\n", numBlocks);
+        return 8;
+    }
+    if (runParallel(readSlice, threads) < 0)
+    {
+        fprintf(stderr, "Error: Unable to read %s.\n", imageName);
+        return 8;
+    }
+    runParallel(scanSlice, threads);
+
+    // fixed metadata
+    owner[0] = OWNER_METADATA;
+    owner[1] = OWNER_METADATA;
+    if (features & FEATURE_CHECKSUMS)
+    {
+        int tableBlocks = (numBlocks + CHECKSUMS_PER_BLOCK - 1) / CHECKSUMS_PER_BLOCK;
+        for (int b = CHECKSUM_TABLE_BLOCK; b < CHECKSUM_TABLE_BLOCK + tableBlocks && b < numBlocks; b++)
+        {
+            owner[b] = OWNER_METADATA;
+            if (blockAt(b)[0] != CHECKSUM_TABLE)
+            {
+                problem(0, "checksum table block %d has type %d", b, blockAt(b)[0]);
+                continue;
+            }
+            checkRegion(b, "checksum table");
+        }
+    }
+    if (features & FEATURE_DEDUP)
+    {
+        int start = blockAt(0)[2];
+        for (int b = start; b < start + DEDUP_INDEX_BLOCKS && b < numBlocks; b++)
+        {
+            owner[b] = OWNER_METADATA;
+            if (start == 0 || blockAt(b)[0] != DEDUP_INDEX)
+            {
+                problem(0, "dedup index block %d has type %d", b, blockAt(b)[0]);
+                continue;
+            }
+            checkRegion(b, "dedup index");
+        }
+    }
+
+    walkDirectory(1, "", NULL);
+
+    // the quota counters against what the live files hold
+    int quotaBlock = blockAt(0)[QUOTA_TABLE_LOC];
+    if ((features & FEATURE_QUOTAS) && (7 + blockAt(0)[4] > QUOTA_TABLE_LOC || quotaBlock == 0 || quotaBlock >= numBlocks ||
+                                        blockAt(quotaBlock)[0] != QUOTA_TABLE || owner[quotaBlock] != OWNER_NONE))
+    {
+        problem(0, "quota table block %d is damaged", quotaBlock);
+    }
+    else if (features & FEATURE_QUOTAS)
+    {
+        owner[quotaBlock] = OWNER_METADATA;
+        checkRegion(quotaBlock, "quota table");
+        unsigned char *table = blockAt(quotaBlock);
+        for (int i = 0; i < QUOTA_MAX_OWNERS; i++)
+        {
+            unsigned char *entry = table + 4 + i * QUOTA_ENTRY_SIZE;
+            int used = (entry[2] << 8) | entry[3];
+            if (used == quotaUsage[i])
+            {
+                continue;
+            }
+            problem(1, "quota table: owner %d is charged %d blocks but holds %d", i, used, quotaUsage[i]);
+            entry[2] = (quotaUsage[i] >> 8) & 0xFF;
+            entry[3] = quotaUsage[i] & 0xFF;
+            dirtyBlocks[quotaBlock] = 1;
+        }
+        if (dirtyBlocks[quotaBlock] && (features & FEATURE_REGION_CHECKS))
+        {
+            int check = crc32c(table + 4, BLOCKSIZE - 4) & 0xFFFF;
+            table[2] = (check >> 8) & 0xFF;
+            table[3] = check & 0xFF;
+        }
+    }
+
+    // snapshots, newest first. Their copies must be allocated, their extents only held
+    int seen = 0;
+    for (int record = blockAt(0)[SNAPSHOT_LIST_LOC]; record != 0; record = blockAt(record)[2])
+    {
+        if (record >= numBlocks || blockAt(record)[0] != SNAPSHOT || owner[record] != OWNER_NONE || ++seen > numBlocks)
+        {
+            problem(0, "snapshot record %d is damaged", record);
+            break;
+        }
+        unsigned char *snapshot = blockAt(record);
+        unsigned char *snapshotHeld = snapshot + SNAPSHOT_BITMAP_LOC;
+        owner[record] = OWNER_SNAPSHOT;
+        for (int b = 0; b < numBlocks; b++)
+        {
+            held[b] |= !((snapshotHeld[b / 8] >> (b % 8)) & 1);
+        }
+        int root = (snapshot[SNAPSHOT_ROOT_LOC] << 8) | snapshot[SNAPSHOT_ROOT_LOC + 1];
+        char path[16];
+        snprintf(path, sizeof(path), "@%.8s", (char *)snapshot + 4);
+        if (root == 0 || root >= numBlocks || owner[root] != OWNER_NONE)
+        {
+            problem(0, "%s: frozen root %d is damaged", path, root);
+            continue;
+        }
+        owner[root] = OWNER_SNAPSHOT;
+        walkDirectory(root, path, snapshotHeld);
+    }
+
+    // inodes nothing links to
+    for (int b = 2; b < numBlocks; b++)
+    {
+        if (blockAt(b)[0] == INODE && !badHeader[b] && owner[b] == OWNER_NONE && !held[b])
+        {
+            problem(1, "orphan inode in block %d", b);
+            if (repair)
+            {
+                memset(blockAt(b), 0, BLOCKSIZE);
+                blockAt(b)[0] = FREE_BLOCK;
+                blockAt(b)[1] = MAGIC_NUMBER;
+                dirtyBlocks[b] = 1;
+            }
+        }
+    }
+
+    // the bitmap against what is in use. Blocks only a snapshot holds may be either
+    for (int b = 0; b < numBlocks; b++)
+    {
+        int used = owner[b] != OWNER_NONE;
+        if (used == !bitmapFree(b) || (!used && held[b]))
+        {
+            continue;
+        }
+        if (used)
+        {
+            problem(1, "block %d is in use but marked free", b);
+            blockAt(0)[7 + b / 8] &= ~(1 << (b % 8));
+        }
+        else
+        {
+            problem(1, "block %d is marked in use but nothing refers to it", b);
+            blockAt(0)[7 + b / 8] |= 1 << (b % 8);
+        }
+        dirtyBlocks[0] = 1;
+    }
+
+    int writeFailed = 0;
+    for (int b = 0; repair && b < numBlocks; b++)
+    {
+        if (dirtyBlocks[b] && writeBlock(disk, b, blockAt(b)) == -1)
+        {
+            fprintf(stderr, "Error: Unable to write block %d.\n", b);
+            writeFailed = 1;
+        }
+    }
+    closeDisk(disk);
+    printf("%s: %d blocks, %d files, %d directories, %d problems", imageName, numBlocks, files, directories, problems);
+    if (repair)
+    {
+        printf(", %d repaired", repaired);
+    }
+    printf("\n");
+    if (problems == 0)
+    {
+        return 0;
+    }
+    return repaired == problems && !writeFailed ? 1 : 4;
+}
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <string.h>
+#include "inodeCache.h"
+#include "arena.h"
+
+Pool inodePool = POOL_INIT(sizeof(Inode), 64); // entries come and go with every file create and delete
+
+// find the cached copy of the inode in block, NULL if it is not cached
+Inode *findCachedInode(Inode **cache, int block)
+{
+    Inode *current = cache[block % INODE_CACHE_BUCKETS];
+    while (current != NULL)
+    {
+        if (current->block == block)
+        {
+            return current;
+        }
+        current = current->next;
+    }
+    return NULL;
+}
+
+// add a zeroed entry for the inode in block, the caller fills it in
+Inode *insertCachedInode(Inode **cache, int block)
+{
+    Inode *inode = (Inode *)poolAlloc(&inodePool);
+    if (inode == NULL)
+    {
+        return NULL;
+    }
+    memset(inode, 0, sizeof(Inode));
+    inode->block = block;
+    inode->next = cache[block % INODE_CACHE_BUCKETS];
+    cache[block % INODE_CACHE_BUCKETS] = inode;
+    return inode;
+}
+
+// drop the entry for the inode in block without writing it back
+void removeCachedInode(Inode **cache, int block)
+{
+    Inode **link = &cache[block % INODE_CACHE_BUCKETS];
+    while (*link != NULL)
+    {
+        if ((*link)->block == block)
+        {
+            Inode *gone = *link;
+            *link = gone->next;
+            poolFree(&inodePool, gone);
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+// free every entry, dirty ones have to be written back first
+void freeInodeCache(Inode **cache)
+{
+    for (int i = 0; i < INODE_CACHE_BUCKETS; i++)
+    {
+        Inode *current = cache[i];
+        while (current != NULL)
+        {
+            Inode *next = current->next;
+            poolFree(&inodePool, current);
+            current = next;
+        }
+        cache[i] = NULL;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef INODECACHE_H
+#define INODECACHE_H
+
+#include "libTinyFS.h"
+
+#define INODE_CACHE_BUCKETS 64
+
+// an inode decoded from its block. One copy per inode block is kept while mounted and every open
+// descriptor of the file points at it, changes are written back when dirty is set
+// a run of consecutive file blocks stored in consecutive disk blocks, see INODE_SPARSE
+typedef struct
+{
+    unsigned short logical;  // first block of the file
+    unsigned short physical; // first block on disk
+    unsigned char length;
+    unsigned char unwritten; // reserved by tfs_fallocate and not written since, reads as zeros
+} SparseRun;
+
+typedef struct Inode
+{
+    int block;                          // inode block number, the cache key
+    int file_index;                     // first block of the extent or the DIRECTORY block, inode[2]
+    int flags;                          // INODE_* flags, inode[3]
+    char name[MAX_FILENAME_LENGTH + 1]; // full name, inode[4..11] and inode[INODE_NAME_LOC..]
+    int file_size;                      // logical size, inode[13..14]
+    int stored_size;                    // bytes in the extent, inode[27..28]
+    int hour;                           // creation time, inode[15..26]
+    int minute;
+    int second;
+    int owner;                          // owner charged for the data blocks, inode[INODE_OWNER_LOC]
+    int run_count;                      // sparse files only, runs in logical order
+    SparseRun runs[SPARSE_MAX_RUNS];
+    int dirty;                          // 1 when the block on disk is out of date
+    struct Inode *next;                 // next inode in the same bucket
+} Inode;
+
+Inode *findCachedInode(Inode **cache, int block);
+Inode *insertCachedInode(Inode **cache, int block);
+void removeCachedInode(Inode **cache, int block);
+void freeInodeCache(Inode **cache);
+
+#endif // INODECACHE_H
@@ -1,75 +1,1461 @@
+#define _GNU_SOURCE // O_DIRECT
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <pthread.h>
+#include <linux/fs.h>
+#include "libDisk.h"
 
-#define BLOCKSIZE 256
+#define DISK_MAX_DIRECT 16 // disks that can be open with O_DIRECT at once
+#define DISK_MAX_STRIPED 8 // striped disks that can be open at once
+#define DISK_MAX_MIRRORED 8 // mirrored disks that can be open at once
+#define DISK_MIRROR_SPLIT 8 // runs of at least this many blocks use a thread per mirror member
+#define DISK_MIRROR_MAGIC "TFSM" // first bytes of a mirror member
+#define DISK_STRIPE_MAGIC "TFSS" // first bytes of a stripe member
+#define DISK_ALIGNED_BLOCKS (DISK_DIRECT_ALIGNMENT / BLOCKSIZE) // blocks in one aligned unit
 
-int openDisk(char *filename, int nBytes)
+DiskStats diskStats = {0, 0, 0, 0};
+
+// the counters may be bumped from several threads, as tinyfsck's readers do
+#define COUNT(field, n) __atomic_fetch_add(&diskStats.field, (n), __ATOMIC_RELAXED)
+
+// disks opened with O_DIRECT and the alignment their transfers need, alignment 0 for a free entry
+typedef struct
+{
+    int fd;
+    int alignment;
+} DirectDisk;
+
+DirectDisk directDisks[DISK_MAX_DIRECT];
+
+// a disk striped over several backing files in units of unit blocks: unit u of the disk is unit
+// u / count of member u % count. A member starts with one aligned unit holding its header, the
+// units follow. Callers use handle, a duplicate of the first member's descriptor
+typedef struct
+{
+    int handle;
+    int count; // members, 0 for a free entry
+    int unit;
+    int members[DISK_MAX_MEMBERS];
+} StripedDisk;
+
+StripedDisk stripedDisks[DISK_MAX_STRIPED];
+
+// a disk mirrored on several backing files, every member holds all of it. A member starts with a
+// header block and a bitmap of the blocks written while some member was stale, the disk follows
+// at block base, the first aligned unit past them. A member that fails is stale until resyncDisk
+// copies the blocks it missed
+typedef struct
+{
+    int handle;
+    int count;  // members, 0 for a free entry
+    int blocks; // blocks of the disk, whole aligned units
+    int base;   // member block holding block 0 of the disk
+    int map;    // bitmap blocks after the header
+    unsigned int generation; // goes up on the current members whenever one drops out
+    int next;   // member the last read went to, ties go to the one after it
+    int members[DISK_MAX_MEMBERS];
+    int stale[DISK_MAX_MEMBERS];
+    int busy[DISK_MAX_MEMBERS]; // reads in flight on each member
+    unsigned char *missed;      // one bit per block, laid out as on disk
+} MirroredDisk;
+
+MirroredDisk mirroredDisks[DISK_MAX_MIRRORED];
+pthread_mutex_t mirrorLock = PTHREAD_MUTEX_INITIALIZER; // members drop out while tinyfsck's readers run
+
+// aligned bounce buffers for direct transfers, reused so a transfer does not allocate
+void *poolBuffers[DISK_POOL_BUFFERS];
+size_t poolSizes[DISK_POOL_BUFFERS];
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER; // the members of a striped disk transfer on their own threads
+
+static void *takeAlignedBuffer(size_t size, size_t *capacity)
+{
+    pthread_mutex_lock(&poolLock);
+    for (int i = 0; i < DISK_POOL_BUFFERS; i++)
+    {
+        if (poolBuffers[i] != NULL && poolSizes[i] >= size)
+        {
+            void *buffer = poolBuffers[i];
+            *capacity = poolSizes[i];
+            poolBuffers[i] = NULL;
+            pthread_mutex_unlock(&poolLock);
+            return buffer;
+        }
+    }
+    pthread_mutex_unlock(&poolLock);
+    // powers of two so a buffer fits the next transfers of about the same size
+    size_t length = DISK_DIRECT_ALIGNMENT;
+    while (length < size)
+    {
+        length <<= 1;
+    }
+    void *buffer;
+    if (posix_memalign(&buffer, DISK_DIRECT_ALIGNMENT, length) != 0)
+    {
+        fprintf(stderr, "Error: Unable to allocate an aligned buffer.\n");
+        return NULL;
+    }
+    *capacity = length;
+    return buffer;
+}
+
+static void returnAlignedBuffer(void *buffer, size_t capacity)
+{
+    int smallest = 0;
+    pthread_mutex_lock(&poolLock);
+    for (int i = 0; i < DISK_POOL_BUFFERS; i++)
+    {
+        if (poolBuffers[i] == NULL)
+        {
+            poolBuffers[i] = buffer;
+            poolSizes[i] = capacity;
+            pthread_mutex_unlock(&poolLock);
+            return;
+        }
+        if (poolSizes[i] < poolSizes[smallest])
+        {
+            smallest = i;
+        }
+    }
+    // pool is full, keep the larger of this buffer and the smallest pooled one
+    if (poolSizes[smallest] < capacity)
+    {
+        free(poolBuffers[smallest]);
+        poolBuffers[smallest] = buffer;
+        poolSizes[smallest] = capacity;
+        pthread_mutex_unlock(&poolLock);
+        return;
+    }
+    pthread_mutex_unlock(&poolLock);
+    free(buffer);
+}
+
+static void freeAlignedBuffers(void)
+{
+    for (int i = 0; i < DISK_POOL_BUFFERS; i++)
+    {
+        free(poolBuffers[i]);
+        poolBuffers[i] = NULL;
+    }
+}
+
+// O_DIRECT transfers must start, end and sit in memory on the alignment, so go through a bounce
+// buffer covering the aligned span. A write that covers only part of the span reads it first.
+static int directTransfer(int disk, off_t offset, size_t length, void *data, int writing)
+{
+    off_t alignment = diskAlignment(disk);
+    off_t start = offset - offset % alignment;
+    off_t end = offset + length + (alignment - (offset + length) % alignment) % alignment;
+    size_t span = end - start;
+    size_t capacity;
+    unsigned char *bounce = takeAlignedBuffer(span, &capacity);
+    if (bounce == NULL)
+    {
+        return -1;
+    }
+    int result = 0;
+    if (!writing || start != offset || (size_t)(end - offset) != length)
+    {
+        COUNT(seeks, 1);
+        COUNT(reads, 1);
+        ssize_t bytesRead = -1;
+        if (lseek(disk, start, SEEK_SET) != -1)
+        {
+            bytesRead = read(disk, bounce, span);
+        }
+        if (bytesRead < (ssize_t)(offset - start + length))
+        {
+            fprintf(stderr, "Error: direct read of %zu bytes at %lld failed.\n", span, (long long)start);
+            result = -1;
+        }
+    }
+    if (result == 0 && writing)
+    {
+        memcpy(bounce + (offset - start), data, length);
+        COUNT(seeks, 1);
+        COUNT(writes, 1);
+        if (lseek(disk, start, SEEK_SET) == -1 || write(disk, bounce, span) != (ssize_t)span)
+        {
+            fprintf(stderr, "Error: direct write of %zu bytes at %lld failed.\n", span, (long long)start);
+            result = -1;
+        }
+    }
+    else if (result == 0)
+    {
+        memcpy(data, bounce + (offset - start), length);
+    }
+    returnAlignedBuffer(bounce, capacity);
+    return result;
+}
+
+// remember a disk opened with O_DIRECT and the logical block size of the device under it
+static int registerDirectDisk(int fd)
+{
+    struct stat info;
+    int alignment = DISK_DIRECT_ALIGNMENT;
+    COUNT(others, 1);
+    if (fstat(fd, &info) == -1)
+    {
+        return -1;
+    }
+    if (S_ISBLK(info.st_mode))
+    {
+        int sectorSize;
+        COUNT(others, 1);
+        if (ioctl(fd, BLKSSZGET, &sectorSize) == 0 && sectorSize > alignment)
+        {
+            alignment = sectorSize;
+        }
+    }
+    else if (info.st_size % alignment != 0)
+    {
+        // an image made without DISK_DIRECT, pad it so the last blocks can be transferred
+        COUNT(others, 1);
+        if (ftruncate(fd, info.st_size + alignment - info.st_size % alignment) == -1)
+        {
+            perror("Error padding disk");
+            return -1;
+        }
+    }
+    for (int i = 0; i < DISK_MAX_DIRECT; i++)
+    {
+        if (directDisks[i].alignment == 0)
+        {
+            directDisks[i].fd = fd;
+            directDisks[i].alignment = alignment;
+            return 0;
+        }
+    }
+    fprintf(stderr, "Error: Too many disks open with O_DIRECT.\n");
+    return -1;
+}
+
+// striped disk behind a handle, NULL for a plain disk
+static StripedDisk *findStriped(int disk)
+{
+    for (int i = 0; i < DISK_MAX_STRIPED; i++)
+    {
+        if (stripedDisks[i].count > 0 && stripedDisks[i].handle == disk)
+        {
+            return &stripedDisks[i];
+        }
+    }
+    return NULL;
+}
+
+// mirrored disk behind a handle, NULL for any other disk
+static MirroredDisk *findMirrored(int disk)
+{
+    for (int i = 0; i < DISK_MAX_MIRRORED; i++)
+    {
+        if (mirroredDisks[i].count > 0 && mirroredDisks[i].handle == disk)
+        {
+            return &mirroredDisks[i];
+        }
+    }
+    return NULL;
+}
+
+// transfer alignment of a disk, BLOCKSIZE unless it was opened with DISK_DIRECT
+int diskAlignment(int disk)
+{
+    StripedDisk *set = findStriped(disk);
+    if (set != NULL)
+    {
+        return diskAlignment(set->members[0]);
+    }
+    MirroredDisk *mirror = findMirrored(disk);
+    if (mirror != NULL)
+    {
+        return diskAlignment(mirror->members[0]);
+    }
+    for (int i = 0; i < DISK_MAX_DIRECT; i++)
+    {
+        if (directDisks[i].alignment != 0 && directDisks[i].fd == disk)
+        {
+            return directDisks[i].alignment;
+        }
+    }
+    return BLOCKSIZE;
+}
+
+// bytes a disk holds, -1 if its size cannot be read. A striped disk holds whole units of every member,
+// a mirrored one what its header says
+off_t diskBytes(int disk)
+{
+    struct stat info;
+    MirroredDisk *mirror = findMirrored(disk);
+    if (mirror != NULL)
+    {
+        return (off_t)mirror->blocks * BLOCKSIZE;
+    }
+    StripedDisk *set = findStriped(disk);
+    if (set == NULL)
+    {
+        return fstat(disk, &info) == -1 ? -1 : info.st_size;
+    }
+    off_t smallest = -1;
+    for (int m = 0; m < set->count; m++)
+    {
+        if (fstat(set->members[m], &info) == -1)
+        {
+            return -1;
+        }
+        if (smallest == -1 || info.st_size < smallest)
+        {
+            smallest = info.st_size;
+        }
+    }
+    off_t unitBytes = (off_t)set->unit * BLOCKSIZE;
+    smallest -= (off_t)DISK_ALIGNED_BLOCKS * BLOCKSIZE;
+    return smallest < 0 ? 0 : smallest / unitBytes * unitBytes * set->count;
+}
+
+// bytes covered by an iovec array
+static size_t vectorLength(const struct iovec *iov, int iovcnt)
+{
+    size_t length = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        length += iov[i].iov_len;
+    }
+    return length;
+}
+
+// a vector O_DIRECT can not take, or with more than IOV_MAX buffers, goes through one linear copy
+static int linearVector(int disk, off_t offset, const struct iovec *iov, int iovcnt, int writing, int direct)
+{
+    size_t length = vectorLength(iov, iovcnt);
+    unsigned char *linear = (unsigned char *)malloc(length > 0 ? length : 1);
+    if (linear == NULL)
+    {
+        return -1;
+    }
+    size_t pos = 0;
+    for (int i = 0; writing && i < iovcnt; pos += iov[i].iov_len, i++)
+    {
+        memcpy(linear + pos, iov[i].iov_base, iov[i].iov_len);
+    }
+    int result = 0;
+    if (direct)
+    {
+        result = directTransfer(disk, offset, length, linear, writing);
+    }
+    else
+    {
+        COUNT(reads, !writing);
+        COUNT(writes, writing);
+        ssize_t moved = writing ? pwrite(disk, linear, length, offset) : pread(disk, linear, length, offset);
+        result = moved == (ssize_t)length ? 0 : -1;
+    }
+    pos = 0;
+    for (int i = 0; result == 0 && !writing && i < iovcnt; pos += iov[i].iov_len, i++)
+    {
+        memcpy(iov[i].iov_base, linear + pos, iov[i].iov_len);
+    }
+    free(linear);
+    return result;
+}
+
+// consecutive blocks of one backing file from or into the buffers of iov with one preadv() or pwritev()
+static int fileVector(int disk, int bNum, const struct iovec *iov, int iovcnt, int writing)
+{
+    int flags = fcntl(disk, F_GETFL);
+    COUNT(others, 1);
+    if (flags == -1)
+    {
+        return -1;
+    }
+    if ((flags & O_DIRECT) || iovcnt > IOV_MAX)
+    {
+        return linearVector(disk, (off_t)bNum * BLOCKSIZE, iov, iovcnt, writing, flags & O_DIRECT);
+    }
+    ssize_t length = (ssize_t)vectorLength(iov, iovcnt);
+    ssize_t moved;
+    if (writing)
+    {
+        COUNT(writes, 1);
+        moved = pwritev(disk, iov, iovcnt, (off_t)bNum * BLOCKSIZE);
+    }
+    else
+    {
+        COUNT(reads, 1);
+        moved = preadv(disk, iov, iovcnt, (off_t)bNum * BLOCKSIZE);
+    }
+    if (moved == -1)
+    {
+        return -1;
+    }
+    else if (moved < length)
+    {
+        fprintf(stderr, "Error: bytes %s less than %zd bytes.\n", writing ? "written" : "read", length);
+        return -1;
+    }
+    return 0;
+}
+
+// member of a striped disk holding block bNum, *memberBlock is set to where it is on the member
+static int stripeMember(StripedDisk *set, int bNum, int *memberBlock)
+{
+    int unit = bNum / set->unit;
+    *memberBlock = DISK_ALIGNED_BLOCKS + (unit / set->count) * set->unit + bNum % set->unit;
+    return set->members[unit % set->count];
+}
+
+// one member's share of a striped or mirrored transfer: a contiguous range of the member, scattered
+// in memory
+typedef struct
+{
+    int fd;
+    int first; // first block on the member, -1 if the member takes no part
+    struct iovec *iov;
+    int iovcnt;
+    int writing;
+    int result;
+} StripeJob;
+
+static void *runStripeJob(void *arg)
+{
+    StripeJob *job = (StripeJob *)arg;
+    job->result = fileVector(job->fd, job->first, job->iov, job->iovcnt, job->writing);
+    return NULL;
+}
+
+// run the jobs that have work side by side, one thread each. The last one runs on this thread
+static void runJobs(StripeJob *jobs, int count)
+{
+    pthread_t threads[DISK_MAX_MEMBERS];
+    int started[DISK_MAX_MEMBERS];
+    int last = -1;
+    for (int m = 0; m < count; m++)
+    {
+        last = jobs[m].first >= 0 ? m : last;
+    }
+    for (int m = 0; m < count; m++)
+    {
+        started[m] = jobs[m].first >= 0 && m != last && pthread_create(&threads[m], NULL, runStripeJob, &jobs[m]) == 0;
+        if (jobs[m].first >= 0 && !started[m])
+        {
+            runStripeJob(&jobs[m]);
+        }
+    }
+    for (int m = 0; m < count; m++)
+    {
+        if (started[m])
+        {
+            pthread_join(threads[m], NULL);
+        }
+    }
+}
+
+// append the next need bytes of iov to the job's buffers, *i and *skip keep the place in iov
+static void takeVector(const struct iovec *iov, int iovcnt, int *i, size_t *skip, size_t need, StripeJob *job)
+{
+    while (need > 0 && *i < iovcnt)
+    {
+        size_t count = iov[*i].iov_len - *skip < need ? iov[*i].iov_len - *skip : need;
+        if (count > 0)
+        {
+            job->iov[job->iovcnt].iov_base = (unsigned char *)iov[*i].iov_base + *skip;
+            job->iov[job->iovcnt++].iov_len = count;
+        }
+        need -= count;
+        *skip += count;
+        if (*skip == iov[*i].iov_len)
+        {
+            (*i)++;
+            *skip = 0;
+        }
+    }
+}
+
+// split a transfer of consecutive blocks of a striped disk into one job per member and run the jobs
+// side by side, one thread per member. The units a run covers on one member are consecutive there,
+// so every member moves its share with a single preadv() or pwritev()
+static int stripedTransfer(StripedDisk *set, int bNum, const struct iovec *iov, int iovcnt, int writing)
+{
+    StripeJob jobs[DISK_MAX_MEMBERS];
+    size_t length = vectorLength(iov, iovcnt);
+    int nBlocks = (int)((length + BLOCKSIZE - 1) / BLOCKSIZE);
+    // every caller buffer once, plus one split per unit boundary
+    int cap = iovcnt + nBlocks / set->unit + 2;
+    struct iovec *pieces = (struct iovec *)malloc(sizeof(struct iovec) * cap * set->count);
+    if (pieces == NULL)
+    {
+        return -1;
+    }
+    for (int m = 0; m < set->count; m++)
+    {
+        jobs[m].fd = set->members[m];
+        jobs[m].first = -1;
+        jobs[m].iov = pieces + m * cap;
+        jobs[m].iovcnt = 0;
+        jobs[m].writing = writing;
+        jobs[m].result = 0;
+    }
+    int i = 0;
+    size_t skip = 0;
+    for (int b = bNum; b < bNum + nBlocks;)
+    {
+        int unit = b / set->unit;
+        int within = b % set->unit;
+        int span = set->unit - within < bNum + nBlocks - b ? set->unit - within : bNum + nBlocks - b;
+        StripeJob *job = &jobs[unit % set->count];
+        if (job->first < 0)
+        {
+            job->first = DISK_ALIGNED_BLOCKS + (unit / set->count) * set->unit + within;
+        }
+        takeVector(iov, iovcnt, &i, &skip, (size_t)span * BLOCKSIZE, job);
+        b += span;
+    }
+    runJobs(jobs, set->count);
+    int result = 0;
+    for (int m = 0; m < set->count; m++)
+    {
+        result = jobs[m].result == -1 ? -1 : result;
+    }
+    free(pieces);
+    return result;
+}
+
+// mirror and stripe headers keep their words most significant byte first
+static void putWord(unsigned char *bytes, unsigned int value)
+{
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+}
+
+static unsigned int getWord(const unsigned char *bytes)
+{
+    return ((unsigned int)bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+// header of a mirror member: magic, generation, blocks of the disk
+static int writeMirrorHeader(MirroredDisk *set, int m)
+{
+    unsigned char header[BLOCKSIZE];
+    memset(header, 0, BLOCKSIZE);
+    memcpy(header, DISK_MIRROR_MAGIC, 4);
+    putWord(header + 4, set->generation);
+    putWord(header + 8, set->blocks);
+    struct iovec whole = {header, BLOCKSIZE};
+    return fileVector(set->members[m], 0, &whole, 1, 1);
+}
+
+// bitmap blocks first to last of one member
+static int writeMirrorMap(MirroredDisk *set, int m, int first, int last)
+{
+    struct iovec part = {set->missed + (size_t)first * BLOCKSIZE, (size_t)(last - first + 1) * BLOCKSIZE};
+    return fileVector(set->members[m], 1 + first, &part, 1, 1);
+}
+
+static int currentMembers(MirroredDisk *set)
+{
+    int current = 0;
+    for (int m = 0; m < set->count; m++)
+    {
+        current += !set->stale[m];
+    }
+    return current;
+}
+
+// raise the generation on the current members, so the next open sees which ones fell behind
+static void writeMirrorHeaders(MirroredDisk *set)
+{
+    set->generation++;
+    for (int m = 0; m < set->count; m++)
+    {
+        if (!set->stale[m] && writeMirrorHeader(set, m) == -1)
+        {
+            fprintf(stderr, "Error: Mirror member %d failed, continuing without it.\n", m);
+            set->stale[m] = 1;
+            set->generation++;
+            m = -1; // the ones done so far need the new generation too
+        }
+    }
+}
+
+// note that the stale members miss blocks first to first + n - 1. The bitmap reaches the current
+// members before the blocks are written, so a crash can not lose track of them
+static void markMissed(MirroredDisk *set, int first, int n)
+{
+    int low = -1;
+    int high = -1;
+    for (int b = first; b < first + n; b++)
+    {
+        if (!(set->missed[b / 8] & (1 << (b % 8))))
+        {
+            set->missed[b / 8] |= 1 << (b % 8);
+            low = low < 0 ? b / 8 / BLOCKSIZE : low;
+            high = b / 8 / BLOCKSIZE;
+        }
+    }
+    int dropped = 0;
+    for (int m = 0; low >= 0 && m < set->count; m++)
+    {
+        if (!set->stale[m] && writeMirrorMap(set, m, low, high) == -1)
+        {
+            fprintf(stderr, "Error: Mirror member %d failed, continuing without it.\n", m);
+            set->stale[m] = 1;
+            dropped = 1;
+        }
+    }
+    if (dropped)
+    {
+        writeMirrorHeaders(set);
+    }
+}
+
+// member m could not transfer blocks first to first + n - 1 and is stale from now on
+static void failMember(MirroredDisk *set, int m, int first, int n)
+{
+    pthread_mutex_lock(&mirrorLock);
+    if (!set->stale[m])
+    {
+        fprintf(stderr, "Error: Mirror member %d failed, continuing without it.\n", m);
+        set->stale[m] = 1;
+        markMissed(set, first, n);
+        writeMirrorHeaders(set);
+    }
+    pthread_mutex_unlock(&mirrorLock);
+}
+
+// current member with the fewest reads in flight, -1 if every member is stale
+static int pickMember(MirroredDisk *set)
+{
+    int best = -1;
+    int next = __atomic_load_n(&set->next, __ATOMIC_RELAXED);
+    for (int k = 1; k <= set->count; k++)
+    {
+        int m = (next + k) % set->count;
+        if (!set->stale[m] && (best < 0 || __atomic_load_n(&set->busy[m], __ATOMIC_RELAXED) < __atomic_load_n(&set->busy[best], __ATOMIC_RELAXED)))
+        {
+            best = m;
+        }
+    }
+    if (best >= 0)
+    {
+        __atomic_store_n(&set->next, best, __ATOMIC_RELAXED);
+    }
+    return best;
+}
+
+// read a long run as one slice per current member, each on its own thread. -1 if a member failed
+static int splitRead(MirroredDisk *set, int bNum, int nBlocks, const struct iovec *iov, int iovcnt)
+{
+    StripeJob jobs[DISK_MAX_MEMBERS];
+    int spans[DISK_MAX_MEMBERS];
+    struct iovec *pieces = (struct iovec *)malloc(sizeof(struct iovec) * (iovcnt + 1) * set->count);
+    if (pieces == NULL)
+    {
+        return -1;
+    }
+    int share = (nBlocks + currentMembers(set) - 1) / currentMembers(set);
+    int i = 0;
+    size_t skip = 0;
+    int b = bNum;
+    for (int m = 0; m < set->count; m++)
+    {
+        jobs[m].fd = set->members[m];
+        jobs[m].first = -1;
+        jobs[m].iov = pieces + m * (iovcnt + 1);
+        jobs[m].iovcnt = 0;
+        jobs[m].writing = 0;
+        jobs[m].result = 0;
+        spans[m] = 0;
+        if (!set->stale[m] && b < bNum + nBlocks)
+        {
+            spans[m] = share < bNum + nBlocks - b ? share : bNum + nBlocks - b;
+            jobs[m].first = set->base + b;
+            takeVector(iov, iovcnt, &i, &skip, (size_t)spans[m] * BLOCKSIZE, &jobs[m]);
+            __atomic_add_fetch(&set->busy[m], 1, __ATOMIC_RELAXED);
+            b += spans[m];
+        }
+    }
+    runJobs(jobs, set->count);
+    int result = 0;
+    for (int m = 0; m < set->count; m++)
+    {
+        if (jobs[m].first >= 0)
+        {
+            __atomic_sub_fetch(&set->busy[m], 1, __ATOMIC_RELAXED);
+        }
+        if (jobs[m].first >= 0 && jobs[m].result == -1)
+        {
+            failMember(set, m, jobs[m].first - set->base, spans[m]);
+            result = -1;
+        }
+    }
+    free(pieces);
+    return result;
+}
+
+// read from the least busy current member, or split a long run across all of them. A member that
+// fails is dropped and the read is tried again on the others
+static int mirroredRead(MirroredDisk *set, int bNum, const struct iovec *iov, int iovcnt)
+{
+    int nBlocks = (int)((vectorLength(iov, iovcnt) + BLOCKSIZE - 1) / BLOCKSIZE);
+    while (currentMembers(set) > 0)
+    {
+        if (nBlocks >= DISK_MIRROR_SPLIT && currentMembers(set) > 1)
+        {
+            if (splitRead(set, bNum, nBlocks, iov, iovcnt) == 0)
+            {
+                return 0;
+            }
+            continue;
+        }
+        int m = pickMember(set);
+        if (m < 0)
+        {
+            break;
+        }
+        __atomic_add_fetch(&set->busy[m], 1, __ATOMIC_RELAXED);
+        int result = fileVector(set->members[m], set->base + bNum, iov, iovcnt, 0);
+        __atomic_sub_fetch(&set->busy[m], 1, __ATOMIC_RELAXED);
+        if (result == 0)
+        {
+            return 0;
+        }
+        failMember(set, m, bNum, nBlocks);
+    }
+    fprintf(stderr, "Error: No mirror member is left to read from.\n");
+    return -1;
+}
+
+// write to every current member, side by side once the run is long enough to pay for the threads.
+// Succeeds while at least one member took the write
+static int mirroredWrite(MirroredDisk *set, int bNum, const struct iovec *iov, int iovcnt)
+{
+    int nBlocks = (int)((vectorLength(iov, iovcnt) + BLOCKSIZE - 1) / BLOCKSIZE);
+    if (currentMembers(set) < set->count)
+    {
+        pthread_mutex_lock(&mirrorLock);
+        markMissed(set, bNum, nBlocks);
+        pthread_mutex_unlock(&mirrorLock);
+    }
+    StripeJob jobs[DISK_MAX_MEMBERS];
+    for (int m = 0; m < set->count; m++)
+    {
+        jobs[m].fd = set->members[m];
+        jobs[m].first = set->stale[m] ? -1 : set->base + bNum;
+        jobs[m].iov = (struct iovec *)iov;
+        jobs[m].iovcnt = iovcnt;
+        jobs[m].writing = 1;
+        jobs[m].result = 0;
+    }
+    if (nBlocks >= DISK_MIRROR_SPLIT)
+    {
+        runJobs(jobs, set->count);
+    }
+    else
+    {
+        for (int m = 0; m < set->count; m++)
+        {
+            if (jobs[m].first >= 0)
+            {
+                runStripeJob(&jobs[m]);
+            }
+        }
+    }
+    int written = 0;
+    for (int m = 0; m < set->count; m++)
+    {
+        written += jobs[m].first >= 0 && jobs[m].result == 0;
+    }
+    if (written == 0)
+    {
+        return -1;
+    }
+    for (int m = 0; m < set->count; m++)
+    {
+        if (jobs[m].first >= 0 && jobs[m].result == -1)
+        {
+            failMember(set, m, bNum, nBlocks);
+        }
+    }
+    return 0;
+}
+
+// copy the blocks in the bitmap from a current member to the stale ones and take those back.
+// Bits with no stale member are left by a crash between a write and its header, those blocks go
+// from the first current member to all others. Returns the blocks copied, -1 if none is current
+static int resyncMirror(MirroredDisk *set)
+{
+    int source = -1;
+    for (int m = set->count - 1; m >= 0; m--)
+    {
+        source = set->stale[m] ? source : m;
+    }
+    if (source < 0)
+    {
+        fprintf(stderr, "Error: No mirror member is left to copy from.\n");
+        return -1;
+    }
+    int targets[DISK_MAX_MEMBERS];
+    int stale = currentMembers(set) < set->count;
+    for (int m = 0; m < set->count; m++)
+    {
+        targets[m] = m != source && (set->stale[m] || !stale);
+    }
+    unsigned char *run = (unsigned char *)malloc(DISK_MIRROR_SPLIT * 8 * BLOCKSIZE);
+    if (run == NULL)
+    {
+        return -1;
+    }
+    int copied = 0;
+    for (int b = 0; b < set->blocks;)
+    {
+        int n = 0;
+        while (b + n < set->blocks && n < DISK_MIRROR_SPLIT * 8 && (set->missed[(b + n) / 8] & (1 << ((b + n) % 8))))
+        {
+            n++;
+        }
+        if (n == 0)
+        {
+            b++;
+            continue;
+        }
+        struct iovec part = {run, (size_t)n * BLOCKSIZE};
+        if (fileVector(set->members[source], set->base + b, &part, 1, 0) == -1)
+        {
+            free(run);
+            failMember(set, source, b, n);
+            return resyncMirror(set);
+        }
+        int delivered = 0;
+        for (int m = 0; m < set->count; m++)
+        {
+            if (targets[m] && fileVector(set->members[m], set->base + b, &part, 1, 1) == -1)
+            {
+                fprintf(stderr, "Error: Unable to rebuild mirror member %d.\n", m);
+                targets[m] = 0;
+                set->stale[m] = 1;
+            }
+            delivered |= targets[m];
+        }
+        copied += delivered ? n : 0;
+        b += n;
+    }
+    free(run);
+    for (int m = 0; m < set->count; m++)
+    {
+        set->stale[m] = set->stale[m] && !targets[m];
+    }
+    writeMirrorHeaders(set);
+    if (currentMembers(set) == set->count)
+    {
+        memset(set->missed, 0, (size_t)set->map * BLOCKSIZE);
+        for (int m = 0; m < set->count; m++)
+        {
+            if (writeMirrorMap(set, m, 0, set->map - 1) == -1)
+            {
+                return -1;
+            }
+        }
+    }
+    return copied;
+}
+
+// open or create a backing file, nBytes 0 opens an existing one
+static int openBackingFile(char *filename, int nBytes, int diskFlags)
+{
+    int fd;
+    int direct = (diskFlags & DISK_DIRECT) ? O_DIRECT : 0;
+    if (nBytes < BLOCKSIZE && nBytes != 0)
+    {
+        fprintf(stderr, "Error: Disk size must be at least BLOCKSIZE bytes.\n");
+        return -1;
+    }
+
+    off_t diskSize = nBytes - (nBytes % BLOCKSIZE);
+    // printf("disksize is %d\n", diskSize);
+    if (diskSize == 0)
+    {
+        diskSize = BLOCKSIZE; // Ensure disk size is at least BLOCKSIZE bytes
+    }
+
+    // Open file
+    if (nBytes == 0)
+    {
+        // Open existing file without truncating
+        fd = open(filename, O_RDWR | direct);
+        COUNT(others, 1);
+        if (fd == -1 && direct && errno == EINVAL)
+        {
+            fprintf(stderr, "Error: %s does not support O_DIRECT, using the page cache.\n", filename);
+            direct = 0;
+            fd = open(filename, O_RDWR);
+            COUNT(others, 1);
+        }
+    }
+    else
+    {
+        // Open file with truncation to specified size
+        fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | direct, 0644);
+        COUNT(others, 2);
+        if (fd == -1 && direct && errno == EINVAL)
+        {
+            fprintf(stderr, "Error: %s does not support O_DIRECT, using the page cache.\n", filename);
+            direct = 0;
+            fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            COUNT(others, 1);
+        }
+        if (direct)
+        {
+            // whole aligned units so the last blocks can be transferred, the file system ignores the tail
+            diskSize += (DISK_DIRECT_ALIGNMENT - diskSize % DISK_DIRECT_ALIGNMENT) % DISK_DIRECT_ALIGNMENT;
+        }
+        // Truncate file size to calculated disk size
+        if (ftruncate(fd, diskSize) == -1)
+        {
+            perror("Error truncating file");
+            close(fd);
+            return -1;
+        }
+    }
+
+    // Check if file open was successful
+    if (fd == -1)
+    {
+        perror("Error opening file");
+        return -1;
+    }
+    if (direct && registerDirectDisk(fd) == -1)
+    {
+        close(fd);
+        COUNT(others, 1);
+        return -1;
+    }
+    return fd;
+}
+
+// header of a stripe member: magic, stripe unit, members, index of the member. Written when the
+// members are created, so a disk opened with another unit or its members in another order is refused
+static int writeStripeHeader(int fd, int unitBlocks, int count, int m)
+{
+    unsigned char header[BLOCKSIZE];
+    memset(header, 0, BLOCKSIZE);
+    memcpy(header, DISK_STRIPE_MAGIC, 4);
+    putWord(header + 4, unitBlocks);
+    putWord(header + 8, count);
+    putWord(header + 12, m);
+    struct iovec whole = {header, BLOCKSIZE};
+    return fileVector(fd, 0, &whole, 1, 1);
+}
+
+static int checkStripeHeader(int fd, char *file, int unitBlocks, int count, int m)
+{
+    unsigned char header[BLOCKSIZE];
+    struct iovec whole = {header, BLOCKSIZE};
+    if (fileVector(fd, 0, &whole, 1, 0) == -1 || memcmp(header, DISK_STRIPE_MAGIC, 4) != 0)
+    {
+        fprintf(stderr, "Error: %s is not a stripe member.\n", file);
+        return -1;
+    }
+    if ((int)getWord(header + 4) != unitBlocks || (int)getWord(header + 8) != count || (int)getWord(header + 12) != m)
+    {
+        fprintf(stderr, "Error: %s is member %d of %d with a stripe unit of %d blocks, not member %d of %d with a unit of %d.\n",
+                file, (int)getWord(header + 12), (int)getWord(header + 8), (int)getWord(header + 4), m, count, unitBlocks);
+        return -1;
+    }
+    return 0;
+}
+
+// open a disk striped over count backing files in units of unitBlocks blocks. With nBytes set the
+// members are created, each big enough for its share of nBytes, and given their headers. Otherwise
+// each member's header has to match its place in files and unitBlocks. Returns the handle of the disk
+int openStripedDisk(char *files[], int count, int unitBlocks, int nBytes, int diskFlags)
+{
+    if (count < 1 || count > DISK_MAX_MEMBERS || unitBlocks < 1)
+    {
+        fprintf(stderr, "Error: A striped disk needs 1 to %d members and a stripe unit of at least one block.\n", DISK_MAX_MEMBERS);
+        return -1;
+    }
+    StripedDisk *set = NULL;
+    for (int i = 0; i < DISK_MAX_STRIPED && set == NULL; i++)
+    {
+        set = stripedDisks[i].count == 0 ? &stripedDisks[i] : NULL;
+    }
+    if (set == NULL)
+    {
+        fprintf(stderr, "Error: Too many striped disks open.\n");
+        return -1;
+    }
+    int memberBytes = 0;
+    if (nBytes != 0)
+    {
+        // whole rows of units, so every member holds the same number of units
+        int blocks = nBytes / BLOCKSIZE > 0 ? nBytes / BLOCKSIZE : 1;
+        int units = (blocks + unitBlocks - 1) / unitBlocks;
+        memberBytes = (DISK_ALIGNED_BLOCKS + (units + count - 1) / count * unitBlocks) * BLOCKSIZE;
+    }
+    for (int m = 0; m < count; m++)
+    {
+        set->members[m] = openBackingFile(files[m], memberBytes, diskFlags);
+        int checked = -1;
+        if (set->members[m] >= 0)
+        {
+            checked = nBytes != 0 ? writeStripeHeader(set->members[m], unitBlocks, count, m) : checkStripeHeader(set->members[m], files[m], unitBlocks, count, m);
+        }
+        if (checked == -1)
+        {
+            if (set->members[m] >= 0)
+            {
+                closeDisk(set->members[m]);
+            }
+            while (m-- > 0)
+            {
+                closeDisk(set->members[m]);
+            }
+            return -1;
+        }
+    }
+    set->handle = dup(set->members[0]);
+    COUNT(others, 1);
+    if (set->handle == -1)
+    {
+        for (int m = 0; m < count; m++)
+        {
+            closeDisk(set->members[m]);
+        }
+        return -1;
+    }
+    set->unit = unitBlocks;
+    set->count = count;
+    return set->handle;
+}
+
+// "stripe:UNIT:FILE,FILE,..." names a striped disk, so mkfs, mount and tinyfsck take one like a file
+static int openStripeSpec(char *spec, int nBytes, int diskFlags)
 {
-    int fd;
-    if (nBytes < BLOCKSIZE && nBytes != 0)
+    char copy[4096];
+    char *files[DISK_MAX_MEMBERS];
+    int count = 0;
+    char *end;
+    long unit = strtol(spec, &end, 10);
+    if (end == spec || *end != ':' || unit < 1 || unit > INT_MAX)
     {
-        fprintf(stderr, "Error: Disk size must be at least BLOCKSIZE bytes.\n");
+        fprintf(stderr, "Error: The stripe unit of %s%s has to be a whole number of blocks, at least 1.\n", DISK_STRIPE_PREFIX, spec);
+        return -1;
+    }
+    if (strlen(end + 1) >= sizeof(copy))
+    {
+        fprintf(stderr, "Error: The member list of a striped disk is longer than %zu bytes.\n", sizeof(copy) - 1);
         return -1;
     }
+    strcpy(copy, end + 1);
+    for (char *file = strtok(copy, ","); file != NULL; file = strtok(NULL, ","))
+    {
+        if (count == DISK_MAX_MEMBERS)
+        {
+            fprintf(stderr, "Error: A striped disk has at most %d members.\n", DISK_MAX_MEMBERS);
+            return -1;
+        }
+        files[count++] = file;
+    }
+    return openStripedDisk(files, count, (int)unit, nBytes, diskFlags);
+}
 
-    off_t diskSize = nBytes - (nBytes % BLOCKSIZE);
-    // printf("disksize is %d\n", diskSize);
-    if (diskSize == 0)
+// read a member's header, its generation or 0 if it has none. *blocks is set to the disk's blocks
+static unsigned int readMirrorHeader(int fd, int *blocks)
+{
+    unsigned char header[BLOCKSIZE];
+    struct iovec whole = {header, BLOCKSIZE};
+    if (fileVector(fd, 0, &whole, 1, 0) == -1 || memcmp(header, DISK_MIRROR_MAGIC, 4) != 0)
     {
-        diskSize = BLOCKSIZE; // Ensure disk size is at least BLOCKSIZE bytes
+        return 0;
     }
+    *blocks = (int)getWord(header + 8);
+    return getWord(header + 4);
+}
 
-    // Open file
-    if (nBytes == 0)
+// open a disk mirrored on count backing files. With nBytes set every member is created to hold the
+// whole disk. Otherwise members behind the others, and missing ones, which are created again, are
+// brought up to date before the disk is used. Returns the handle of the disk
+int openMirroredDisk(char *files[], int count, int nBytes, int diskFlags)
+{
+    if (count < 1 || count > DISK_MAX_MEMBERS)
     {
-        // Open existing file without truncating
-        fd = open(filename, O_RDWR);
+        fprintf(stderr, "Error: A mirrored disk needs 1 to %d members.\n", DISK_MAX_MEMBERS);
+        return -1;
+    }
+    MirroredDisk *set = NULL;
+    for (int i = 0; i < DISK_MAX_MIRRORED && set == NULL; i++)
+    {
+        set = mirroredDisks[i].count == 0 ? &mirroredDisks[i] : NULL;
+    }
+    if (set == NULL)
+    {
+        fprintf(stderr, "Error: Too many mirrored disks open.\n");
+        return -1;
+    }
+    unsigned int generations[DISK_MAX_MEMBERS];
+    int sizes[DISK_MAX_MEMBERS];
+    set->generation = 0;
+    set->blocks = nBytes / BLOCKSIZE > 0 ? nBytes / BLOCKSIZE : 1;
+    for (int m = 0; m < count; m++)
+    {
+        set->busy[m] = 0;
+        generations[m] = 0;
+        sizes[m] = 0;
+        set->members[m] = -1;
+        if (nBytes == 0)
+        {
+            set->members[m] = openBackingFile(files[m], 0, diskFlags);
+            generations[m] = set->members[m] < 0 ? 0 : readMirrorHeader(set->members[m], &sizes[m]);
+            if (generations[m] > set->generation)
+            {
+                set->generation = generations[m];
+                set->blocks = sizes[m];
+            }
+        }
+    }
+    if (nBytes == 0 && set->generation == 0)
+    {
+        fprintf(stderr, "Error: No member of the mirrored disk is usable.\n");
+        for (int m = 0; m < count; m++)
+        {
+            closeDisk(set->members[m]);
+        }
+        return -1;
+    }
+    if (nBytes == 0 && set->blocks % DISK_ALIGNED_BLOCKS != 0)
+    {
+        // made before members were laid out in aligned units, its blocks sit elsewhere
+        fprintf(stderr, "Error: The mirrored disk uses an older layout and has to be made again.\n");
+        for (int m = 0; m < count; m++)
+        {
+            closeDisk(set->members[m]);
+        }
+        return -1;
+    }
+    // the disk and its start on the members take whole aligned units, so DISK_DIRECT transfers
+    // of the last blocks, which are padded to a unit, stay within the members
+    set->blocks = (set->blocks + DISK_ALIGNED_BLOCKS - 1) / DISK_ALIGNED_BLOCKS * DISK_ALIGNED_BLOCKS;
+    int mapBlocks = (set->blocks + 8 * BLOCKSIZE - 1) / (8 * BLOCKSIZE);
+    set->map = mapBlocks;
+    set->base = (1 + mapBlocks + DISK_ALIGNED_BLOCKS - 1) / DISK_ALIGNED_BLOCKS * DISK_ALIGNED_BLOCKS;
+    set->missed = (unsigned char *)calloc(mapBlocks, BLOCKSIZE);
+    int rebuild = 0;
+    for (int m = 0; m < count; m++)
+    {
+        set->stale[m] = nBytes == 0 && (generations[m] != set->generation || sizes[m] != set->blocks);
+        if (set->members[m] < 0)
+        {
+            // created afresh, a missing member is rebuilt in full
+            set->members[m] = openBackingFile(files[m], (set->base + set->blocks) * BLOCKSIZE, diskFlags);
+            rebuild |= nBytes == 0;
+        }
+        else if (set->stale[m] && (generations[m] == 0 || sizes[m] != set->blocks))
+        {
+            rebuild = 1; // no header to go by
+        }
+        if (set->members[m] < 0 || set->missed == NULL)
+        {
+            for (int k = 0; k < count; k++)
+            {
+                closeDisk(set->members[k]);
+            }
+            free(set->missed);
+            return -1;
+        }
+    }
+    set->count = count;
+    set->next = 0;
+    int result = 0;
+    if (nBytes != 0)
+    {
+        for (int m = 0; m < count && result == 0; m++)
+        {
+            result = writeMirrorMap(set, m, 0, mapBlocks - 1);
+        }
     }
     else
     {
-        // Open file with truncation to specified size
-        fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
-        // Truncate file size to calculated disk size
-        if (ftruncate(fd, diskSize) == -1)
+        int source = 0;
+        while (source < count && set->stale[source])
         {
-            perror("Error truncating file");
-            close(fd);
+            source++;
+        }
+        struct iovec map = {set->missed, (size_t)mapBlocks * BLOCKSIZE};
+        result = source < count ? fileVector(set->members[source], 1, &map, 1, 0) : -1;
+        if (source == count)
+        {
+            fprintf(stderr, "Error: No member of the mirrored disk is current.\n");
+        }
+        if (rebuild)
+        {
+            memset(set->missed, 0xFF, (size_t)mapBlocks * BLOCKSIZE);
+        }
+        // trailing bits past the last block stay clear
+        for (int b = set->blocks; b < mapBlocks * 8 * BLOCKSIZE; b++)
+        {
+            set->missed[b / 8] &= ~(1 << (b % 8));
+        }
+    }
+    if (result == 0)
+    {
+        writeMirrorHeaders(set);
+        int copied = nBytes == 0 ? resyncMirror(set) : 0;
+        result = copied < 0 ? -1 : 0;
+        if (copied > 0)
+        {
+            fprintf(stderr, "Mirror: copied %d blocks to bring its members up to date.\n", copied);
+        }
+    }
+    set->handle = result == 0 ? dup(set->members[0]) : -1;
+    COUNT(others, 1);
+    if (set->handle == -1)
+    {
+        for (int m = 0; m < count; m++)
+        {
+            closeDisk(set->members[m]);
+        }
+        free(set->missed);
+        set->count = 0;
+        return -1;
+    }
+    return set->handle;
+}
+
+// "mirror:FILE,FILE,..." names a mirrored disk
+static int openMirrorSpec(char *spec, int nBytes, int diskFlags)
+{
+    char copy[4096];
+    char *files[DISK_MAX_MEMBERS];
+    int count = 0;
+    if (strlen(spec) >= sizeof(copy))
+    {
+        fprintf(stderr, "Error: Expected %sFILE,FILE,... for a mirrored disk.\n", DISK_MIRROR_PREFIX);
+        return -1;
+    }
+    strcpy(copy, spec);
+    for (char *file = strtok(copy, ","); file != NULL; file = strtok(NULL, ","))
+    {
+        if (count == DISK_MAX_MEMBERS)
+        {
+            fprintf(stderr, "Error: A mirrored disk has at most %d members.\n", DISK_MAX_MEMBERS);
             return -1;
         }
+        files[count++] = file;
     }
+    return openMirroredDisk(files, count, nBytes, diskFlags);
+}
 
-    // Check if file open was successful
-    if (fd == -1)
+// stop writing to one member of a mirrored disk, as if it had failed. The blocks written from now
+// on are tracked, and resyncDisk copies just those when the member comes back
+int detachMirror(int disk, int member)
+{
+    MirroredDisk *set = findMirrored(disk);
+    if (set == NULL || member < 0 || member >= set->count || set->stale[member] || currentMembers(set) < 2)
     {
-        perror("Error opening file");
+        fprintf(stderr, "Error: Unable to detach member %d, the mirror needs one current member.\n", member);
         return -1;
     }
-    return fd;
+    pthread_mutex_lock(&mirrorLock);
+    set->stale[member] = 1;
+    writeMirrorHeaders(set);
+    pthread_mutex_unlock(&mirrorLock);
+    return 0;
+}
+
+// bring the stale members of a mirrored disk up to date. Returns the blocks copied, -1 if a member
+// is still stale. Not to be called while other threads use the disk
+int resyncDisk(int disk)
+{
+    MirroredDisk *set = findMirrored(disk);
+    if (set == NULL)
+    {
+        return 0;
+    }
+    int copied = resyncMirror(set);
+    return currentMembers(set) < set->count ? -1 : copied;
+}
+
+int openDisk(char *filename, int nBytes)
+{
+    return openDiskFlags(filename, nBytes, 0);
+}
+
+int openDiskFlags(char *filename, int nBytes, int diskFlags)
+{
+    if (filename != NULL && strncmp(filename, DISK_STRIPE_PREFIX, strlen(DISK_STRIPE_PREFIX)) == 0)
+    {
+        return openStripeSpec(filename + strlen(DISK_STRIPE_PREFIX), nBytes, diskFlags);
+    }
+    if (filename != NULL && strncmp(filename, DISK_MIRROR_PREFIX, strlen(DISK_MIRROR_PREFIX)) == 0)
+    {
+        return openMirrorSpec(filename + strlen(DISK_MIRROR_PREFIX), nBytes, diskFlags);
+    }
+    return openBackingFile(filename, nBytes, diskFlags);
+}
+
+// pass posix_fadvise advice for blocks bNum to bNum + nBlocks - 1 on to the files under a disk.
+// A disk opened with DISK_DIRECT has no page cache to advise
+int adviseDisk(int disk, int bNum, int nBlocks, int advice)
+{
+    MirroredDisk *mirror = findMirrored(disk);
+    if (mirror != NULL)
+    {
+        int result = 0;
+        for (int m = 0; m < mirror->count; m++)
+        {
+            result = !mirror->stale[m] && adviseDisk(mirror->members[m], mirror->base + bNum, nBlocks, advice) == -1 ? -1 : result;
+        }
+        return result;
+    }
+    StripedDisk *set = findStriped(disk);
+    if (set != NULL)
+    {
+        // each member is advised once, from its first to its last block in the range
+        int first[DISK_MAX_MEMBERS];
+        int last[DISK_MAX_MEMBERS];
+        for (int m = 0; m < set->count; m++)
+        {
+            first[m] = -1;
+        }
+        for (int b = bNum; b < bNum + nBlocks; b = (b / set->unit + 1) * set->unit)
+        {
+            int unit = b / set->unit;
+            int m = unit % set->count;
+            int memberBlock = DISK_ALIGNED_BLOCKS + (unit / set->count) * set->unit + b % set->unit;
+            int end = (unit + 1) * set->unit < bNum + nBlocks ? (unit + 1) * set->unit : bNum + nBlocks;
+            first[m] = first[m] < 0 ? memberBlock : first[m];
+            last[m] = memberBlock + end - b - 1;
+        }
+        int result = 0;
+        for (int m = 0; m < set->count; m++)
+        {
+            result = first[m] >= 0 && adviseDisk(set->members[m], first[m], last[m] - first[m] + 1, advice) == -1 ? -1 : result;
+        }
+        return result;
+    }
+    if (nBlocks <= 0 || diskAlignment(disk) != BLOCKSIZE)
+    {
+        return 0;
+    }
+    COUNT(others, 1);
+    return posix_fadvise(disk, (off_t)bNum * BLOCKSIZE, (off_t)nBlocks * BLOCKSIZE, advice) == 0 ? 0 : -1;
 }
 
 int closeDisk(int disk)
 {
+    MirroredDisk *mirror = findMirrored(disk);
+    if (mirror != NULL)
+    {
+        for (int m = 0; m < mirror->count; m++)
+        {
+            closeDisk(mirror->members[m]);
+        }
+        mirror->count = 0;
+        free(mirror->missed);
+        close(disk);
+        COUNT(others, 1);
+        return 0;
+    }
+    StripedDisk *set = findStriped(disk);
+    if (set != NULL)
+    {
+        for (int m = 0; m < set->count; m++)
+        {
+            closeDisk(set->members[m]);
+        }
+        set->count = 0;
+        close(disk);
+        COUNT(others, 1);
+        return 0;
+    }
+    int direct = 0;
+    for (int i = 0; i < DISK_MAX_DIRECT; i++)
+    {
+        if (directDisks[i].alignment != 0 && directDisks[i].fd == disk)
+        {
+            directDisks[i].alignment = 0;
+        }
+        direct |= directDisks[i].alignment != 0;
+    }
+    if (!direct)
+    {
+        freeAlignedBuffers();
+    }
+    COUNT(others, 1);
     if (fcntl(disk, F_GETFD) != -1)
     {
         close(disk);
+        COUNT(others, 1);
     }
     return 0;
 }
 
+// push everything written so far to stable storage, data only like fdatasync
+int syncDisk(int disk)
+{
+    MirroredDisk *mirror = findMirrored(disk);
+    if (mirror != NULL)
+    {
+        int result = 0;
+        for (int m = 0; m < mirror->count; m++)
+        {
+            result = !mirror->stale[m] && syncDisk(mirror->members[m]) == -1 ? -1 : result;
+        }
+        return result;
+    }
+    StripedDisk *set = findStriped(disk);
+    if (set != NULL)
+    {
+        int result = 0;
+        for (int m = 0; m < set->count; m++)
+        {
+            result = syncDisk(set->members[m]) == -1 ? -1 : result;
+        }
+        return result;
+    }
+    COUNT(others, 1);
+    return fdatasync(disk);
+}
+
 int readBlock(int disk, int bNum, void *block)
 {
+    MirroredDisk *mirror = findMirrored(disk);
+    if (mirror != NULL)
+    {
+        struct iovec whole = {block, BLOCKSIZE};
+        return mirroredRead(mirror, bNum, &whole, 1);
+    }
+    StripedDisk *set = findStriped(disk);
+    if (set != NULL)
+    {
+        int memberBlock;
+        int member = stripeMember(set, bNum, &memberBlock);
+        return readBlock(member, memberBlock, block);
+    }
     int flags = fcntl(disk, F_GETFL);
+    COUNT(others, 1);
     if (flags == -1)
     {
         return -1;
     }
+    if (flags & O_DIRECT)
+    {
+        return directTransfer(disk, (off_t)bNum * BLOCKSIZE, BLOCKSIZE, block, 0);
+    }
     int offset = bNum * BLOCKSIZE;
+    COUNT(seeks, 1);
     if (lseek(disk, offset, SEEK_SET) == -1)
     {
         return -1;
     }
+    COUNT(reads, 1);
     int bytesRead = read(disk, block, BLOCKSIZE);
     if (bytesRead == -1)
     {
@@ -92,6 +1478,19 @@ int readBlock(int disk, int bNum, void *block)
 
 int writeBlock(int disk, int bNum, void *block)
 {
+    MirroredDisk *mirror = findMirrored(disk);
+    if (mirror != NULL)
+    {
+        struct iovec whole = {block, BLOCKSIZE};
+        return mirroredWrite(mirror, bNum, &whole, 1);
+    }
+    StripedDisk *set = findStriped(disk);
+    if (set != NULL)
+    {
+        int memberBlock;
+        int member = stripeMember(set, bNum, &memberBlock);
+        return writeBlock(member, memberBlock, block);
+    }
     // printf("Block being written in bytes: to offset %d\n", bNum);
     // for (int i = 0; i < BLOCKSIZE; i++)
     // {
@@ -100,15 +1499,22 @@ int writeBlock(int disk, int bNum, void *block)
     // printf("\n");
     
     int flags = fcntl(disk, F_GETFL);
+    COUNT(others, 1);
     if (flags == -1)
     {
         return -1;
     }
+    if (flags & O_DIRECT)
+    {
+        return directTransfer(disk, (off_t)bNum * BLOCKSIZE, BLOCKSIZE, block, 1);
+    }
     int offset = bNum * BLOCKSIZE;
+    COUNT(seeks, 1);
     if (lseek(disk, offset, SEEK_SET) == -1)
     {
         return -1;
     }
+    COUNT(writes, 1);
     int bytesWritten = write(disk, block, BLOCKSIZE);
     if (bytesWritten == -1)
     {
@@ -120,4 +1526,142 @@ int writeBlock(int disk, int bNum, void *block)
         return -1;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+// read nBlocks consecutive blocks starting at bNum with a single read()
+int readBlocks(int disk, int bNum, int nBlocks, void *blocks)
+{
+    MirroredDisk *mirror = findMirrored(disk);
+    if (mirror != NULL)
+    {
+        struct iovec whole = {blocks, (size_t)nBlocks * BLOCKSIZE};
+        return mirroredRead(mirror, bNum, &whole, 1);
+    }
+    StripedDisk *set = findStriped(disk);
+    if (set != NULL)
+    {
+        struct iovec whole = {blocks, (size_t)nBlocks * BLOCKSIZE};
+        return stripedTransfer(set, bNum, &whole, 1, 0);
+    }
+    int flags = fcntl(disk, F_GETFL);
+    COUNT(others, 1);
+    if (flags == -1)
+    {
+        return -1;
+    }
+    if (flags & O_DIRECT)
+    {
+        return directTransfer(disk, (off_t)bNum * BLOCKSIZE, (size_t)nBlocks * BLOCKSIZE, blocks, 0);
+    }
+    off_t offset = (off_t)bNum * BLOCKSIZE;
+    COUNT(seeks, 1);
+    if (lseek(disk, offset, SEEK_SET) == -1)
+    {
+        return -1;
+    }
+    COUNT(reads, 1);
+    ssize_t length = (ssize_t)nBlocks * BLOCKSIZE;
+    ssize_t bytesRead = read(disk, blocks, length);
+    if (bytesRead == -1)
+    {
+        return -1;
+    }
+    else if (bytesRead < length)
+    {
+        fprintf(stderr, "Error: bytes read less than %d blocks.\n", nBlocks);
+        return -1;
+    }
+    return 0;
+}
+
+// write nBlocks consecutive blocks starting at bNum with a single write()
+int writeBlocks(int disk, int bNum, int nBlocks, void *blocks)
+{
+    MirroredDisk *mirror = findMirrored(disk);
+    if (mirror != NULL)
+    {
+        struct iovec whole = {blocks, (size_t)nBlocks * BLOCKSIZE};
+        return mirroredWrite(mirror, bNum, &whole, 1);
+    }
+    StripedDisk *set = findStriped(disk);
+    if (set != NULL)
+    {
+        struct iovec whole = {blocks, (size_t)nBlocks * BLOCKSIZE};
+        return stripedTransfer(set, bNum, &whole, 1, 1);
+    }
+    int flags = fcntl(disk, F_GETFL);
+    COUNT(others, 1);
+    if (flags == -1)
+    {
+        return -1;
+    }
+    if (flags & O_DIRECT)
+    {
+        return directTransfer(disk, (off_t)bNum * BLOCKSIZE, (size_t)nBlocks * BLOCKSIZE, blocks, 1);
+    }
+    off_t offset = (off_t)bNum * BLOCKSIZE;
+    COUNT(seeks, 1);
+    if (lseek(disk, offset, SEEK_SET) == -1)
+    {
+        return -1;
+    }
+    COUNT(writes, 1);
+    ssize_t length = (ssize_t)nBlocks * BLOCKSIZE;
+    ssize_t bytesWritten = write(disk, blocks, length);
+    if (bytesWritten == -1)
+    {
+        return -1;
+    }
+    else if (bytesWritten < length)
+    {
+        fprintf(stderr, "Error: bytes written less than %d blocks.\n", nBlocks);
+        return -1;
+    }
+    return 0;
+}
+
+// read consecutive blocks starting at bNum into the buffers of iov with a single preadv(). The
+// buffers together have to cover whole blocks
+int readBlocksv(int disk, int bNum, const struct iovec *iov, int iovcnt)
+{
+    MirroredDisk *mirror = findMirrored(disk);
+    if (mirror != NULL)
+    {
+        return mirroredRead(mirror, bNum, iov, iovcnt);
+    }
+    StripedDisk *set = findStriped(disk);
+    if (set != NULL)
+    {
+        return stripedTransfer(set, bNum, iov, iovcnt, 0);
+    }
+    return fileVector(disk, bNum, iov, iovcnt, 0);
+}
+
+// write the buffers of iov as consecutive blocks starting at bNum with a single pwritev()
+int writeBlocksv(int disk, int bNum, const struct iovec *iov, int iovcnt)
+{
+    MirroredDisk *mirror = findMirrored(disk);
+    if (mirror != NULL)
+    {
+        return mirroredWrite(mirror, bNum, iov, iovcnt);
+    }
+    StripedDisk *set = findStriped(disk);
+    if (set != NULL)
+    {
+        return stripedTransfer(set, bNum, iov, iovcnt, 1);
+    }
+    return fileVector(disk, bNum, iov, iovcnt, 1);
+}
+
+void getDiskStats(DiskStats *stats)
+{
+    *stats = diskStats;
+}
+
+void resetDiskStats(void)
+{
+    diskStats.reads = 0;
+    diskStats.writes = 0;
+    diskStats.seeks = 0;
+    diskStats.others = 0;
+}
@@ -2,12 +2,48 @@
 #define LIBDISK_H
 
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define BLOCKSIZE 256
 
+// openDiskFlags flags
+#define DISK_DIRECT 0x1 // bypass the kernel page cache with O_DIRECT
+
+#define DISK_DIRECT_ALIGNMENT 4096 // alignment used for O_DIRECT on regular files
+#define DISK_POOL_BUFFERS 4        // aligned bounce buffers kept between direct transfers
+
+#define DISK_MAX_MEMBERS 8            // backing files of one striped or mirrored disk
+#define DISK_STRIPE_PREFIX "stripe:" // disk names "stripe:UNIT:FILE,FILE,..." open a striped disk
+#define DISK_MIRROR_PREFIX "mirror:" // disk names "mirror:FILE,FILE,..." open a mirrored disk
+
+// running counts of the syscalls issued by this library, used by the bench
+typedef struct
+{
+    unsigned long reads;  // read() calls
+    unsigned long writes; // write() calls
+    unsigned long seeks;  // lseek() calls
+    unsigned long others; // open()/ftruncate()/fcntl()/close() calls
+} DiskStats;
+
 int openDisk(char *filename, int nBytes);
+int openDiskFlags(char *filename, int nBytes, int flags);
+int openStripedDisk(char *files[], int count, int unitBlocks, int nBytes, int flags);
+int openMirroredDisk(char *files[], int count, int nBytes, int flags);
+int detachMirror(int disk, int member);
+int resyncDisk(int disk);
+int diskAlignment(int disk);
+off_t diskBytes(int disk);
 int readBlock(int disk, int bNum, void *block);
 int writeBlock(int disk, int bNum, void *block);
+int readBlocks(int disk, int bNum, int nBlocks, void *blocks);
+int writeBlocks(int disk, int bNum, int nBlocks, void *blocks);
+int readBlocksv(int disk, int bNum, const struct iovec *iov, int iovcnt);
+int writeBlocksv(int disk, int bNum, const struct iovec *iov, int iovcnt);
+int adviseDisk(int disk, int bNum, int nBlocks, int advice);
 int closeDisk(int disk);
+int syncDisk(int disk);
+void getDiskStats(DiskStats *stats);
+void resetDiskStats(void);
 
 #endif /* LIBDISK_H */
\ No newline at end of file
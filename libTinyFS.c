@@ -1,14 +1,69 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "libTinyFS.h"
 #include "libDisk.h"
 #include "TinyFS_errno.h"
+#include "arena.c"
 #include "fdLL.c"
+#include "inodeCache.c"
 #include "bitmap.c"
+#include "crc32c.c"
+#include "lz.c"
+#include "writeBuffer.c"
 #include <sys/fcntl.h>
 #include <time.h>
+#include <pthread.h>
+#include "trace.h"
+
+// the public calls are defined under untraced_ names. trace.c, included at the end, wraps each of
+// them in the tfs_ function callers link against, which records the call while a trace is open
+#define tfs_mkfs untraced_mkfs
+#define tfs_mount untraced_mount
+#define tfs_unmount untraced_unmount
+#define tfs_openFile untraced_openFile
+#define tfs_openPath untraced_openPath
+#define tfs_mkdir untraced_mkdir
+#define tfs_createMany untraced_createMany
+#define tfs_deleteMany untraced_deleteMany
+#define tfs_writeFile untraced_writeFile
+#define tfs_deleteFile untraced_deleteFile
+#define tfs_closeFile untraced_closeFile
+#define tfs_fsync untraced_fsync
+#define tfs_sync untraced_sync
+#define tfs_setDirectIO untraced_setDirectIO
+#define tfs_readdir untraced_readdir
+#define tfs_stat untraced_stat
+#define tfs_listDirectory untraced_listDirectory
+#define tfs_readByte untraced_readByte
+#define tfs_seek untraced_seek
+#define tfs_lseek untraced_lseek
+#define tfs_writeAt untraced_writeAt
+#define tfs_truncate untraced_truncate
+#define tfs_fallocate untraced_fallocate
+#define tfs_export untraced_export
+#define tfs_import untraced_import
+#define tfs_setRawData untraced_setRawData
+#define tfs_readv untraced_readv
+#define tfs_writev untraced_writev
+#define tfs_advise untraced_advise
+#define tfs_setOwner untraced_setOwner
+#define tfs_setQuota untraced_setQuota
+#define tfs_quotaUsage untraced_quotaUsage
+#define tfs_setThrottle untraced_setThrottle
+#define tfs_readFileInfo untraced_readFileInfo
+#define tfs_rename untraced_rename
+#define tfs_setCompression untraced_setCompression
+#define tfs_setFileCompression untraced_setFileCompression
+#define tfs_setDedup untraced_setDedup
+#define tfs_snapshot untraced_snapshot
+#define tfs_deleteSnapshot untraced_deleteSnapshot
+#define tfs_mountSnapshot untraced_mountSnapshot
 
 int mounted = 0;     // 1 if file system is mounted, 0 if not
 char *currMountedFS; // Name of the currently mounted file system
@@ -16,766 +71,4852 @@ int fds = 1;         // File descriptor counter
 int disk = -1;       // File descriptor for disk
 Bitmap *mountedBitmap = NULL;
 FileEntry *openFileTable = NULL;
+int mountedFeatures = 0;             // feature flags of the mounted file system (superblock[3])
+uint32_t *checksumTable = NULL;      // CRC32C of each data block, indexed by block number
+unsigned char *checksumDirty = NULL; // one flag per checksum table block, set when it needs writing
+unsigned char *checksumLoaded = NULL; // one flag per checksum table block, set once it has been read
+int checksumBlocks = 0;              // number of checksum table blocks on the mounted disk
+int compressByDefault = 0;           // mount wide compression for files without their own setting
+unsigned char compressScratch[65536]; // compressed stream being built by tfs_writeFile
+int dedupEnabled = 0;                // new content is deduplicated on this mount
+int rootBlock = 1;                   // block holding the mounted root directory
+int readOnly = 0;                    // 1 when a snapshot is mounted
+int snapshotList = 0;                // newest snapshot record (superblock[255]), 0 if none
+Bitmap *pinnedBitmap = NULL;         // blocks held by snapshots, never reused or scrubbed while they exist
+int pinnedLoaded = 0;                // pinnedBitmap has been built from the snapshot records
+int dedupIndexBlock = 0;             // first block of the dedup index (superblock[2]), 0 if the image has none
+int directIO = 0;                    // open disks with O_DIRECT on the next mkfs or mount
+int rawDataFormat = 0;               // format the next tfs_mkfs with FEATURE_RAW_DATA
+int dataHeader = 4;                  // header bytes in front of the content of a data block, 0 with FEATURE_RAW_DATA
+int dataPayload = BLOCKSIZE - 4;     // bytes of file content a data block holds
+int quotaBlock = 0;                  // quota table block (superblock[QUOTA_TABLE_LOC]), 0 if the image has none
+int quotaLimit[QUOTA_MAX_OWNERS];    // block limit of every owner, 0 for none
+int quotaUsed[QUOTA_MAX_OWNERS];     // data blocks charged to every owner
+int quotaDirty = 0;                  // the quota table changed since it was last written
+int quotaOwner = 0;                  // owner of the file being changed, charged for what it allocates
+int currentOwner = 0;                // owner of the files created from now on
+Arena mountArena;                    // mount lifetime allocations: bitmap, checksum table, disk name
+
+// one entry of the dedup index, an extent that may be shared by several inodes
+typedef struct
+{
+    uint64_t hash;   // FNV-1a hash of the stored content
+    int start;       // first block of the extent, 0 for an empty slot
+    int stored_size; // bytes of content in the extent
+    int refs;        // number of inodes pointing at the extent
+} DedupEntry;
+
+// token bucket limiting the bytes one owner reads and writes per second
+typedef struct
+{
+    double rate;          // bytes per second, 0 for no limit
+    double burst;         // most bytes that can go through at once after a quiet spell
+    double tokens;        // bytes that may go through now, negative while the owner is in debt
+    struct timespec last; // when tokens was last brought up to date
+} Throttle;
+
+Throttle throttles[QUOTA_MAX_OWNERS];
+
+DedupEntry dedupIndex[DEDUP_INDEX_BLOCKS * DEDUP_ENTRIES_PER_BLOCK];
+unsigned char dedupDirty[DEDUP_INDEX_BLOCKS];
+int dedupLoaded = 0; // dedupIndex holds the index of the mounted image, read on first use
+
+// one entry of the dentry cache, the result of looking a name up in a directory
+#define DENTRY_CACHE_SIZE 512
+typedef struct
+{
+    int parent; // block of the directory the name was looked up in, 0 for an empty slot
+    int inode;  // inode block the name resolves to, 0 if the name is known not to exist
+    int dir;    // DIRECTORY block when the inode is a directory, 0 otherwise
+    char name[MAX_FILENAME_LENGTH + 1];
+} DentryEntry;
+
+DentryEntry dentryCache[DENTRY_CACHE_SIZE]; // direct mapped on parent and name, cleared on mount
+Inode *inodeCache[INODE_CACHE_BUCKETS];     // decoded inodes by block, written back on close and unmount
+
+// number of checksum table blocks needed to cover every block on a disk
+int checksumTableSize(int num_blocks)
+{
+    return (num_blocks + CHECKSUMS_PER_BLOCK - 1) / CHECKSUMS_PER_BLOCK;
+}
+
+// data blocks needed for size bytes of file content
+int dataBlocks(int size)
+{
+    return (size + dataPayload - 1) / dataPayload;
+}
 
-Bitmap *readBitmap(int disk)
+// write the header of a data block, linked to next (0 for none). Header-free images keep
+// nothing in data blocks but content, so there is nothing to write
+void stampDataHeader(unsigned char *block, int next)
 {
-    // Go to the location where the bitmap is stored on disk
-    if (lseek(disk, 4, SEEK_SET) == -1)
+    if (dataHeader == 0)
     {
-        fprintf(stderr, "Error: Unable to seek to index 4.\n");
-        closeDisk(disk);
-        return NULL;
+        return;
     }
+    block[0] = FILE_EXTENT;
+    block[1] = MAGIC_NUMBER;
+    block[2] = (unsigned char)next;
+    block[3] = 0x00;
+}
+
+// check of the entries of a checksum table or dedup index block, kept in its header bytes [2..3]
+int regionCheck(unsigned char *block)
+{
+    return crc32c(block + 4, BLOCKSIZE - 4) & 0xFFFF;
+}
+
+void stampRegionCheck(unsigned char *block)
+{
+    int check = regionCheck(block);
+    block[2] = (check >> 8) & 0xFF;
+    block[3] = check & 0xFF;
+}
+
+// images made before region checks have 0 in those bytes and are taken as they are
+int regionValid(unsigned char *block)
+{
+    return !(mountedFeatures & FEATURE_REGION_CHECKS) || ((block[2] << 8) | block[3]) == regionCheck(block);
+}
 
-    // Read the bitmap structure from disk
-    Bitmap *bitmap = (Bitmap *)malloc(sizeof(Bitmap));
-    if (read(disk, bitmap, sizeof(Bitmap)) != sizeof(Bitmap))
+// set up an empty in-memory checksum table, its blocks are read one at a time on first use
+int initChecksumTable(int num_blocks)
+{
+    checksumBlocks = checksumTableSize(num_blocks);
+    checksumTable = (uint32_t *)arenaAlloc(&mountArena, checksumBlocks * CHECKSUMS_PER_BLOCK * sizeof(uint32_t));
+    checksumDirty = (unsigned char *)arenaAlloc(&mountArena, checksumBlocks);
+    checksumLoaded = (unsigned char *)arenaAlloc(&mountArena, checksumBlocks);
+    if (checksumTable == NULL || checksumDirty == NULL || checksumLoaded == NULL)
     {
-        fprintf(stderr, "Error: Unable to read bitmap data.\n");
-        closeDisk(disk);
-        free(bitmap);
-        return NULL;
+        fprintf(stderr, "Error: Unable to allocate memory for checksum table.\n");
+        return READ_ERROR;
+    }
+    return 1;
+}
+
+// read the checksum table block holding the entry of bNum, if it is not in memory yet
+int loadChecksumRegion(int bNum)
+{
+    unsigned char tableBlock[BLOCKSIZE];
+    int b = bNum / CHECKSUMS_PER_BLOCK;
+    if (checksumLoaded[b])
+    {
+        return 1;
+    }
+    if (bufferedRead(disk, CHECKSUM_TABLE_BLOCK + b, tableBlock) == -1 || tableBlock[0] != CHECKSUM_TABLE ||
+        !regionValid(tableBlock))
+    {
+        fprintf(stderr, "Error: Unable to read checksum table block %d.\n", b);
+        return DISK_READ_ERROR;
     }
+    for (int i = 0; i < CHECKSUMS_PER_BLOCK; i++)
+    {
+        unsigned char *entry = tableBlock + 4 + i * 4;
+        checksumTable[b * CHECKSUMS_PER_BLOCK + i] = (uint32_t)entry[0] | (uint32_t)entry[1] << 8 |
+                                                     (uint32_t)entry[2] << 16 | (uint32_t)entry[3] << 24;
+    }
+    checksumLoaded[b] = 1;
+    return 1;
+}
 
-    // Allocate memory for free blocks
-    bitmap->free_blocks = (uint8_t *)malloc(bitmap->bitmap_size);
-    if (bitmap->free_blocks == NULL)
+// write back the checksum table blocks changed since the last flush
+int flushChecksumTable(void)
+{
+    unsigned char tableBlock[BLOCKSIZE];
+    if (!(mountedFeatures & FEATURE_CHECKSUMS))
     {
-        fprintf(stderr, "Error: Unable to allocate memory for bitmap contents.\n");
-        closeDisk(disk);
-        free(bitmap);
-        return NULL;
+        return 1;
+    }
+    for (int b = 0; b < checksumBlocks; b++)
+    {
+        if (!checksumDirty[b])
+        {
+            continue;
+        }
+        memset(tableBlock, 0, BLOCKSIZE);
+        tableBlock[0] = CHECKSUM_TABLE;
+        tableBlock[1] = MAGIC_NUMBER;
+        for (int i = 0; i < CHECKSUMS_PER_BLOCK; i++)
+        {
+            uint32_t crc = checksumTable[b * CHECKSUMS_PER_BLOCK + i];
+            unsigned char *entry = tableBlock + 4 + i * 4;
+            entry[0] = crc & 0xFF;
+            entry[1] = (crc >> 8) & 0xFF;
+            entry[2] = (crc >> 16) & 0xFF;
+            entry[3] = (crc >> 24) & 0xFF;
+        }
+        if (mountedFeatures & FEATURE_REGION_CHECKS)
+        {
+            stampRegionCheck(tableBlock);
+        }
+        if (bufferedWrite(disk, CHECKSUM_TABLE_BLOCK + b, tableBlock) == -1)
+        {
+            fprintf(stderr, "Error: Unable to write checksum table block %d.\n", b);
+            return WRITE_ERROR;
+        }
+        checksumDirty[b] = 0;
     }
+    return 1;
+}
 
-    // Read the bitmap contents from disk
-    if (read(disk, bitmap->free_blocks, bitmap->bitmap_size) != bitmap->bitmap_size)
+// record crc as the checksum of a data block that is about to be written (0 clears the entry)
+int setChecksumEntry(int bNum, uint32_t crc)
+{
+    if (!(mountedFeatures & FEATURE_CHECKSUMS))
     {
-        fprintf(stderr, "Error: Unable to read bitmap contents.\n");
-        closeDisk(disk);
-        free(bitmap->free_blocks);
-        free(bitmap);
-        return NULL;
+        return 1;
+    }
+    int result = loadChecksumRegion(bNum);
+    if (result < 0)
+    {
+        return result;
     }
+    checksumTable[bNum] = crc;
+    checksumDirty[bNum / CHECKSUMS_PER_BLOCK] = 1;
+    return 1;
+}
 
-    return bitmap;
+int setBlockChecksum(int bNum, unsigned char *block)
+{
+    return setChecksumEntry(bNum, block == NULL ? 0 : crc32c(block, BLOCKSIZE));
 }
 
-int writeBitmap(int disk, Bitmap *bitmap)
+// check the checksum crc of a data block that was just read against its checksum table entry
+int verifyChecksumEntry(int bNum, uint32_t crc)
 {
-    // Go back to index 4(location where bitmap should be written to disk)
-    if (lseek(disk, 4, SEEK_SET) == -1)
+    if (!(mountedFeatures & FEATURE_CHECKSUMS))
     {
-        fprintf(stderr, "Error: Unable to seek to index 4.\n");
-        closeDisk(disk);
-        return SEEK_ERROR;
+        return 1;
+    }
+    int result = loadChecksumRegion(bNum);
+    if (result < 0)
+    {
+        return result;
     }
+    if (crc != checksumTable[bNum])
+    {
+        fprintf(stderr, "Error: Checksum mismatch on block %d.\n", bNum);
+        return CHECKSUM_ERROR;
+    }
+    return 1;
+}
 
-    if (bitmap->bitmap_size + sizeof(Bitmap) > 232)
+int verifyBlockChecksum(int bNum, unsigned char *block)
+{
+    if (!(mountedFeatures & FEATURE_CHECKSUMS))
     {
-        fprintf(stderr, "Error: Bitmap size too large.\n");
-        closeDisk(disk);
-        return BITMAP_SIZE_ERROR;
+        return 1;
     }
-    
-    if (write(disk, bitmap, sizeof(Bitmap)) != sizeof(Bitmap))
+    return verifyChecksumEntry(bNum, crc32c(block, BLOCKSIZE));
+}
+
+// copy the name of an inode into name, which holds MAX_FILENAME_LENGTH + 1 bytes
+void inodeName(unsigned char *inode, char *name)
+{
+    if (inode[INODE_NAME_LOC] != 0x00)
     {
-        fprintf(stderr, "Error: Unable to write bitmap data.\n");
-        closeDisk(disk);
-        return WRITE_ERROR;
+        memcpy(name, inode + INODE_NAME_LOC, MAX_FILENAME_LENGTH);
+        name[MAX_FILENAME_LENGTH] = '\0';
+        return;
     }
+    // images written before long names only have the 8 byte name
+    memcpy(name, inode + 4, 8);
+    name[8] = '\0';
+}
 
-    if (write(disk, bitmap->free_blocks, bitmap->bitmap_size) != bitmap->bitmap_size)
+// bytes an inode's content takes in its extent
+int inodeStoredSize(unsigned char *inode)
+{
+    if (inode[3] & INODE_COMPRESSED)
     {
-        fprintf(stderr, "Error: Unable to write bitmap data.\n");
-        closeDisk(disk);
-        return WRITE_ERROR;
+        return (inode[27] << 8) | inode[28];
     }
+    return (inode[13] << 8) | inode[14];
+}
 
-    return 1;
+// read the run list of a sparse inode, returns the number of runs
+int decodeSparseRuns(unsigned char *block, SparseRun *runs)
+{
+    int count = block[SPARSE_MAP_LOC] < SPARSE_MAX_RUNS ? block[SPARSE_MAP_LOC] : SPARSE_MAX_RUNS;
+    for (int r = 0; r < count; r++)
+    {
+        unsigned char *run = block + SPARSE_MAP_LOC + 1 + r * SPARSE_RUN_SIZE;
+        runs[r].logical = (unsigned short)(((run[0] << 8) | run[1]) & ~SPARSE_RUN_UNWRITTEN);
+        runs[r].unwritten = ((run[0] << 8) & SPARSE_RUN_UNWRITTEN) != 0;
+        runs[r].physical = (unsigned short)((run[2] << 8) | run[3]);
+        runs[r].length = run[4];
+    }
+    return count;
 }
 
-int tfs_mkfs(char *filename, int nBytes)
+// fill a decoded inode from its raw block
+void decodeInode(unsigned char *block, Inode *inode)
 {
-    /* Makes a blank TinyFS file system of size nBytes on the unix file
-    specified by ‘filename’. This function should use the emulated disk
-    library to open the specified unix file, and upon success, format the
-    file to be a mountable disk. This includes initializing all data to 0x00,
-    setting magic numbers, initializing and writing the superblock and
-    inodes, etc. Must return a specified success/error code. */
+    inode->file_index = block[2];
+    inode->flags = block[3];
+    inodeName(block, inode->name);
+    inode->file_size = (block[13] << 8) | block[14];
+    inode->stored_size = inodeStoredSize(block);
+    memcpy(&inode->hour, block + 15, 4);
+    memcpy(&inode->minute, block + 19, 4);
+    memcpy(&inode->second, block + 23, 4);
+    inode->owner = block[INODE_OWNER_LOC] < QUOTA_MAX_OWNERS ? block[INODE_OWNER_LOC] : 0;
+    inode->run_count = (inode->flags & INODE_SPARSE) ? decodeSparseRuns(block, inode->runs) : 0;
+}
 
-    disk = openDisk(filename, nBytes);
-    if (disk < 0)
+// lay a decoded inode out as its raw block
+void encodeInode(Inode *inode, unsigned char *block)
+{
+    memset(block, 0, BLOCKSIZE);
+    block[0] = INODE;
+    block[1] = MAGIC_NUMBER;
+    block[2] = (unsigned char)inode->file_index;
+    block[3] = (unsigned char)inode->flags;
+    // the first 8 characters stay at [4..11] for older readers, the full name lives at INODE_NAME_LOC
+    strncpy((char *)block + 4, inode->name, 8);
+    strcpy((char *)block + INODE_NAME_LOC, inode->name);
+    block[13] = (unsigned char)(inode->file_size >> 8);
+    block[14] = (unsigned char)inode->file_size;
+    memcpy(block + 15, &inode->hour, 4);
+    memcpy(block + 19, &inode->minute, 4);
+    memcpy(block + 23, &inode->second, 4);
+    // bytes actually in the extent, only differs from the size for compressed files
+    block[27] = (unsigned char)(inode->stored_size >> 8);
+    block[28] = (unsigned char)inode->stored_size;
+    block[INODE_OWNER_LOC] = (unsigned char)inode->owner;
+    if (inode->flags & INODE_SPARSE)
     {
-        fprintf(stderr, "Error: Unable to open disk file.\n");
-        return INVLD_BLK_SIZE;
+        block[SPARSE_MAP_LOC] = (unsigned char)inode->run_count;
+        for (int r = 0; r < inode->run_count; r++)
+        {
+            unsigned char *run = block + SPARSE_MAP_LOC + 1 + r * SPARSE_RUN_SIZE;
+            run[0] = (unsigned char)((inode->runs[r].logical | (inode->runs[r].unwritten ? SPARSE_RUN_UNWRITTEN : 0)) >> 8);
+            run[1] = (unsigned char)inode->runs[r].logical;
+            run[2] = (unsigned char)(inode->runs[r].physical >> 8);
+            run[3] = (unsigned char)inode->runs[r].physical;
+            run[4] = inode->runs[r].length;
+        }
     }
-    else
+}
+
+// the decoded inode stored in block, read and cached on first use. NULL if it is not an inode
+Inode *loadInode(int block)
+{
+    Inode *inode = findCachedInode(inodeCache, block);
+    if (inode != NULL)
     {
-        unsigned char superblock[BLOCKSIZE];
-        superblock[0] = 0x01; // Set the first byte to 0x01
-        superblock[1] = 0x44; // Set the second byte to 0x44 (magic num)
+        return inode;
+    }
+    unsigned char raw[BLOCKSIZE];
+    if (bufferedRead(disk, block, raw) == -1 || raw[0] != INODE)
+    {
+        return NULL;
+    }
+    inode = insertCachedInode(inodeCache, block);
+    if (inode != NULL)
+    {
+        decodeInode(raw, inode);
+    }
+    return inode;
+}
 
-        // Set the remaining blocks to 0x00
-        for (int i = 2; i < BLOCKSIZE; i++)
+// write a dirty inode back to its block
+int storeInode(Inode *inode)
+{
+    unsigned char raw[BLOCKSIZE];
+    if (!inode->dirty)
+    {
+        return 1;
+    }
+    encodeInode(inode, raw);
+    if (bufferedWrite(disk, inode->block, raw) == -1)
+    {
+        fprintf(stderr, "Error: Unable to write inode to disk.\n");
+        return WRITE_ERROR;
+    }
+    inode->dirty = 0;
+    return 1;
+}
+
+// write back every dirty inode in the cache
+int flushInodes(void)
+{
+    for (int i = 0; i < INODE_CACHE_BUCKETS; i++)
+    {
+        for (Inode *inode = inodeCache[i]; inode != NULL; inode = inode->next)
         {
-            superblock[i] = 0x00;
+            if (storeInode(inode) < 0)
+            {
+                return WRITE_ERROR;
+            }
         }
+    }
+    return 1;
+}
 
-        // we will not write superblock yet, because we want to add bitmap to it first
-        unsigned char rootDirectory[BLOCKSIZE];
-        rootDirectory[0] = 0x02; // Set the first byte to 0x02
-        rootDirectory[1] = 0x44; // Set the second byte to 0x44 (magic num)
+DentryEntry *dentrySlot(int parent, char *name)
+{
+    uint32_t h = 2166136261u ^ (uint32_t)parent;
+    for (int i = 0; name[i] != '\0'; i++)
+    {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return &dentryCache[h % DENTRY_CACHE_SIZE];
+}
 
-        for (int i = 2; i < BLOCKSIZE; i++)
+// remember what name resolves to in directory parent, inode 0 records that it does not exist
+void dentryInsert(int parent, char *name, int inode, int dir)
+{
+    DentryEntry *entry = dentrySlot(parent, name);
+    entry->parent = parent;
+    entry->inode = inode;
+    entry->dir = dir;
+    strcpy(entry->name, name);
+}
+
+// drop every entry looked up in directory parent, used when its block is freed
+void dentryForgetDirectory(int parent)
+{
+    for (int i = 0; i < DENTRY_CACHE_SIZE; i++)
+    {
+        if (dentryCache[i].parent == parent)
         {
-            rootDirectory[i] = 0x00;
+            dentryCache[i].parent = 0;
         }
-        // printf("Root Directory contents: ");
-        // for (int i = 0; i < BLOCKSIZE; i++)
-        // {
-        //     printf("%02x ", rootDirectory[i]);
-        // }
-        // printf("\n");
+    }
+}
 
-        if (writeBlock(disk, 1, rootDirectory) == -1)
+// look up name in the directory stored in block parent. Returns its inode block and sets *dir
+// to its DIRECTORY block (0 for a file), or FILE_NOT_FOUND_ERROR. A cache miss scans the
+// directory once and caches every name it reads on the way.
+int lookupName(int parent, char *name, int *dir)
+{
+    DentryEntry *entry = dentrySlot(parent, name);
+    if (entry->parent == parent && strcmp(entry->name, name) == 0)
+    {
+        if (entry->inode == 0)
         {
-            fprintf(stderr, "Error: Unable to write root directory to disk.\n");
-            closeDisk(disk);
-            return WRITE_ERROR;
+            return FILE_NOT_FOUND_ERROR;
         }
+        *dir = entry->dir;
+        return entry->inode;
+    }
 
-        unsigned char emptyBlock[BLOCKSIZE];
-        emptyBlock[0] = 0x04; // Set the first byte to 0x04
-        emptyBlock[1] = 0x44; // Set the second byte to 0x44 (magic num)
+    unsigned char directory[BLOCKSIZE];
+    int found = FILE_NOT_FOUND_ERROR;
+    if (bufferedRead(disk, parent, directory) == -1)
+    {
+        return DISK_READ_ERROR;
+    }
+    for (int i = 4; i < 251; i += 2)
+    {
+        int value = (directory[i] << 8) | directory[i + 1];
+        if (value == 0)
+        {
+            continue;
+        }
+        Inode *inode = loadInode(value);
+        if (inode == NULL)
+        {
+            continue;
+        }
+        int entryDir = (inode->flags & INODE_DIRECTORY) ? inode->file_index : 0;
+        dentryInsert(parent, inode->name, value, entryDir);
+        if (found < 0 && strcmp(inode->name, name) == 0)
+        {
+            found = value;
+            *dir = entryDir;
+        }
+    }
+    if (found < 0)
+    {
+        dentryInsert(parent, name, 0, 0);
+    }
+    else
+    {
+        // another name may have hashed to the same slot during the scan
+        dentryInsert(parent, name, found, *dir);
+    }
+    return found;
+}
 
-        for (int i = 2; i < BLOCKSIZE; i++)
+// walk path down from the mounted root through every component but the last, which all have to
+// be directories. Fills leaf with the last component's name and returns the block of the
+// directory that holds it
+int resolveParent(char *path, char *leaf)
+{
+    int current = rootBlock;
+    int length = 0;
+    leaf[0] = '\0';
+    for (char *p = path;; p++)
+    {
+        if (*p != '/' && *p != '\0')
         {
-            emptyBlock[i] = 0x00;
+            if (length == MAX_FILENAME_LENGTH)
+            {
+                fprintf(stderr, "Error: File name exceeds the maximum limit of %d characters.\n", MAX_FILENAME_LENGTH);
+                return NAME_LENGTH_ERROR;
+            }
+            leaf[length++] = *p;
+            continue;
+        }
+        leaf[length] = '\0';
+        // skip empty components from leading, trailing or repeated slashes
+        char *rest = p;
+        while (*rest == '/')
+        {
+            rest++;
+        }
+        if (*rest == '\0')
+        {
+            break;
+        }
+        if (length > 0)
+        {
+            int child_dir = 0;
+            int inode = lookupName(current, leaf, &child_dir);
+            if (inode < 0)
+            {
+                return inode;
+            }
+            if (child_dir == 0)
+            {
+                return NOT_A_DIRECTORY_ERROR;
+            }
+            current = child_dir;
         }
+        length = 0;
+        p = rest - 1;
+    }
+    if (leaf[0] == '\0')
+    {
+        fprintf(stderr, "Error: Empty file name.\n");
+        return NAME_LENGTH_ERROR;
+    }
+    return current;
+}
 
-        int num_blocks = nBytes / BLOCKSIZE;
-        for (int i = 2; i < num_blocks; i++)
+// resolve path to its inode block, see resolveParent. *parent is set to the block of the
+// directory holding the last component once the walk gets there and stays 0 otherwise, so
+// FILE_NOT_FOUND_ERROR with a parent means the last component can be created.
+int resolvePath(char *path, int *parent, char *leaf, int *dir)
+{
+    *parent = 0;
+    int current = resolveParent(path, leaf);
+    if (current < 0)
+    {
+        return current;
+    }
+    *parent = current;
+    return lookupName(current, leaf, dir);
+}
+
+// build the compressed stream for a file: a 2 byte chunk count, a 2 byte stored length per chunk
+// (high bit set when the chunk did not shrink and is kept raw), then the chunks back to back.
+// returns the stream size, or -1 if it would not fit in cap bytes
+int compressStream(char *buffer, int size, unsigned char *stream, int cap)
+{
+    int chunks = (size + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE;
+    int pos = 2 + chunks * 2;
+    if (pos >= cap)
+    {
+        return -1;
+    }
+    stream[0] = (chunks >> 8) & 0xFF;
+    stream[1] = chunks & 0xFF;
+    for (int c = 0; c < chunks; c++)
+    {
+        unsigned char *src = (unsigned char *)buffer + c * COMPRESS_CHUNK_SIZE;
+        int len = size - c * COMPRESS_CHUNK_SIZE;
+        if (len > COMPRESS_CHUNK_SIZE)
+        {
+            len = COMPRESS_CHUNK_SIZE;
+        }
+        int room = cap - pos < len - 1 ? cap - pos : len - 1;
+        int stored = lz_compress(src, len, stream + pos, room);
+        int entry = stored;
+        if (stored < 0)
         {
-            if (writeBlock(disk, i, emptyBlock) == -1)
+            if (pos + len > cap)
             {
-                fprintf(stderr, "Error: Unable to write empty block to disk.\n");
-                closeDisk(disk);
-                return WRITE_ERROR;
+                return -1;
             }
+            memcpy(stream + pos, src, len);
+            stored = len;
+            entry = len | 0x8000;
         }
+        stream[2 + c * 2] = (entry >> 8) & 0xFF;
+        stream[3 + c * 2] = entry & 0xFF;
+        pos += stored;
+    }
+    return pos;
+}
 
-        int bitmap_size = (((nBytes / BLOCKSIZE) + 7) / 8);
-        Bitmap *bitmap = create_bitmap(bitmap_size, num_blocks, NULL);
-        // make sure num+blocks is less than max number of blocks we can store in 2 bytes
-        if (bitmap_size > 248)
+// copy len bytes starting at pos of the content stored in the extent at start, skipping block headers.
+// the blocks are read in runs of up to READAHEAD_MAX_BLOCKS with one read() each. Header-free
+// extents are byte-contiguous, so whole blocks are read straight into dst
+int readExtent(int start, int pos, int len, unsigned char *dst)
+{
+    static unsigned char run[READAHEAD_MAX_BLOCKS * BLOCKSIZE];
+    while (len > 0)
+    {
+        int first = pos / dataPayload;
+        int blocks = dataBlocks(pos % dataPayload + len);
+        if (blocks > READAHEAD_MAX_BLOCKS)
         {
-            fprintf(stderr, "Error: Disk size too large to fit on superblock.\n");
-            closeDisk(disk);
-            return -123; // make an error code
+            blocks = READAHEAD_MAX_BLOCKS;
+        }
+        int direct = dataHeader == 0 && pos % BLOCKSIZE == 0 && len >= blocks * BLOCKSIZE;
+        unsigned char *target = direct ? dst : run;
+        if (bufferedReadRun(disk, start + first, blocks, target) == -1)
+        {
+            fprintf(stderr, "Error: Unable to read file content from disk.\n");
+            return DISK_READ_ERROR;
+        }
+        for (int b = 0; b < blocks && dataHeader == 0; b++)
+        {
+            if (verifyBlockChecksum(start + first + b, target + b * BLOCKSIZE) < 0)
+            {
+                return CHECKSUM_ERROR;
+            }
+        }
+        if (dataHeader == 0)
+        {
+            int count = blocks * BLOCKSIZE - pos % BLOCKSIZE < len ? blocks * BLOCKSIZE - pos % BLOCKSIZE : len;
+            if (!direct)
+            {
+                memcpy(dst, run + pos % BLOCKSIZE, count);
+            }
+            dst += count;
+            pos += count;
+            len -= count;
+            continue;
+        }
+        for (int b = 0; b < blocks && len > 0; b++)
+        {
+            unsigned char *fileContent = run + b * BLOCKSIZE;
+            if (verifyBlockChecksum(start + first + b, fileContent) < 0)
+            {
+                return CHECKSUM_ERROR;
+            }
+            int within = pos % dataPayload;
+            int count = dataPayload - within < len ? dataPayload - within : len;
+            memcpy(dst, fileContent + dataHeader + within, count);
+            dst += count;
+            pos += count;
+            len -= count;
+        }
+    }
+    return 1;
+}
+
+// make sure block, part of the extent of an uncompressed file or a run of a sparse one, is in the
+// file's readahead buffer. end is the block after the extent or run, reads never go past it.
+// A miss that lands right where the buffer ended means the file is being streamed, so the window
+// doubles (up to READAHEAD_MAX_BLOCKS) and a long scan is read in ever larger runs, one read() each.
+// TFS_ADVICE_RANDOM keeps the window at one block, TFS_ADVICE_NOREUSE drops the run read before
+// from the page cache
+int fillReadahead(FileEntry *file, int block, int end)
+{
+    if (block >= file->ra_start && block < file->ra_start + file->ra_count)
+    {
+        return 1;
+    }
+    if (file->readahead == NULL)
+    {
+        file->readahead = (unsigned char *)poolAlloc(&readaheadPool);
+        if (file->readahead == NULL)
+        {
+            return READ_ERROR;
+        }
+    }
+    if (file->advice == TFS_ADVICE_NOREUSE && file->ra_count > 0)
+    {
+        adviseDisk(disk, file->ra_start, file->ra_count, POSIX_FADV_DONTNEED);
+    }
+    if (file->ra_count > 0 && block == file->ra_start + file->ra_count && file->ra_window < READAHEAD_MAX_BLOCKS && file->advice != TFS_ADVICE_RANDOM)
+    {
+        file->ra_window *= 2;
+    }
+    int count = end - block < file->ra_window ? end - block : file->ra_window;
+    file->ra_count = 0;
+    if (bufferedReadRun(disk, block, count, file->readahead) == -1)
+    {
+        fprintf(stderr, "Error: Unable to read file content from disk.\n");
+        return DISK_READ_ERROR;
+    }
+    for (int b = 0; b < count; b++)
+    {
+        if (verifyBlockChecksum(block + b, file->readahead + b * BLOCKSIZE) < 0)
+        {
+            return CHECKSUM_ERROR;
+        }
+    }
+    file->ra_start = block;
+    file->ra_count = count;
+    return 1;
+}
+
+// pass posix_fadvise advice for bytes offset to offset + len - 1 of a file on to the blocks holding
+// them. Compressed and deduplicated content does not map byte for byte, their whole extent is advised
+void adviseRange(FileEntry *file, int offset, int len, int advice)
+{
+    Inode *inode = file->inode;
+    if (len <= 0 || offset >= inode->file_size)
+    {
+        return;
+    }
+    int first = offset / dataPayload;
+    int last = (offset + len < inode->file_size ? offset + len - 1 : inode->file_size - 1) / dataPayload;
+    if (inode->flags & INODE_SPARSE)
+    {
+        for (int r = 0; r < inode->run_count; r++)
+        {
+            SparseRun *run = &inode->runs[r];
+            int lo = first > run->logical ? first : run->logical;
+            int hi = last < run->logical + run->length - 1 ? last : run->logical + run->length - 1;
+            if (!run->unwritten && lo <= hi)
+            {
+                adviseDisk(disk, run->physical + lo - run->logical, hi - lo + 1, advice);
+            }
+        }
+        return;
+    }
+    int blocks = dataBlocks(inode->stored_size);
+    if (inode->flags & (INODE_COMPRESSED | INODE_DEDUP))
+    {
+        first = 0;
+        last = blocks - 1;
+    }
+    last = last < blocks - 1 ? last : blocks - 1;
+    if (inode->file_index != 0 && first <= last)
+    {
+        adviseDisk(disk, inode->file_index + first, last - first + 1, advice);
+    }
+}
+
+// decompress one chunk of a compressed file into its chunk cache
+int loadChunk(FileEntry *file, int chunk)
+{
+    unsigned char header[2 + 2 * MAX_COMPRESS_CHUNKS];
+    unsigned char packed[COMPRESS_CHUNK_SIZE];
+    int header_len = file->inode->stored_size < (int)sizeof(header) ? file->inode->stored_size : (int)sizeof(header);
+    int result = readExtent(file->inode->file_index, 0, header_len, header);
+    if (result < 0)
+    {
+        return result;
+    }
+    int chunks = (header[0] << 8) | header[1];
+    if (chunk >= chunks || chunks > MAX_COMPRESS_CHUNKS)
+    {
+        fprintf(stderr, "Error: Corrupt compressed file header.\n");
+        return READ_ERROR;
+    }
+    int pos = 2 + chunks * 2;
+    for (int c = 0; c < chunk; c++)
+    {
+        pos += ((header[2 + c * 2] << 8) | header[3 + c * 2]) & 0x7FFF;
+    }
+    int entry = (header[2 + chunk * 2] << 8) | header[3 + chunk * 2];
+    int stored = entry & 0x7FFF;
+    int expected = file->inode->file_size - chunk * COMPRESS_CHUNK_SIZE;
+    if (expected > COMPRESS_CHUNK_SIZE)
+    {
+        expected = COMPRESS_CHUNK_SIZE;
+    }
+    if (file->chunk_cache == NULL)
+    {
+        file->chunk_cache = (unsigned char *)poolAlloc(&chunkCachePool);
+        if (file->chunk_cache == NULL)
+        {
+            return READ_ERROR;
+        }
+    }
+    file->cached_chunk = -1;
+    if (stored > COMPRESS_CHUNK_SIZE || pos + stored > file->inode->stored_size)
+    {
+        fprintf(stderr, "Error: Corrupt compressed file header.\n");
+        return READ_ERROR;
+    }
+    if (entry & 0x8000)
+    {
+        result = readExtent(file->inode->file_index, pos, stored, file->chunk_cache);
+        if (result < 0)
+        {
+            return result;
+        }
+        if (stored != expected)
+        {
+            return READ_ERROR;
+        }
+    }
+    else
+    {
+        result = readExtent(file->inode->file_index, pos, stored, packed);
+        if (result < 0)
+        {
+            return result;
+        }
+        if (lz_decompress(packed, stored, file->chunk_cache, COMPRESS_CHUNK_SIZE) != expected)
+        {
+            fprintf(stderr, "Error: Unable to decompress chunk %d.\n", chunk);
+            return READ_ERROR;
+        }
+    }
+    file->cached_chunk = chunk;
+    return 1;
+}
+
+// Quotas
+// read the quota table of the mounted image, it is one block and every allocation needs it
+int loadQuotaTable(void)
+{
+    unsigned char table[BLOCKSIZE];
+    if (bufferedRead(disk, quotaBlock, table) == -1 || table[0] != QUOTA_TABLE || !regionValid(table))
+    {
+        fprintf(stderr, "Error: Unable to read the quota table.\n");
+        return DISK_READ_ERROR;
+    }
+    for (int i = 0; i < QUOTA_MAX_OWNERS; i++)
+    {
+        unsigned char *raw = table + 4 + i * QUOTA_ENTRY_SIZE;
+        quotaLimit[i] = (raw[0] << 8) | raw[1];
+        quotaUsed[i] = (raw[2] << 8) | raw[3];
+    }
+    quotaDirty = 0;
+    return 1;
+}
+
+int flushQuotaTable(void)
+{
+    unsigned char table[BLOCKSIZE];
+    if (quotaBlock == 0 || !quotaDirty)
+    {
+        return 1;
+    }
+    memset(table, 0, BLOCKSIZE);
+    table[0] = QUOTA_TABLE;
+    table[1] = MAGIC_NUMBER;
+    for (int i = 0; i < QUOTA_MAX_OWNERS; i++)
+    {
+        unsigned char *raw = table + 4 + i * QUOTA_ENTRY_SIZE;
+        raw[0] = (quotaLimit[i] >> 8) & 0xFF;
+        raw[1] = quotaLimit[i] & 0xFF;
+        raw[2] = (quotaUsed[i] >> 8) & 0xFF;
+        raw[3] = quotaUsed[i] & 0xFF;
+    }
+    if (mountedFeatures & FEATURE_REGION_CHECKS)
+    {
+        stampRegionCheck(table);
+    }
+    if (bufferedWrite(disk, quotaBlock, table) == -1)
+    {
+        fprintf(stderr, "Error: Unable to write the quota table.\n");
+        return WRITE_ERROR;
+    }
+    quotaDirty = 0;
+    return 1;
+}
+
+// move the usage of quotaOwner by blocks without looking at its limit. Used for blocks given back,
+// and for copies of blocks the same change frees again right after
+void adjustQuota(int blocks)
+{
+    if (quotaBlock == 0)
+    {
+        return;
+    }
+    quotaUsed[quotaOwner] += blocks;
+    if (quotaUsed[quotaOwner] < 0)
+    {
+        quotaUsed[quotaOwner] = 0;
+    }
+    quotaDirty = 1;
+}
+
+// QUOTA_ERROR if quotaOwner could not be charged blocks once it has given back released blocks.
+// Lets a rewrite refuse before it lets go of the content it replaces
+int checkQuota(int released, int blocks)
+{
+    if (quotaBlock == 0 || quotaLimit[quotaOwner] == 0)
+    {
+        return 1;
+    }
+    int used = quotaUsed[quotaOwner] > released ? quotaUsed[quotaOwner] - released : 0;
+    if (used + blocks > quotaLimit[quotaOwner])
+    {
+        fprintf(stderr, "Error: Owner %d would go over its quota of %d blocks.\n", quotaOwner, quotaLimit[quotaOwner]);
+        return QUOTA_ERROR;
+    }
+    return 1;
+}
+
+// charge blocks about to be allocated to quotaOwner, QUOTA_ERROR if that takes it past its limit.
+// Only the owner's counter is looked at, so the check costs the same however full the disk is
+int chargeQuota(int blocks)
+{
+    if (checkQuota(0, blocks) < 0)
+    {
+        return QUOTA_ERROR;
+    }
+    adjustQuota(blocks);
+    return 1;
+}
+
+// blocks a file is charged for, which releasing its content gives back
+int chargedBlocks(Inode *inode)
+{
+    if (!(inode->flags & INODE_SPARSE))
+    {
+        return dataBlocks(inode->stored_size);
+    }
+    int blocks = 0;
+    for (int r = 0; r < inode->run_count; r++)
+    {
+        blocks += inode->runs[r].length;
+    }
+    return blocks;
+}
+
+// take bytes from the token bucket of owner, sleeping off any debt at its rate. Owners without a
+// rate return at once
+void throttleIO(int owner, int bytes)
+{
+    Throttle *throttle = &throttles[owner];
+    if (throttle->rate == 0 || bytes <= 0)
+    {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - throttle->last.tv_sec) + (now.tv_nsec - throttle->last.tv_nsec) / 1e9;
+    throttle->tokens += elapsed * throttle->rate;
+    if (throttle->tokens > throttle->burst)
+    {
+        throttle->tokens = throttle->burst;
+    }
+    throttle->last = now;
+    throttle->tokens -= bytes;
+    if (throttle->tokens < 0)
+    {
+        // the refill on the next call counts the time slept here, which pays the debt back
+        double wait = -throttle->tokens / throttle->rate;
+        struct timespec pause = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+        nanosleep(&pause, NULL);
+    }
+}
+
+// rewrite the superblock fields that change while mounted: dedup index and quota table location,
+// features and bitmap. The quota counters are written with it so they match the bitmap on disk
+int writeSuperblock(void)
+{
+    unsigned char superblock[BLOCKSIZE];
+    if (bufferedRead(disk, 0, superblock) == -1)
+    {
+        fprintf(stderr, "Error: Unable to read superblock from disk.\n");
+        return DISK_READ_ERROR;
+    }
+    superblock[2] = (unsigned char)dedupIndexBlock;
+    superblock[3] = (unsigned char)mountedFeatures;
+    superblock[SNAPSHOT_LIST_LOC] = (unsigned char)snapshotList;
+    if (quotaBlock != 0)
+    {
+        superblock[QUOTA_TABLE_LOC] = (unsigned char)quotaBlock;
+    }
+    for (int i = 0; i < mountedBitmap->bitmap_size; i++)
+    {
+        superblock[i + 7] = mountedBitmap->free_blocks[i];
+    }
+    if (bufferedWrite(disk, 0, superblock) == -1)
+    {
+        fprintf(stderr, "Error: Unable to write superblock to disk.\n");
+        return WRITE_ERROR;
+    }
+    return flushQuotaTable();
+}
+
+// FNV-1a, used to find dedup candidates (matches are always confirmed byte for byte)
+uint64_t contentHash(unsigned char *data, int size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// read the dedup index of the mounted image the first time it is needed
+int loadDedupIndex(void)
+{
+    unsigned char indexBlock[BLOCKSIZE];
+    if (dedupLoaded || dedupIndexBlock == 0)
+    {
+        return 1;
+    }
+    for (int b = 0; b < DEDUP_INDEX_BLOCKS; b++)
+    {
+        if (bufferedRead(disk, dedupIndexBlock + b, indexBlock) == -1 || indexBlock[0] != DEDUP_INDEX ||
+            !regionValid(indexBlock))
+        {
+            fprintf(stderr, "Error: Unable to read dedup index block %d.\n", b);
+            return DISK_READ_ERROR;
+        }
+        for (int i = 0; i < DEDUP_ENTRIES_PER_BLOCK; i++)
+        {
+            unsigned char *raw = indexBlock + 4 + i * DEDUP_ENTRY_SIZE;
+            DedupEntry *entry = &dedupIndex[b * DEDUP_ENTRIES_PER_BLOCK + i];
+            entry->hash = 0;
+            for (int j = 7; j >= 0; j--)
+            {
+                entry->hash = (entry->hash << 8) | raw[j];
+            }
+            entry->start = (raw[8] << 8) | raw[9];
+            entry->stored_size = (raw[10] << 8) | raw[11];
+            entry->refs = (raw[12] << 8) | raw[13];
+        }
+        dedupDirty[b] = 0;
+    }
+    dedupLoaded = 1;
+    return 1;
+}
+
+int flushDedupIndex(void)
+{
+    unsigned char indexBlock[BLOCKSIZE];
+    if (dedupIndexBlock == 0)
+    {
+        return 1;
+    }
+    for (int b = 0; b < DEDUP_INDEX_BLOCKS; b++)
+    {
+        if (!dedupDirty[b])
+        {
+            continue;
+        }
+        memset(indexBlock, 0, BLOCKSIZE);
+        indexBlock[0] = DEDUP_INDEX;
+        indexBlock[1] = MAGIC_NUMBER;
+        for (int i = 0; i < DEDUP_ENTRIES_PER_BLOCK; i++)
+        {
+            unsigned char *raw = indexBlock + 4 + i * DEDUP_ENTRY_SIZE;
+            DedupEntry *entry = &dedupIndex[b * DEDUP_ENTRIES_PER_BLOCK + i];
+            for (int j = 0; j < 8; j++)
+            {
+                raw[j] = (entry->hash >> (8 * j)) & 0xFF;
+            }
+            raw[8] = (entry->start >> 8) & 0xFF;
+            raw[9] = entry->start & 0xFF;
+            raw[10] = (entry->stored_size >> 8) & 0xFF;
+            raw[11] = entry->stored_size & 0xFF;
+            raw[12] = (entry->refs >> 8) & 0xFF;
+            raw[13] = entry->refs & 0xFF;
+        }
+        if (mountedFeatures & FEATURE_REGION_CHECKS)
+        {
+            stampRegionCheck(indexBlock);
+        }
+        if (bufferedWrite(disk, dedupIndexBlock + b, indexBlock) == -1)
+        {
+            fprintf(stderr, "Error: Unable to write dedup index block %d.\n", b);
+            return WRITE_ERROR;
+        }
+        dedupDirty[b] = 0;
+    }
+    return 1;
+}
+
+// compare the content stored in an extent with data, block by block
+int extentMatches(int start, char *data, int size)
+{
+    unsigned char block[BLOCKSIZE];
+    for (int pos = 0; pos < size; pos += dataPayload)
+    {
+        int count = size - pos < dataPayload ? size - pos : dataPayload;
+        if (bufferedRead(disk, start + pos / dataPayload, block) == -1 || verifyBlockChecksum(start + pos / dataPayload, block) < 0)
+        {
+            return 0;
+        }
+        if (memcmp(block + dataHeader, data + pos, count) != 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// find an indexed extent holding exactly this content, returns its slot or -1
+int findDedupContent(char *data, int size, uint64_t hash)
+{
+    if (loadDedupIndex() < 0)
+    {
+        return -1;
+    }
+    for (int i = 0; i < DEDUP_INDEX_BLOCKS * DEDUP_ENTRIES_PER_BLOCK; i++)
+    {
+        DedupEntry *entry = &dedupIndex[i];
+        if (entry->start != 0 && entry->hash == hash && entry->stored_size == size && extentMatches(entry->start, data, size))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// index a freshly written extent with one reference, returns its slot or -1 when the index is full
+int addDedupEntry(uint64_t hash, int start, int size)
+{
+    if (loadDedupIndex() < 0)
+    {
+        return -1;
+    }
+    for (int i = 0; i < DEDUP_INDEX_BLOCKS * DEDUP_ENTRIES_PER_BLOCK; i++)
+    {
+        if (dedupIndex[i].start == 0)
+        {
+            dedupIndex[i].hash = hash;
+            dedupIndex[i].start = start;
+            dedupIndex[i].stored_size = size;
+            dedupIndex[i].refs = 1;
+            dedupDirty[i / DEDUP_ENTRIES_PER_BLOCK] = 1;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// rebuild the set of blocks held by any snapshot from the snapshot records
+int loadPinnedBitmap(void)
+{
+    unsigned char record[BLOCKSIZE];
+    free_bitmap(pinnedBitmap);
+    pinnedBitmap = NULL;
+    pinnedLoaded = 1;
+    if (snapshotList == 0)
+    {
+        return 1;
+    }
+    pinnedBitmap = create_bitmap(mountedBitmap->bitmap_size, mountedBitmap->num_blocks, NULL);
+    if (pinnedBitmap == NULL)
+    {
+        return READ_ERROR;
+    }
+    for (int current = snapshotList; current != 0; current = record[2])
+    {
+        if (bufferedRead(disk, current, record) == -1 || record[0] != SNAPSHOT)
+        {
+            fprintf(stderr, "Error: Unable to read snapshot record %d.\n", current);
+            // without the full set no block is safe to reuse
+            memset(pinnedBitmap->free_blocks, 0, pinnedBitmap->bitmap_size);
+            return DISK_READ_ERROR;
+        }
+        for (int i = 0; i < pinnedBitmap->bitmap_size; i++)
+        {
+            pinnedBitmap->free_blocks[i] &= record[SNAPSHOT_BITMAP_LOC + i];
+        }
+    }
+    return 1;
+}
+
+// blocks held by snapshots, read from the snapshot records the first time something is allocated or freed
+Bitmap *pinnedBlocks(void)
+{
+    if (!pinnedLoaded)
+    {
+        loadPinnedBitmap();
+    }
+    return pinnedBitmap;
+}
+
+// give count blocks starting at start back to the live bitmap, scrubbing the ones no snapshot holds
+int releaseBlocks(int start, int count)
+{
+    Bitmap *pinned = pinnedBlocks();
+    char freeBlock[BLOCKSIZE];
+    freeBlock[0] = 0x04;
+    freeBlock[1] = 0x44;
+    for (int i = 2; i < BLOCKSIZE; i++)
+    {
+        freeBlock[i] = 0x00;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        // a snapshot may still read this block, so only the live bitmap lets go of it
+        if (pinned == NULL || is_block_free(pinned, start + i))
+        {
+            if (bufferedWrite(disk, start + i, freeBlock) == -1)
+            {
+                fprintf(stderr, "Error: Unable to write free block to disk.\n");
+                closeDisk(disk);
+                return WRITE_ERROR;
+            }
+            if (setBlockChecksum(start + i, NULL) < 0)
+            {
+                return DISK_READ_ERROR;
+            }
+        }
+        free_block(mountedBitmap, start + i);
+    }
+    adjustQuota(-count);
+    return 1;
+}
+
+// drop a file's claim on its extent, the blocks are only scrubbed and freed once nothing else uses them
+int releaseExtent(int start, int stored_size, int flags)
+{
+    if (flags & INODE_DEDUP)
+    {
+        int result = loadDedupIndex();
+        if (result < 0)
+        {
+            return result;
+        }
+        for (int i = 0; i < DEDUP_INDEX_BLOCKS * DEDUP_ENTRIES_PER_BLOCK; i++)
+        {
+            if (dedupIndex[i].start == start)
+            {
+                dedupDirty[i / DEDUP_ENTRIES_PER_BLOCK] = 1;
+                if (--dedupIndex[i].refs > 0)
+                {
+                    // still shared, leave the blocks alone. Each file was charged for them
+                    adjustQuota(-dataBlocks(stored_size));
+                    return 1;
+                }
+                memset(&dedupIndex[i], 0, sizeof(DedupEntry));
+                break;
+            }
+        }
+    }
+
+    return releaseBlocks(start, dataBlocks(stored_size));
+}
+
+// first block of a free run for an extent of num_blocks, -2 if there is none. inode[2] keeps the
+// first block in one byte, and so does the link to the next block in a block header, so the run
+// has to start below block 256, and on images with headers also end there
+int findExtentRun(int num_blocks)
+{
+    int limit = dataHeader > 0 ? 257 - num_blocks : 256;
+    if (limit <= 0)
+    {
+        return -2;
+    }
+    return find_free_run_below(mountedBitmap, pinnedBlocks(), num_blocks, limit);
+}
+
+// allocate a contiguous run for stored_size bytes and write them with linked block headers,
+// or as bare content on header-free images. Returns the first block of the run
+int writeExtent(char *data, int stored_size)
+{
+    // find free blocks for new data for file
+    int num_blocks = dataBlocks(stored_size);
+    if (num_blocks == 0)
+    {
+        return 0; // empty files have no extent
+    }
+    if (chargeQuota(num_blocks) < 0)
+    {
+        return QUOTA_ERROR;
+    }
+    int free_block = findExtentRun(num_blocks);
+    if (free_block == -2)
+    {
+        fprintf(stderr, "Error: No free blocks available.\n");
+        adjustQuota(-num_blocks);
+        return FREE_BLOCK_ERROR;
+    }
+    for (int i = 0; i < num_blocks; i++)
+    {
+        allocate_block(mountedBitmap, free_block + i);
+    }
+    unsigned char fileContent[BLOCKSIZE];
+
+    // write the data (which is 4 less than blocksize when 4 bytes are used for metadata)
+    int i;
+    int remaining_size = stored_size;
+    int chunk_size = dataPayload;
+    int offset = dataHeader;
+    
+    // calculate the block number of next block to link blocks in a file system
+    int next_block = free_block + 1;
+    int blocks_written = 0;
+    while (remaining_size > 0)
+    {
+        int current_chunk_size = (remaining_size < chunk_size) ? remaining_size : chunk_size;
+        // printf("current chunk size is %d\n", current_chunk_size);
+        for (i = 0; i < current_chunk_size; i++)
+        {
+            fileContent[offset + i] = data[i];
+        }
+        data += current_chunk_size;
+        remaining_size -= current_chunk_size;
+        // printf("remaining size is %d\n", remaining_size);
+
+        // Fill the remaining space in the block with 0x00 if current_chunk_size is less than a full block
+        if (current_chunk_size < chunk_size)
+        {
+            for (i = current_chunk_size; i < chunk_size; i++)
+            {
+                fileContent[offset + i] = 0x00;
+                // printf("i is %d\n", i+offset);
+            }
+        }
+        if (remaining_size != 0 && dataHeader > 0)
+        {
+            // set the link to next block for file data if there is still more data to be written
+            stampDataHeader(fileContent, next_block);
+        }
+        else
+        {
+            stampDataHeader(fileContent, 0);
+        }
+
+        // write the modified fileContent back to disk, giving the run and its charge back on failure
+        if (setBlockChecksum(free_block + blocks_written, fileContent) < 0)
+        {
+            releaseBlocks(free_block, num_blocks);
+            return DISK_READ_ERROR;
+        }
+        if (bufferedWrite(disk, free_block + blocks_written, fileContent) == -1)
+        {
+            fprintf(stderr, "Error: Unable to write file content to disk.\n");
+            releaseBlocks(free_block, num_blocks);
+            closeDisk(disk);
+            return WRITE_ERROR;
+        }
+        blocks_written++;
+        next_block++;
+        // Print the block data written in bytes
+        // printf("Block %d data written: ", blocks_written++);
+        // for (i = 0; i < BLOCKSIZE; i++)
+        // {
+        //     printf("%02x ", fileContent[i]);
+        // }
+        // printf("\n");
+    }
+    return free_block;
+}
+
+// Sparse files
+#define MAP_UNWRITTEN 0x10000 // block map entry of a block reserved but not written yet
+
+// the disk block holding logical block of a sparse file, 0 for a hole or an unwritten block.
+// *end is set to the block right after the run it is in
+int sparseBlock(Inode *inode, int logical, int *end)
+{
+    for (int r = 0; r < inode->run_count; r++)
+    {
+        SparseRun *run = &inode->runs[r];
+        if (logical >= run->logical && logical < run->logical + run->length && !run->unwritten)
+        {
+            *end = run->physical + run->length;
+            return run->physical + logical - run->logical;
+        }
+    }
+    return 0;
+}
+
+// expand the runs of a sparse file into the disk block of every file block, 0 for holes and
+// MAP_UNWRITTEN added for unwritten blocks
+void expandSparseMap(Inode *inode, int *map)
+{
+    memset(map, 0, MAX_FILE_BLOCKS * sizeof(int));
+    for (int r = 0; r < inode->run_count; r++)
+    {
+        for (int b = 0; b < inode->runs[r].length; b++)
+        {
+            map[inode->runs[r].logical + b] = (inode->runs[r].physical + b) | (inode->runs[r].unwritten ? MAP_UNWRITTEN : 0);
+        }
+    }
+}
+
+// turn a block map back into runs, SPARSE_MAP_FULL_ERROR if they do not fit in the inode
+int packSparseMap(int *map, SparseRun *runs)
+{
+    int count = 0;
+    for (int l = 0; l < MAX_FILE_BLOCKS; l++)
+    {
+        if (map[l] == 0)
+        {
+            continue;
+        }
+        int physical = map[l] & ~MAP_UNWRITTEN;
+        int unwritten = (map[l] & MAP_UNWRITTEN) != 0;
+        SparseRun *run = count > 0 ? &runs[count - 1] : NULL;
+        if (run != NULL && run->logical + run->length == l && run->physical + run->length == physical &&
+            run->unwritten == unwritten && run->length < 255)
+        {
+            run->length++;
+            continue;
+        }
+        if (count == SPARSE_MAX_RUNS)
+        {
+            return SPARSE_MAP_FULL_ERROR;
+        }
+        runs[count].logical = (unsigned short)l;
+        runs[count].physical = (unsigned short)physical;
+        runs[count].length = 1;
+        runs[count].unwritten = (unsigned char)unwritten;
+        count++;
+    }
+    return count;
+}
+
+// 1 if count blocks from start are free in the live bitmap and held by no snapshot
+int blocksFree(int start, int count, Bitmap *pinned)
+{
+    if (start + count > mountedBitmap->num_blocks)
+    {
+        return 0;
+    }
+    for (int b = start; b < start + count; b++)
+    {
+        if (!is_block_free(mountedBitmap, b) || (pinned != NULL && !is_block_free(pinned, b)))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int allZero(const char *data, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        if (data[i] != 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// write size bytes at offset into a sparse file. File blocks that would only receive zeros stay
+// holes, or unwritten, unless dense is set. A block a snapshot still holds is copied to a new
+// block before it changes. New blocks for neighbouring file blocks are allocated as one run, right after the
+// block before them when that is free, so a file filled in order stays one run. The blocks a write
+// replaces are released only once the inode maps the new ones, so a failure leaves the old mapping
+int writeSparse(FileEntry *file, int offset, const char *data, int size, int dense)
+{
+    static int map[MAX_FILE_BLOCKS];
+    static int next[MAX_FILE_BLOCKS];
+    static unsigned char edges[2][BLOCKSIZE]; // old content of a partial first and last block
+    Inode *inode = file->inode;
+    if (size <= 0)
+    {
+        return 1;
+    }
+    int first = offset / dataPayload;
+    int last = (offset + size - 1) / dataPayload;
+    expandSparseMap(inode, map);
+    memcpy(next, map, sizeof(next));
+    Bitmap *pinned = pinnedBlocks();
+    for (int l = first; l <= last; l++)
+    {
+        int lo = l == first ? offset % dataPayload : 0;
+        int hi = l == last ? (offset + size - 1) % dataPayload + 1 : dataPayload;
+        int zeros = !dense && allZero(data + l * dataPayload + lo - offset, hi - lo);
+        if (map[l] == 0)
+        {
+            next[l] = zeros ? 0 : -1;
+        }
+        else if ((map[l] & MAP_UNWRITTEN) && zeros)
+        {
+            continue; // stays unwritten
+        }
+        else if (pinned != NULL && !is_block_free(pinned, map[l] & ~MAP_UNWRITTEN))
+        {
+            next[l] = -1;
+        }
+        else if (map[l] & MAP_UNWRITTEN)
+        {
+            next[l] = map[l] & ~MAP_UNWRITTEN; // reserved, written in place
+        }
+    }
+
+    // the rest of a partial first or last block is read and checked before anything is allocated
+    for (int e = 0; e < 2; e++)
+    {
+        int l = e == 0 ? first : last;
+        int lo = l == first ? offset % dataPayload : 0;
+        int hi = l == last ? (offset + size - 1) % dataPayload + 1 : dataPayload;
+        memset(edges[e], 0, BLOCKSIZE);
+        if (map[l] != 0 && !(map[l] & MAP_UNWRITTEN) && (lo > 0 || hi < dataPayload))
+        {
+            if (bufferedRead(disk, map[l], edges[e]) == -1)
+            {
+                fprintf(stderr, "Error: Unable to read file content from disk.\n");
+                return DISK_READ_ERROR;
+            }
+            if (verifyBlockChecksum(map[l], edges[e]) < 0)
+            {
+                return CHECKSUM_ERROR;
+            }
+        }
+    }
+
+    // new blocks count against the quota, copies of blocks a snapshot holds replace them
+    int fresh = 0;
+    int copies = 0;
+    for (int l = first; l <= last; l++)
+    {
+        fresh += next[l] == -1 && map[l] == 0;
+        copies += next[l] == -1 && map[l] != 0;
+    }
+    if (chargeQuota(fresh) < 0)
+    {
+        return QUOTA_ERROR;
+    }
+    adjustQuota(copies);
+    int result = 1;
+    for (int l = first; l <= last; l++)
+    {
+        if (next[l] != -1)
+        {
+            continue;
+        }
+        int span = 1;
+        while (l + span <= last && next[l + span] == -1)
+        {
+            span++;
+        }
+        int start = -2;
+        int before = l > 0 && next[l - 1] > 0 ? (next[l - 1] & ~MAP_UNWRITTEN) + 1 : 0;
+        if (before > 0 && blocksFree(before, span, pinned))
+        {
+            start = before;
+        }
+        else
+        {
+            start = find_free_run(mountedBitmap, pinned, span);
+            if (start == -2 && span > 1)
+            {
+                // no room for the whole span, take what is free one block at a time
+                span = 1;
+                start = find_free_run(mountedBitmap, pinned, 1);
+            }
+        }
+        if (start == -2)
+        {
+            fprintf(stderr, "Error: No free blocks available.\n");
+            result = FREE_BLOCK_ERROR;
+            break;
+        }
+        for (int b = 0; b < span; b++)
+        {
+            allocate_block(mountedBitmap, start + b);
+            next[l + b] = start + b;
+        }
+        l += span - 1;
+    }
+    SparseRun runs[SPARSE_MAX_RUNS];
+    int count = 0;
+    if (result > 0)
+    {
+        // the runs have to fit in the inode before anything is written
+        for (int l = first; l <= last; l++)
+        {
+            if (next[l] < 0)
+            {
+                next[l] = 0;
+            }
+        }
+        count = packSparseMap(next, runs);
+        if (count < 0)
+        {
+            fprintf(stderr, "Error: File is too fragmented for its block map.\n");
+            result = count;
+        }
+    }
+    unsigned char block[BLOCKSIZE];
+    for (int l = first; l <= last && result > 0; l++)
+    {
+        if (next[l] == 0 || (next[l] & MAP_UNWRITTEN))
+        {
+            continue; // only zeros were written into this hole or unwritten block
+        }
+        int lo = l == first ? offset % dataPayload : 0;
+        int hi = l == last ? (offset + size - 1) % dataPayload + 1 : dataPayload;
+        if (l == first || l == last)
+        {
+            memcpy(block, edges[l == first ? 0 : 1], BLOCKSIZE);
+        }
+        else
+        {
+            memset(block, 0, BLOCKSIZE);
+        }
+        // sparse blocks are found through the run list, they are not linked
+        stampDataHeader(block, 0);
+        memcpy(block + dataHeader + lo, data + l * dataPayload + lo - offset, hi - lo);
+        result = setBlockChecksum(next[l], block);
+        if (result > 0 && bufferedWrite(disk, next[l], block) == -1)
+        {
+            fprintf(stderr, "Error: Unable to write file content to disk.\n");
+            result = WRITE_ERROR;
+        }
+    }
+    if (result < 0)
+    {
+        for (int l = first; l <= last; l++)
+        {
+            if (next[l] > 0 && next[l] != (map[l] & ~MAP_UNWRITTEN) && next[l] != map[l])
+            {
+                free_block(mountedBitmap, next[l]);
+            }
+        }
+        adjustQuota(-fresh - copies);
+        return result;
+    }
+
+    memcpy(inode->runs, runs, count * sizeof(SparseRun));
+    inode->run_count = count;
+    if (offset + size > inode->file_size)
+    {
+        inode->file_size = offset + size;
+    }
+    inode->dirty = 1;
+    file->ra_count = 0;
+    for (int l = first; l <= last; l++)
+    {
+        int old = map[l] & ~MAP_UNWRITTEN;
+        if (old != 0 && next[l] != old)
+        {
+            result = releaseBlocks(old, 1);
+            if (result < 0)
+            {
+                return result;
+            }
+        }
+    }
+    return flushChecksumTable() < 0 ? WRITE_ERROR : 1;
+}
+
+// free every block mapped by a sparse file
+int releaseSparse(Inode *inode)
+{
+    for (int r = 0; r < inode->run_count; r++)
+    {
+        int result = releaseBlocks(inode->runs[r].physical, inode->runs[r].length);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+    inode->run_count = 0;
+    return 1;
+}
+
+// switch an open file to the sparse layout. A plain extent already is a run of blocks and is
+// listed as it is, compressed or deduplicated content is written out again as a private copy
+int makeSparse(FileEntry *file)
+{
+    static int map[MAX_FILE_BLOCKS];
+    static unsigned char content[65535];
+    Inode *inode = file->inode;
+    if (inode->flags & INODE_SPARSE)
+    {
+        return 1;
+    }
+    if (!(inode->flags & (INODE_COMPRESSED | INODE_DEDUP)))
+    {
+        int blocks = dataBlocks(inode->stored_size);
+        memset(map, 0, sizeof(map));
+        for (int b = 0; b < blocks; b++)
+        {
+            map[b] = inode->file_index + b;
+        }
+        inode->run_count = packSparseMap(map, inode->runs);
+        inode->flags = INODE_SPARSE;
+        inode->file_index = 0;
+        inode->stored_size = 0;
+        inode->dirty = 1;
+        return 1;
+    }
+    int size = inode->file_size;
+    int result = 1;
+    if (inode->flags & INODE_COMPRESSED)
+    {
+        for (int c = 0; c * COMPRESS_CHUNK_SIZE < size; c++)
+        {
+            result = loadChunk(file, c);
+            if (result < 0)
+            {
+                return result;
+            }
+            int len = size - c * COMPRESS_CHUNK_SIZE < COMPRESS_CHUNK_SIZE ? size - c * COMPRESS_CHUNK_SIZE : COMPRESS_CHUNK_SIZE;
+            memcpy(content + c * COMPRESS_CHUNK_SIZE, file->chunk_cache, len);
+        }
+    }
+    else
+    {
+        result = readExtent(inode->file_index, 0, size, content);
+    }
+    if (result < 0)
+    {
+        return result;
+    }
+    // the copy is written before the old extent is let go, so a write that fails for want of
+    // space or quota leaves the file as it was. The owner is not charged for both at once
+    int file_index = inode->file_index;
+    int stored_size = inode->stored_size;
+    int flags = inode->flags;
+    inode->flags = INODE_SPARSE;
+    inode->file_index = 0;
+    inode->stored_size = 0;
+    inode->run_count = 0;
+    adjustQuota(-dataBlocks(stored_size));
+    result = writeSparse(file, 0, (char *)content, size, 1);
+    adjustQuota(dataBlocks(stored_size));
+    if (result < 0)
+    {
+        inode->flags = flags;
+        inode->file_index = file_index;
+        inode->stored_size = stored_size;
+        inode->run_count = 0;
+        return result;
+    }
+    file->cached_chunk = -1;
+    inode->dirty = 1;
+    result = releaseExtent(file_index, stored_size, flags);
+    if (result < 0)
+    {
+        return result;
+    }
+    return flushDedupIndex() < 0 ? WRITE_ERROR : 1;
+}
+
+// replace the content of a preallocated file without giving up its blocks. Blocks past the new
+// end become unwritten again and the rest of the new last block is cleared, so nothing of the
+// old content shows if the file grows later
+int rewriteReserved(FileEntry *file, char *buffer, int size)
+{
+    static int map[MAX_FILE_BLOCKS];
+    static char zeros[BLOCKSIZE];
+    Inode *inode = file->inode;
+    int old_size = inode->file_size;
+    file->cached_chunk = -1;
+    int result = writeSparse(file, 0, buffer, size, 0);
+    if (result >= 0 && size < old_size && size % dataPayload != 0)
+    {
+        int tail = dataPayload - size % dataPayload;
+        result = writeSparse(file, size, zeros, tail < old_size - size ? tail : old_size - size, 0);
+    }
+    if (result < 0)
+    {
+        return result;
+    }
+    expandSparseMap(inode, map);
+    for (int l = dataBlocks(size); l < MAX_FILE_BLOCKS; l++)
+    {
+        if (map[l] != 0)
+        {
+            map[l] |= MAP_UNWRITTEN;
+        }
+    }
+    SparseRun runs[SPARSE_MAX_RUNS];
+    int count = packSparseMap(map, runs);
+    if (count < 0)
+    {
+        // no room to list the unwritten part separately, the reservation past the end goes
+        for (int l = dataBlocks(size); l < MAX_FILE_BLOCKS; l++)
+        {
+            if (map[l] != 0 && releaseBlocks(map[l] & ~MAP_UNWRITTEN, 1) < 0)
+            {
+                return WRITE_ERROR;
+            }
+            map[l] = 0;
+        }
+        count = packSparseMap(map, runs);
+    }
+    memcpy(inode->runs, runs, count * sizeof(SparseRun));
+    inode->run_count = count;
+    inode->file_size = size;
+    inode->dirty = 1;
+    file->offset = 0;
+    file->ra_count = 0;
+    return flushChecksumTable() < 0 ? WRITE_ERROR : 1;
+}
+
+// walk the snapshot list for name, fills record and the block of the record before it (0 for the head)
+int findSnapshot(char *name, unsigned char *record, int *prev)
+{
+    int previous = 0;
+    int current = snapshotList;
+    while (current != 0)
+    {
+        if (bufferedRead(disk, current, record) == -1 || record[0] != SNAPSHOT)
+        {
+            fprintf(stderr, "Error: Unable to read snapshot record %d.\n", current);
+            return DISK_READ_ERROR;
+        }
+        if (strncmp((char *)record + 4, name, 8) == 0)
+        {
+            if (prev != NULL)
+            {
+                *prev = previous;
+            }
+            return current;
+        }
+        previous = current;
+        current = record[2];
+    }
+    return SNAPSHOT_NOT_FOUND_ERROR;
+}
+
+// grab one block for a snapshot copy, remembered in allocated so a failed snapshot can give it back.
+// copies are found through one byte pointers (inode[2]) so they have to sit below block 256
+int snapshotBlock(int *allocated, int *count)
+{
+    int block = find_free_run(mountedBitmap, pinnedBlocks(), 1);
+    if (block < 0 || block > 255)
+    {
+        fprintf(stderr, "Error: No free blocks available for the snapshot.\n");
+        return FREE_BLOCK_ERROR;
+    }
+    allocate_block(mountedBitmap, block);
+    allocated[(*count)++] = block;
+    return block;
+}
+
+// copy the directory stored in block dir and every inode below it, marking the copies and the
+// data extents they point at in held. Returns the block of the copied directory.
+int snapshotDirectory(int dir, Bitmap *held, int *allocated, int *count)
+{
+    unsigned char directory[BLOCKSIZE];
+    unsigned char inode[BLOCKSIZE];
+    if (bufferedRead(disk, dir, directory) == -1)
+    {
+        return DISK_READ_ERROR;
+    }
+    int copy_dir = snapshotBlock(allocated, count);
+    if (copy_dir < 0)
+    {
+        return copy_dir;
+    }
+    allocate_block(held, copy_dir);
+    for (int i = 4; i < 251; i += 2)
+    {
+        int value = (directory[i] << 8) | directory[i + 1];
+        if (value == 0)
+        {
+            continue;
+        }
+        int copy = snapshotBlock(allocated, count);
+        if (copy < 0)
+        {
+            return copy;
+        }
+        if (bufferedRead(disk, value, inode) == -1)
+        {
+            return DISK_READ_ERROR;
+        }
+        if (inode[3] & INODE_DIRECTORY)
+        {
+            int sub = snapshotDirectory(inode[2], held, allocated, count);
+            if (sub < 0)
+            {
+                return sub;
+            }
+            inode[2] = (unsigned char)sub;
+        }
+        else if (inode[3] & INODE_SPARSE)
+        {
+            SparseRun runs[SPARSE_MAX_RUNS];
+            int run_count = decodeSparseRuns(inode, runs);
+            for (int r = 0; r < run_count; r++)
+            {
+                for (int b = 0; b < runs[r].length; b++)
+                {
+                    allocate_block(held, runs[r].physical + b);
+                }
+            }
+        }
+        else
+        {
+            int stored_blocks = dataBlocks(inodeStoredSize(inode));
+            for (int b = 0; b < stored_blocks; b++)
+            {
+                allocate_block(held, inode[2] + b);
+            }
+        }
+        if (bufferedWrite(disk, copy, inode) == -1)
+        {
+            return WRITE_ERROR;
+        }
+        allocate_block(held, copy);
+        directory[i] = (copy >> 8) & 0xFF;
+        directory[i + 1] = copy & 0xFF;
+    }
+    if (bufferedWrite(disk, copy_dir, directory) == -1)
+    {
+        return WRITE_ERROR;
+    }
+    return copy_dir;
+}
+
+// free a directory copied by snapshotDirectory along with the inode copies below it
+int freeSnapshotDirectory(int dir, char *freeBlock)
+{
+    unsigned char directory[BLOCKSIZE];
+    unsigned char inode[BLOCKSIZE];
+    if (bufferedRead(disk, dir, directory) == -1)
+    {
+        return DISK_READ_ERROR;
+    }
+    for (int i = 4; i < 251; i += 2)
+    {
+        int value = (directory[i] << 8) | directory[i + 1];
+        if (value == 0)
+        {
+            continue;
+        }
+        if (bufferedRead(disk, value, inode) == -1)
+        {
+            return DISK_READ_ERROR;
+        }
+        if ((inode[3] & INODE_DIRECTORY) && freeSnapshotDirectory(inode[2], freeBlock) < 0)
+        {
+            return DISK_READ_ERROR;
+        }
+        bufferedWrite(disk, value, freeBlock);
+        free_block(mountedBitmap, value);
+    }
+    bufferedWrite(disk, dir, freeBlock);
+    free_block(mountedBitmap, dir);
+    return 1;
+}
+
+int tfs_mkfs(char *filename, int nBytes)
+{
+    /* Makes a blank TinyFS file system of size nBytes on the unix file
+    specified by ‘filename’. This function should use the emulated disk
+    library to open the specified unix file, and upon success, format the
+    file to be a mountable disk. This includes initializing all data to 0x00,
+    setting magic numbers, initializing and writing the superblock and
+    inodes, etc. Must return a specified success/error code. */
+
+    // blocks left behind by a disk closed on an error must not land on this one
+    dropWriteBuffer();
+    disk = openDiskFlags(filename, nBytes, directIO ? DISK_DIRECT : 0);
+    if (disk < 0)
+    {
+        fprintf(stderr, "Error: Unable to open disk file.\n");
+        return INVLD_BLK_SIZE;
+    }
+    else
+    {
+        unsigned char superblock[BLOCKSIZE];
+        superblock[0] = 0x01; // Set the first byte to 0x01
+        superblock[1] = 0x44; // Set the second byte to 0x44 (magic num)
+
+        // Set the remaining blocks to 0x00
+        for (int i = 2; i < BLOCKSIZE; i++)
+        {
+            superblock[i] = 0x00;
+        }
+
+        // we will not write superblock yet, because we want to add bitmap to it first
+        unsigned char rootDirectory[BLOCKSIZE];
+        rootDirectory[0] = 0x02; // Set the first byte to 0x02
+        rootDirectory[1] = 0x44; // Set the second byte to 0x44 (magic num)
+
+        for (int i = 2; i < BLOCKSIZE; i++)
+        {
+            rootDirectory[i] = 0x00;
+        }
+        // printf("Root Directory contents: ");
+        // for (int i = 0; i < BLOCKSIZE; i++)
+        // {
+        //     printf("%02x ", rootDirectory[i]);
+        // }
+        // printf("\n");
+
+        if (bufferedWrite(disk, 1, rootDirectory) == -1)
+        {
+            fprintf(stderr, "Error: Unable to write root directory to disk.\n");
+            closeDisk(disk);
+            return WRITE_ERROR;
+        }
+
+        unsigned char emptyBlock[BLOCKSIZE];
+        emptyBlock[0] = 0x04; // Set the first byte to 0x04
+        emptyBlock[1] = 0x44; // Set the second byte to 0x44 (magic num)
+
+        for (int i = 2; i < BLOCKSIZE; i++)
+        {
+            emptyBlock[i] = 0x00;
+        }
+
+        int num_blocks = nBytes / BLOCKSIZE;
+        for (int i = 2; i < num_blocks; i++)
+        {
+            if (bufferedWrite(disk, i, emptyBlock) == -1)
+            {
+                fprintf(stderr, "Error: Unable to write empty block to disk.\n");
+                closeDisk(disk);
+                return WRITE_ERROR;
+            }
+        }
+
+        int bitmap_size = (((nBytes / BLOCKSIZE) + 7) / 8);
+        Bitmap *bitmap = create_bitmap(bitmap_size, num_blocks, NULL);
+        // make sure num+blocks is less than max number of blocks we can store in 2 bytes
+        if (bitmap_size > 248)
+        {
+            fprintf(stderr, "Error: Disk size too large to fit on superblock.\n");
+            free_bitmap(bitmap);
+            closeDisk(disk);
+            return -123; // make an error code
+        }
+        if (num_blocks > 65535)
+        {
+            fprintf(stderr, "Error: Disk size too large.\n");
+            free_bitmap(bitmap);
+            closeDisk(disk);
+            return -123; // make an error code
+        }
+
+        // reserve the checksum table right after the root directory, every entry starts unset
+        int table_blocks = checksumTableSize(num_blocks);
+        if (CHECKSUM_TABLE_BLOCK + table_blocks > num_blocks)
+        {
+            fprintf(stderr, "Error: Disk too small for the checksum table.\n");
+            free_bitmap(bitmap);
+            closeDisk(disk);
+            return INVLD_BLK_SIZE;
+        }
+        unsigned char tableBlock[BLOCKSIZE];
+        memset(tableBlock, 0, BLOCKSIZE);
+        tableBlock[0] = CHECKSUM_TABLE;
+        tableBlock[1] = MAGIC_NUMBER;
+        stampRegionCheck(tableBlock);
+        for (int i = 0; i < table_blocks; i++)
+        {
+            if (bufferedWrite(disk, CHECKSUM_TABLE_BLOCK + i, tableBlock) == -1)
+            {
+                fprintf(stderr, "Error: Unable to write checksum table to disk.\n");
+                free_bitmap(bitmap);
+                closeDisk(disk);
+                return WRITE_ERROR;
+            }
+            allocate_block(bitmap, CHECKSUM_TABLE_BLOCK + i);
+        }
+        superblock[3] = FEATURE_CHECKSUMS | FEATURE_REGION_CHECKS | (rawDataFormat ? FEATURE_RAW_DATA : 0);
+
+        unsigned char *bitmap_data = bitmap->free_blocks;
+        superblock[4] = (unsigned char)bitmap_size;
+
+        // Split num_blocks into two bytes
+        unsigned char num_blocks_high_byte = (num_blocks >> 8) & 0xFF; // Most significant byte
+        unsigned char num_blocks_low_byte = num_blocks & 0xFF;         // Least significant byte
+
+        // Write the two bytes to superblock
+        superblock[5] = num_blocks_high_byte; // Write most significant byte to index 5
+        superblock[6] = num_blocks_low_byte;  // Write least significant byte to index 6
+
+        for (int i = 0; i < bitmap_size; i++)
+        {
+            // printf("writing bitmap data\n");
+            superblock[i + 7] = bitmap_data[i]; // Start writing from index 7 onwards
+            // printf("bitmap data is %d\n", bitmap_data[i]);
+        }
+        free_bitmap(bitmap);
+        // Print contents of superblock in bytes
+        // for (int i = 0; i < BLOCKSIZE; i++)
+        // {
+        //     printf("%02X ", superblock[i]);
+        // }
+        // printf("\n");
+        if (bufferedWrite(disk, 0, superblock) == -1)
+        {
+            fprintf(stderr, "Error: Unable to write superblock to disk.\n");
+            closeDisk(disk);
+            return WRITE_ERROR;
+        }
+
+        // the root directory was written before the empty blocks and they start at block 2
+        // printf("tfs create has all went through\n");
+        // make success code for mkfs
+        if (flushWriteBuffer(disk) == -1)
+        {
+            fprintf(stderr, "Error: Unable to write file system to disk.\n");
+            closeDisk(disk);
+            return WRITE_ERROR;
+        }
+        closeDisk(disk);
+        disk = -1;
+    }
+    return MKFS_SUCCESS;
+}
+
+// mount the live file system, or the snapshot called snapshotName read only
+int mountImage(char *diskname, char *snapshotName)
+{
+    // check if already mounted
+    if (mounted)
+    {
+        fprintf(stderr, "Error: File system already mounted.\n");
+        return MOUNTED_ERROR;
+    }
+
+    // whatever a failed mount left in the arena goes now
+    arenaReset(&mountArena);
+    dropWriteBuffer();
+    disk = openDiskFlags(diskname, 0, directIO ? DISK_DIRECT : 0);
+    if (disk < 0)
+    {
+        return DISK_ERROR;
+    }
+
+    unsigned char superblock_data[BLOCKSIZE];
+    if (bufferedRead(disk, 0, superblock_data) == -1)
+    {
+        fprintf(stderr, "Error: Unable to read superblock from disk.\n");
+        closeDisk(disk);
+        return DISK_READ_ERROR;
+    }
+
+    // check for magic number
+    if (superblock_data[1] != 0x44)
+    {
+        fprintf(stderr, "Error: Incorrect magic number. Not a TinyFS file system.\n");
+        closeDisk(disk);
+        return MAGIC_NUMBER_ERROR;
+    }
+
+    int bitmap_size = superblock_data[4];
+    int num_blocks = (superblock_data[5] << 8) | superblock_data[6];
+    // printf("bitmap size is %d\n", bitmap_size);
+    // printf("num blocks is %d\n", num_blocks);
+    unsigned char *bitmap_data = (unsigned char *)arenaAlloc(&mountArena, bitmap_size);
+
+    for (int i = 0; i < bitmap_size; i++)
+    {
+        bitmap_data[i] = superblock_data[i + 7];
+    }
+
+    rootBlock = 1;
+    readOnly = 0;
+    snapshotList = superblock_data[SNAPSHOT_LIST_LOC];
+    memset(dentryCache, 0, sizeof(dentryCache));
+    if (snapshotName != NULL)
+    {
+        // a snapshot is mounted through its frozen root directory and the blocks it holds
+        unsigned char record[BLOCKSIZE];
+        int record_block = findSnapshot(snapshotName, record, NULL);
+        if (record_block < 0)
+        {
+            fprintf(stderr, "Error: No snapshot named %s.\n", snapshotName);
+            closeDisk(disk);
+            return record_block;
+        }
+        rootBlock = (record[SNAPSHOT_ROOT_LOC] << 8) | record[SNAPSHOT_ROOT_LOC + 1];
+        for (int i = 0; i < bitmap_size; i++)
+        {
+            bitmap_data[i] = record[SNAPSHOT_BITMAP_LOC + i];
+        }
+        readOnly = 1;
+    }
+
+    Bitmap *bitmap = (Bitmap *)arenaAlloc(&mountArena, sizeof(Bitmap));
+    bitmap->bitmap_size = bitmap_size;
+    bitmap->num_blocks = num_blocks;
+    bitmap->free_blocks = bitmap_data;
+    mountedBitmap = bitmap;
+    mountedFeatures = superblock_data[3];
+    dataHeader = (mountedFeatures & FEATURE_RAW_DATA) ? 0 : 4;
+    dataPayload = BLOCKSIZE - dataHeader;
+    // only the superblock and the quota table are read here. Checksum table blocks, the dedup index
+    // and the snapshot records are read when first needed, like directories and inodes
+    if (mountedFeatures & FEATURE_CHECKSUMS)
+    {
+        int result = initChecksumTable(num_blocks);
+        if (result < 0)
+        {
+            closeDisk(disk);
+            return result;
+        }
+    }
+    dedupIndexBlock = 0;
+    dedupLoaded = 0;
+    if ((mountedFeatures & FEATURE_DEDUP) && !readOnly)
+    {
+        // shared extents have to be tracked even when this mount does not dedup new content
+        dedupIndexBlock = superblock_data[2];
+    }
+    quotaBlock = 0;
+    if ((mountedFeatures & FEATURE_QUOTAS) && !readOnly)
+    {
+        // usage is charged on every allocation, so the counters are kept in memory from the start
+        quotaBlock = superblock_data[QUOTA_TABLE_LOC];
+        int result = loadQuotaTable();
+        if (result < 0)
+        {
+            quotaBlock = 0;
+            closeDisk(disk);
+            return result;
+        }
+    }
+    free_bitmap(pinnedBitmap);
+    pinnedBitmap = NULL;
+    pinnedLoaded = readOnly; // a read only mount never allocates or frees
+    mounted = 1;
+    // printf("File system mounted successfully: %s\n", diskname);
+    currMountedFS = arenaStrdup(&mountArena, diskname);
+    return MOUNT_SUCCESS;
+}
+
+int tfs_mount(char *diskname)
+{
+    return mountImage(diskname, NULL);
+}
+
+int tfs_unmount(void)
+{    /* tfs_mount(char *diskname) “mounts” a TinyFS file system located within
+    ‘diskname’. tfs_unmount(void) “unmounts” the currently mounted file
+    system. As part of the mount operation, tfs_mount should verify the file
+    system is the correct type. In tinyFS, only one file system may be
+    mounted at a time. Use tfs_unmount to cleanly unmount the currently
+    mounted file system. Must return a specified success/error code. */
+
+    if (!mounted)
+    {
+        fprintf(stderr, "Error: No file system mounted.\n");
+        return MOUNTED_ERROR;
+    }
+    // persist the allocation state, it only lives in memory while mounted
+    if (!readOnly && (flushInodes() < 0 || writeSuperblock() < 0 || flushChecksumTable() < 0 || flushDedupIndex() < 0))
+    {
+        return WRITE_ERROR;
+    }
+    if (flushWriteBuffer(disk) == -1)
+    {
+        fprintf(stderr, "Error: Unable to write buffered blocks to disk.\n");
+        return WRITE_ERROR;
+    }
+    freeInodeCache(inodeCache);
+    free_bitmap(pinnedBitmap);
+    pinnedBitmap = NULL;
+    // the bitmap, checksum table and disk name all live in the arena
+    arenaReset(&mountArena);
+    mountedBitmap = NULL;
+    currMountedFS = NULL;
+    checksumTable = NULL;
+    checksumDirty = NULL;
+    checksumLoaded = NULL;
+    compressByDefault = 0;
+    dedupEnabled = 0;
+    dedupIndexBlock = 0;
+    quotaBlock = 0;
+    currentOwner = 0;
+    rootBlock = 1;
+    readOnly = 0;
+    freeTable(openFileTable);
+    openFileTable = NULL;
+    closeDisk(disk);
+    disk = -1;
+    mounted = 0;
+    printf("File system unmounted successfully.\n");
+    return UNMOUNT_SUCCESS;
+}
+
+// fill in a new inode's name, flags, DIRECTORY block (for directories) and creation time
+void initInode(Inode *inode, char *name, int flags, int dir_block)
+{
+    inode->file_index = dir_block;
+    inode->flags = flags;
+    inode->owner = currentOwner;
+    strcpy(inode->name, name);
+    // creation timestamp
+    time_t t;
+    time(&t);
+    struct tm *local_time = localtime(&t);
+    inode->hour = local_time->tm_hour;
+    inode->minute = local_time->tm_min;
+    inode->second = local_time->tm_sec;
+}
+
+// create an inode called name in the directory stored in block parent, with flags in inode[3]
+// and, for a directory, its DIRECTORY block in inode[2]. Returns the new inode block.
+int createInode(int parent, char *name, int flags, int dir_block)
+{
+    int inode_index = find_free_run(mountedBitmap, pinnedBlocks(), 1);
+    // printf("free block is %d\n", inode_index);
+    if (inode_index == -2)
+    {
+        fprintf(stderr, "Error: No free blocks available.\n");
+        return FREE_BLOCK_ERROR;
+    }
+    // we store it as a 16 bit number so we can store up to 65536 blocks
+    allocate_block(mountedBitmap, inode_index);
+    unsigned char directory[BLOCKSIZE];
+
+    if (bufferedRead(disk, parent, directory) == -1)
+    {
+        fprintf(stderr, "Error: Unable to read directory from disk.\n");
+        free_block(mountedBitmap, inode_index);
+        return DISK_READ_ERROR;
+    }
+
+    int mapped = 0;
+    for (int i = 4; i < 251; i += 2)
+    {
+        // need two bytes to write up to block 65535 for inodes
+        int value = (directory[i] << 8) | directory[i + 1];
+        // if value is 0 (unallocated) then thats where next inode mapping will be
+        if (value == 0)
+        {
+            directory[i] = (inode_index >> 8) & 0xFF;
+            directory[i + 1] = inode_index & 0xFF;
+            mapped = 1;
+            break;
+        }
+    }
+    if (!mapped)
+    {
+        fprintf(stderr, "Error: Directory is full.\n");
+        free_block(mountedBitmap, inode_index);
+        return DIRECTORY_FULL_ERROR;
+    }
+    // now create contents for inode, cached so the file can be used right away without a read
+    Inode *inode = insertCachedInode(inodeCache, inode_index);
+    if (inode == NULL)
+    {
+        free_block(mountedBitmap, inode_index);
+        return READ_ERROR;
+    }
+    initInode(inode, name, flags, dir_block);
+    // written now so the directory entry never points at a block that is not an inode yet
+    inode->dirty = 1;
+    if (storeInode(inode) < 0)
+    {
+        closeDisk(disk);
+        return WRITE_ERROR;
+    }
+    if (bufferedWrite(disk, parent, directory) == -1)
+    {
+        fprintf(stderr, "Error: Unable to write directory to disk.\n");
+        closeDisk(disk);
+        return WRITE_ERROR;
+    }
+    dentryInsert(parent, name, inode_index, dir_block);
+    return inode_index;
+}
+
+fileDescriptor tfs_openFile(char *name)
+{
+    /* Creates or Opens a file for reading and writing on the currently
+    mounted file system. Creates a dynamic resource table entry for the file,
+    and returns a file descriptor (integer) that can be used to reference
+    this entry while the filesystem is mounted. The name may be a path like
+    "a/b/c" through directories made with tfs_mkdir, only the last
+    component is created if missing. */
+
+    if (!mounted)
+    {
+        fprintf(stderr, "Error: No file system mounted.\n");
+        return MOUNTED_ERROR; // Or define an appropriate error code
+    }
+
+    char leaf[MAX_FILENAME_LENGTH + 1];
+    int parent = 0;
+    int dir = 0;
+    int inode_index = resolvePath(name, &parent, leaf, &dir);
+    if (inode_index < 0 && (inode_index != FILE_NOT_FOUND_ERROR || parent == 0))
+    {
+        return inode_index;
+    }
+
+    if (inode_index > 0)
+    {
+        // Check if the file is already open in the dynamic resource table
+        FileEntry *current = openFileTable;
+        while (current != NULL)
+        {
+            if (current->inode_index == inode_index)
+            {
+                // File already exists, return its file descriptor
+                return current->fileDescriptor;
+            }
+            current = current->next;
+        }
+
+        // the file may already be on disk from an earlier mount, if so just open it
+        Inode *existing = loadInode(inode_index);
+        if (existing == NULL)
+        {
+            fprintf(stderr, "Error: Unable to read inode from disk.\n");
+            return DISK_READ_ERROR;
+        }
+        int fd = fds++;
+        FileEntry *entry = createFileEntry(leaf, fd, inode_index);
+        if (entry == NULL)
+        {
+            return READ_ERROR;
+        }
+        entry->parent_index = parent;
+        entry->inode = existing;
+        insertFileEntry(&openFileTable, entry);
+        return fd;
+    }
+    if (readOnly)
+    {
+        fprintf(stderr, "Error: Snapshot is mounted read only.\n");
+        return READ_ONLY_ERROR;
+    }
+
+    // File does not exist, creates a dynamic resource table entry for the file, returns a file descriptor
+    inode_index = createInode(parent, leaf, 0, 0);
+    if (inode_index < 0)
+    {
+        return inode_index;
+    }
+    int fd = fds++;
+    FileEntry *newFileEntry = createFileEntry(leaf, fd, inode_index);
+    if (newFileEntry == NULL)
+    {
+        return READ_ERROR;
+    }
+    newFileEntry->parent_index = parent;
+    newFileEntry->inode = findCachedInode(inodeCache, inode_index);
+    insertFileEntry(&openFileTable, newFileEntry);
+    return fd;
+}
+
+fileDescriptor tfs_openPath(char *path)
+{
+    /* opens or creates the file at path, relative to the root directory.
+    Same as tfs_openFile, named for callers working with nested paths. */
+    return tfs_openFile(path);
+}
+
+int tfs_mkdir(char *path)
+{
+    /* creates an empty directory at path. Every directory above it has to
+    exist already. */
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    if (readOnly)
+    {
+        return READ_ONLY_ERROR;
+    }
+    char leaf[MAX_FILENAME_LENGTH + 1];
+    int parent = 0;
+    int dir = 0;
+    int existing = resolvePath(path, &parent, leaf, &dir);
+    if (existing > 0)
+    {
+        fprintf(stderr, "Error: %s already exists.\n", path);
+        return FILE_EXISTS_ERROR;
+    }
+    if (existing != FILE_NOT_FOUND_ERROR || parent == 0)
+    {
+        return existing;
+    }
+
+    // the directory block is found through inode[2], so it has to fit in one byte
+    int dir_block = find_free_run(mountedBitmap, pinnedBlocks(), 1);
+    if (dir_block < 0 || dir_block > 255)
+    {
+        fprintf(stderr, "Error: No free blocks available.\n");
+        return FREE_BLOCK_ERROR;
+    }
+    unsigned char directory[BLOCKSIZE];
+    memset(directory, 0, BLOCKSIZE);
+    directory[0] = DIRECTORY;
+    directory[1] = MAGIC_NUMBER;
+    if (bufferedWrite(disk, dir_block, directory) == -1)
+    {
+        fprintf(stderr, "Error: Unable to write directory to disk.\n");
+        return WRITE_ERROR;
+    }
+    allocate_block(mountedBitmap, dir_block);
+    int inode_index = createInode(parent, leaf, INODE_DIRECTORY, dir_block);
+    if (inode_index < 0)
+    {
+        free_block(mountedBitmap, dir_block);
+        return inode_index;
+    }
+    return 1;
+}
+
+int tfs_closeFile(fileDescriptor FD)
+{
+   /* Closes the file, de-allocates all system resources, and removes table
+    entry */
+
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file != NULL && file->inode != NULL && storeInode(file->inode) < 0)
+    {
+        return WRITE_ERROR;
+    }
+    int result = deleteFileEntry(&openFileTable, FD);
+    return result;
+}
+
+// give back what an open file holds, once a rewrite has written the content that replaces it.
+// The caller fills in the inode
+int releaseContent(FileEntry *file)
+{
+    Inode *inode = file->inode;
+    file->cached_chunk = -1;
+    file->ra_count = 0;
+    if (inode->flags & INODE_SPARSE)
+    {
+        return releaseSparse(inode);
+    }
+    if (inode->stored_size > 0)
+    {
+        return releaseExtent(inode->file_index, inode->stored_size, inode->flags);
+    }
+    return 1;
+}
+
+// whether an extent of num_blocks finds room once the blocks inode holds are given back. Blocks
+// still shared with other deduplicated files stay in use
+int fitsInPlace(Inode *inode, int num_blocks)
+{
+    SparseRun runs[SPARSE_MAX_RUNS];
+    int count = 0;
+    if (inode->flags & INODE_SPARSE)
+    {
+        count = inode->run_count;
+        memcpy(runs, inode->runs, count * sizeof(SparseRun));
+    }
+    else if (inode->stored_size > 0)
+    {
+        runs[0].physical = inode->file_index;
+        runs[0].length = dataBlocks(inode->stored_size);
+        count = 1;
+    }
+    if ((inode->flags & INODE_DEDUP) && count > 0)
+    {
+        if (loadDedupIndex() < 0)
+        {
+            return 0;
+        }
+        for (int i = 0; i < DEDUP_INDEX_BLOCKS * DEDUP_ENTRIES_PER_BLOCK; i++)
+        {
+            if (dedupIndex[i].start == inode->file_index && dedupIndex[i].refs > 1)
+            {
+                count = 0;
+            }
+        }
+    }
+    for (int r = 0; r < count; r++)
+    {
+        for (int b = 0; b < runs[r].length; b++)
+        {
+            free_block(mountedBitmap, runs[r].physical + b);
+        }
+    }
+    int start = findExtentRun(num_blocks);
+    for (int r = 0; r < count; r++)
+    {
+        for (int b = 0; b < runs[r].length; b++)
+        {
+            allocate_block(mountedBitmap, runs[r].physical + b);
+        }
+    }
+    return start != -2;
+}
+
+// a rewrite with no room for both copies gives the old content back first, when the new extent
+// then fits. The old content is lost if the write still fails. *held is the quota credit the
+// caller took for the old content, it is settled here. Returns whether the content was released
+int makeRoom(FileEntry *file, int num_blocks, int *held)
+{
+    Inode *inode = file->inode;
+    if (!fitsInPlace(inode, num_blocks))
+    {
+        return 0;
+    }
+    adjustQuota(*held);
+    *held = 0;
+    if (releaseContent(file) < 0)
+    {
+        return 0;
+    }
+    inode->file_index = 0;
+    inode->file_size = 0;
+    inode->stored_size = 0;
+    inode->flags = 0;
+    inode->run_count = 0;
+    inode->dirty = 1;
+    return 1;
+}
+
+int tfs_writeFile(fileDescriptor FD, char *buffer, int size)
+{
+    /* Writes buffer ‘buffer’ of size ‘size’, which represents an entire
+    file’s content, to the file system. Previous content (if any) will be
+    completely lost. Sets the file pointer to 0 (the start of file) when
+    done. Returns success/error codes. */
+    // Iterate through all fileEntries in the openFileTable and print the fd
+    // printf("File Descriptors in openFileTable: ");
+    // FileEntry *allFileTable = openFileTable;
+    // while (allFileTable != NULL)
+    // {
+    //     printf("%d ", allFileTable->fileDescriptor);
+    //     allFileTable = allFileTable->next;
+    // }
+    // printf("\n");
+
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: File not found in open file table.\n");
+        return FILE_NOT_FOUND_ERROR;
+    }
+    if (readOnly)
+    {
+        return READ_ONLY_ERROR;
+    }
+    if (file->inode->flags & INODE_DIRECTORY)
+    {
+        return IS_A_DIRECTORY_ERROR;
+    }
+    if (size > 65535)
+    {
+        fprintf(stderr, "file size needs to be less than 65535 to fit on 2 bytes.\n");
+        return -4; // make an error code
+    }
+    quotaOwner = file->inode->owner;
+    throttleIO(quotaOwner, size);
+    // a preallocated file keeps its blocks, the new content is written over them in place
+    if (file->inode->flags & INODE_PREALLOCATED)
+    {
+        return rewriteReserved(file, buffer, size);
+    }
+
+    // compressed files store a chunked LZ stream instead of the raw content, kept only if it is smaller
+    int flags = 0;
+    int stored_size = size;
+    char *data = buffer;
+    int compress = file->compress >= 0 ? file->compress : compressByDefault;
+    if (compress && size > 0)
+    {
+        int stream_size = compressStream(buffer, size, compressScratch, size - 1);
+        if (stream_size > 0)
+        {
+            flags |= INODE_COMPRESSED;
+            stored_size = stream_size;
+            data = (char *)compressScratch;
+        }
+    }
+    // a rewrite the owner's quota cannot take fails while the old content is still there
+    int held = chargedBlocks(file->inode);
+    if (checkQuota(held, dataBlocks(stored_size)) < 0)
+    {
+        return QUOTA_ERROR;
+    }
+    // the new content is written before the old is let go, so a rewrite that fails for want of
+    // space leaves the file as it was, unless the new content only fits where the old one is.
+    // The owner is not charged for both at once
+    adjustQuota(-held);
+    int free_block = 0;
+    int dedup_slot = -1;
+    uint64_t hash = 0;
+    if (dedupEnabled && stored_size > 0)
+    {
+        hash = contentHash((unsigned char *)data, stored_size);
+        dedup_slot = findDedupContent(data, stored_size, hash);
+    }
+    if (dedup_slot >= 0)
+    {
+        // identical content is already on disk, point at its extent instead of writing a copy
+        if (chargeQuota(dataBlocks(stored_size)) < 0)
+        {
+            adjustQuota(held);
+            return QUOTA_ERROR;
+        }
+        dedupIndex[dedup_slot].refs++;
+        dedupDirty[dedup_slot / DEDUP_ENTRIES_PER_BLOCK] = 1;
+        free_block = dedupIndex[dedup_slot].start;
+        flags |= INODE_DEDUP;
+    }
+    else
+    {
+        free_block = writeExtent(data, stored_size);
+        if (free_block == FREE_BLOCK_ERROR && makeRoom(file, dataBlocks(stored_size), &held))
+        {
+            free_block = writeExtent(data, stored_size);
+        }
+        if (free_block < 0)
+        {
+            adjustQuota(held);
+            return free_block;
+        }
+        if (dedupEnabled && stored_size > 0 && addDedupEntry(hash, free_block, stored_size) >= 0)
+        {
+            flags |= INODE_DEDUP;
+        }
+    }
+    adjustQuota(held);
+    if (free_block > 255)
+    {
+        fprintf(stderr, "next block size needs to be less than 255 to fit on byte.\n");
+        closeDisk(disk);
+        return -4; // make an error code
+    }
+    int result = releaseContent(file);
+    if (result < 0)
+    {
+        return result;
+    }
+    if (flushChecksumTable() < 0 || flushDedupIndex() < 0)
+    {
+        return WRITE_ERROR;
+    }
+    // only the cached inode changes here, it is written back on close or unmount
+    file->inode->file_index = free_block;
+    file->inode->file_size = size;
+    file->inode->stored_size = stored_size;
+    file->inode->flags = flags;
+    file->inode->dirty = 1;
+    file->offset = 0;
+    // printf("returning in this function\n");
+    return 1;
+}
+
+// free everything an open file holds except its slot in the parent directory: the extent, or for
+// a directory its entry table (passed in as entries, it has to be empty), and the inode block
+int releaseFile(FileEntry *deleteMe, unsigned char *entries)
+{
+    char freeBlock[BLOCKSIZE];
+    quotaOwner = deleteMe->inode->owner;
+    freeBlock[0] = 0x04;
+    freeBlock[1] = 0x44;
+    for (int i = 2; i < BLOCKSIZE; i++)
+    {
+        freeBlock[i] = 0x00;
+    }
+    if (deleteMe->inode->flags & INODE_DIRECTORY)
+    {
+        // only empty directories can go, their entry table is freed with the inode
+        for (int i = 4; i < 251; i++)
+        {
+            if (entries[i] != 0x00)
+            {
+                return DIRECTORY_NOT_EMPTY_ERROR;
+            }
+        }
+        if (bufferedWrite(disk, deleteMe->inode->file_index, freeBlock) == -1)
+        {
+            return WRITE_ERROR;
+        }
+        free_block(mountedBitmap, deleteMe->inode->file_index);
+        dentryForgetDirectory(deleteMe->inode->file_index);
+    }
+    else if (deleteMe->inode->flags & INODE_SPARSE)
+    {
+        int result = releaseSparse(deleteMe->inode);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+    else if (deleteMe->inode->stored_size > 0)
+    {
+        int result = releaseExtent(deleteMe->inode->file_index, deleteMe->inode->stored_size, deleteMe->inode->flags);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+    // delete inodex by replacing it as a free block
+    if (bufferedWrite(disk, deleteMe->inode_index, freeBlock) == -1)
+    {
+        fprintf(stderr, "Error: Unable to write free block to disk.\n");
+        closeDisk(disk);
+        return WRITE_ERROR;
+    }
+    free_block(mountedBitmap, deleteMe->inode_index);
+    // the cached copy goes too, so closing the file does not write it back over the free block
+    removeCachedInode(inodeCache, deleteMe->inode_index);
+    deleteMe->inode = NULL;
+    dentryInsert(deleteMe->parent_index, deleteMe->filename, 0, 0);
+    return 1;
+}
+
+// clear the slot pointing at inode_index in a directory's entry table
+void removeDirectoryEntry(unsigned char *directory, int inode_index)
+{
+    for (int i = 4; i < 251; i += 2)
+    {
+        // need two bytes to write up to block 65535 for inodes
+        int value = (directory[i] << 8) | directory[i + 1];
+        if (value == inode_index)
+        {
+            directory[i] = 0x00;
+            directory[i + 1] = 0x00;
+            break;
+        }
+    }
+}
+
+int tfs_deleteFile(fileDescriptor FD)
+{    /* deletes a file and marks its blocks as free on disk. */
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    FileEntry *deleteMe = findFileEntryByFD(openFileTable, FD);
+    if (deleteMe == NULL)
+    {
+        return FILE_NOT_FOUND_ERROR;
+    }
+    if (readOnly)
+    {
+        return READ_ONLY_ERROR;
+    }
+    unsigned char entries[BLOCKSIZE];
+    if ((deleteMe->inode->flags & INODE_DIRECTORY) && bufferedRead(disk, deleteMe->inode->file_index, entries) == -1)
+    {
+        return DISK_READ_ERROR;
+    }
+    int parent = deleteMe->parent_index;
+    int inode_index = deleteMe->inode_index;
+    int result = releaseFile(deleteMe, entries);
+    if (result < 0)
+    {
+        return result;
+    }
+    //update the parent directory by deleting that inode
+    unsigned char rootDirectory[BLOCKSIZE];
+    bufferedRead(disk, parent, rootDirectory);
+    removeDirectoryEntry(rootDirectory, inode_index);
+    if (bufferedWrite(disk, parent, rootDirectory) == -1 || flushChecksumTable() < 0 || flushDedupIndex() < 0)
+    {
+        fprintf(stderr, "Error: Unable to write directory to disk.\n");
+        closeDisk(disk);
+        return WRITE_ERROR;
+    }
+    tfs_closeFile(FD); // remove from open file table and free memory
+    return DELETE_SUCCESS;
+}
+
+int tfs_readByte(fileDescriptor FD, char *buffer)
+{    /* reads one byte from the file and copies it to buffer, using the
+    current file pointer location and incrementing it by one upon success.
+    If the file pointer is already past the end of the file then
+    tfs_readByte() should return an error and not increment the file pointer.
+    */
+
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+
+    // Find the file entry in the open file table
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
+    {
+        return FILE_NOT_FOUND_ERROR;
+    }
+
+    // Check if the file pointer is already past the end of the file
+    if (file->offset >= file->inode->file_size)
+    {
+        return END_OF_FILE_ERROR;
+    }
+    throttleIO(file->inode->owner, 1);
+
+    // compressed files are read through the decompressed chunk holding the file pointer
+    if (file->inode->flags & INODE_COMPRESSED)
+    {
+        int chunk = file->offset / COMPRESS_CHUNK_SIZE;
+        if (file->cached_chunk != chunk)
+        {
+            int result = loadChunk(file, chunk);
+            if (result < 0)
+            {
+                return result;
+            }
+        }
+        *buffer = (char)file->chunk_cache[file->offset % COMPRESS_CHUNK_SIZE];
+        file->offset = file->offset + 1;
+        return 1;
+    }
+
+    // Figure out what block the file pointer is in (file pointer = fileindex + offset)
+    int start_pointer = file->inode->file_index;
+    int block_to_read = start_pointer + (file->offset / dataPayload);
+    int end = start_pointer + dataBlocks(file->inode->stored_size);
+    if (file->inode->flags & INODE_SPARSE)
+    {
+        block_to_read = sparseBlock(file->inode, file->offset / dataPayload, &end);
+        if (block_to_read == 0)
+        {
+            // holes read as zeros without going to the disk
+            *buffer = 0;
+            file->offset = file->offset + 1;
+            return 1;
+        }
+    }
+    int file_pointer = file->offset % dataPayload + dataHeader; // skip the block header
+    // a read that does not pick up where the last one stopped shrinks the readahead window
+    if (file->offset != file->next_offset && file->ra_window > 1 && file->advice != TFS_ADVICE_SEQUENTIAL)
+    {
+        file->ra_window /= 2;
+    }
+    file->next_offset = file->offset + 1;
+    int result = fillReadahead(file, block_to_read, end);
+    if (result < 0)
+    {
+        return result;
+    }
+    char byteData = (char)file->readahead[(block_to_read - file->ra_start) * BLOCKSIZE + file_pointer];
+    // Read one byte from the file and copy it to the buffer as a char
+    *buffer = byteData;
+    file->offset = file->offset + 1;
+    return 1; // Success
+}
+
+int tfs_seek(fileDescriptor FD, int offset)
+{    /* change the file pointer location to offset (absolute). Returns
+    success/error codes.*/
+
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    // offset will be used to calculate file pointer for readByte
+    file->offset = offset;
+    return SEEK_SUCCESS;
+}
+
+// the file pointer for whence SEEK_SET, SEEK_CUR or SEEK_END, or for SEEK_DATA and SEEK_HOLE the
+// next offset from offset on that is or is not in a hole. Returns the new offset
+int tfs_lseek(fileDescriptor FD, int offset, int whence)
+{
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
+    {
+        return FILE_NOT_FOUND_ERROR;
+    }
+    Inode *inode = file->inode;
+    int size = inode->file_size;
+    int end = 0;
+    if (whence == SEEK_CUR)
+    {
+        offset += file->offset;
+    }
+    else if (whence == SEEK_END)
+    {
+        offset += size;
+    }
+    else if (whence == SEEK_DATA || whence == SEEK_HOLE)
+    {
+        // like lseek(2) there is no data or hole to find past the end
+        if (offset < 0 || offset >= size)
+        {
+            return END_OF_FILE_ERROR;
+        }
+        int hole = whence == SEEK_HOLE;
+        if (inode->flags & INODE_SPARSE)
+        {
+            int l = offset / dataPayload;
+            while (l * dataPayload < size && (sparseBlock(inode, l, &end) == 0) != hole)
+            {
+                l++;
+            }
+            if (l * dataPayload > offset)
+            {
+                offset = l * dataPayload < size ? l * dataPayload : size;
+            }
+        }
+        else if (hole)
+        {
+            offset = size; // the only hole of a file without a block map is at its end
+        }
+        if (offset >= size && !hole)
+        {
+            return END_OF_FILE_ERROR;
+        }
+    }
+    else if (whence != SEEK_SET)
+    {
+        return SEEK_ERROR;
+    }
+    if (offset < 0)
+    {
+        return SEEK_ERROR;
+    }
+    file->offset = offset;
+    return offset;
+}
+
+// write size bytes at offset without touching the rest of the file, which grows if they end past
+// it. A gap left before offset is a hole. The file pointer does not move
+int tfs_writeAt(fileDescriptor FD, int offset, char *buffer, int size)
+{
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
+    {
+        return FILE_NOT_FOUND_ERROR;
+    }
+    if (readOnly)
+    {
+        return READ_ONLY_ERROR;
+    }
+    if (file->inode->flags & INODE_DIRECTORY)
+    {
+        return IS_A_DIRECTORY_ERROR;
+    }
+    if (offset < 0 || size < 0)
+    {
+        return SEEK_ERROR;
+    }
+    if (offset + size > 65535)
+    {
+        fprintf(stderr, "file size needs to be less than 65535 to fit on 2 bytes.\n");
+        return WRITE_ERROR;
+    }
+    quotaOwner = file->inode->owner;
+    throttleIO(quotaOwner, size);
+    int result = makeSparse(file);
+    if (result < 0)
+    {
+        return result;
+    }
+    return writeSparse(file, offset, buffer, size, 0);
+}
+
+// set the size of a file. Growing adds a hole at the end, shrinking frees the blocks past the new end
+int tfs_truncate(fileDescriptor FD, int size)
+{
+    static int map[MAX_FILE_BLOCKS];
+    static char zeros[BLOCKSIZE];
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
+    {
+        return FILE_NOT_FOUND_ERROR;
+    }
+    if (readOnly)
+    {
+        return READ_ONLY_ERROR;
+    }
+    if (file->inode->flags & INODE_DIRECTORY)
+    {
+        return IS_A_DIRECTORY_ERROR;
+    }
+    if (size < 0 || size > 65535)
+    {
+        fprintf(stderr, "file size needs to be less than 65535 to fit on 2 bytes.\n");
+        return WRITE_ERROR;
+    }
+    quotaOwner = file->inode->owner;
+    int result = makeSparse(file);
+    if (result < 0)
+    {
+        return result;
+    }
+    Inode *inode = file->inode;
+    if (size < inode->file_size)
+    {
+        // clear the tail of the new last block, so growing the file again reads zeros there
+        int tail = dataPayload - size % dataPayload;
+        if (size % dataPayload != 0)
+        {
+            result = writeSparse(file, size, zeros, tail < inode->file_size - size ? tail : inode->file_size - size, 0);
+            if (result < 0)
+            {
+                return result;
+            }
+        }
+        expandSparseMap(inode, map);
+        for (int l = dataBlocks(size); l < MAX_FILE_BLOCKS; l++)
+        {
+            if (map[l] != 0)
+            {
+                result = releaseBlocks(map[l] & ~MAP_UNWRITTEN, 1);
+                if (result < 0)
+                {
+                    return result;
+                }
+                map[l] = 0;
+            }
+        }
+        inode->run_count = packSparseMap(map, inode->runs);
+        if (flushChecksumTable() < 0)
+        {
+            return WRITE_ERROR;
+        }
+    }
+    inode->file_size = size;
+    inode->dirty = 1;
+    file->ra_count = 0;
+    return 1;
+}
+
+// reserve a contiguous run of blocks for the first size bytes of a file, so later writes up to
+// there, tfs_writeFile included, go to those blocks in place. Blocks already in the range move
+// into the run once here if they are not in one. The file size does not change
+int tfs_fallocate(fileDescriptor FD, int size, int flags)
+{
+    static int map[MAX_FILE_BLOCKS];
+    static int next[MAX_FILE_BLOCKS];
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
+    {
+        return FILE_NOT_FOUND_ERROR;
+    }
+    if (readOnly)
+    {
+        return READ_ONLY_ERROR;
+    }
+    if (file->inode->flags & INODE_DIRECTORY)
+    {
+        return IS_A_DIRECTORY_ERROR;
+    }
+    if (size < 0 || size > 65535)
+    {
+        fprintf(stderr, "file size needs to be less than 65535 to fit on 2 bytes.\n");
+        return WRITE_ERROR;
+    }
+    quotaOwner = file->inode->owner;
+    int result = makeSparse(file);
+    if (result < 0)
+    {
+        return result;
+    }
+    Inode *inode = file->inode;
+    int blocks = dataBlocks(size);
+    expandSparseMap(inode, map);
+    memcpy(next, map, sizeof(next));
+
+    // blocks already mapped as one run from the start of the file can stay where they are
+    int first = map[0] & ~MAP_UNWRITTEN;
+    int mapped = 0;
+    while (mapped < blocks && map[mapped] != 0 && (map[mapped] & ~MAP_UNWRITTEN) == first + mapped)
+    {
+        mapped++;
+    }
+    int later = 0;
+    for (int l = mapped; l < blocks; l++)
+    {
+        later |= map[l] != 0;
+    }
+    // only blocks the file does not have yet count against the quota, moved ones are freed again
+    int fresh = 0;
+    for (int l = 0; l < blocks; l++)
+    {
+        fresh += map[l] == 0;
+    }
+    if (chargeQuota(fresh) < 0)
+    {
+        return QUOTA_ERROR;
+    }
+    Bitmap *pinned = pinnedBlocks();
+    int start = first;
+    if (mapped < blocks && (mapped == 0 || later || !blocksFree(first + mapped, blocks - mapped, pinned)))
+    {
+        start = find_free_run(mountedBitmap, pinned, blocks);
+        if (start == -2)
+        {
+            fprintf(stderr, "Error: No free blocks available.\n");
+            adjustQuota(-fresh);
+            return FREE_BLOCK_ERROR;
+        }
+    }
+    int moved = 0;
+    for (int l = 0; l < blocks; l++)
+    {
+        if (map[l] != 0 && (map[l] & ~MAP_UNWRITTEN) == start + l)
+        {
+            continue;
+        }
+        allocate_block(mountedBitmap, start + l);
+        if (map[l] == 0)
+        {
+            next[l] = (start + l) | ((flags & FALLOCATE_NO_ZERO) ? MAP_UNWRITTEN : 0);
+        }
+        else
+        {
+            next[l] = (start + l) | (map[l] & MAP_UNWRITTEN);
+            moved++;
+        }
+    }
+    adjustQuota(moved);
+    SparseRun runs[SPARSE_MAX_RUNS];
+    int count = packSparseMap(next, runs);
+    if (count < 0)
+    {
+        fprintf(stderr, "Error: File is too fragmented for its block map.\n");
+        result = count;
+    }
+
+    // moved blocks are copied, new ones are written as zeros unless they are left unwritten. The
+    // old blocks stay mapped until every copy is written, so a failure only gives back the new ones
+    unsigned char block[BLOCKSIZE];
+    for (int l = 0; l < blocks && result > 0; l++)
+    {
+        if (next[l] == map[l] || (next[l] & MAP_UNWRITTEN))
+        {
+            continue;
+        }
+        memset(block, 0, BLOCKSIZE);
+        if (map[l] != 0 && !(map[l] & MAP_UNWRITTEN))
+        {
+            if (bufferedRead(disk, map[l], block) == -1)
+            {
+                fprintf(stderr, "Error: Unable to read file content from disk.\n");
+                result = DISK_READ_ERROR;
+                break;
+            }
+            if (verifyBlockChecksum(map[l], block) < 0)
+            {
+                result = CHECKSUM_ERROR;
+                break;
+            }
+        }
+        stampDataHeader(block, 0);
+        result = setBlockChecksum(start + l, block);
+        if (result > 0 && bufferedWrite(disk, start + l, block) == -1)
+        {
+            fprintf(stderr, "Error: Unable to write file content to disk.\n");
+            result = WRITE_ERROR;
+        }
+    }
+    if (result < 0)
+    {
+        for (int l = 0; l < blocks; l++)
+        {
+            if (next[l] != map[l])
+            {
+                free_block(mountedBitmap, start + l);
+            }
+        }
+        adjustQuota(-fresh - moved);
+        return result;
+    }
+    memcpy(inode->runs, runs, count * sizeof(SparseRun));
+    inode->run_count = count;
+    inode->flags |= INODE_PREALLOCATED;
+    inode->dirty = 1;
+    file->ra_count = 0;
+    for (int l = 0; l < blocks; l++)
+    {
+        if (next[l] != map[l] && map[l] != 0)
+        {
+            result = releaseBlocks(map[l] & ~MAP_UNWRITTEN, 1);
+            if (result < 0)
+            {
+                return result;
+            }
+        }
+    }
+    return flushChecksumTable() < 0 ? WRITE_ERROR : 1;
+}
+
+
+
+// Durability
+// write the allocation state and every buffered block, then wait for the disk to have them
+int syncMounted(void)
+{
+    if (writeSuperblock() < 0 || flushChecksumTable() < 0 || flushDedupIndex() < 0)
+    {
+        return WRITE_ERROR;
+    }
+    if (flushWriteBuffer(disk) == -1 || syncDisk(disk) == -1)
+    {
+        fprintf(stderr, "Error: Unable to sync disk.\n");
+        return WRITE_ERROR;
+    }
+    return 1;
+}
+
+int tfs_fsync(fileDescriptor FD)
+{
+    /* makes the content of one open file durable, like fdatasync: its data
+    blocks, its inode and the allocation state needed to read it back are
+    on stable storage when this returns. Writes are otherwise buffered until
+    the buffer fills, a sync or unmount. */
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
+    {
+        return FILE_NOT_FOUND_ERROR;
+    }
+    if (readOnly)
+    {
+        return 1;
+    }
+    if (storeInode(file->inode) < 0)
+    {
+        return WRITE_ERROR;
+    }
+    return syncMounted();
+}
+
+int tfs_sync(void)
+{
+    /* makes everything written on this mount durable: every cached inode,
+    the allocation state and all buffered blocks. */
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    if (readOnly)
+    {
+        return 1;
+    }
+    if (flushInodes() < 0)
+    {
+        return WRITE_ERROR;
+    }
+    return syncMounted();
+}
+
+// Direct I/O
+int tfs_setDirectIO(int enabled)
+{
+    /* opens disks with O_DIRECT from the next tfs_mkfs or mount on, so images
+    skip the kernel page cache and the block buffer is the only cache. Blocks
+    are read and written in whole aligned units of the device. */
+    directIO = enabled ? 1 : 0;
+    return 1;
+}
+
+// Header-free data blocks
+int tfs_setRawData(int enabled)
+{
+    /* formats the images of the following tfs_mkfs calls with FEATURE_RAW_DATA.
+    Their data blocks hold nothing but file content, 256 bytes each: the extent
+    of a file is found through its inode and the bitmap alone, so a contiguous
+    file is byte-contiguous on disk. Images without the flag keep the 4 byte
+    header in every data block and mount as before. */
+    rawDataFormat = enabled ? 1 : 0;
+    return 1;
+}
+
+// Host file transfer
+// readv or writev until every iovec is done or the host file ends, returns the bytes moved or -1
+int transferVector(int hostfd, struct iovec *iov, int count, int writing)
+{
+    int total = 0;
+    while (count > 0)
+    {
+        ssize_t n = writing ? writev(hostfd, iov, count) : readv(hostfd, iov, count);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return -1;
+        }
+        if (n == 0)
+        {
+            break; // end of the host file
+        }
+        total += (int)n;
+        while (count > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return total;
+}
+
+// move the host file position over a hole, seeking so a regular file gets a hole of its own,
+// writing zeros where the descriptor cannot seek
+int skipHost(int hostfd, int size)
+{
+    static char zeros[4096];
+    if (lseek(hostfd, size, SEEK_CUR) != -1)
+    {
+        return 1;
+    }
+    while (size > 0)
+    {
+        struct iovec iov = {zeros, size < (int)sizeof(zeros) ? (size_t)size : sizeof(zeros)};
+        if (transferVector(hostfd, &iov, 1, 1) != (int)iov.iov_len)
+        {
+            return -1;
+        }
+        size -= (int)sizeof(zeros);
+    }
+    return 1;
+}
+
+int tfs_export(fileDescriptor FD, int hostfd)
+{
+    /* writes the content of an open file to the host descriptor hostfd from
+    its current position. Runs of blocks are read with one read() each and
+    their payloads, which sit between block headers, are gathered into one
+    writev(). Holes of sparse files become holes in a seekable host file.
+    Returns the number of bytes exported. */
+    static unsigned char run[READAHEAD_MAX_BLOCKS * BLOCKSIZE];
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
+    {
+        return FILE_NOT_FOUND_ERROR;
+    }
+    Inode *inode = file->inode;
+    if (inode->flags & INODE_DIRECTORY)
+    {
+        return IS_A_DIRECTORY_ERROR;
+    }
+    int size = inode->file_size;
+    throttleIO(inode->owner, size);
+    if (inode->flags & INODE_COMPRESSED)
+    {
+        for (int c = 0; c * COMPRESS_CHUNK_SIZE < size; c++)
+        {
+            int result = loadChunk(file, c);
+            if (result < 0)
+            {
+                return result;
+            }
+            int len = size - c * COMPRESS_CHUNK_SIZE < COMPRESS_CHUNK_SIZE ? size - c * COMPRESS_CHUNK_SIZE : COMPRESS_CHUNK_SIZE;
+            struct iovec iov = {file->chunk_cache, (size_t)len};
+            if (transferVector(hostfd, &iov, 1, 1) != len)
+            {
+                fprintf(stderr, "Error: Unable to write to the host file.\n");
+                return WRITE_ERROR;
+            }
+        }
+        if (file->advice == TFS_ADVICE_NOREUSE)
+        {
+            adviseRange(file, 0, size, POSIX_FADV_DONTNEED);
+        }
+        return size;
+    }
+
+    struct iovec iov[READAHEAD_MAX_BLOCKS];
+    int blocks = dataBlocks(size);
+    int hole = 0;
+    for (int l = 0; l < blocks;)
+    {
+        int end = inode->file_index + blocks;
+        int block = (inode->flags & INODE_SPARSE) ? sparseBlock(inode, l, &end) : inode->file_index + l;
+        if (block == 0)
+        {
+            hole += size - l * dataPayload < dataPayload ? size - l * dataPayload : dataPayload;
+            l++;
+            continue;
+        }
+        if (hole > 0 && skipHost(hostfd, hole) < 0)
+        {
+            fprintf(stderr, "Error: Unable to write to the host file.\n");
+            return WRITE_ERROR;
+        }
+        hole = 0;
+        int count = end - block < blocks - l ? end - block : blocks - l;
+        if (count > READAHEAD_MAX_BLOCKS)
+        {
+            count = READAHEAD_MAX_BLOCKS;
+        }
+        if (bufferedReadRun(disk, block, count, run) == -1)
+        {
+            fprintf(stderr, "Error: Unable to read file content from disk.\n");
+            return DISK_READ_ERROR;
+        }
+        int want = 0;
+        for (int b = 0; b < count; b++)
+        {
+            if (verifyBlockChecksum(block + b, run + b * BLOCKSIZE) < 0)
+            {
+                return CHECKSUM_ERROR;
+            }
+            int len = size - (l + b) * dataPayload < dataPayload ? size - (l + b) * dataPayload : dataPayload;
+            iov[b].iov_base = run + b * BLOCKSIZE + dataHeader;
+            iov[b].iov_len = (size_t)len;
+            want += len;
+        }
+        int pieces = count;
+        if (dataHeader == 0)
+        {
+            // header-free payloads follow each other, so the run moves as one piece
+            iov[0].iov_len = (size_t)want;
+            pieces = 1;
+        }
+        if (transferVector(hostfd, iov, pieces, 1) != want)
+        {
+            fprintf(stderr, "Error: Unable to write to the host file.\n");
+            return WRITE_ERROR;
+        }
+        if (file->advice == TFS_ADVICE_NOREUSE)
+        {
+            adviseDisk(disk, block, count, POSIX_FADV_DONTNEED);
+        }
+        l += count;
+    }
+    if (hole > 0)
+    {
+        // a hole at the end still has to make the host file long enough
+        char zero = 0;
+        struct iovec last = {&zero, 1};
+        if (skipHost(hostfd, hole - 1) < 0 || transferVector(hostfd, &last, 1, 1) != 1)
+        {
+            fprintf(stderr, "Error: Unable to write to the host file.\n");
+            return WRITE_ERROR;
+        }
+    }
+    return size;
+}
+
+// read size bytes from hostfd straight into the payloads of a new extent for file, a run of
+// blocks at a time: one readv() scatters the data between the block headers and one write
+// puts the run on the disk
+int importExtent(FileEntry *file, int hostfd, int size)
+{
+    static unsigned char run[READAHEAD_MAX_BLOCKS * BLOCKSIZE];
+    int num_blocks = dataBlocks(size);
+    if (num_blocks == 0)
+    {
+        return 1;
+    }
+    quotaOwner = file->inode->owner;
+    throttleIO(quotaOwner, size);
+    if (chargeQuota(num_blocks) < 0)
+    {
+        return QUOTA_ERROR;
+    }
+    int start = findExtentRun(num_blocks);
+    if (start == -2)
+    {
+        fprintf(stderr, "Error: No free blocks available.\n");
+        adjustQuota(-num_blocks);
+        return FREE_BLOCK_ERROR;
+    }
+    for (int b = 0; b < num_blocks; b++)
+    {
+        allocate_block(mountedBitmap, start + b);
+    }
+    struct iovec iov[READAHEAD_MAX_BLOCKS];
+    for (int first = 0; first < num_blocks; first += READAHEAD_MAX_BLOCKS)
+    {
+        int count = num_blocks - first < READAHEAD_MAX_BLOCKS ? num_blocks - first : READAHEAD_MAX_BLOCKS;
+        memset(run, 0, count * BLOCKSIZE);
+        int want = 0;
+        for (int b = 0; b < count; b++)
+        {
+            unsigned char *block = run + b * BLOCKSIZE;
+            int len = size - (first + b) * dataPayload < dataPayload ? size - (first + b) * dataPayload : dataPayload;
+            stampDataHeader(block, first + b + 1 < num_blocks ? start + first + b + 1 : 0);
+            iov[b].iov_base = block + dataHeader;
+            iov[b].iov_len = (size_t)len;
+            want += len;
+        }
+        int pieces = count;
+        if (dataHeader == 0)
+        {
+            iov[0].iov_len = (size_t)want;
+            pieces = 1;
+        }
+        int result = 1;
+        if (transferVector(hostfd, iov, pieces, 0) != want)
+        {
+            fprintf(stderr, "Error: Unable to read the host file.\n");
+            result = READ_ERROR;
+        }
+        for (int b = 0; b < count && result > 0; b++)
+        {
+            if (setBlockChecksum(start + first + b, run + b * BLOCKSIZE) < 0)
+            {
+                result = DISK_READ_ERROR;
+            }
+        }
+        if (result > 0 && bufferedWriteRun(disk, start + first, count, run) == -1)
+        {
+            fprintf(stderr, "Error: Unable to write file content to disk.\n");
+            result = WRITE_ERROR;
+        }
+        if (result < 0)
+        {
+            releaseBlocks(start, num_blocks);
+            return result;
+        }
+    }
+    if (flushChecksumTable() < 0)
+    {
+        return WRITE_ERROR;
+    }
+    file->inode->file_index = start;
+    file->inode->file_size = size;
+    file->inode->stored_size = size;
+    file->inode->flags = 0;
+    file->inode->dirty = 1;
+    file->offset = 0;
+    return 1;
+}
+
+fileDescriptor tfs_import(int hostfd, char *name)
+{
+    /* creates or replaces the file name with everything left to read from
+    the host descriptor hostfd and returns it open. A regular host file is
+    read straight into the blocks of a new extent, see importExtent. Content
+    that has to be seen whole first, because it is compressed, deduplicated,
+    preallocated or comes from a pipe, goes through tfs_writeFile. */
+    static char content[65536];
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    if (readOnly)
+    {
+        return READ_ONLY_ERROR;
+    }
+    struct stat st;
+    off_t here = lseek(hostfd, 0, SEEK_CUR);
+    int streaming = here != -1 && fstat(hostfd, &st) == 0 && S_ISREG(st.st_mode);
+    if (streaming && st.st_size - here > 65535)
+    {
+        fprintf(stderr, "file size needs to be less than 65535 to fit on 2 bytes.\n");
+        return WRITE_ERROR;
+    }
+    fileDescriptor fd = tfs_openFile(name);
+    if (fd < 0)
+    {
+        return fd;
+    }
+    FileEntry *file = findFileEntryByFD(openFileTable, fd);
+    if (file->inode->flags & INODE_DIRECTORY)
+    {
+        return IS_A_DIRECTORY_ERROR;
+    }
+    int compress = file->compress >= 0 ? file->compress : compressByDefault;
+    int result;
+    if (!streaming || compress || dedupEnabled || (file->inode->flags & INODE_PREALLOCATED))
+    {
+        struct iovec iov = {content, sizeof(content)};
+        int size = transferVector(hostfd, &iov, 1, 0);
+        if (size < 0 || size > 65535)
+        {
+            fprintf(stderr, "Error: Unable to read the host file, or it is larger than 65535 bytes.\n");
+            return READ_ERROR;
+        }
+        result = tfs_writeFile(fd, content, size);
+    }
+    else
+    {
+        // drop the old content the way tfs_writeFile does, then fill a new extent
+        result = tfs_writeFile(fd, content, 0);
+        if (result >= 0)
+        {
+            result = importExtent(file, hostfd, (int)(st.st_size - here));
+        }
+    }
+    return result < 0 ? result : fd;
+}
+
+// Vectored I/O
+#define VECTOR_PIECES 1024 // most iovecs handed to one preadv() or pwritev(), IOV_MAX on Linux
+#define BLOCK_PIECES 16    // caller buffers one block may map onto before it goes through a copy instead
+
+// position in an iovec array passed in by the caller
+typedef struct
+{
+    const struct iovec *iov;
+    int count;
+    size_t skip; // bytes of iov[0] already used
+} VectorCursor;
+
+// step over the caller's buffers that are used up
+void settleCursor(VectorCursor *cursor)
+{
+    while (cursor->count > 0 && cursor->skip == cursor->iov->iov_len)
+    {
+        cursor->iov++;
+        cursor->count--;
+        cursor->skip = 0;
+    }
+}
+
+// append the next len bytes of the caller's buffers to pieces and move past them. Returns the
+// number of pieces added, or -1 if that would take more than max; the cursor moves either way
+int takePieces(VectorCursor *cursor, int len, struct iovec *pieces, int max)
+{
+    int added = 0;
+    settleCursor(cursor);
+    while (len > 0 && cursor->count > 0)
+    {
+        size_t left = cursor->iov->iov_len - cursor->skip;
+        size_t count = left < (size_t)len ? left : (size_t)len;
+        if (added < max)
+        {
+            pieces[added].iov_base = (unsigned char *)cursor->iov->iov_base + cursor->skip;
+            pieces[added].iov_len = count;
+        }
+        added++;
+        len -= (int)count;
+        cursor->skip += count;
+        settleCursor(cursor);
+    }
+    return added > max ? -1 : added;
+}
+
+// copy len bytes between data and the caller's buffers, into them when toCaller is set
+void copyVector(VectorCursor *cursor, unsigned char *data, int len, int toCaller)
+{
+    settleCursor(cursor);
+    while (len > 0 && cursor->count > 0)
+    {
+        unsigned char *buffer = (unsigned char *)cursor->iov->iov_base + cursor->skip;
+        size_t left = cursor->iov->iov_len - cursor->skip;
+        int count = left < (size_t)len ? (int)left : len;
+        if (toCaller)
+        {
+            memcpy(buffer, data, count);
+        }
+        else
+        {
+            memcpy(data, buffer, count);
+        }
+        data += count;
+        len -= count;
+        cursor->skip += count;
+        settleCursor(cursor);
+    }
+}
+
+// CRC32C of a block laid out over count pieces
+uint32_t piecesChecksum(struct iovec *pieces, int count)
+{
+    uint32_t crc = 0;
+    for (int i = 0; i < count; i++)
+    {
+        crc = crc32c_extend(crc, pieces[i].iov_base, pieces[i].iov_len);
+    }
+    return crc;
+}
+
+// read len bytes of file content, starting within bytes into the payload of block and running on
+// through the blocks after it, straight into the caller's buffers with one preadv() per batch of
+// blocks. Block headers and the parts of the first and last block outside the range land in scratch
+// space. A block that would map onto too many small buffers is read whole and copied out
+int readRunVector(int block, int within, int len, VectorCursor *cursor)
+{
+    static unsigned char scratch[READAHEAD_MAX_BLOCKS][BLOCKSIZE];
+    static struct iovec pieces[VECTOR_PIECES];
+    int first[READAHEAD_MAX_BLOCKS + 1];
+    VectorCursor staged[READAHEAD_MAX_BLOCKS];
+    int stagedAt[READAHEAD_MAX_BLOCKS];
+    int stagedLen[READAHEAD_MAX_BLOCKS];
+    int stagedFrom[READAHEAD_MAX_BLOCKS];
+    while (len > 0)
+    {
+        int n = 0;
+        int blocks = 0;
+        int copies = 0;
+        while (len > 0 && blocks < READAHEAD_MAX_BLOCKS && n + BLOCK_PIECES + 2 <= VECTOR_PIECES)
+        {
+            unsigned char *spare = scratch[blocks];
+            int count = dataPayload - within < len ? dataPayload - within : len;
+            first[blocks] = n;
+            VectorCursor at = *cursor;
+            int head = dataHeader + within;
+            int tail = BLOCKSIZE - head - count;
+            if (head > 0)
+            {
+                pieces[n++] = (struct iovec){spare, (size_t)head};
+            }
+            int added = takePieces(cursor, count, pieces + n, BLOCK_PIECES);
+            if (added < 0)
+            {
+                // the whole block goes to scratch space and is copied out once it is read
+                n = first[blocks];
+                pieces[n++] = (struct iovec){spare, BLOCKSIZE};
+                staged[copies] = at;
+                stagedAt[copies] = blocks;
+                stagedFrom[copies] = head;
+                stagedLen[copies++] = count;
+                tail = 0;
+            }
+            else
+            {
+                n += added;
+            }
+            if (tail > 0)
+            {
+                pieces[n++] = (struct iovec){spare + head + count, (size_t)tail};
+            }
+            len -= count;
+            within = 0;
+            blocks++;
+        }
+        first[blocks] = n;
+        if (bufferedReadRunv(disk, block, blocks, pieces, n) == -1)
+        {
+            fprintf(stderr, "Error: Unable to read file content from disk.\n");
+            return DISK_READ_ERROR;
+        }
+        for (int b = 0; b < blocks && (mountedFeatures & FEATURE_CHECKSUMS); b++)
+        {
+            if (verifyChecksumEntry(block + b, piecesChecksum(pieces + first[b], first[b + 1] - first[b])) < 0)
+            {
+                return CHECKSUM_ERROR;
+            }
+        }
+        for (int c = 0; c < copies; c++)
+        {
+            copyVector(&staged[c], scratch[stagedAt[c]] + stagedFrom[c], stagedLen[c], 1);
+        }
+        block += blocks;
+    }
+    return 1;
+}
+
+// write size bytes of the caller's buffers as a new extent for file with one pwritev() per batch
+// of blocks. Headers and the zeros after the content come from scratch space; a block that would
+// take too many small buffers is copied together in scratch space instead. Returns the first block
+// of the extent, 0 for no content, and leaves the inode to the caller
+int writeExtentVector(FileEntry *file, VectorCursor *cursor, int size)
+{
+    static unsigned char scratch[READAHEAD_MAX_BLOCKS][BLOCKSIZE];
+    static unsigned char zeros[BLOCKSIZE];
+    static struct iovec pieces[VECTOR_PIECES];
+    int first[READAHEAD_MAX_BLOCKS + 1];
+    int num_blocks = dataBlocks(size);
+    if (num_blocks == 0)
+    {
+        return 0;
+    }
+    quotaOwner = file->inode->owner;
+    throttleIO(quotaOwner, size);
+    if (chargeQuota(num_blocks) < 0)
+    {
+        return QUOTA_ERROR;
+    }
+    int start = findExtentRun(num_blocks);
+    if (start == -2)
+    {
+        fprintf(stderr, "Error: No free blocks available.\n");
+        adjustQuota(-num_blocks);
+        return FREE_BLOCK_ERROR;
+    }
+    for (int b = 0; b < num_blocks; b++)
+    {
+        allocate_block(mountedBitmap, start + b);
+    }
+    int done = 0;
+    while (done < num_blocks)
+    {
+        int n = 0;
+        int blocks = 0;
+        while (done + blocks < num_blocks && blocks < READAHEAD_MAX_BLOCKS && n + BLOCK_PIECES + 2 <= VECTOR_PIECES)
+        {
+            int l = done + blocks;
+            unsigned char *spare = scratch[blocks];
+            int count = size - l * dataPayload < dataPayload ? size - l * dataPayload : dataPayload;
+            first[blocks] = n;
+            stampDataHeader(spare, l + 1 < num_blocks ? start + l + 1 : 0);
+            if (dataHeader > 0)
+            {
+                pieces[n++] = (struct iovec){spare, (size_t)dataHeader};
+            }
+            VectorCursor at = *cursor;
+            int added = takePieces(cursor, count, pieces + n, BLOCK_PIECES);
+            if (added < 0)
+            {
+                memset(spare + dataHeader, 0, dataPayload);
+                copyVector(&at, spare + dataHeader, count, 0);
+                n = first[blocks];
+                pieces[n++] = (struct iovec){spare, BLOCKSIZE};
+            }
+            else
+            {
+                n += added;
+                if (count < dataPayload)
+                {
+                    pieces[n++] = (struct iovec){zeros, (size_t)(dataPayload - count)};
+                }
+            }
+            blocks++;
+        }
+        first[blocks] = n;
+        int result = 1;
+        for (int b = 0; b < blocks && result > 0; b++)
+        {
+            uint32_t crc = (mountedFeatures & FEATURE_CHECKSUMS) ? piecesChecksum(pieces + first[b], first[b + 1] - first[b]) : 0;
+            result = setChecksumEntry(start + done + b, crc) < 0 ? DISK_READ_ERROR : 1;
+        }
+        if (result > 0 && bufferedWriteRunv(disk, start + done, blocks, pieces, n) == -1)
+        {
+            fprintf(stderr, "Error: Unable to write file content to disk.\n");
+            result = WRITE_ERROR;
+        }
+        if (result < 0)
+        {
+            releaseBlocks(start, num_blocks);
+            return result;
+        }
+        done += blocks;
+    }
+    return start;
+}
+
+// bytes covered by the caller's buffers, -1 for a bad count or more than a file can hold
+int vectorSize(const struct iovec *iov, int iovcnt)
+{
+    long total = 0;
+    if (iov == NULL || iovcnt < 0)
+    {
+        return -1;
+    }
+    for (int i = 0; i < iovcnt; i++)
+    {
+        total += (long)iov[i].iov_len;
+        if (total > 65535)
+        {
+            return -1;
+        }
+    }
+    return (int)total;
+}
+
+int tfs_readv(fileDescriptor FD, const struct iovec *iov, int iovcnt)
+{
+    /* reads from the file pointer into the buffers of iov one after the other,
+    like readv(2), and moves the file pointer past what was read. Uncompressed
+    content goes from the disk straight into the buffers with one preadv()
+    per run of blocks, holes are filled with zeros. Returns the number of
+    bytes read, 0 at the end of the file. */
+    static unsigned char zeros[BLOCKSIZE];
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
+    {
+        return FILE_NOT_FOUND_ERROR;
+    }
+    Inode *inode = file->inode;
+    if (inode->flags & INODE_DIRECTORY)
+    {
+        return IS_A_DIRECTORY_ERROR;
+    }
+    int total = vectorSize(iov, iovcnt);
+    if (total < 0)
+    {
+        return READ_ERROR;
+    }
+    int pos = file->offset;
+    int len = inode->file_size - pos < total ? inode->file_size - pos : total;
+    if (len <= 0)
+    {
+        return 0;
+    }
+    throttleIO(inode->owner, len);
+    VectorCursor cursor = {iov, iovcnt, 0};
+    int result = 1;
+    if (inode->flags & INODE_COMPRESSED)
+    {
+        for (int p = pos; p < pos + len && result > 0;)
+        {
+            int chunk = p / COMPRESS_CHUNK_SIZE;
+            result = file->cached_chunk == chunk ? 1 : loadChunk(file, chunk);
+            int count = (chunk + 1) * COMPRESS_CHUNK_SIZE - p < pos + len - p ? (chunk + 1) * COMPRESS_CHUNK_SIZE - p : pos + len - p;
+            if (result > 0)
+            {
+                copyVector(&cursor, file->chunk_cache + p % COMPRESS_CHUNK_SIZE, count, 1);
+            }
+            p += count;
+        }
+    }
+    else if (inode->flags & INODE_SPARSE)
+    {
+        for (int p = pos; p < pos + len && result > 0;)
+        {
+            int end = 0;
+            int block = sparseBlock(inode, p / dataPayload, &end);
+            int within = p % dataPayload;
+            int count = dataPayload - within;
+            if (block != 0)
+            {
+                count = (end - block) * dataPayload - within;
+            }
+            count = count < pos + len - p ? count : pos + len - p;
+            if (block == 0)
+            {
+                copyVector(&cursor, zeros, count, 1);
+            }
+            else
+            {
+                result = readRunVector(block, within, count, &cursor);
+            }
+            p += count;
+        }
+    }
+    else
+    {
+        result = readRunVector(inode->file_index + pos / dataPayload, pos % dataPayload, len, &cursor);
+    }
+    if (result < 0)
+    {
+        return result;
+    }
+    if (file->advice == TFS_ADVICE_NOREUSE)
+    {
+        adviseRange(file, pos, len, POSIX_FADV_DONTNEED);
+    }
+    file->offset = pos + len;
+    return len;
+}
+
+int tfs_writev(fileDescriptor FD, const struct iovec *iov, int iovcnt)
+{
+    /* replaces the content of a file with the buffers of iov one after the
+    other, as tfs_writeFile does with a single buffer, and sets the file
+    pointer to 0. A plain file is written from the buffers straight to its
+    new extent with one pwritev() per run of blocks, without copying them
+    into one buffer first. Compressed, deduplicated and preallocated files
+    need the whole content at once, so for them the buffers are gathered and
+    passed to tfs_writeFile. */
+    static char content[65535];
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: File not found in open file table.\n");
+        return FILE_NOT_FOUND_ERROR;
+    }
+    int size = vectorSize(iov, iovcnt);
+    if (size < 0)
+    {
+        fprintf(stderr, "file size needs to be less than 65535 to fit on 2 bytes.\n");
+        return WRITE_ERROR;
+    }
+    VectorCursor cursor = {iov, iovcnt, 0};
+    int compress = file->compress >= 0 ? file->compress : compressByDefault;
+    if (compress || dedupEnabled || (file->inode->flags & INODE_PREALLOCATED))
+    {
+        copyVector(&cursor, (unsigned char *)content, size, 0);
+        return tfs_writeFile(FD, content, size);
+    }
+    // fill a new extent, then let go of the old content the way tfs_writeFile does
+    quotaOwner = file->inode->owner;
+    int held = chargedBlocks(file->inode);
+    if (checkQuota(held, dataBlocks(size)) < 0)
+    {
+        return QUOTA_ERROR;
+    }
+    adjustQuota(-held);
+    int start = writeExtentVector(file, &cursor, size);
+    if (start == FREE_BLOCK_ERROR && makeRoom(file, dataBlocks(size), &held))
+    {
+        start = writeExtentVector(file, &cursor, size);
+    }
+    adjustQuota(held);
+    if (start < 0)
+    {
+        return start;
+    }
+    int result = releaseContent(file);
+    if (result < 0)
+    {
+        return result;
+    }
+    if (flushChecksumTable() < 0 || flushDedupIndex() < 0)
+    {
+        return WRITE_ERROR;
+    }
+    file->inode->file_index = start;
+    file->inode->file_size = size;
+    file->inode->stored_size = size;
+    file->inode->flags = 0;
+    file->inode->dirty = 1;
+    file->offset = 0;
+    return 1;
+}
+
+// Access hints
+int tfs_advise(fileDescriptor FD, int offset, int len, int advice)
+{
+    /* tells TinyFS how a file is going to be read, like posix_fadvise.
+    TFS_ADVICE_SEQUENTIAL reads ahead with the largest window from the first
+    miss on and TFS_ADVICE_RANDOM reads just the block asked for. With
+    TFS_ADVICE_NOREUSE every run is dropped from the page cache once the
+    reader is past it, so a scan of a large file does not push out the
+    blocks other files keep using. These three and TFS_ADVICE_NORMAL hold for
+    the whole file until the next of them. TFS_ADVICE_WILLNEED has the kernel
+    start reading bytes offset to offset + len - 1 in the background and
+    TFS_ADVICE_DONTNEED drops them from the page cache and the file's buffers.
+    A disk opened with O_DIRECT has no page cache, so there WILLNEED reads the
+    start of the range into the file's readahead buffer right away. len 0
+    runs to the end of the file. An unknown advice fails with ADVICE_ERROR,
+    a negative offset or len with RANGE_ERROR. */
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
+    }
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
+    {
+        return FILE_NOT_FOUND_ERROR;
+    }
+    Inode *inode = file->inode;
+    if (inode->flags & INODE_DIRECTORY)
+    {
+        return IS_A_DIRECTORY_ERROR;
+    }
+    if (advice < TFS_ADVICE_NORMAL || advice > TFS_ADVICE_NOREUSE)
+    {
+        fprintf(stderr, "Error: Invalid access hint %d.\n", advice);
+        return ADVICE_ERROR;
+    }
+    if (offset < 0 || len < 0)
+    {
+        fprintf(stderr, "Error: Invalid range of %d bytes at offset %d for an access hint.\n", len, offset);
+        return RANGE_ERROR;
+    }
+    if (len == 0)
+    {
+        len = inode->file_size - offset;
+    }
+    switch (advice)
+    {
+    case TFS_ADVICE_WILLNEED:
+        if (diskAlignment(disk) == BLOCKSIZE)
+        {
+            adviseRange(file, offset, len, POSIX_FADV_WILLNEED);
+        }
+        else if (offset < inode->file_size && (inode->flags & INODE_COMPRESSED))
+        {
+            int chunk = offset / COMPRESS_CHUNK_SIZE;
+            return file->cached_chunk == chunk ? 1 : loadChunk(file, chunk);
+        }
+        else if (offset < inode->file_size)
+        {
+            int end = inode->file_index + dataBlocks(inode->stored_size);
+            int block = inode->file_index + offset / dataPayload;
+            if (inode->flags & INODE_SPARSE)
+            {
+                block = sparseBlock(inode, offset / dataPayload, &end);
+            }
+            if (block == 0)
+            {
+                return 1; // a hole needs no reading
+            }
+            // one run covering the range, the window the reader had is kept for its next miss
+            int window = file->ra_window;
+            int blocks = (offset % dataPayload + len + dataPayload - 1) / dataPayload;
+            file->ra_window = blocks < READAHEAD_MAX_BLOCKS ? blocks : READAHEAD_MAX_BLOCKS;
+            int result = fillReadahead(file, block, end);
+            file->ra_window = window;
+            return result;
         }
-        if (num_blocks > 65535)
+        return 1;
+    case TFS_ADVICE_DONTNEED:
+        adviseRange(file, offset, len, POSIX_FADV_DONTNEED);
+        file->ra_count = 0;
+        file->cached_chunk = -1;
+        return 1;
+    case TFS_ADVICE_SEQUENTIAL:
+        file->ra_window = READAHEAD_MAX_BLOCKS;
+        break;
+    case TFS_ADVICE_RANDOM:
+    case TFS_ADVICE_NORMAL:
+        file->ra_window = 1;
+        break;
+    }
+    file->advice = advice;
+    return 1;
+}
+
+// Quotas and throttling
+// add the data blocks of every file below dir to the counter of its owner. Files sharing a
+// dedup extent are each charged for it, snapshot copies are not charged at all
+void countQuotaUsage(int dir)
+{
+    unsigned char directory[BLOCKSIZE];
+    if (bufferedRead(disk, dir, directory) == -1)
+    {
+        return;
+    }
+    for (int i = 4; i < 251; i += 2)
+    {
+        int value = (directory[i] << 8) | directory[i + 1];
+        Inode *inode = value == 0 ? NULL : loadInode(value);
+        if (inode == NULL)
         {
-            fprintf(stderr, "Error: Disk size too large.\n");
-            closeDisk(disk);
-            return -123; // make an error code
+            continue;
         }
-        unsigned char *bitmap_data = bitmap->free_blocks;
-        superblock[4] = (unsigned char)bitmap_size;
-
-        // Split num_blocks into two bytes
-        unsigned char num_blocks_high_byte = (num_blocks >> 8) & 0xFF; // Most significant byte
-        unsigned char num_blocks_low_byte = num_blocks & 0xFF;         // Least significant byte
-
-        // Write the two bytes to superblock
-        superblock[5] = num_blocks_high_byte; // Write most significant byte to index 5
-        superblock[6] = num_blocks_low_byte;  // Write least significant byte to index 6
-
-        for (int i = 0; i < bitmap_size; i++)
+        if (inode->flags & INODE_DIRECTORY)
         {
-            // printf("writing bitmap data\n");
-            superblock[i + 7] = bitmap_data[i]; // Start writing from index 7 onwards
-            // printf("bitmap data is %d\n", bitmap_data[i]);
+            countQuotaUsage(inode->file_index);
         }
-        // Print contents of superblock in bytes
-        // for (int i = 0; i < BLOCKSIZE; i++)
-        // {
-        //     printf("%02X ", superblock[i]);
-        // }
-        // printf("\n");
-        if (writeBlock(disk, 0, superblock) == -1)
+        else if (inode->flags & INODE_SPARSE)
         {
-            fprintf(stderr, "Error: Unable to write superblock to disk.\n");
-            closeDisk(disk);
-            return WRITE_ERROR;
+            for (int r = 0; r < inode->run_count; r++)
+            {
+                quotaUsed[inode->owner] += inode->runs[r].length;
+            }
         }
-
-        if (writeBlock(disk, 1, rootDirectory) == -1)
+        else
         {
-            fprintf(stderr, "Error: Unable to write root directory to disk.\n");
-            closeDisk(disk);
-            return WRITE_ERROR;
+            quotaUsed[inode->owner] += dataBlocks(inode->stored_size);
         }
-        // printf("tfs create has all went through\n");
-        // make success code for mkfs
     }
-    return MKFS_SUCCESS;
 }
 
-int tfs_mount(char *diskname)
+int tfs_setOwner(int owner)
 {
-    // check if already mounted
-    if (mounted)
+    /* makes owner, 0 to QUOTA_MAX_OWNERS - 1, the owner of the files and
+    directories created from now on. The data blocks of a file count against
+    the quota of its owner whoever writes them, and its reads and writes
+    against the owner's throttle. Files of older images belong to owner 0. */
+    if (owner < 0 || owner >= QUOTA_MAX_OWNERS)
     {
-        fprintf(stderr, "Error: File system already mounted.\n");
-        return MOUNTED_ERROR;
+        return QUOTA_ERROR;
     }
+    currentOwner = owner;
+    return 1;
+}
 
-    disk = openDisk(diskname, 0);
-    if (disk < 0)
+int tfs_setQuota(int owner, int blocks)
+{
+    /* limits the data blocks the files of owner may hold to blocks, 0 for no
+    limit. Allocations that would go past it fail with QUOTA_ERROR, lowering
+    the limit below what is in use only stops further growth. The first call
+    for an image allocates its quota table and counts what every owner
+    already uses, from then on the counters are kept up to date on every
+    allocation and free and written along with the superblock. */
+    if (!mounted)
     {
-        return DISK_ERROR;
+        return MOUNTED_ERROR;
     }
-
-    char superblock_data[BLOCKSIZE];
-    if (readBlock(disk, 0, superblock_data) == -1)
+    if (readOnly)
     {
-        fprintf(stderr, "Error: Unable to read superblock from disk.\n");
-        closeDisk(disk);
-        return DISK_READ_ERROR;
+        return READ_ONLY_ERROR;
     }
-
-    // check for magic number
-    if (superblock_data[1] != 0x44)
+    if (owner < 0 || owner >= QUOTA_MAX_OWNERS || blocks < 0 || blocks > 65535)
     {
-        fprintf(stderr, "Error: Incorrect magic number. Not a TinyFS file system.\n");
-        closeDisk(disk);
-        return MAGIC_NUMBER_ERROR;
+        return QUOTA_ERROR;
     }
-
-    int bitmap_size = superblock_data[4];
-    int num_blocks = (superblock_data[5] << 8) | superblock_data[6];
-    // printf("bitmap size is %d\n", bitmap_size);
-    // printf("num blocks is %d\n", num_blocks);
-    unsigned char *bitmap_data = (unsigned char *)malloc(bitmap_size);
-
-    for (int i = 0; i < bitmap_size; i++)
+    if (quotaBlock == 0)
     {
-        bitmap_data[i] = superblock_data[i + 7];
+        // the table is found through a superblock byte the bitmap of the largest images needs
+        if (7 + mountedBitmap->bitmap_size > QUOTA_TABLE_LOC)
+        {
+            fprintf(stderr, "Error: No room in the superblock for a quota table.\n");
+            return QUOTA_ERROR;
+        }
+        int start = find_free_run(mountedBitmap, pinnedBlocks(), 1);
+        if (start < 0 || start > 255)
+        {
+            fprintf(stderr, "Error: No room for the quota table.\n");
+            return FREE_BLOCK_ERROR;
+        }
+        allocate_block(mountedBitmap, start);
+        memset(quotaLimit, 0, sizeof(quotaLimit));
+        memset(quotaUsed, 0, sizeof(quotaUsed));
+        countQuotaUsage(1);
+        quotaBlock = start;
+        mountedFeatures |= FEATURE_QUOTAS;
     }
-
-    Bitmap *bitmap = create_bitmap(bitmap_size, num_blocks, bitmap_data);
-    mountedBitmap = bitmap;
-    mounted = 1;
-    // printf("File system mounted successfully: %s\n", diskname);
-    currMountedFS = (char *)malloc(strlen(diskname));
-    strcpy(currMountedFS, diskname);
-    return MOUNT_SUCCESS;
+    quotaLimit[owner] = blocks;
+    quotaDirty = 1;
+    return writeSuperblock() < 0 ? WRITE_ERROR : 1;
 }
 
-int tfs_unmount(void)
-{    /* tfs_mount(char *diskname) “mounts” a TinyFS file system located within
-    ‘diskname’. tfs_unmount(void) “unmounts” the currently mounted file
-    system. As part of the mount operation, tfs_mount should verify the file
-    system is the correct type. In tinyFS, only one file system may be
-    mounted at a time. Use tfs_unmount to cleanly unmount the currently
-    mounted file system. Must return a specified success/error code. */
-
+int tfs_quotaUsage(int owner, int *used, int *limit)
+{
+    /* fills used with the data blocks charged to owner and limit with its
+    quota, 0 for none. Returns 0 with both set to 0 when the image has no
+    quota table yet, nothing is counted before the first tfs_setQuota. */
     if (!mounted)
     {
-        fprintf(stderr, "Error: No file system mounted.\n");
         return MOUNTED_ERROR;
     }
-    mounted = 0;
-    printf("File system unmounted successfully.\n");
-    return UNMOUNT_SUCCESS;
+    if (owner < 0 || owner >= QUOTA_MAX_OWNERS)
+    {
+        return QUOTA_ERROR;
+    }
+    *used = quotaBlock == 0 ? 0 : quotaUsed[owner];
+    *limit = quotaBlock == 0 ? 0 : quotaLimit[owner];
+    return quotaBlock == 0 ? 0 : 1;
 }
 
-fileDescriptor tfs_openFile(char *name)
+int tfs_setThrottle(int owner, int bytesPerSecond, int burst)
 {
-    /* Creates or Opens a file for reading and writing on the currently
-    mounted file system. Creates a dynamic resource table entry for the file,
-    and returns a file descriptor (integer) that can be used to reference
-    this entry while the filesystem is mounted. */
-    time_t t;
+    /* limits the bytes the files of owner read and write through the API to
+    bytesPerSecond, 0 for no limit, with a token bucket of burst bytes (0
+    for one second's worth). A call over the budget sleeps until the debt it
+    ran up is paid back, so the cost of the check does not depend on the
+    size of the transfer. The limit holds for the rest of the process and is
+    not stored on the image. */
+    if (owner < 0 || owner >= QUOTA_MAX_OWNERS || bytesPerSecond < 0 || burst < 0)
+    {
+        return QUOTA_ERROR;
+    }
+    Throttle *throttle = &throttles[owner];
+    throttle->rate = bytesPerSecond;
+    throttle->burst = burst > 0 ? burst : bytesPerSecond;
+    throttle->tokens = throttle->burst;
+    clock_gettime(CLOCK_MONOTONIC, &throttle->last);
+    return 1;
+}
 
+// Compression
+int tfs_setCompression(int enabled)
+{
+    /* turns compression on or off for every file written on this mount that
+    has no setting of its own. Lasts until unmount. */
     if (!mounted)
     {
-        fprintf(stderr, "Error: No file system mounted.\n");
-        return MOUNTED_ERROR; // Or define an appropriate error code
+        return MOUNTED_ERROR;
     }
+    compressByDefault = enabled ? 1 : 0;
+    return 1;
+}
 
-    // Check if the file already exists in the dynamic resource table
-    FileEntry *current = openFileTable;
-    while (current != NULL)
+int tfs_setFileCompression(fileDescriptor FD, int enabled)
+{
+    /* turns compression on or off for the next tfs_writeFile of one file.
+    Already written content keeps the form recorded in its inode. */
+    FileEntry *file = findFileEntryByFD(openFileTable, FD);
+    if (file == NULL)
     {
-        if (strcmp(current->filename, name) == 0)
-        {
-            // File already exists, return its file descriptor
-            return current->fileDescriptor;
-        }
-        current = current->next;
+        return FILE_NOT_FOUND_ERROR;
     }
+    file->compress = enabled ? 1 : 0;
+    return 1;
+}
 
-    // File does not exist, creates a dynamic resource table entry for the file, returns a file descriptor
-    int fd = fds++;
-    // printf("file descriptor %d created for file %s\n", fd, name);
-
-    int free_block = find_free_blocks_of_size(mountedBitmap, 1);
-    // printf("free block is %d\n", free_block);
-    if (free_block == -2)
+// Deduplication
+int tfs_setDedup(int enabled)
+{
+    /* turns deduplication of new file content on or off for this mount.
+    The first time it is turned on for an image, a dedup index is allocated
+    and recorded in the superblock. Files written while it is on share the
+    extent of any indexed file with identical content, deleting or
+    rewriting a shared file only drops its reference. */
+    if (!mounted)
     {
-        fprintf(stderr, "Error: No free blocks available.\n");
-        return FREE_BLOCK_ERROR;
+        return MOUNTED_ERROR;
     }
-    allocate_block(mountedBitmap, free_block);
-    // printf("block allocated\n");
-    // multiply by 256 to get index relative to the disk for later calculations
-    // we store it as a 16 bit number so we can store up to 65536 blocks
-    // seek to root directory block where data is written
-    // if (lseek(disk, ROOT_DIRECTORY_LOC + 4, SEEK_SET) == -1)
-    // {
-    //     fprintf(stderr, "Error: Unable to seek to root directory block.\n");
-    //     closeDisk(disk);
-    //     return SEEK_ERROR;
-    // }
-
-    int inode_index = free_block;
-    FileEntry *newFileEntry = createFileEntry(name, fd, inode_index);
-    unsigned char rootDirectory[BLOCKSIZE];
-
-    if (readBlock(disk, 1, rootDirectory) == -1)
+    if (readOnly)
     {
-        fprintf(stderr, "Error: Unable to read root directory from disk.\n");
-        closeDisk(disk);
-        return DISK_READ_ERROR;
+        return READ_ONLY_ERROR;
     }
-
-    for (int i = 4; i < 251; i += 2)
+    if (enabled && dedupIndexBlock == 0)
     {
-        // need two bytes to write up to block 65535 for inodes
-        int value = (rootDirectory[i] << 8) | rootDirectory[i + 1];
-        // if value is 0 (unallocated) then thats where next inode mapping will be
-        if (value == 0)
+        int start = find_free_run(mountedBitmap, pinnedBlocks(), DEDUP_INDEX_BLOCKS);
+        if (start < 0 || start > 255)
         {
-            rootDirectory[i] = (inode_index >> 8) & 0xFF;
-            rootDirectory[i + 1] = inode_index & 0xFF;
-            break;
+            fprintf(stderr, "Error: No room for the dedup index.\n");
+            return FREE_BLOCK_ERROR;
+        }
+        for (int i = 0; i < DEDUP_INDEX_BLOCKS; i++)
+        {
+            allocate_block(mountedBitmap, start + i);
+            dedupDirty[i] = 1;
+        }
+        memset(dedupIndex, 0, sizeof(dedupIndex));
+        dedupLoaded = 1;
+        dedupIndexBlock = start;
+        mountedFeatures |= FEATURE_DEDUP;
+        if (flushDedupIndex() < 0 || writeSuperblock() < 0)
+        {
+            return WRITE_ERROR;
         }
     }
-    // printf("found space for next inode mapping\n");
-    // now create contents for inode
-    unsigned char inode[BLOCKSIZE];
-    if (readBlock(disk, inode_index, inode) == -1)
+    dedupEnabled = enabled ? 1 : 0;
+    return 1;
+}
+
+// Snapshots
+int tfs_snapshot(char *name)
+{
+    /* freezes the root directory, inodes and allocation state of the mounted
+    file system into a read only snapshot that tfs_mountSnapshot can mount.
+    Only metadata is copied: every directory and every inode get a copy,
+    and the data extents they point at are held so later writes and deletes
+    go to fresh blocks instead of overwriting them. */
+    if (!mounted)
     {
-        fprintf(stderr, "Error: Unable to read inode from disk.\n");
-        closeDisk(disk);
-        return DISK_READ_ERROR;
+        return MOUNTED_ERROR;
+    }
+    if (readOnly)
+    {
+        return READ_ONLY_ERROR;
     }
-    inode[0] = 0x02; // Set the first byte to 0x02 to represent inode
-
-    // INODE STRUCTURE [0] = 0x02, [1] = 0x44, [2] = block number of first block of file, [3] = empty [4-12] = file name and byte 12 will be null character
-    //  for is file name is exactly 8 characters long
     if (strlen(name) > 8)
     {
-        fprintf(stderr, "Error: File name exceeds the maximum limit of 8 characters.\n");
+        fprintf(stderr, "Error: Snapshot name exceeds the maximum limit of 8 characters.\n");
         return NAME_LENGTH_ERROR;
     }
-    for (int i = 4; i < 12; i++)
+    if (SNAPSHOT_BITMAP_LOC + mountedBitmap->bitmap_size > BLOCKSIZE)
     {
-        inode[i] = name[i - 4];
+        fprintf(stderr, "Error: Disk too large for snapshots.\n");
+        return BITMAP_SIZE_ERROR;
+    }
+    unsigned char record[BLOCKSIZE];
+    if (findSnapshot(name, record, NULL) > 0)
+    {
+        fprintf(stderr, "Error: Snapshot %s already exists.\n", name);
+        return SNAPSHOT_EXISTS_ERROR;
     }
-    // printf("inode contents: ");
-    // for (int i = 0; i < BLOCKSIZE; i++)
-    // {
-    //     printf("%02x ", inode[i]);
-    // }
-    // printf("\n");
-    // inode[12] will be null character which blocks are set to by default
-    // inode[13] and [inode 14] will be file size which are set to 0/null again by default
-
-    // inode[15] will be creation timestamp (8 bytes)
-    time(&t);
-    struct tm *local_time = localtime(&t);
 
-    // printf("AAA Current local time: %02d:%02d:%02d\n", local_time->tm_hour, local_time->tm_min, local_time->tm_sec);
-    // printf("Size of time_t: %zu bytes\n", sizeof(t));
-    // printf("size of tm_hour is %zu\n", sizeof(local_time->tm_hour));
-    // printf("size of tm_min is %zu\n", sizeof(local_time->tm_min));
-    // printf("size of tm_sec is %zu\n", sizeof(local_time->tm_sec));
-    // Convert tm_hour to bytes
-    unsigned char hour_bytes[sizeof(local_time->tm_hour)];
-    for (int i = 0; i < sizeof(local_time->tm_hour); i++)
+    // inode blocks are copied raw, so cached changes have to reach them first
+    if (flushInodes() < 0)
     {
-        hour_bytes[i] = *((unsigned char *)&local_time->tm_hour + i);
+        return WRITE_ERROR;
     }
 
-    // Write hour_bytes to inode starting at i = 15
-    for (int i = 0; i < sizeof(local_time->tm_hour); i++)
+    // the record doubles as the bitmap of every block the snapshot holds
+    int allocated[256];
+    int count = 0;
+    int record_block = snapshotBlock(allocated, &count);
+    int frozen_root = -1;
+    memset(record, 0, BLOCKSIZE);
+    Bitmap held = {mountedBitmap->bitmap_size, mountedBitmap->num_blocks, record + SNAPSHOT_BITMAP_LOC};
+    initialize_free_blocks(&held);
+    if (record_block > 0)
     {
-        inode[i + 15] = hour_bytes[i];
+        frozen_root = snapshotDirectory(rootBlock, &held, allocated, &count);
     }
-    // Convert tm_min to bytes
-    unsigned char min_bytes[sizeof(local_time->tm_min)];
-    for (int i = 0; i < sizeof(local_time->tm_min); i++)
+    if (record_block < 0 || frozen_root < 0)
     {
-        min_bytes[i] = *((unsigned char *)&local_time->tm_min + i);
+        fprintf(stderr, "Error: Unable to copy the file system for the snapshot.\n");
+        for (int i = 0; i < count; i++)
+        {
+            free_block(mountedBitmap, allocated[i]);
+        }
+        return record_block < 0 ? record_block : frozen_root;
     }
-
-    // Write min_bytes to inode starting at i = 19
-    for (int i = 0; i < sizeof(local_time->tm_min); i++)
+    allocate_block(&held, record_block);
+    record[0] = SNAPSHOT;
+    record[1] = MAGIC_NUMBER;
+    record[2] = (unsigned char)snapshotList;
+    strncpy((char *)record + 4, name, 8);
+    record[SNAPSHOT_ROOT_LOC] = (frozen_root >> 8) & 0xFF;
+    record[SNAPSHOT_ROOT_LOC + 1] = frozen_root & 0xFF;
+    record[15] = (unsigned char)mountedFeatures;
+    record[16] = (unsigned char)mountedBitmap->bitmap_size;
+    if (bufferedWrite(disk, record_block, record) == -1)
     {
-        inode[i + 19] = min_bytes[i];
+        fprintf(stderr, "Error: Unable to write snapshot to disk.\n");
+        return WRITE_ERROR;
     }
-
-    // Convert tm_sec to bytes
-    unsigned char sec_bytes[sizeof(local_time->tm_sec)];
-    for (int i = 0; i < sizeof(local_time->tm_sec); i++)
+    snapshotList = record_block;
+    if (loadPinnedBitmap() < 0 || writeSuperblock() < 0)
     {
-        sec_bytes[i] = *((unsigned char *)&local_time->tm_sec + i);
+        return WRITE_ERROR;
     }
+    return 1;
+}
 
-    // Write sec_bytes to inode starting at i = 23
-    for (int i = 0; i < sizeof(local_time->tm_sec); i++)
+int tfs_deleteSnapshot(char *name)
+{
+    /* removes a snapshot. Its record, frozen root directory and inode copies
+    are freed, and data blocks it held become reusable once no other
+    snapshot holds them and the live file system has let go of them. */
+    if (!mounted)
     {
-        inode[i + 23] = sec_bytes[i];
+        return MOUNTED_ERROR;
     }
-    if (writeBlock(disk, inode_index, inode) == -1)
+    if (readOnly)
     {
-        fprintf(stderr, "Error: Unable to write inode to disk.\n");
-        closeDisk(disk);
-        return WRITE_ERROR;
+        return READ_ONLY_ERROR;
     }
-    unsigned char testInode[BLOCKSIZE];
-    if (readBlock(disk, inode_index, testInode) == -1)
+    unsigned char record[BLOCKSIZE];
+    int prev = 0;
+    int record_block = findSnapshot(name, record, &prev);
+    if (record_block < 0)
     {
-        fprintf(stderr, "Error: Unable to read root directory from disk.\n");
-        closeDisk(disk);
-        return DISK_READ_ERROR;
+        return record_block;
     }
-    if (writeBlock(disk, 1, rootDirectory) == -1)
+
+    // unlink the record from the list
+    if (prev == 0)
     {
-        fprintf(stderr, "Error: Unable to write root directory to disk.\n");
-        closeDisk(disk);
-        return WRITE_ERROR;
+        snapshotList = record[2];
+    }
+    else
+    {
+        unsigned char prevRecord[BLOCKSIZE];
+        if (bufferedRead(disk, prev, prevRecord) == -1)
+        {
+            return DISK_READ_ERROR;
+        }
+        prevRecord[2] = record[2];
+        if (bufferedWrite(disk, prev, prevRecord) == -1)
+        {
+            return WRITE_ERROR;
+        }
     }
 
-    if (readBlock(disk, 1, rootDirectory) == -1)
+    char freeBlock[BLOCKSIZE];
+    memset(freeBlock, 0, BLOCKSIZE);
+    freeBlock[0] = FREE_BLOCK;
+    freeBlock[1] = MAGIC_NUMBER;
+    int frozen_root = (record[SNAPSHOT_ROOT_LOC] << 8) | record[SNAPSHOT_ROOT_LOC + 1];
+    if (freeSnapshotDirectory(frozen_root, freeBlock) < 0)
     {
-        fprintf(stderr, "Error: Unable to read root directory from disk.\n");
-        closeDisk(disk);
         return DISK_READ_ERROR;
     }
-    insertFileEntry(&openFileTable, newFileEntry);
-    /* find first free location to place an inode block */
-    /* add a new entry in drt that refers to this filename
-     *     returns a fileDescriptor (temp->id) */
-    return fd;
+    bufferedWrite(disk, record_block, freeBlock);
+    free_block(mountedBitmap, record_block);
+    if (loadPinnedBitmap() < 0 || writeSuperblock() < 0)
+    {
+        return WRITE_ERROR;
+    }
+    return 1;
 }
 
-int tfs_closeFile(fileDescriptor FD)
+int tfs_mountSnapshot(char *diskname, char *name)
 {
-   /* Closes the file, de-allocates all system resources, and removes table
-    entry */
-
-    int result = deleteFileEntry(openFileTable, FD);
-    return result;
+    /* mounts the snapshot called name of the file system in diskname, read
+    only. Files are opened and read as usual, anything that would modify
+    the image returns READ_ONLY_ERROR. Unmount with tfs_unmount. */
+    return mountImage(diskname, name);
 }
 
-int tfs_writeFile(fileDescriptor FD, char *buffer, int size)
-{
-    /* Writes buffer ‘buffer’ of size ‘size’, which represents an entire
-    file’s content, to the file system. Previous content (if any) will be
-    completely lost. Sets the file pointer to 0 (the start of file) when
-    done. Returns success/error codes. */
-    // subtract 4 from block_size
-    int num_blocks = (size + (BLOCKSIZE - 4) - 1) / (BLOCKSIZE - 4);
-    // Iterate through all fileEntries in the openFileTable and print the fd
-    // printf("File Descriptors in openFileTable: ");
-    // FileEntry *allFileTable = openFileTable;
-    // while (allFileTable != NULL)
-    // {
-    //     printf("%d ", allFileTable->fileDescriptor);
-    //     allFileTable = allFileTable->next;
-    // }
-    // printf("\n");
 
-    FileEntry *file = findFileEntryByFD(openFileTable, FD);
-    if (file == NULL)
-    {
-        fprintf(stderr, "Error: File not found in open file table.\n");
-        return FILE_NOT_FOUND_ERROR;
-    }
-    // check if there is data already written to the file and if so deallocate it
-    if (file->file_size > 0)
-    {
-        int file_index = file->file_index;
-        int prev_num_blocks = (file->file_size + (BLOCKSIZE - 4) - 1) / (BLOCKSIZE - 4);
 
-        char freeBlock[BLOCKSIZE];
-        freeBlock[0] = 0x04;
-        freeBlock[1] = 0x44;
-        for (int i = 2; i < BLOCKSIZE; i++)
-        {
-            freeBlock[i] = 0x00;
-        }
-        for (int i = 0; i < prev_num_blocks; i++)
+// EXTRA CREDIT :,)
+
+
+// Batched metadata
+// directory block of a batch, read on first use and kept until the batch writes it out
+unsigned char *batchDirectory(int *blocks, unsigned char *tables, int *count, int block)
+{
+    for (int i = 0; i < *count; i++)
+    {
+        if (blocks[i] == block)
         {
-            if (writeBlock(disk, file_index + i, freeBlock) == -1)
-            {
-                fprintf(stderr, "Error: Unable to write free block to disk.\n");
-                closeDisk(disk);
-                return WRITE_ERROR;
-            }
-            free_block(mountedBitmap, file->file_index + i);
+            return tables + i * BLOCKSIZE;
         }
+    }
+    if (bufferedRead(disk, block, tables + *count * BLOCKSIZE) == -1)
+    {
+        return NULL;
+    }
+    blocks[*count] = block;
+    return tables + (*count)++ * BLOCKSIZE;
+}
 
-        // deallocate previous blocks allocated to a file
-        free_num_blocks(mountedBitmap, file->inode_index, prev_num_blocks);
-        // update file size to be 0 now temporarily until we write new data
-        file->file_size = 0;
+int tfs_createMany(char *names[], int n, fileDescriptor descriptors[])
+{
+    /* opens or creates n files at once, like calling tfs_openFile on each
+    name. descriptors[i] gets the descriptor for names[i], or the error for that
+    name. The inodes of new files are allocated in one pass over the bitmap
+    and written as contiguous runs, and every directory they go in is read
+    and written once. Returns how many names got a descriptor. */
+    if (!mounted)
+    {
+        return MOUNTED_ERROR;
     }
-
-    // find free blocks for new data for file
-    int free_block = find_free_blocks_of_size(mountedBitmap, num_blocks);
-    file->file_index = free_block;
-    if (free_block == -2)
+    if (readOnly)
     {
-        fprintf(stderr, "Error: No free blocks available.\n");
-        return FREE_BLOCK_ERROR;
+        return READ_ONLY_ERROR;
     }
-    unsigned char fileContent[BLOCKSIZE];
-    if (readBlock(disk, free_block, fileContent) == -1)
+    char (*leaves)[MAX_FILENAME_LENGTH + 1] = malloc(n * sizeof(*leaves));
+    int *parents = (int *)malloc(n * sizeof(int));
+    int *pending = (int *)malloc(n * sizeof(int)); // names to create, in order
+    int *blocks = (int *)malloc(n * sizeof(int));  // inode block of each pending name, -1 if it failed
+    int *dirBlocks = (int *)malloc(n * sizeof(int));
+    unsigned char *tables = (unsigned char *)malloc(n * BLOCKSIZE);
+    unsigned char *raw = (unsigned char *)malloc(n * BLOCKSIZE);
+    if (leaves == NULL || parents == NULL || pending == NULL || blocks == NULL || dirBlocks == NULL || tables == NULL || raw == NULL)
     {
-        fprintf(stderr, "Error: Unable to read file content from disk.\n");
-        closeDisk(disk);
-        return DISK_READ_ERROR;
+        free(leaves);
+        free(parents);
+        free(pending);
+        free(blocks);
+        free(dirBlocks);
+        free(tables);
+        free(raw);
+        return READ_ERROR;
     }
 
-    // write the data (which is 4 less than blocksize because 4 bytes used for metadata)
-    int i;
-    int remaining_size = size;
-    int chunk_size = 252;
-    int offset = 4;
-    
-    // calculate the block number of next block to link blocks in a file system
-    int next_block = free_block + 1;
-    int blocks_written = 1;
-    while (remaining_size > 0)
+    // resolve every name first against its directory table, read once, names that exist are simply opened
+    int count = 0;
+    int dirCount = 0;
+    for (int i = 0; i < n; i++)
     {
-        int current_chunk_size = (remaining_size < chunk_size) ? remaining_size : chunk_size;
-        // printf("current chunk size is %d\n", current_chunk_size);
-        for (i = 0; i < current_chunk_size; i++)
+        descriptors[i] = 0;
+        parents[i] = resolveParent(names[i], leaves[i]);
+        if (parents[i] < 0)
         {
-            fileContent[offset + i] = buffer[i];
+            descriptors[i] = parents[i];
+            continue;
         }
-        remaining_size -= current_chunk_size;
-        // printf("remaining size is %d\n", remaining_size);
-
-        // Fill the remaining space in the block with 0x00 if current_chunk_size is less than 252
-        if (current_chunk_size < chunk_size)
+        unsigned char *directory = batchDirectory(dirBlocks, tables, &dirCount, parents[i]);
+        if (directory == NULL)
         {
-            for (i = current_chunk_size; i < chunk_size; i++)
-            {
-                fileContent[offset + i] = 0x00;
-                // printf("i is %d\n", i+offset);
-            }
+            descriptors[i] = DISK_READ_ERROR;
+            continue;
         }
-        if (remaining_size != 0)
+        int exists = 0;
+        for (int e = 4; e < 251 && !exists; e += 2)
         {
-            if (next_block > 255)
-            {
-                fprintf(stderr, "next block size needs to be less than 255 to fit on byte.\n");
-                closeDisk(disk);
-                return -4; // make an error code
-            }
-            // set the link to next block for file data if there is still more data to be written
-            fileContent[2] = (unsigned char)next_block;
+            int value = (directory[e] << 8) | directory[e + 1];
+            Inode *inode = value != 0 ? loadInode(value) : NULL;
+            exists = inode != NULL && strcmp(inode->name, leaves[i]) == 0;
         }
-
-        // write the modified fileContent back to disk
-        if (writeBlock(disk, free_block, fileContent) == -1)
+        if (exists)
         {
-            fprintf(stderr, "Error: Unable to write file content to disk.\n");
-            closeDisk(disk);
-            return WRITE_ERROR;
+            descriptors[i] = tfs_openFile(names[i]);
+            continue;
+        }
+        int repeat = 0;
+        for (int j = 0; j < count && !repeat; j++)
+        {
+            repeat = parents[pending[j]] == parents[i] && strcmp(leaves[pending[j]], leaves[i]) == 0;
+        }
+        if (!repeat)
+        {
+            pending[count++] = i; // a repeated name is opened once its first copy exists
         }
-        // Print the block data written in bytes
-        // printf("Block %d data written: ", blocks_written++);
-        // for (i = 0; i < BLOCKSIZE; i++)
-        // {
-        //     printf("%02x ", fileContent[i]);
-        // }
-        // printf("\n");
-    }
-    file->file_size = size;
-    // printf("after editing file size\n");
-    unsigned char inode[BLOCKSIZE];
-    if (readBlock(disk, file->inode_index, inode) == -1)
-    {
-        fprintf(stderr, "Error: Unable to read inode from disk.\n");
-        closeDisk(disk);
-        return DISK_READ_ERROR;
-    }
-    // printf("block read\n");
-    if (free_block > 255)
-    {
-        fprintf(stderr, "next block size needs to be less than 255 to fit on byte.\n");
-        closeDisk(disk);
-        return -4; // make an error code
     }
-    // set the pointer to beginning of file in inode block
-    inode[2] = (unsigned char)free_block;
-    if (size > 65535)
+
+    // one pass over the bitmap for every inode block, contiguous when the disk allows
+    int found = find_free_list(mountedBitmap, pinnedBlocks(), count, blocks);
+    for (int j = 0; j < count; j++)
     {
-        fprintf(stderr, "file size needs to be less than 65535 to fit on 2 bytes.\n");
-        closeDisk(disk);
-        return -4; // make an error code
+        if (j >= found)
+        {
+            blocks[j] = -1;
+            descriptors[pending[j]] = FREE_BLOCK_ERROR;
+            continue;
+        }
+        allocate_block(mountedBitmap, blocks[j]);
     }
-    // split size into two unsigned char bytes
-    unsigned char size_byte1 = (unsigned char)(size >> 8);
-    unsigned char size_byte2 = (unsigned char)size;
 
-    // write size bytes to index 12 and 13 in inode
-    inode[13] = size_byte1;
-    inode[14] = size_byte2;
-
-    // write updated inode back to disk
-    // printf("writing inode back to disk\n");
-    // printf("inode_index is %d\n", file->inode_index);
-
-    if (writeBlock(disk, file->inode_index, inode) == -1)
+    // give each new inode a slot in its directory
+    for (int j = 0; j < found; j++)
     {
-        fprintf(stderr, "Error: Unable to write inode to disk.\n");
-        closeDisk(disk);
-        return WRITE_ERROR;
+        unsigned char *directory = batchDirectory(dirBlocks, tables, &dirCount, parents[pending[j]]);
+        int mapped = 0;
+        for (int i = 4; directory != NULL && i < 251 && !mapped; i += 2)
+        {
+            if (((directory[i] << 8) | directory[i + 1]) == 0)
+            {
+                directory[i] = (blocks[j] >> 8) & 0xFF;
+                directory[i + 1] = blocks[j] & 0xFF;
+                mapped = 1;
+            }
+        }
+        Inode *inode = mapped ? insertCachedInode(inodeCache, blocks[j]) : NULL;
+        if (inode == NULL)
+        {
+            if (mapped)
+            {
+                removeDirectoryEntry(directory, blocks[j]);
+            }
+            free_block(mountedBitmap, blocks[j]);
+            blocks[j] = -1;
+            descriptors[pending[j]] = directory == NULL ? DISK_READ_ERROR : mapped ? READ_ERROR : DIRECTORY_FULL_ERROR;
+            continue;
+        }
+        initInode(inode, leaves[pending[j]], 0, 0);
+        encodeInode(inode, raw + j * BLOCKSIZE);
     }
-    // printf("returning in this function\n");
-    return 1;
-}
 
-int tfs_deleteFile(fileDescriptor FD)
-{    /* deletes a file and marks its blocks as free on disk. */
-    if (!mounted)
+    // inodes go out as runs of consecutive blocks before any directory points at them
+    int result = 1;
+    for (int j = 0; j < found; j++)
     {
-        return MOUNTED_ERROR;
+        if (blocks[j] < 0)
+        {
+            continue;
+        }
+        int length = 1;
+        while (j + length < found && blocks[j + length] == blocks[j] + length)
+        {
+            length++;
+        }
+        if (bufferedWriteRun(disk, blocks[j], length, raw + j * BLOCKSIZE) == -1)
+        {
+            result = WRITE_ERROR;
+        }
+        j += length - 1;
     }
-    FileEntry *deleteMe = findFileEntryByFD(openFileTable, FD);
-    int file_index = deleteMe->file_index;
-    int prev_num_blocks = (deleteMe->file_size + (BLOCKSIZE - 4) - 1) / (BLOCKSIZE - 4);
-    // printf("prev num blocks is %d and file_index is %d for fd %d\n", prev_num_blocks, file_index, deleteMe->fileDescriptor);
-    char freeBlock[BLOCKSIZE];
-    freeBlock[0] = 0x04;
-    freeBlock[1] = 0x44;
-    for (int i = 2; i < BLOCKSIZE; i++)
+    int written = 0;
+    for (int i = 0; i < dirCount && result > 0; i++, written++)
     {
-        freeBlock[i] = 0x00;
+        if (bufferedWrite(disk, dirBlocks[i], tables + i * BLOCKSIZE) == -1)
+        {
+            result = WRITE_ERROR;
+        }
     }
-    for (int i = 0; i < prev_num_blocks; i++)
+    if (result < 0)
     {
-        if (writeBlock(disk, file_index + i, freeBlock) == -1)
+        // take every new inode back out of its directory, the bitmap and the cache, and put back
+        // the directory tables that already went out
+        for (int j = 0; j < found; j++)
         {
-            fprintf(stderr, "Error: Unable to write free block to disk.\n");
-            closeDisk(disk);
-            return WRITE_ERROR;
+            if (blocks[j] < 0)
+            {
+                continue;
+            }
+            removeDirectoryEntry(batchDirectory(dirBlocks, tables, &dirCount, parents[pending[j]]), blocks[j]);
+            free_block(mountedBitmap, blocks[j]);
+            removeCachedInode(inodeCache, blocks[j]);
+            blocks[j] = -1;
+        }
+        for (int i = 0; i < written; i++)
+        {
+            bufferedWrite(disk, dirBlocks[i], tables + i * BLOCKSIZE);
         }
-        free_block(mountedBitmap, deleteMe->file_index + i);
     }
-    // delete inodex by replacing it as a free block
-    if (writeBlock(disk, deleteMe->inode_index, freeBlock) == -1)
+
+    int opened = 0;
+    for (int j = 0; j < found && result > 0; j++)
     {
-        fprintf(stderr, "Error: Unable to write free block to disk.\n");
-        closeDisk(disk);
-        return WRITE_ERROR;
+        if (blocks[j] < 0)
+        {
+            continue;
+        }
+        int i = pending[j];
+        dentryInsert(parents[i], leaves[i], blocks[j], 0);
+        FileEntry *entry = createFileEntry(leaves[i], fds++, blocks[j]);
+        if (entry == NULL)
+        {
+            descriptors[i] = READ_ERROR;
+            continue;
+        }
+        entry->parent_index = parents[i];
+        entry->inode = findCachedInode(inodeCache, blocks[j]);
+        insertFileEntry(&openFileTable, entry);
+        descriptors[i] = entry->fileDescriptor;
     }
-    char rootDirectory[BLOCKSIZE];
-    readBlock(disk, 1, rootDirectory);
-    //update root directory by deleting that inode
-    for (int i = 4; i < 251; i += 2)
+    for (int i = 0; i < n; i++)
     {
-        // need two bytes to write up to block 65535 for inodes
-        int value = (rootDirectory[i] << 8) | rootDirectory[i + 1];
-        // if value is 0 (unallocated) then thats where next inode mapping will be
-        if (value == deleteMe->inode_index)
+        if (descriptors[i] == 0)
         {
-            rootDirectory[i] = 0x00;
-            rootDirectory[i + 1] = 0x00;
-            break;
+            descriptors[i] = result > 0 ? tfs_openFile(names[i]) : result;
+        }
+        if (descriptors[i] > 0)
+        {
+            opened++;
         }
     }
-    // deallocate previous blocks allocated to a file
-    free_num_blocks(mountedBitmap, deleteMe->inode_index, prev_num_blocks);
-    // update file size to be 0 now temporarily until we write new data
-    deleteMe->file_size = 0;
-    free_num_blocks(mountedBitmap, deleteMe->inode_index, deleteMe->file_size);
-    tfs_closeFile(FD); // remove from open file table and free memory
-    return DELETE_SUCCESS;
+    free(leaves);
+    free(parents);
+    free(pending);
+    free(blocks);
+    free(dirBlocks);
+    free(tables);
+    free(raw);
+    return opened;
 }
 
-int tfs_readByte(fileDescriptor FD, char *buffer)
-{    /* reads one byte from the file and copies it to buffer, using the
-    current file pointer location and incrementing it by one upon success.
-    If the file pointer is already past the end of the file then
-    tfs_readByte() should return an error and not increment the file pointer.
-    */
-
+int tfs_deleteMany(fileDescriptor fds[], int n)
+{
+    /* deletes n open files at once, like calling tfs_deleteFile on each.
+    Every directory touched is read and written once, and the checksum
+    table and dedup index are flushed once at the end. A directory can be
+    deleted in the same batch as the files in it if it comes after them.
+    Returns how many files were deleted. */
     if (!mounted)
     {
         return MOUNTED_ERROR;
     }
-
-    // Find the file entry in the open file table
-    FileEntry *file = findFileEntryByFD(openFileTable, FD);
-    if (file == NULL)
+    if (readOnly)
     {
-        return FILE_NOT_FOUND_ERROR;
+        return READ_ONLY_ERROR;
     }
-
-    // Check if the file pointer is already past the end of the file
-    if (file->offset >= file->file_size)
+    // each file touches at most its parent and, for a directory, its own entry table
+    int *dirBlocks = (int *)malloc(2 * n * sizeof(int));
+    unsigned char *tables = (unsigned char *)malloc(2 * n * BLOCKSIZE);
+    if (dirBlocks == NULL || tables == NULL)
     {
-        return END_OF_FILE_ERROR;
+        free(dirBlocks);
+        free(tables);
+        return READ_ERROR;
     }
-
-    // Seek to the current file pointer location
-    // Figure out what block the file pointer is in (file pointer = fileindex + offset)
-    int start_pointer = file->file_index;
-    int block_to_read = start_pointer + (file->offset / 252);
-    int file_pointer = start_pointer * 256 + ((file->offset / 252) * 256) + file->offset % 252 + 4;
-    printf("file pointer is %d\n", file_pointer);
-    unsigned char fileContent[BLOCKSIZE];
-    if (readBlock(disk, block_to_read, fileContent) == -1)
+    int dirCount = 0;
+    int deleted = 0;
+    for (int i = 0; i < n; i++)
     {
-        fprintf(stderr, "Error: Unable to read file content from disk.\n");
-        closeDisk(disk);
-        return DISK_READ_ERROR;
+        FileEntry *deleteMe = findFileEntryByFD(openFileTable, fds[i]);
+        if (deleteMe == NULL)
+        {
+            continue;
+        }
+        unsigned char *entries = NULL;
+        int own = 0;
+        if (deleteMe->inode->flags & INODE_DIRECTORY)
+        {
+            own = deleteMe->inode->file_index;
+            entries = batchDirectory(dirBlocks, tables, &dirCount, own);
+        }
+        unsigned char *parent = batchDirectory(dirBlocks, tables, &dirCount, deleteMe->parent_index);
+        if (parent == NULL || (own != 0 && entries == NULL))
+        {
+            continue;
+        }
+        int inode_index = deleteMe->inode_index;
+        if (releaseFile(deleteMe, entries) < 0)
+        {
+            continue;
+        }
+        removeDirectoryEntry(parent, inode_index);
+        // a deleted directory's table is already scrubbed, it must not be written back
+        for (int d = 0; own != 0 && d < dirCount; d++)
+        {
+            if (dirBlocks[d] == own)
+            {
+                dirBlocks[d] = 0;
+            }
+        }
+        tfs_closeFile(fds[i]);
+        deleted++;
     }
-    char byteData = (char)fileContent[file_pointer];
-    // Read one byte from the file and copy it to the buffer as a char
-    *buffer = byteData;
-    file->offset = file->offset + 1;
-    return 1; // Success
-}
-
-int tfs_seek(fileDescriptor FD, int offset)
-{    /* change the file pointer location to offset (absolute). Returns
-    success/error codes.*/
-
-    if (!mounted)
+    int result = deleted;
+    for (int d = 0; d < dirCount; d++)
     {
-        return MOUNTED_ERROR;
+        if (dirBlocks[d] != 0 && bufferedWrite(disk, dirBlocks[d], tables + d * BLOCKSIZE) == -1)
+        {
+            result = WRITE_ERROR;
+        }
     }
-    FileEntry *file = findFileEntryByFD(openFileTable, FD);
-    // offset will be used to calculate file pointer for readByte
-    file->offset = offset;
-    return SEEK_SUCCESS;
+    if (flushChecksumTable() < 0 || flushDedupIndex() < 0)
+    {
+        result = WRITE_ERROR;
+    }
+    free(dirBlocks);
+    free(tables);
+    return result;
 }
 
 
-
-// EXTRA CREDIT :,)
-
-
-
 // Timestamps (10%)
 int tfs_readFileInfo(fileDescriptor FD)
 {
@@ -788,38 +4929,11 @@ int tfs_readFileInfo(fileDescriptor FD)
         fprintf(stderr, "Error: File not found.\n");
         return FILE_NOT_FOUND_ERROR;
     }
-    int inode_ind = file->inode_index;
-    // printf("inode index is %d\n", inode_ind);
-    unsigned char inodeBlock[BLOCKSIZE];
-    // Print the contents of the inodeBlock
-    readBlock(disk, inode_ind, inodeBlock);
-    // printf("inodeBlock contents in time thing: ");
-    // for (int i = 0; i < BLOCKSIZE; i++)
-    // {
-    //     printf("%02x ", inodeBlock[i]);
-    // }
-    // printf("\n");
-    // Read the unsigned bytes from inodeBlock[15] to inodeBlock[18]
-    unsigned char hour_bytes[4];
-    for (int i = 0; i < 4; i++)
-    {
-        hour_bytes[i] = inodeBlock[15 + i];
-    }
-    unsigned char min_bytes[4];
-    for (int i = 0; i < 4; i++)
-    {
-        min_bytes[i] = inodeBlock[19 + i];
-    }
-    unsigned char sec_bytes[4];
-    for (int i = 0; i < 4; i++)
-    {
-        sec_bytes[i] = inodeBlock[23 + i];
-    }
-    // Convert the bytes to local_time->tm_hour
+    // the creation time was decoded from inode[15..26] when the inode was cached
     struct tm local_time;
-    local_time.tm_hour = *((int *)hour_bytes);
-    local_time.tm_min = *((int *)min_bytes);
-    local_time.tm_sec = *((int *)sec_bytes);
+    local_time.tm_hour = file->inode->hour;
+    local_time.tm_min = file->inode->minute;
+    local_time.tm_sec = file->inode->second;
     printf("File created at time: %02d:%02d:%02d\n", local_time.tm_hour, local_time.tm_min, local_time.tm_sec);
 
     // Print the local_time->tm_hour
@@ -848,59 +4962,157 @@ int tfs_rename(fileDescriptor FD, char *newName)
         fprintf(stderr, "Error: File not found.\n");
         return FILE_NOT_FOUND_ERROR;
     }
-    strcpy(file->filename, newName);
-    unsigned char inodeBlock[BLOCKSIZE];
-    readBlock(disk, file->inode_index, inodeBlock);
-    for (int i = 4; i < 12; i++)
+    if (readOnly)
     {
-        inodeBlock[i] = newName[i - 4];
+        return READ_ONLY_ERROR;
     }
-    writeBlock(disk, file->inode_index, inodeBlock);
+    if (strlen(newName) > MAX_FILENAME_LENGTH || strchr(newName, '/') != NULL)
+    {
+        fprintf(stderr, "Error: Invalid file name %s.\n", newName);
+        return NAME_LENGTH_ERROR;
+    }
+    strcpy(file->inode->name, newName);
+    file->inode->dirty = 1;
+    // the file stays in the same directory, only the name it is found under changes
+    dentryInsert(file->parent_index, file->filename, 0, 0);
+    dentryInsert(file->parent_index, newName, file->inode_index, (file->inode->flags & INODE_DIRECTORY) ? file->inode->file_index : 0);
+    strcpy(file->filename, newName);
     printf("File renamed successfully to %s.\n", newName);
     return RENAME_SUCCESS;
 }
 
+// print the entries of the directory stored in block dir, prefix is the path leading to it
+void printDirectory(int dir, char *prefix)
+{
+    unsigned char directory[BLOCKSIZE];
+    bufferedRead(disk, dir, directory);
+    for (int i = 4; i < 251; i += 2)
+    {
+        // need two bytes to write up to block 65535 for inodes
+        int value = (directory[i] << 8) | directory[i + 1];
+        if (value == 0)
+        {
+            continue; // slot freed by tfs_deleteFile
+        }
+        Inode *inode = loadInode(value);
+        if (inode == NULL || strlen(inode->name) == 0)
+        {
+            continue;
+        }
+        char path[256];
+        snprintf(path, sizeof(path), "%s%s", prefix, inode->name);
+        if (inode->flags & INODE_DIRECTORY)
+        {
+            printf("Directory: %s/\n", path);
+            strncat(path, "/", sizeof(path) - strlen(path) - 1);
+            printDirectory(inode->file_index, path);
+        }
+        else
+        {
+            printf("File name: %s\n", path);
+        }
+    }
+}
+
 int tfs_readdir()
 {
     /* lists all the files and directories on the disk, print the
-    list to stdout -- Note: if you don’t have hierarchical directories, this just reads
-    the root directory aka “all files” */
-    int j;
+    list to stdout. Directories are walked depth first and every entry is
+    printed with its full path. */
     if (!mounted)
     {
         fprintf(stderr, "Error: No file system mounted.\n");
         return MOUNTED_ERROR;
     }
-    unsigned char rootDirectory[BLOCKSIZE];
-    readBlock(disk, 1, rootDirectory);
+    printDirectory(rootBlock, "");
+    return READDIR_SUCCESS;
+}
+
+// look up path without creating anything and fill info from its inode. An empty path or "/" is
+// the root directory
+int tfs_stat(char *path, FileInfo *info)
+{
+    if (!mounted)
+    {
+        fprintf(stderr, "Error: No file system mounted.\n");
+        return MOUNTED_ERROR;
+    }
+    memset(info, 0, sizeof(FileInfo));
+    if (strspn(path, "/") == strlen(path))
+    {
+        info->isDirectory = 1;
+        return INFO_SUCCESS;
+    }
+    char leaf[MAX_FILENAME_LENGTH + 1];
+    int parent = 0;
+    int dir = 0;
+    int inode_index = resolvePath(path, &parent, leaf, &dir);
+    if (inode_index < 0)
+    {
+        return inode_index;
+    }
+    Inode *inode = loadInode(inode_index);
+    if (inode == NULL)
+    {
+        return DISK_READ_ERROR;
+    }
+    info->size = inode->file_size;
+    info->isDirectory = (inode->flags & INODE_DIRECTORY) != 0;
+    info->hour = inode->hour;
+    info->minute = inode->minute;
+    info->second = inode->second;
+    return INFO_SUCCESS;
+}
+
+// copy the names in the directory at path into names, at most max of them. Returns how many
+// entries the directory holds, which may be more than max
+int tfs_listDirectory(char *path, char names[][MAX_FILENAME_LENGTH + 1], int max)
+{
+    if (!mounted)
+    {
+        fprintf(stderr, "Error: No file system mounted.\n");
+        return MOUNTED_ERROR;
+    }
+    int dir = rootBlock;
+    if (strspn(path, "/") != strlen(path))
+    {
+        char leaf[MAX_FILENAME_LENGTH + 1];
+        int parent = 0;
+        int inode_index = resolvePath(path, &parent, leaf, &dir);
+        if (inode_index < 0)
+        {
+            return inode_index;
+        }
+        if (dir == 0)
+        {
+            return NOT_A_DIRECTORY_ERROR;
+        }
+    }
+    unsigned char directory[BLOCKSIZE];
+    if (bufferedRead(disk, dir, directory) == -1)
+    {
+        return DISK_READ_ERROR;
+    }
+    int count = 0;
     for (int i = 4; i < 251; i += 2)
     {
-        // need two bytes to write up to block 65535 for inodes
-        int value = (rootDirectory[i] << 8) | rootDirectory[i + 1];
-        // if value is 0 (unallocated) then thats where next inode mapping will be
+        int value = (directory[i] << 8) | directory[i + 1];
         if (value == 0)
         {
-            break;
+            continue;
         }
-        // printf("value is %d\n", value);
-        unsigned char inodeBlock[BLOCKSIZE];
-        readBlock(disk, value, inodeBlock);
-        char filename[9];
-        // printf("Inode contents: ");
-        // for (int i = 0; i < BLOCKSIZE; i++)
-        // {
-        //     printf("%02x ", inodeBlock[i]);
-        // }
-        // printf("\n");
-        for (j = 0; j < 8 && inodeBlock[j + 4] != 0x00; j++)
+        Inode *inode = loadInode(value);
+        if (inode == NULL || strlen(inode->name) == 0)
         {
-            filename[j] = inodeBlock[j + 4];
+            continue;
         }
-        filename[j] = '\0'; // Null-terminate the string
-        if (strlen(filename) > 0)
+        if (count < max)
         {
-            printf("File name: %s\n", filename);
+            strcpy(names[count], inode->name);
         }
+        count++;
     }
-    return READDIR_SUCCESS;
+    return count;
 }
+
+#include "trace.c"
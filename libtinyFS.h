@@ -1,3 +1,8 @@
+#ifndef LIBTINYFS_H
+#define LIBTINYFS_H
+
+#include <sys/uio.h> // struct iovec of tfs_readv and tfs_writev
+
 /* The default size of the disk and file system block */
 #define BLOCKSIZE 256
 /* Your program should use a 10240 Byte disk size giving you 40 blocks
@@ -5,23 +10,68 @@ total. This is a default size. You must be able to support different
 possible values */
 #define DEFAULT_DISK_SIZE 10240
 /* use this name for a default emulated disk file name */
-#define DEFAULT_DISK_NAME “tinyFSDisk”
+#define DEFAULT_DISK_NAME "tinyFSDisk"
 /* use as a special type to keep track of files */
 typedef int fileDescriptor;
 /* magic number */
 #define MAGIC_NUMBER 0x44
 
+//names of files and directories, a path is made of names separated by '/'
+#define MAX_FILENAME_LENGTH 31
+#define INODE_NAME_LOC 32 // full name, null terminated; inode[4..11] keeps the first 8 characters
+
+/* what tfs_stat reports about a file or directory */
+typedef struct
+{
+    int size;        // logical size in bytes, 0 for a directory
+    int isDirectory;
+    int hour;        // creation time
+    int minute;
+    int second;
+} FileInfo;
+
 int tfs_mkfs(char *filename, int nBytes);
 int tfs_mount(char *filename);
+int tfs_unmount(void);
 fileDescriptor tfs_openFile(char *name);
+fileDescriptor tfs_openPath(char *path);
+int tfs_mkdir(char *path);
+int tfs_createMany(char *names[], int n, fileDescriptor descriptors[]);
+int tfs_deleteMany(fileDescriptor fds[], int n);
 int tfs_writeFile(fileDescriptor FD, char *buffer, int size);
 int tfs_deleteFile(fileDescriptor FD);
 int tfs_closeFile(fileDescriptor FD);
+int tfs_fsync(fileDescriptor FD);
+int tfs_sync(void);
+int tfs_setDirectIO(int enabled);
 int tfs_readdir();
+int tfs_stat(char *path, FileInfo *info);
+int tfs_listDirectory(char *path, char names[][MAX_FILENAME_LENGTH + 1], int max);
 int tfs_readByte(fileDescriptor FD, char *buffer);
 int tfs_seek(fileDescriptor FD, int offset);
+int tfs_lseek(fileDescriptor FD, int offset, int whence);
+int tfs_writeAt(fileDescriptor FD, int offset, char *buffer, int size);
+int tfs_truncate(fileDescriptor FD, int size);
+int tfs_fallocate(fileDescriptor FD, int size, int flags);
+int tfs_export(fileDescriptor FD, int hostfd);
+fileDescriptor tfs_import(int hostfd, char *name);
+int tfs_setRawData(int enabled);
+int tfs_readv(fileDescriptor FD, const struct iovec *iov, int iovcnt);
+int tfs_writev(fileDescriptor FD, const struct iovec *iov, int iovcnt);
+int tfs_advise(fileDescriptor FD, int offset, int len, int advice);
+int tfs_setOwner(int owner);
+int tfs_setQuota(int owner, int blocks);
+int tfs_quotaUsage(int owner, int *used, int *limit);
+int tfs_setThrottle(int owner, int bytesPerSecond, int burst);
 int tfs_readFileInfo(fileDescriptor FD);
 int tfs_rename(fileDescriptor FD, char *newName);
+int tfs_setCompression(int enabled);
+int tfs_setFileCompression(fileDescriptor FD, int enabled);
+int tfs_setDedup(int enabled);
+int tfs_snapshot(char *name);
+int tfs_deleteSnapshot(char *name);
+int tfs_mountSnapshot(char *diskname, char *name);
+int tfs_trace(char *path);
 
 //block types
 #define EMPTY 0
@@ -29,7 +79,85 @@ int tfs_rename(fileDescriptor FD, char *newName);
 #define INODE 2
 #define FILE_EXTENT 3
 #define FREE_BLOCK 4
+#define CHECKSUM_TABLE 5
+#define DEDUP_INDEX 6
+#define SNAPSHOT 7
+#define DIRECTORY 8 // entry table of a directory other than the root, same layout as the root directory
+#define QUOTA_TABLE 9 // block limit and blocks in use of every owner, see QUOTA_TABLE_LOC
 
 //block locations
 #define SUPERBLOCK_LOC 0
-#define ROOT_DIRECTORY_LOC 256
\ No newline at end of file
+#define ROOT_DIRECTORY_LOC 256
+#define CHECKSUM_TABLE_BLOCK 2 // first checksum table block, right after the root directory
+#define SNAPSHOT_LIST_LOC 255  // superblock byte holding the newest snapshot record block, 0 if none
+#define QUOTA_TABLE_LOC 254    // superblock byte holding the quota table block, only free when the bitmap ends before it
+
+//feature flags kept in superblock[3]
+#define FEATURE_CHECKSUMS 0x01 // data blocks have CRC32C entries in the checksum table
+#define FEATURE_DEDUP 0x02     // the image has a dedup index starting at block superblock[2]
+#define FEATURE_REGION_CHECKS 0x04 // checksum table and dedup index blocks keep a check of their entries in [2..3]
+#define FEATURE_RAW_DATA 0x08  // data blocks are bare content without the 4 byte header, extents are not linked
+#define FEATURE_QUOTAS 0x10    // the image has a quota table at block superblock[QUOTA_TABLE_LOC]
+
+//checksum table blocks keep the 4 byte header and hold 4 byte little endian CRC32C entries
+#define CHECKSUMS_PER_BLOCK ((BLOCKSIZE - 4) / 4)
+
+//inode flags kept in inode[3]
+#define INODE_COMPRESSED 0x01 // payload is a chunked LZ stream, stored size in inode[27..28]
+#define INODE_DEDUP 0x02      // extent is in the dedup index and freed through its reference count
+#define INODE_DIRECTORY 0x04  // inode is a directory, inode[2] is its DIRECTORY block
+#define INODE_SPARSE 0x08     // content is mapped through the run list at SPARSE_MAP_LOC, unmapped blocks are holes
+#define INODE_PREALLOCATED 0x10 // sparse file reserved by tfs_fallocate, tfs_writeFile rewrites it in place
+#define INODE_OWNER_LOC 29      // owner the data blocks of the file are charged to, 0 on older images
+
+//sparse files keep [SPARSE_MAP_LOC] the number of runs followed by 5 byte runs: 2 byte first logical
+//block of the file, 2 byte first block on disk, 1 byte length. Holes read as zeros and take no blocks
+#define SPARSE_MAP_LOC 64
+#define SPARSE_RUN_SIZE 5
+#define SPARSE_MAX_RUNS ((BLOCKSIZE - SPARSE_MAP_LOC - 1) / SPARSE_RUN_SIZE)
+#define MAX_FILE_BLOCKS ((65535 + 251) / 252) // 252 byte blocks in the largest file, header-free images need fewer
+#define SPARSE_RUN_UNWRITTEN 0x8000 // set in the logical block of a run reserved but not written, it reads as zeros
+
+//flags of tfs_fallocate
+#define FALLOCATE_NO_ZERO 0x01 // reserve the blocks as unwritten instead of writing zeros to them
+
+//whence values of tfs_lseek beyond SEEK_SET, SEEK_CUR and SEEK_END, same numbers as Linux
+#ifndef SEEK_DATA
+#define SEEK_DATA 3 // next offset at or after the given one that is not in a hole
+#endif
+#ifndef SEEK_HOLE
+#define SEEK_HOLE 4 // next hole at or after the given one, the end of the file counts as one
+#endif
+
+//compressed payloads are cut into independently compressed chunks so reads can decompress just one
+#define COMPRESS_CHUNK_SIZE 4096
+#define MAX_COMPRESS_CHUNKS ((65535 + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE)
+
+//largest readahead window of an open file, also the most blocks readExtent reads at once
+#define READAHEAD_MAX_BLOCKS 64
+
+//advice values of tfs_advise, same numbers as posix_fadvise on Linux
+#define TFS_ADVICE_NORMAL 0     // the readahead window grows while reads are sequential
+#define TFS_ADVICE_RANDOM 1     // no readahead, a miss reads just the block asked for
+#define TFS_ADVICE_SEQUENTIAL 2 // the largest readahead window from the first miss on
+#define TFS_ADVICE_WILLNEED 3   // start reading the range now
+#define TFS_ADVICE_DONTNEED 4   // drop the range from the caches
+#define TFS_ADVICE_NOREUSE 5    // runs are dropped from the page cache once the reader moves past them
+
+//dedup index blocks keep the 4 byte header and hold 14 byte entries:
+//8 byte content hash, 2 byte first block, 2 byte stored size, 2 byte reference count
+#define DEDUP_ENTRY_SIZE 14
+#define DEDUP_ENTRIES_PER_BLOCK ((BLOCKSIZE - 4) / DEDUP_ENTRY_SIZE)
+#define DEDUP_INDEX_BLOCKS 7 // one entry for every inode slot in the root directory
+
+//quota table blocks keep the 4 byte header and hold one 4 byte entry per owner: 2 byte block limit
+//(0 for none) and 2 byte data blocks in use, counted once per file even when dedup shares an extent
+#define QUOTA_ENTRY_SIZE 4
+#define QUOTA_MAX_OWNERS ((BLOCKSIZE - 4) / QUOTA_ENTRY_SIZE)
+
+//snapshot records: [2] next older record, [4..11] name, [13..14] frozen root directory,
+//[15] features, [16] bitmap size, [17..] blocks held by the snapshot in bitmap form (0 = held)
+#define SNAPSHOT_ROOT_LOC 13
+#define SNAPSHOT_BITMAP_LOC 17
+
+#endif // LIBTINYFS_H
@@ -0,0 +1,174 @@
+#include "lz.h"
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MF_LIMIT 12     // a match may not start in the last 12 bytes
+#define LZ_LAST_LITERALS 5 // the last 5 bytes are always literals
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+static uint32_t lz_read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// write a length that did not fit in its token nibble as a run of 255s
+static int lz_put_length(unsigned char *dst, int op, int length)
+{
+    while (length >= 255)
+    {
+        dst[op++] = 255;
+        length -= 255;
+    }
+    dst[op++] = (unsigned char)length;
+    return op;
+}
+
+// emit one sequence: literals from anchor followed by an optional match
+static int lz_put_sequence(unsigned char *dst, int op, int dstCap, const unsigned char *literals, int litLen,
+                           int offset, int matchLen)
+{
+    // worst case size of this sequence, checked up front so the writes below never overrun
+    if (op + 1 + litLen / 255 + 1 + litLen + 2 + matchLen / 255 + 1 > dstCap)
+    {
+        return -1;
+    }
+    int token = op++;
+    dst[token] = (unsigned char)((litLen >= 15 ? 15 : litLen) << 4);
+    if (litLen >= 15)
+    {
+        op = lz_put_length(dst, op, litLen - 15);
+    }
+    memcpy(dst + op, literals, litLen);
+    op += litLen;
+    if (matchLen == 0)
+    {
+        return op;
+    }
+    dst[op++] = offset & 0xFF;
+    dst[op++] = (offset >> 8) & 0xFF;
+    matchLen -= LZ_MIN_MATCH;
+    dst[token] |= (unsigned char)(matchLen >= 15 ? 15 : matchLen);
+    if (matchLen >= 15)
+    {
+        op = lz_put_length(dst, op, matchLen - 15);
+    }
+    return op;
+}
+
+// compress src into dst, returns the compressed size or -1 if it does not fit in dstCap
+int lz_compress(const unsigned char *src, int srcLen, unsigned char *dst, int dstCap)
+{
+    int table[1 << LZ_HASH_BITS];
+    int ip = 0;
+    int anchor = 0;
+    int op = 0;
+
+    memset(table, 0xFF, sizeof(table)); // every slot starts at -1
+    if (srcLen > LZ_MF_LIMIT)
+    {
+        int limit = srcLen - LZ_MF_LIMIT;
+        int matchLimit = srcLen - LZ_LAST_LITERALS;
+        while (ip < limit)
+        {
+            uint32_t sequence = lz_read32(src + ip);
+            uint32_t h = lz_hash(sequence);
+            int ref = table[h];
+            table[h] = ip;
+            if (ref < 0 || ip - ref > LZ_MAX_OFFSET || lz_read32(src + ref) != sequence)
+            {
+                ip++;
+                continue;
+            }
+            int matchLen = LZ_MIN_MATCH;
+            while (ip + matchLen < matchLimit && src[ref + matchLen] == src[ip + matchLen])
+            {
+                matchLen++;
+            }
+            op = lz_put_sequence(dst, op, dstCap, src + anchor, ip - anchor, ip - ref, matchLen);
+            if (op < 0)
+            {
+                return -1;
+            }
+            ip += matchLen;
+            anchor = ip;
+        }
+    }
+    return lz_put_sequence(dst, op, dstCap, src + anchor, srcLen - anchor, 0, 0);
+}
+
+// decompress src into dst, returns the decompressed size or -1 on malformed input
+int lz_decompress(const unsigned char *src, int srcLen, unsigned char *dst, int dstCap)
+{
+    int ip = 0;
+    int op = 0;
+    while (ip < srcLen)
+    {
+        int token = src[ip++];
+        int litLen = token >> 4;
+        if (litLen == 15)
+        {
+            int b;
+            do
+            {
+                if (ip >= srcLen)
+                {
+                    return -1;
+                }
+                b = src[ip++];
+                litLen += b;
+            } while (b == 255);
+        }
+        if (ip + litLen > srcLen || op + litLen > dstCap)
+        {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip == srcLen)
+        {
+            break; // the last sequence has no match
+        }
+
+        if (ip + 2 > srcLen)
+        {
+            return -1;
+        }
+        int offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        int matchLen = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15)
+        {
+            int b;
+            do
+            {
+                if (ip >= srcLen)
+                {
+                    return -1;
+                }
+                b = src[ip++];
+                matchLen += b;
+            } while (b == 255);
+        }
+        if (offset == 0 || offset > op || op + matchLen > dstCap)
+        {
+            return -1;
+        }
+        // byte by byte so overlapping matches repeat the pattern
+        for (int i = 0; i < matchLen; i++)
+        {
+            dst[op] = dst[op - offset];
+            op++;
+        }
+    }
+    return op;
+}
@@ -0,0 +1,9 @@
+#ifndef LZ_H
+#define LZ_H
+
+// LZ4 block format codec used for compressed file payloads
+
+int lz_compress(const unsigned char *src, int srcLen, unsigned char *dst, int dstCap);
+int lz_decompress(const unsigned char *src, int srcLen, unsigned char *dst, int dstCap);
+
+#endif // LZ_H
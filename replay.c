@@ -0,0 +1,656 @@
+/* tinyfs-replay: plays a trace written by tfs_trace back against a fresh image
+ * Every file name given to tfs_mkfs, tfs_mount and tfs_mountSnapshot in the trace is replaced by
+ * image. If the trace mounts before it formats, the image is first formatted with the size and
+ * data format recorded with the mount. Buffers are not in the trace, writes replay a fixed pattern
+ * of the recorded size, so compression and dedup may not save what they did when recorded.
+ *
+ * usage: tinyfs-replay [-t] [-j threads] trace image
+ *   -t  keep the timing of the trace: each call starts as long after the first as it did when
+ *       recorded, instead of right after the one before
+ *   -j  spread the calls over threads. Calls on one descriptor stay on one thread and in order,
+ *       calls that do not name a descriptor (mount, sync, mkdir, ...) run alone between the
+ *       others. The library is not thread safe, so every call still holds one lock the way
+ *       tinyfs-fuse does, the threads only change how calls on different files interleave
+ *
+ * Prints the number of calls, the time recorded and the time replayed for every operation, and how
+ * many calls returned something other than they did when recorded.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libTinyFS.h"
+#include "TinyFS_errno.h"
+#include "trace.h"
+
+#define REPLAY_MAX_THREADS 64
+
+// one call read back from the trace
+typedef struct
+{
+    int op;
+    long long start;    // microseconds after the first call
+    long long duration; // microseconds the call took when recorded
+    int result;
+    int numbers[4];     // the i arguments, in order
+    char *strings[2];   // the s arguments, in order
+    char **names;       // the S argument of tfs_createMany
+    int *list;          // the D argument of tfs_createMany and tfs_deleteMany
+    int worker;         // thread the call runs on, -1 to run it alone
+} Record;
+
+// totals of one operation
+typedef struct
+{
+    long calls;
+    long long recorded;
+    long long replayed;
+    long differ;
+} OpStats;
+
+typedef struct
+{
+    int id;
+    int first; // first record of the stretch the thread runs its calls from
+    int last;  // one past the last
+} Worker;
+
+Record *records = NULL;
+int recordCount = 0;
+OpStats stats[TRACE_OPS];
+int *fdMap = NULL;  // descriptor handed out in the replay for every descriptor in the trace
+int fdSlots = 0;
+char *imageName;
+int keepTiming = 0;
+int formatted = 0;  // the image has been formatted by this replay
+int hostNull = -1;  // where tfs_export writes
+long long replayStart;
+unsigned char pattern[65536];
+pthread_mutex_t fsLock = PTHREAD_MUTEX_INITIALIZER;
+
+long long nowMicros(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// trace decoding, every reader returns -1 once the data runs out
+typedef struct
+{
+    unsigned char *data;
+    size_t size;
+    size_t pos;
+} Cursor;
+
+int readNumber(Cursor *cursor, unsigned long long *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (cursor->pos >= cursor->size)
+        {
+            return -1;
+        }
+        unsigned char byte = cursor->data[cursor->pos++];
+        *value |= (unsigned long long)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int readSigned(Cursor *cursor, long long *value)
+{
+    unsigned long long raw;
+    if (readNumber(cursor, &raw) < 0)
+    {
+        return -1;
+    }
+    *value = (long long)(raw >> 1) ^ -(long long)(raw & 1);
+    return 0;
+}
+
+int readString(Cursor *cursor, char **string)
+{
+    unsigned long long length;
+    if (readNumber(cursor, &length) < 0 || length > cursor->size - cursor->pos + 1)
+    {
+        return -1;
+    }
+    *string = NULL;
+    if (length == 0)
+    {
+        return 0;
+    }
+    *string = (char *)malloc(length);
+    memcpy(*string, cursor->data + cursor->pos, length - 1);
+    (*string)[length - 1] = '\0';
+    cursor->pos += length - 1;
+    return 0;
+}
+
+// the arguments of one record, laid out as traceOps lists them
+int readArguments(Cursor *cursor, Record *record)
+{
+    int numbers = 0;
+    int strings = 0;
+    long long count = 0;
+    for (const char *format = traceOps[record->op].format; *format != '\0'; format++)
+    {
+        if (*format == 'i')
+        {
+            if (readSigned(cursor, &count) < 0 || numbers == 4)
+            {
+                return -1;
+            }
+            record->numbers[numbers++] = (int)count;
+        }
+        else if (*format == 's')
+        {
+            if (readString(cursor, &record->strings[strings++]) < 0)
+            {
+                return -1;
+            }
+        }
+        else if (count < 0 || (size_t)count > cursor->size)
+        {
+            return -1;
+        }
+        else if (*format == 'S')
+        {
+            record->names = (char **)calloc(count + 1, sizeof(char *));
+            for (int i = 0; i < count; i++)
+            {
+                if (readString(cursor, &record->names[i]) < 0)
+                {
+                    return -1;
+                }
+            }
+        }
+        else
+        {
+            record->list = (int *)calloc(count + 1, sizeof(int));
+            for (int i = 0; i < count; i++)
+            {
+                long long value;
+                if (readSigned(cursor, &value) < 0)
+                {
+                    return -1;
+                }
+                record->list[i] = (int)value;
+            }
+        }
+    }
+    return 0;
+}
+
+int loadTrace(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: Unable to open trace %s.\n", path);
+        return -1;
+    }
+    Cursor cursor = {NULL, 0, 0};
+    size_t capacity = 0;
+    size_t got;
+    do
+    {
+        if (cursor.size == capacity)
+        {
+            capacity = capacity == 0 ? 1 << 20 : capacity * 2;
+            cursor.data = (unsigned char *)realloc(cursor.data, capacity);
+        }
+        got = fread(cursor.data + cursor.size, 1, capacity - cursor.size, file);
+        cursor.size += got;
+    } while (got > 0);
+    fclose(file);
+    if (cursor.size < 5 || memcmp(cursor.data, TRACE_MAGIC, 4) != 0 || cursor.data[4] != TRACE_VERSION)
+    {
+        fprintf(stderr, "Error: %s is not a TinyFS trace.\n", path);
+        free(cursor.data);
+        return -1;
+    }
+    cursor.pos = 5;
+    int slots = 0;
+    long long start = 0;
+    while (cursor.pos < cursor.size)
+    {
+        if (recordCount == slots)
+        {
+            slots = slots == 0 ? 4096 : slots * 2;
+            records = (Record *)realloc(records, slots * sizeof(Record));
+        }
+        Record *record = &records[recordCount];
+        memset(record, 0, sizeof(Record));
+        long long delta;
+        unsigned long long duration;
+        long long result;
+        // a record cut short by a program that died while tracing ends the trace
+        if (cursor.size - cursor.pos < 2)
+        {
+            break;
+        }
+        record->op = cursor.data[cursor.pos];
+        cursor.pos += 2; // the thread that made the call is not needed to replay it
+        if (record->op <= 0 || record->op >= TRACE_OPS || readSigned(&cursor, &delta) < 0 ||
+            readNumber(&cursor, &duration) < 0 || readSigned(&cursor, &result) < 0 || readArguments(&cursor, record) < 0)
+        {
+            break;
+        }
+        start += delta;
+        record->start = start;
+        record->duration = (long long)duration;
+        record->result = (int)result;
+        recordCount++;
+    }
+    free(cursor.data);
+    // calls are timed from the first one
+    for (int i = recordCount - 1; i >= 0; i--)
+    {
+        records[i].start -= records[0].start;
+    }
+    return 0;
+}
+
+// calls whose first argument is a descriptor
+int takesDescriptor(int op)
+{
+    switch (op)
+    {
+    case TRACE_WRITE_FILE:
+    case TRACE_DELETE_FILE:
+    case TRACE_CLOSE_FILE:
+    case TRACE_FSYNC:
+    case TRACE_READ_BYTE:
+    case TRACE_SEEK:
+    case TRACE_LSEEK:
+    case TRACE_WRITE_AT:
+    case TRACE_TRUNCATE:
+    case TRACE_FALLOCATE:
+    case TRACE_EXPORT:
+    case TRACE_READV:
+    case TRACE_WRITEV:
+    case TRACE_ADVISE:
+    case TRACE_READ_FILE_INFO:
+    case TRACE_RENAME:
+    case TRACE_SET_FILE_COMPRESSION:
+        return 1;
+    }
+    return 0;
+}
+
+// calls that hand back a new descriptor as their result
+int opensDescriptor(int op)
+{
+    return op == TRACE_OPEN_FILE || op == TRACE_OPEN_PATH || op == TRACE_IMPORT;
+}
+
+// size the descriptor map and pick the thread of every call
+void planReplay(int threads)
+{
+    int highest = 0;
+    for (int i = 0; i < recordCount; i++)
+    {
+        Record *record = &records[i];
+        if (opensDescriptor(record->op) && record->result > highest)
+        {
+            highest = record->result;
+        }
+        for (int j = 0; record->op == TRACE_CREATE_MANY && j < record->numbers[1]; j++)
+        {
+            highest = record->list[j] > highest ? record->list[j] : highest;
+        }
+        int key = takesDescriptor(record->op) ? record->numbers[0] : opensDescriptor(record->op) ? record->result : -1;
+        record->worker = key > 0 ? key % threads : -1;
+    }
+    fdSlots = highest + 1;
+    fdMap = (int *)calloc(fdSlots, sizeof(int));
+}
+
+// the replay descriptor of a descriptor in the trace, -1 for one opened before the trace started
+int mapDescriptor(int recorded)
+{
+    if (recorded <= 0 || recorded >= fdSlots || fdMap[recorded] == 0)
+    {
+        return -1;
+    }
+    return fdMap[recorded];
+}
+
+void learnDescriptor(int recorded, int replayed)
+{
+    if (recorded > 0 && recorded < fdSlots && replayed > 0)
+    {
+        fdMap[recorded] = replayed;
+    }
+}
+
+// make the call of one record on the replay image and account for it
+void replayRecord(Record *record)
+{
+    static __thread unsigned char buffer[65536];
+    int *n = record->numbers;
+    if (keepTiming)
+    {
+        long long due = replayStart + record->start;
+        struct timespec wake = {(time_t)(due / 1000000), (long)(due % 1000000) * 1000};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    }
+    // vectors split the recorded size evenly over the recorded number of buffers
+    struct iovec *iov = NULL;
+    if (record->op == TRACE_READV || record->op == TRACE_WRITEV)
+    {
+        int count = n[1] > 0 ? n[1] : 1;
+        int total = n[2] < 0 ? 0 : n[2] > 65535 ? 65535 : n[2];
+        iov = (struct iovec *)malloc(count * sizeof(struct iovec));
+        unsigned char *base = record->op == TRACE_READV ? buffer : pattern;
+        for (int i = 0; i < count; i++)
+        {
+            iov[i].iov_base = base + (size_t)total * i / count;
+            iov[i].iov_len = (size_t)total * (i + 1) / count - (size_t)total * i / count;
+        }
+    }
+    FILE *host = NULL;
+    if (record->op == TRACE_IMPORT)
+    {
+        host = tmpfile();
+        if (host != NULL)
+        {
+            fwrite(pattern, 1, n[0] < 0 ? 0 : n[0] > 65535 ? 65535 : n[0], host);
+            fflush(host);
+            lseek(fileno(host), 0, SEEK_SET);
+        }
+    }
+    char(*names)[MAX_FILENAME_LENGTH + 1] = NULL;
+    if (record->op == TRACE_LIST_DIRECTORY && n[0] > 0)
+    {
+        names = malloc((size_t)n[0] * sizeof(*names));
+    }
+    int *descriptors = NULL;
+    if (record->op == TRACE_CREATE_MANY || record->op == TRACE_DELETE_MANY)
+    {
+        descriptors = (int *)calloc(n[0] > 0 ? n[0] : 1, sizeof(int));
+        for (int i = 0; record->op == TRACE_DELETE_MANY && i < n[0]; i++)
+        {
+            descriptors[i] = mapDescriptor(record->list[i]);
+        }
+    }
+
+    pthread_mutex_lock(&fsLock);
+    int fd = takesDescriptor(record->op) ? mapDescriptor(n[0]) : -1;
+    if ((record->op == TRACE_MOUNT || record->op == TRACE_MOUNT_SNAPSHOT) && !formatted)
+    {
+        // the trace started on an image that already existed, start from an empty one of its size
+        tfs_setRawData((n[1] & FEATURE_RAW_DATA) != 0);
+        tfs_mkfs(imageName, n[0] > 0 ? n[0] : DEFAULT_DISK_SIZE);
+        tfs_setRawData(0);
+        formatted = 1;
+    }
+    long long started = nowMicros();
+    int result = 0;
+    char byte;
+    FileInfo info;
+    int used, limit;
+    switch (record->op)
+    {
+    case TRACE_MKFS:
+        result = tfs_mkfs(imageName, n[0]);
+        formatted = 1;
+        break;
+    case TRACE_MOUNT:
+        result = tfs_mount(imageName);
+        break;
+    case TRACE_UNMOUNT:
+        result = tfs_unmount();
+        break;
+    case TRACE_OPEN_FILE:
+        result = tfs_openFile(record->strings[0]);
+        learnDescriptor(record->result, result);
+        break;
+    case TRACE_OPEN_PATH:
+        result = tfs_openPath(record->strings[0]);
+        learnDescriptor(record->result, result);
+        break;
+    case TRACE_MKDIR:
+        result = tfs_mkdir(record->strings[0]);
+        break;
+    case TRACE_CREATE_MANY:
+        result = tfs_createMany(record->names, n[0], descriptors);
+        for (int i = 0; i < n[1] && i < n[0]; i++)
+        {
+            learnDescriptor(record->list[i], descriptors[i]);
+        }
+        break;
+    case TRACE_DELETE_MANY:
+        result = tfs_deleteMany(descriptors, n[0]);
+        break;
+    case TRACE_WRITE_FILE:
+        result = tfs_writeFile(fd, (char *)pattern, n[1] < 0 ? 0 : n[1] > 65535 ? 65535 : n[1]);
+        break;
+    case TRACE_DELETE_FILE:
+        result = tfs_deleteFile(fd);
+        break;
+    case TRACE_CLOSE_FILE:
+        result = tfs_closeFile(fd);
+        break;
+    case TRACE_FSYNC:
+        result = tfs_fsync(fd);
+        break;
+    case TRACE_SYNC:
+        result = tfs_sync();
+        break;
+    case TRACE_SET_DIRECT_IO:
+        result = tfs_setDirectIO(n[0]);
+        break;
+    case TRACE_READDIR:
+        result = tfs_readdir();
+        break;
+    case TRACE_STAT:
+        result = tfs_stat(record->strings[0], &info);
+        break;
+    case TRACE_LIST_DIRECTORY:
+        result = tfs_listDirectory(record->strings[0], names, names == NULL ? 0 : n[0]);
+        break;
+    case TRACE_READ_BYTE:
+        result = tfs_readByte(fd, &byte);
+        break;
+    case TRACE_SEEK:
+        result = tfs_seek(fd, n[1]);
+        break;
+    case TRACE_LSEEK:
+        result = tfs_lseek(fd, n[1], n[2]);
+        break;
+    case TRACE_WRITE_AT:
+        result = tfs_writeAt(fd, n[1], (char *)pattern, n[2] < 0 ? 0 : n[2] > 65535 ? 65535 : n[2]);
+        break;
+    case TRACE_TRUNCATE:
+        result = tfs_truncate(fd, n[1]);
+        break;
+    case TRACE_FALLOCATE:
+        result = tfs_fallocate(fd, n[1], n[2]);
+        break;
+    case TRACE_EXPORT:
+        result = tfs_export(fd, hostNull);
+        break;
+    case TRACE_IMPORT:
+        result = host == NULL ? READ_ERROR : tfs_import(fileno(host), record->strings[0]);
+        learnDescriptor(record->result, result);
+        break;
+    case TRACE_SET_RAW_DATA:
+        result = tfs_setRawData(n[0]);
+        break;
+    case TRACE_READV:
+        result = tfs_readv(fd, iov, n[1] > 0 ? n[1] : 1);
+        break;
+    case TRACE_WRITEV:
+        result = tfs_writev(fd, iov, n[1] > 0 ? n[1] : 1);
+        break;
+    case TRACE_ADVISE:
+        result = tfs_advise(fd, n[1], n[2], n[3]);
+        break;
+    case TRACE_SET_OWNER:
+        result = tfs_setOwner(n[0]);
+        break;
+    case TRACE_SET_QUOTA:
+        result = tfs_setQuota(n[0], n[1]);
+        break;
+    case TRACE_QUOTA_USAGE:
+        result = tfs_quotaUsage(n[0], &used, &limit);
+        break;
+    case TRACE_SET_THROTTLE:
+        result = tfs_setThrottle(n[0], n[1], n[2]);
+        break;
+    case TRACE_READ_FILE_INFO:
+        result = tfs_readFileInfo(fd);
+        break;
+    case TRACE_RENAME:
+        result = tfs_rename(fd, record->strings[0]);
+        break;
+    case TRACE_SET_COMPRESSION:
+        result = tfs_setCompression(n[0]);
+        break;
+    case TRACE_SET_FILE_COMPRESSION:
+        result = tfs_setFileCompression(fd, n[1]);
+        break;
+    case TRACE_SET_DEDUP:
+        result = tfs_setDedup(n[0]);
+        break;
+    case TRACE_SNAPSHOT:
+        result = tfs_snapshot(record->strings[0]);
+        break;
+    case TRACE_DELETE_SNAPSHOT:
+        result = tfs_deleteSnapshot(record->strings[0]);
+        break;
+    case TRACE_MOUNT_SNAPSHOT:
+        result = tfs_mountSnapshot(imageName, record->strings[1]);
+        break;
+    }
+    OpStats *op = &stats[record->op];
+    op->calls++;
+    op->recorded += record->duration;
+    op->replayed += nowMicros() - started;
+    // descriptors are numbered differently in the replay, only whether one came back counts
+    int opened = opensDescriptor(record->op);
+    if (opened ? (result >= 0) != (record->result >= 0) : result != record->result)
+    {
+        op->differ++;
+    }
+    pthread_mutex_unlock(&fsLock);
+
+    if (host != NULL)
+    {
+        fclose(host);
+    }
+    free(iov);
+    free(names);
+    free(descriptors);
+}
+
+void *runWorker(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    for (int i = worker->first; i < worker->last; i++)
+    {
+        if (records[i].worker == worker->id)
+        {
+            replayRecord(&records[i]);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int threads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "tj:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            keepTiming = 1;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t] [-j threads] trace image\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 2 || threads < 1 || threads > REPLAY_MAX_THREADS)
+    {
+        fprintf(stderr, "usage: %s [-t] [-j threads] trace image\n", argv[0]);
+        return 2;
+    }
+    imageName = argv[optind + 1];
+    if (loadTrace(argv[optind]) < 0)
+    {
+        return 1;
+    }
+    planReplay(threads);
+    for (int i = 0; i < (int)sizeof(pattern); i++)
+    {
+        pattern[i] = (unsigned char)("TinyFS replay "[i % 14] + i / 4096);
+    }
+    hostNull = open("/dev/null", O_WRONLY);
+
+    replayStart = nowMicros();
+    pthread_t ids[REPLAY_MAX_THREADS];
+    Worker workers[REPLAY_MAX_THREADS];
+    for (int i = 0; i < recordCount;)
+    {
+        if (threads == 1 || records[i].worker < 0)
+        {
+            replayRecord(&records[i++]);
+            continue;
+        }
+        // a stretch of calls on descriptors, each thread takes the calls on its descriptors
+        int last = i;
+        while (last < recordCount && records[last].worker >= 0)
+        {
+            last++;
+        }
+        for (int t = 0; t < threads; t++)
+        {
+            workers[t] = (Worker){t, i, last};
+            pthread_create(&ids[t], NULL, runWorker, &workers[t]);
+        }
+        for (int t = 0; t < threads; t++)
+        {
+            pthread_join(ids[t], NULL);
+        }
+        i = last;
+    }
+    long long wall = nowMicros() - replayStart;
+
+    long long recorded = recordCount > 0 ? records[recordCount - 1].start + records[recordCount - 1].duration : 0;
+    printf("%s: %d calls, recorded %.3f s, replayed %.3f s on %d thread%s%s\n", argv[optind], recordCount,
+           recorded / 1e6, wall / 1e6, threads, threads == 1 ? "" : "s", keepTiming ? " with the recorded timing" : "");
+    printf("%-20s %10s %14s %14s %8s\n", "operation", "calls", "recorded us", "replayed us", "differ");
+    long differ = 0;
+    for (int op = 1; op < TRACE_OPS; op++)
+    {
+        if (stats[op].calls > 0)
+        {
+            printf("%-20s %10ld %14lld %14lld %8ld\n", traceOps[op].name, stats[op].calls, stats[op].recorded,
+                   stats[op].replayed, stats[op].differ);
+            differ += stats[op].differ;
+        }
+    }
+    if (differ > 0)
+    {
+        printf("%ld calls returned something other than they did when recorded\n", differ);
+    }
+    return 0;
+}
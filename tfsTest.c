@@ -5,11 +5,68 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "libtinyFS.h"
 #include "libTinyFS.h"
 #include "TinyFS_errno.h"
 
+/* image the focused tests below format, make clean removes it with the other .dsk files */
+#define TEST_DISK_NAME "tfsTest.dsk"
+#define TEST_DISK_SIZE (BLOCKSIZE * 200)
+
+int failures = 0;		/* checks that did not hold */
+char content[65535];		/* file content written by the tests */
+
+/* report a check that did not hold and count it, returns whether it held */
+#define CHECK(cond) check ((cond), #cond, __LINE__)
+
+int check (int ok, char *what, int line)
+{
+  if (!ok)
+    {
+      printf ("] Failed at line %i: %s\n", line, what);
+      failures++;
+    }
+  return ok;
+}
+
+/* format the test image with size bytes and mount it */
+int freshDisk (int size)
+{
+  remove (TEST_DISK_NAME);
+  if (!CHECK (tfs_mkfs (TEST_DISK_NAME, size) == MKFS_SUCCESS))
+    return -1;
+  if (!CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS))
+    return -1;
+  return 0;
+}
+
+/* fill content with a pattern that does not repeat within a block */
+void fillContent (int seed)
+{
+  int i;
+  for (i = 0; i < sizeof (content); i++)
+    content[i] = (char) ((i * 7 + i / 251 + seed) & 0xFF);
+}
+
+/* 1 if the next size bytes read from FD are expected */
+int readsBack (fileDescriptor FD, char *expected, int size)
+{
+  char c;
+  int i;
+  for (i = 0; i < size; i++)
+    if (tfs_readByte (FD, &c) < 0 || c != expected[i])
+      return 0;
+  return 1;
+}
+
+/* 1 if tinyfsck finds nothing wrong with the unmounted test image */
+int fsckClean (void)
+{
+  return system ("./tinyfsck " TEST_DISK_NAME " > /dev/null") == 0;
+}
+
 /* simple helper function to fill Buffer with as many inPhrase strings as possible before reaching size */
 int fillBufferWithPhrase (char *inPhrase, char *Buffer, int size)
 {
@@ -29,7 +86,7 @@ int fillBufferWithPhrase (char *inPhrase, char *Buffer, int size)
 
 /* This program will create 2 files (of sizes 200 and 1000) to be read from or stored in the TinyFS file system. */
 int
-main ()
+demo ()
 {
   char readBuffer;
   char *afileContent, *bfileContent;	/* buffers to store file content */
@@ -49,7 +106,7 @@ main ()
       if (tfs_mount (DEFAULT_DISK_NAME) < 0)	/* if we still can't open it... */
 	{
 	  perror ("failed to open disk");	/* then just exit */
-	  return;
+	  return -1;
 	}
     }
 
@@ -58,14 +115,14 @@ main ()
   if (fillBufferWithPhrase (phrase1, afileContent, afileSize) < 0)
     {
       perror ("failed");
-      return;
+      return -1;
     }
 
   bfileContent = (char *) malloc (bfileSize * sizeof (char));
   if (fillBufferWithPhrase (phrase2, bfileContent, bfileSize) < 0)
     {
       perror ("failed");
-      return;
+      return -1;
     }
 
 /* print content of files for debugging */
@@ -160,3 +217,1065 @@ main ()
   printf ("\nend of demo\n\n");
   return 0;
 }
+
+/* whole files written, read back, rewritten and deleted, and still there after a remount */
+void testFiles ()
+{
+  fileDescriptor FD;
+  char c;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (1);
+  FD = tfs_openFile ("files");
+  CHECK (FD >= 0);
+  CHECK (tfs_readByte (FD, &c) == END_OF_FILE_ERROR);
+  CHECK (tfs_writeFile (FD, content, 3000) == 1);
+  CHECK (readsBack (FD, content, 3000));
+  CHECK (tfs_readByte (FD, &c) == END_OF_FILE_ERROR);
+  CHECK (tfs_seek (FD, 1000) >= 0);
+  CHECK (readsBack (FD, content + 1000, 10));
+  CHECK (tfs_writeFile (FD, content + 5, 100) == 1);
+  CHECK (readsBack (FD, content + 5, 100));
+  CHECK (tfs_writeFile (FD, content, 5000) == 1);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  FD = tfs_openFile ("files");
+  CHECK (readsBack (FD, content, 5000));
+  CHECK (tfs_deleteFile (FD) == DELETE_SUCCESS);
+  CHECK (tfs_readByte (FD, &c) < 0);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+}
+
+/* flip a bit in the first copy of the len bytes at pattern found in the unmounted test image */
+int corruptImage (char *pattern, int len)
+{
+  static char image[BLOCKSIZE * 2048];
+  FILE *file = fopen (TEST_DISK_NAME, "r+b");
+  int size, i;
+  if (file == NULL)
+    return -1;
+  size = fread (image, 1, sizeof (image), file);
+  for (i = 0; i + len <= size; i++)
+    if (memcmp (image + i, pattern, len) == 0)
+      {
+	image[i] ^= 0x01;
+	fseek (file, i, SEEK_SET);
+	fwrite (image + i, 1, 1, file);
+	fclose (file);
+	return i;
+      }
+  fclose (file);
+  return -1;
+}
+
+/* a data block changed behind the file system's back fails its checksum on read */
+void testChecksums ()
+{
+  fileDescriptor FD;
+  char c;
+  int i, result = 0;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (2);
+  FD = tfs_openFile ("sums");
+  CHECK (tfs_writeFile (FD, content, 1000) == 1);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+  CHECK (corruptImage (content + 600, 16) >= 0);
+  CHECK (!fsckClean ());
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  FD = tfs_openFile ("sums");
+  for (i = 0; i < 1000 && result >= 0; i++)
+    result = tfs_readByte (FD, &c);
+  CHECK (result == CHECKSUM_ERROR);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+}
+
+/* compressed files read back whole and from the middle of a chunk, and survive a remount. The
+   compressible file would need more blocks than the disk has if it were stored as it is */
+void testCompression ()
+{
+  fileDescriptor FD, rawFD;
+  int i;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  for (i = 0; i < 60000; i++)
+    content[i] = "compressible "[i % 13];
+  CHECK (tfs_setCompression (1) == 1);
+  FD = tfs_openFile ("packed");
+  CHECK (tfs_writeFile (FD, content, 60000) == 1);
+  CHECK (readsBack (FD, content, 60000));
+  CHECK (tfs_seek (FD, 9000) >= 0);
+  CHECK (readsBack (FD, content + 9000, 300));
+  rawFD = tfs_openFile ("raw");
+  CHECK (tfs_setFileCompression (rawFD, 0) == 1);
+  CHECK (tfs_writeFile (rawFD, content, 3000) == 1);
+  CHECK (readsBack (rawFD, content, 3000));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  FD = tfs_openFile ("packed");
+  CHECK (readsBack (FD, content, 60000));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+}
+
+/* identical files share one extent, which outlives the first of them to go. The two copies
+   would not both fit on the disk */
+void testDedup ()
+{
+  fileDescriptor aFD, bFD;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (3);
+  CHECK (tfs_setDedup (1) == 1);
+  aFD = tfs_openFile ("first");
+  bFD = tfs_openFile ("second");
+  CHECK (tfs_writeFile (aFD, content, 30000) == 1);
+  CHECK (tfs_writeFile (bFD, content, 30000) == 1);
+  CHECK (readsBack (bFD, content, 30000));
+  CHECK (tfs_deleteFile (aFD) == DELETE_SUCCESS);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  bFD = tfs_openFile ("second");
+  CHECK (readsBack (bFD, content, 30000));
+  CHECK (tfs_writeFile (bFD, content + 1, 30000) == 1);
+  CHECK (readsBack (bFD, content + 1, 30000));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+}
+
+/* a snapshot keeps the content files had when it was taken, read only, while the live file
+   system moves on */
+void testSnapshots ()
+{
+  fileDescriptor FD;
+  FileInfo info;
+  char c;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (4);
+  FD = tfs_openFile ("kept");
+  CHECK (tfs_writeFile (FD, content, 2000) == 1);
+  CHECK (tfs_snapshot ("before") == 1);
+  CHECK (tfs_snapshot ("before") == SNAPSHOT_EXISTS_ERROR);
+  CHECK (tfs_writeFile (FD, content + 7, 3000) == 1);
+  CHECK (tfs_deleteFile (tfs_openFile ("kept")) == DELETE_SUCCESS);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  CHECK (tfs_mountSnapshot (TEST_DISK_NAME, "missing") < 0);
+  CHECK (tfs_mountSnapshot (TEST_DISK_NAME, "before") == MOUNT_SUCCESS);
+  FD = tfs_openFile ("kept");
+  CHECK (readsBack (FD, content, 2000));
+  CHECK (tfs_readByte (FD, &c) == END_OF_FILE_ERROR);
+  CHECK (tfs_writeFile (FD, content, 10) == READ_ONLY_ERROR);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  CHECK (tfs_stat ("kept", &info) == FILE_NOT_FOUND_ERROR);
+  CHECK (tfs_deleteSnapshot ("before") == 1);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+  CHECK (tfs_mountSnapshot (TEST_DISK_NAME, "before") < 0);
+}
+
+/* files in nested directories are found by path, listed, and keep their directory from being
+   deleted */
+void testDirectories ()
+{
+  fileDescriptor FD, dirFD;
+  FileInfo info;
+  char names[4][MAX_FILENAME_LENGTH + 1];
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (5);
+  CHECK (tfs_mkdir ("outer") == 1);
+  CHECK (tfs_mkdir ("outer/inner") == 1);
+  CHECK (tfs_mkdir ("outer") == FILE_EXISTS_ERROR);
+  CHECK (tfs_mkdir ("nowhere/inner") < 0);
+  FD = tfs_openPath ("outer/inner/a file with a long name");
+  CHECK (FD >= 0);
+  CHECK (tfs_writeFile (FD, content, 700) == 1);
+  CHECK (tfs_stat ("outer/inner/a file with a long name", &info) == INFO_SUCCESS);
+  CHECK (info.size == 700 && !info.isDirectory);
+  CHECK (tfs_stat ("outer/inner", &info) == INFO_SUCCESS && info.isDirectory);
+  CHECK (tfs_stat ("outer/missing", &info) == FILE_NOT_FOUND_ERROR);
+  CHECK (tfs_listDirectory ("outer", names, 4) == 1);
+  CHECK (strcmp (names[0], "inner") == 0);
+  CHECK (tfs_listDirectory ("outer/inner", names, 4) == 1);
+  CHECK (strcmp (names[0], "a file with a long name") == 0);
+  dirFD = tfs_openPath ("outer/inner");
+  CHECK (tfs_deleteFile (dirFD) == DIRECTORY_NOT_EMPTY_ERROR);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  FD = tfs_openPath ("outer/inner/a file with a long name");
+  CHECK (readsBack (FD, content, 700));
+  CHECK (tfs_deleteFile (FD) == DELETE_SUCCESS);
+  dirFD = tfs_openPath ("outer/inner");
+  CHECK (tfs_deleteFile (dirFD) == DELETE_SUCCESS);
+  CHECK (tfs_listDirectory ("outer", names, 4) == 0);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+}
+
+/* a file reopened after close reads its cached inode, and changes to an inode reach the disk on
+   unmount even when the file is never closed */
+void testInodeCache ()
+{
+  fileDescriptor FD, otherFD;
+  FileInfo info;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (6);
+  FD = tfs_openFile ("shared");
+  CHECK (tfs_openFile ("shared") == FD);
+  CHECK (tfs_writeFile (FD, content, 900) == 1);
+  CHECK (tfs_closeFile (FD) >= 0);
+  otherFD = tfs_openFile ("shared");
+  CHECK (otherFD >= 0 && otherFD != FD);
+  CHECK (readsBack (otherFD, content, 900));
+  CHECK (tfs_rename (otherFD, "renamed") == RENAME_SUCCESS);
+  CHECK (tfs_stat ("shared", &info) == FILE_NOT_FOUND_ERROR);
+  CHECK (tfs_stat ("renamed", &info) == INFO_SUCCESS && info.size == 900);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  CHECK (tfs_stat ("renamed", &info) == INFO_SUCCESS && info.size == 900);
+  FD = tfs_openFile ("renamed");
+  CHECK (readsBack (FD, content, 900));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+}
+
+/* a batch creates new names and opens existing ones, and a directory can go in the same delete
+   batch as the files in it */
+void testBatches ()
+{
+  char *names[] = { "one", "batch/two", "batch/three", "one", "missing/four" };
+  fileDescriptor FDs[5], doomed[3];
+  char listed[4][MAX_FILENAME_LENGTH + 1];
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (7);
+  CHECK (tfs_mkdir ("batch") == 1);
+  CHECK (tfs_createMany (names, 5, FDs) == 4);
+  CHECK (FDs[0] >= 0 && FDs[1] >= 0 && FDs[2] >= 0);
+  CHECK (FDs[3] == FDs[0]);
+  CHECK (FDs[4] < 0);
+  CHECK (tfs_writeFile (FDs[1], content, 400) == 1);
+  CHECK (readsBack (FDs[1], content, 400));
+  CHECK (tfs_listDirectory ("batch", listed, 4) == 2);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  CHECK (tfs_createMany (names, 3, FDs) == 3);
+  CHECK (readsBack (FDs[1], content, 400));
+  doomed[0] = FDs[1];
+  doomed[1] = FDs[2];
+  doomed[2] = tfs_openPath ("batch");
+  CHECK (tfs_deleteMany (doomed, 3) == 3);
+  CHECK (tfs_listDirectory ("/", listed, 4) == 1);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+}
+
+/* reads through the readahead window stay correct across seeks, and two files read in turn do
+   not share a window */
+void testReadahead ()
+{
+  fileDescriptor aFD, bFD;
+  char c;
+  int i, ok = 1;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (8);
+  aFD = tfs_openFile ("a");
+  bFD = tfs_openFile ("b");
+  CHECK (tfs_writeFile (aFD, content, 30000) == 1);
+  CHECK (tfs_writeFile (bFD, content + 100, 10000) == 1);
+  for (i = 0; i < 10000 && ok; i++)
+    {
+      ok = tfs_readByte (aFD, &c) >= 0 && c == content[i];
+      ok = ok && tfs_readByte (bFD, &c) >= 0 && c == content[100 + i];
+    }
+  CHECK (ok);
+  CHECK (readsBack (aFD, content + 10000, 20000));
+  CHECK (tfs_seek (aFD, 25000) >= 0);
+  CHECK (readsBack (aFD, content + 25000, 100));
+  CHECK (tfs_seek (aFD, 3) >= 0);
+  CHECK (readsBack (aFD, content + 3, 600));
+  CHECK (tfs_seek (aFD, 29999) >= 0);
+  CHECK (readsBack (aFD, content + 29999, 1));
+  CHECK (tfs_readByte (aFD, &c) == END_OF_FILE_ERROR);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+}
+
+/* copy the test image, mounted or not, to name */
+int copyImage (char *name)
+{
+  static char image[BLOCKSIZE * 2048];
+  FILE *from = fopen (TEST_DISK_NAME, "rb");
+  FILE *to = fopen (name, "wb");
+  int size = -1;
+  if (from != NULL && to != NULL)
+    {
+      size = fread (image, 1, sizeof (image), from);
+      if (fwrite (image, 1, size, to) != size)
+	size = -1;
+    }
+  if (from != NULL)
+    fclose (from);
+  if (to != NULL)
+    fclose (to);
+  return size;
+}
+
+/* what tfs_fsync and tfs_sync return has reached the image file while the file system is still
+   mounted: a copy taken right after mounts and reads it back */
+void testDurability ()
+{
+  fileDescriptor aFD, bFD;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (9);
+  aFD = tfs_openFile ("fsynced");
+  CHECK (tfs_writeFile (aFD, content, 1500) == 1);
+  CHECK (tfs_fsync (aFD) == 1);
+  CHECK (copyImage ("tfsCopy.dsk") == TEST_DISK_SIZE);
+  bFD = tfs_openFile ("synced");
+  CHECK (tfs_writeFile (bFD, content + 50, 800) == 1);
+  CHECK (tfs_writeFile (aFD, content + 9, 1500) == 1);
+  CHECK (tfs_sync () == 1);
+  CHECK (copyImage ("tfsSync.dsk") == TEST_DISK_SIZE);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+
+  CHECK (tfs_mount ("tfsCopy.dsk") == MOUNT_SUCCESS);
+  aFD = tfs_openFile ("fsynced");
+  CHECK (readsBack (aFD, content, 1500));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (system ("./tinyfsck tfsCopy.dsk > /dev/null") == 0);
+  CHECK (tfs_mount ("tfsSync.dsk") == MOUNT_SUCCESS);
+  aFD = tfs_openFile ("fsynced");
+  bFD = tfs_openFile ("synced");
+  CHECK (readsBack (aFD, content + 9, 1500));
+  CHECK (readsBack (bFD, content + 50, 800));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (system ("./tinyfsck tfsSync.dsk > /dev/null") == 0);
+  remove ("tfsCopy.dsk");
+  remove ("tfsSync.dsk");
+}
+
+/* images opened with O_DIRECT are written and read in whole aligned units and stay readable */
+void testDirectIO ()
+{
+  fileDescriptor FD;
+  CHECK (tfs_setDirectIO (1) == 1);
+  if (freshDisk (TEST_DISK_SIZE + 3 * BLOCKSIZE) < 0)
+    {
+      tfs_setDirectIO (0);
+      return;
+    }
+  fillContent (10);
+  FD = tfs_openFile ("direct");
+  CHECK (tfs_writeFile (FD, content, 7000) == 1);
+  CHECK (tfs_writeAt (FD, 6900, content + 1, 300) == 1);
+  CHECK (readsBack (FD, content, 6900));
+  CHECK (readsBack (FD, content + 1, 300));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  FD = tfs_openFile ("direct");
+  CHECK (readsBack (FD, content, 6900));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (tfs_setDirectIO (0) == 1);
+}
+
+/* file entries come from a per-mount arena: descriptors stay usable while files are opened and
+   closed many times over, and every mount starts from a fresh arena */
+void testFileEntries ()
+{
+  fileDescriptor FDs[60];
+  char name[MAX_FILENAME_LENGTH + 1];
+  int mount, i, ok = 1;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  for (mount = 0; mount < 4; mount++)
+    {
+      CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+      for (i = 0; i < 60; i++)
+	{
+	  sprintf (name, "entry number %i", i);
+	  FDs[i] = tfs_openFile (name);
+	  ok = ok && FDs[i] >= 0;
+	  if (mount == 0 && ok)
+	    ok = tfs_writeFile (FDs[i], name, strlen (name)) == 1;
+	}
+      for (i = 0; i < 60; i += 2)
+	ok = ok && tfs_closeFile (FDs[i]) >= 0;
+      for (i = 0; i < 60; i++)
+	{
+	  sprintf (name, "entry number %i", i);
+	  FDs[i] = tfs_openFile (name);
+	  ok = ok && FDs[i] >= 0 && readsBack (FDs[i], name, strlen (name));
+	}
+      CHECK (ok);
+      CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+    }
+  CHECK (fsckClean ());
+}
+
+/* mounting reads the superblock only, everything else is read on first use: a file that is not
+   a TinyFS image is turned away, and a full image works from a cold mount */
+void testLazyMount ()
+{
+  fileDescriptor FD;
+  FILE *junk;
+  char name[MAX_FILENAME_LENGTH + 1];
+  int i;
+  junk = fopen ("tfsJunk.dsk", "wb");
+  for (i = 0; i < TEST_DISK_SIZE; i++)
+    fputc (i & 0x7F, junk);
+  fclose (junk);
+  CHECK (tfs_mount ("tfsJunk.dsk") == MAGIC_NUMBER_ERROR);
+  CHECK (tfs_mount ("tfsMissing.dsk") < 0);
+  remove ("tfsJunk.dsk");
+
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (11);
+  CHECK (tfs_setDedup (1) == 1);
+  CHECK (tfs_mkdir ("deep") == 1);
+  CHECK (tfs_mkdir ("deep/er") == 1);
+  for (i = 0; i < 20; i++)
+    {
+      sprintf (name, "deep/er/f%i", i);
+      FD = tfs_openPath (name);
+      CHECK (tfs_writeFile (FD, content + i, 300) == 1);
+    }
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  FD = tfs_openPath ("deep/er/f13");
+  CHECK (readsBack (FD, content + 13, 300));
+  FD = tfs_openPath ("deep/er/f20");
+  CHECK (tfs_writeFile (FD, content + 13, 300) == 1);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+}
+
+/* tinyfsck repairs a block the bitmap holds for nothing, and leaves the image clean */
+void testFsck ()
+{
+  fileDescriptor FD;
+  FILE *image;
+  unsigned char bitmapByte;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (12);
+  FD = tfs_openFile ("checked");
+  CHECK (tfs_writeFile (FD, content, 2000) == 1);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  /* the bitmap starts at superblock byte 7, a clear bit is a block in use */
+  image = fopen (TEST_DISK_NAME, "r+b");
+  fseek (image, 7 + 199 / 8, SEEK_SET);
+  bitmapByte = fgetc (image);
+  CHECK (bitmapByte & 0x80);
+  fseek (image, 7 + 199 / 8, SEEK_SET);
+  fputc (bitmapByte & ~0x80, image);
+  fclose (image);
+  CHECK (system ("./tinyfsck " TEST_DISK_NAME " > /dev/null") == 4 << 8);
+  CHECK (system ("./tinyfsck -r -j 3 " TEST_DISK_NAME " > /dev/null") == 1 << 8);
+  CHECK (fsckClean ());
+  CHECK (system ("./tinyfsck tfsMissing.dsk 2> /dev/null") == 8 << 8);
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  FD = tfs_openFile ("checked");
+  CHECK (readsBack (FD, content, 2000));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+}
+
+/* write a file of blocks that no compression or dedup shrinks over whatever free space is left,
+   so the next allocation fails */
+fileDescriptor fillDisk (char *name)
+{
+  static char filler[65535];
+  fileDescriptor FD = tfs_openFile (name);
+  int i, size;
+  for (i = 0; i < sizeof (filler); i++)
+    filler[i] = (char) (i * 131 + i / 7);
+  tfs_setFileCompression (FD, 0);
+  for (size = 252 * 255; size > 0; size -= 252)
+    if (tfs_writeFile (FD, filler, size) == 1)
+      break;
+  return FD;
+}
+
+/* sparse files: holes read as zeros, SEEK_DATA and SEEK_HOLE find them, truncate grows and
+   shrinks. A file that has to be rewritten as a sparse copy and cannot be keeps its content */
+void testSparse ()
+{
+  fileDescriptor FD, fillerFD;
+  char zeros[1000];
+  int used, before, limit;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (13);
+  memset (zeros, 0, sizeof (zeros));
+  FD = tfs_openFile ("sparse");
+  CHECK (tfs_writeAt (FD, 2000, content, 300) == 1);
+  CHECK (readsBack (FD, zeros, 1000));
+  CHECK (tfs_seek (FD, 2000) >= 0);
+  CHECK (readsBack (FD, content, 300));
+  CHECK (tfs_lseek (FD, 0, SEEK_DATA) == 2000 / 252 * 252);
+  CHECK (tfs_lseek (FD, 2000, SEEK_HOLE) == 2300);
+  CHECK (tfs_lseek (FD, 0, SEEK_END) == 2300);
+  CHECK (tfs_truncate (FD, 5000) == 1);
+  CHECK (tfs_lseek (FD, 2100, SEEK_HOLE) == 10 * 252);
+  CHECK (tfs_truncate (FD, 2100) == 1);
+  CHECK (tfs_truncate (FD, 2300) == 1);
+  CHECK (tfs_seek (FD, 2000) >= 0);
+  CHECK (readsBack (FD, content, 100));
+  CHECK (readsBack (FD, zeros, 200));
+  CHECK (tfs_writeFile (FD, content, 600) == 1);
+  CHECK (tfs_writeAt (FD, 100, zeros, 50) == 1);
+  CHECK (readsBack (FD, content, 100));
+  CHECK (readsBack (FD, zeros, 50));
+  CHECK (readsBack (FD, content + 150, 450));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  /* a compressed file has to be copied out to become sparse, which a full disk has no room for */
+  CHECK (freshDisk (TEST_DISK_SIZE) == 0);
+  for (int i = 0; i < 4035; i++)
+    content[i] = "squeeze"[i % 7];
+  CHECK (tfs_setCompression (1) == 1);
+  FD = tfs_openFile ("packed");
+  CHECK (tfs_writeFile (FD, content, 4035) == 1);
+  fillerFD = fillDisk ("filler");
+  CHECK (tfs_writeAt (FD, 590, zeros, 613) == FREE_BLOCK_ERROR);
+  CHECK (tfs_truncate (FD, 100) == FREE_BLOCK_ERROR);
+  CHECK (tfs_fallocate (FD, 4035, 0) == FREE_BLOCK_ERROR);
+  CHECK (tfs_seek (FD, 0) >= 0);
+  CHECK (readsBack (FD, content, 4035));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  FD = tfs_openFile ("packed");
+  CHECK (readsBack (FD, content, 4035));
+  fillerFD = tfs_openFile ("filler");
+  CHECK (tfs_deleteFile (fillerFD) == DELETE_SUCCESS);
+  CHECK (tfs_writeAt (FD, 590, zeros, 613) == 1);
+  CHECK (tfs_seek (FD, 0) >= 0);
+  CHECK (readsBack (FD, content, 590));
+  CHECK (readsBack (FD, zeros, 613));
+  CHECK (readsBack (FD, content + 1203, 4035 - 1203));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  /* a damaged edge block stops a write before it takes new blocks for the holes in front of it */
+  CHECK (freshDisk (TEST_DISK_SIZE) == 0);
+  CHECK (tfs_setQuota (0, 150) == 1);
+  fillContent (13);
+  FD = tfs_openFile ("edges");
+  CHECK (tfs_writeAt (FD, 2000, content, 300) == 1);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (corruptImage (content + 100, 16) >= 0);
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  CHECK (tfs_quotaUsage (0, &used, &limit) == 1);
+  FD = tfs_openFile ("edges");
+  CHECK (tfs_writeAt (FD, 0, content + 5000, 2100) == CHECKSUM_ERROR);
+  CHECK (tfs_quotaUsage (0, &before, &limit) == 1);
+  CHECK (before == used);
+  CHECK (tfs_lseek (FD, 0, SEEK_DATA) == 2000 / 252 * 252);
+  CHECK (tfs_seek (FD, 0) >= 0);
+  CHECK (readsBack (FD, zeros, 252));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+}
+
+/* a preallocated file is rewritten in its reserved blocks, so it can still be rewritten, shrunk
+   and grown again up to its reservation once the disk is full */
+void testFallocate ()
+{
+  fileDescriptor FD, lazyFD;
+  char zeros[3000];
+  FileInfo info;
+  int used, before, limit;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (14);
+  memset (zeros, 0, sizeof (zeros));
+  FD = tfs_openFile ("reserved");
+  CHECK (tfs_writeFile (FD, content, 500) == 1);
+  CHECK (tfs_fallocate (FD, 3000, 0) == 1);
+  CHECK (tfs_stat ("reserved", &info) == INFO_SUCCESS && info.size == 500);
+  CHECK (readsBack (FD, content, 500));
+  lazyFD = tfs_openFile ("lazy");
+  CHECK (tfs_fallocate (lazyFD, 2000, FALLOCATE_NO_ZERO) == 1);
+  CHECK (tfs_truncate (lazyFD, 2000) == 1);
+  CHECK (readsBack (lazyFD, zeros, 2000));
+  fillDisk ("filler");
+  CHECK (tfs_writeFile (FD, content + 1, 3000) == 1);
+  CHECK (readsBack (FD, content + 1, 3000));
+  CHECK (tfs_writeFile (FD, content + 2, 1000) == 1);
+  CHECK (tfs_writeFile (FD, content + 3, 3000) == 1);
+  CHECK (readsBack (FD, content + 3, 3000));
+  CHECK (tfs_writeAt (lazyFD, 1000, content, 500) == 1);
+  CHECK (tfs_writeFile (FD, content, 3300) == FREE_BLOCK_ERROR);
+  CHECK (tfs_seek (FD, 0) >= 0);
+  CHECK (readsBack (FD, content + 3, 3000));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  lazyFD = tfs_openFile ("lazy");
+  CHECK (readsBack (lazyFD, zeros, 1000));
+  CHECK (readsBack (lazyFD, content, 500));
+  CHECK (readsBack (lazyFD, zeros, 500));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+
+  /* a block that fails its checksum while the file moves to a bigger run leaves the file mapped
+     where it was, with the new run and its charge given back */
+  CHECK (freshDisk (TEST_DISK_SIZE) == 0);
+  CHECK (tfs_setQuota (0, 150) == 1);
+  FD = tfs_openFile ("moving");
+  CHECK (tfs_writeFile (FD, content, 504) == 1);
+  CHECK (tfs_writeFile (tfs_openFile ("behind"), content + 3000, 100) == 1);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (corruptImage (content + 300, 16) >= 0);
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  CHECK (tfs_quotaUsage (0, &used, &limit) == 1);
+  FD = tfs_openFile ("moving");
+  CHECK (tfs_fallocate (FD, 252 * 10, 0) == CHECKSUM_ERROR);
+  CHECK (tfs_quotaUsage (0, &before, &limit) == 1);
+  CHECK (before == used);
+  CHECK (tfs_stat ("moving", &info) == INFO_SUCCESS && info.size == 504);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+}
+
+/* files move to and from host descriptors: a regular file, a pipe, and back out again */
+void testHostTransfer ()
+{
+  static char back[65535];
+  fileDescriptor FD, pipedFD;
+  FILE *host = tmpfile ();
+  FILE *out = tmpfile ();
+  int pipeFDs[2];
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (15);
+  fwrite (content, 1, 20000, host);
+  fflush (host);
+  lseek (fileno (host), 0, SEEK_SET);
+  FD = tfs_import (fileno (host), "imported");
+  CHECK (FD >= 0);
+  CHECK (readsBack (FD, content, 20000));
+  CHECK (write (fileno (out), "head", 4) == 4);
+  CHECK (tfs_export (FD, fileno (out)) == 20000);
+  lseek (fileno (out), 0, SEEK_SET);
+  CHECK (read (fileno (out), back, sizeof (back)) == 20004);
+  CHECK (memcmp (back + 4, content, 20000) == 0);
+
+  CHECK (pipe (pipeFDs) == 0);
+  CHECK (write (pipeFDs[1], content + 5, 3000) == 3000);
+  close (pipeFDs[1]);
+  pipedFD = tfs_import (pipeFDs[0], "piped");
+  close (pipeFDs[0]);
+  CHECK (readsBack (pipedFD, content + 5, 3000));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+  fclose (host);
+  fclose (out);
+}
+
+/* header-free images hold 256 bytes of content per block. Extents have to start below block 256
+   wherever the image ends, so writes that find no such run fail without leaking blocks */
+void testRawData ()
+{
+  fileDescriptor FD;
+  char name[MAX_FILENAME_LENGTH + 1];
+  int i, result = 1;
+  CHECK (tfs_setRawData (1) == 1);
+  if (freshDisk (BLOCKSIZE * 400) < 0)
+    {
+      tfs_setRawData (0);
+      return;
+    }
+  CHECK (tfs_setRawData (0) == 1);
+  fillContent (16);
+  FD = tfs_openFile ("raw");
+  CHECK (tfs_writeFile (FD, content, 256 * 10) == 1);
+  CHECK (readsBack (FD, content, 256 * 10));
+  CHECK (tfs_writeAt (FD, 256 * 3 + 5, content + 9, 300) == 1);
+  CHECK (tfs_seek (FD, 256 * 3 + 5) >= 0);
+  CHECK (readsBack (FD, content + 9, 300));
+  for (i = 0; i < 40 && result == 1; i++)
+    {
+      sprintf (name, "fill%i", i);
+      result = tfs_writeFile (tfs_openFile (name), content, 256 * 20);
+    }
+  CHECK (result == FREE_BLOCK_ERROR);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  /* the same on an image with block headers, where the whole extent has to sit below 256 */
+  CHECK (freshDisk (BLOCKSIZE * 400) == 0);
+  result = 1;
+  for (i = 0; i < 40 && result == 1; i++)
+    {
+      sprintf (name, "fill%i", i);
+      result = tfs_writeFile (tfs_openFile (name), content, 252 * 20);
+    }
+  CHECK (result == FREE_BLOCK_ERROR);
+  FD = tfs_openFile ("fill0");
+  CHECK (readsBack (FD, content, 252 * 20));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+}
+
+/* scatters size bytes of content over count iovecs of uneven length */
+int splitVector (struct iovec *iov, char *buffer, int size, int count)
+{
+  int i, pos = 0;
+  for (i = 0; i < count && pos < size; i++)
+    {
+      iov[i].iov_base = buffer + pos;
+      iov[i].iov_len = i == count - 1 ? size - pos : 1 + (i * 37) % 61;
+      if (pos + (int) iov[i].iov_len > size)
+        iov[i].iov_len = size - pos;
+      pos += iov[i].iov_len;
+    }
+  return i;
+}
+
+/* iovecs land on the right bytes whichever way they split the blocks, including
+   blocks spread over more than 16 buffers, holes and compressed files */
+void testVectored ()
+{
+  static char readback[65535];
+  struct iovec iov[2000];
+  fileDescriptor FD;
+  int count;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  CHECK (tfs_setCompression (0) == 1);
+  fillContent (17);
+  FD = tfs_openFile ("vector");
+  count = splitVector (iov, content, 20000, 2000);
+  CHECK (tfs_writev (FD, iov, count) == 1);
+  CHECK (readsBack (FD, content, 20000));
+  CHECK (tfs_seek (FD, 1000) >= 0);
+  memset (readback, 0, sizeof (readback));
+  count = splitVector (iov, readback, 15000, 300);
+  CHECK (tfs_readv (FD, iov, count) == 15000);
+  CHECK (memcmp (readback, content + 1000, 15000) == 0);
+  count = splitVector (iov, readback, 8000, 100);
+  CHECK (tfs_readv (FD, iov, count) == 4000);
+  CHECK (memcmp (readback, content + 16000, 4000) == 0);
+  CHECK (tfs_readv (FD, iov, count) == 0);
+
+  /* a rewrite that fits a smaller extent keeps the file consistent */
+  count = splitVector (iov, content + 3, 700, 9);
+  CHECK (tfs_writev (FD, iov, count) == 1);
+  CHECK (readsBack (FD, content + 3, 700));
+
+  /* holes read as zeros between the written ranges */
+  FD = tfs_openFile ("holes");
+  CHECK (tfs_writeAt (FD, 3000, content, 500) == 1);
+  memset (readback, 1, sizeof (readback));
+  count = splitVector (iov, readback, 3500, 50);
+  CHECK (tfs_readv (FD, iov, count) == 3500);
+  CHECK (memcmp (readback + 3000, content, 500) == 0);
+  for (count = 0; count < 3000 && readback[count] == 0; count++)
+    ;
+  CHECK (count == 3000);
+
+  /* compressed files take the gathered path through tfs_writeFile */
+  for (count = 0; count < 5000; count++)
+    content[count] = "vectored"[count % 8];
+  CHECK (tfs_setCompression (1) == 1);
+  FD = tfs_openFile ("packed");
+  count = splitVector (iov, content, 5000, 40);
+  CHECK (tfs_writev (FD, iov, count) == 1);
+  CHECK (tfs_setCompression (0) == 1);
+  memset (readback, 0, sizeof (readback));
+  count = splitVector (iov, readback, 5000, 70);
+  CHECK (tfs_readv (FD, iov, count) == 5000);
+  CHECK (memcmp (readback, content, 5000) == 0);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+}
+
+/* a striped disk round-trips through its members, and each member's header refuses
+   another stripe unit, member count or order instead of mounting scrambled blocks */
+#define STRIPE_DISK "stripe:4:tfsStripe0.dsk,tfsStripe1.dsk"
+
+void testStriping ()
+{
+  fileDescriptor FD;
+  int direct;
+  fillContent (18);
+  for (direct = 0; direct <= 1; direct++)
+    {
+      CHECK (tfs_setDirectIO (direct) == 1);
+      CHECK (tfs_mkfs (STRIPE_DISK, TEST_DISK_SIZE) == MKFS_SUCCESS);
+      CHECK (tfs_mount (STRIPE_DISK) == MOUNT_SUCCESS);
+      FD = tfs_openFile ("striped");
+      CHECK (tfs_writeFile (FD, content, 20000) == 1);
+      CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+      CHECK (system ("./tinyfsck " STRIPE_DISK " > /dev/null") == 0);
+      CHECK (tfs_mount (STRIPE_DISK) == MOUNT_SUCCESS);
+      FD = tfs_openFile ("striped");
+      CHECK (readsBack (FD, content, 20000));
+      CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+    }
+  CHECK (tfs_setDirectIO (0) == 1);
+  CHECK (tfs_mount ("stripe:8:tfsStripe0.dsk,tfsStripe1.dsk") < 0);
+  CHECK (tfs_mount ("stripe:4:tfsStripe1.dsk,tfsStripe0.dsk") < 0);
+  CHECK (tfs_mount ("stripe:4:tfsStripe0.dsk") < 0);
+  CHECK (tfs_mount ("stripe:4:tfsStripe0.dsk,tfsStripe1.dsk," TEST_DISK_NAME) < 0);
+  CHECK (tfs_mount ("stripe:-4:tfsStripe0.dsk,tfsStripe1.dsk") < 0);
+  CHECK (tfs_mount ("stripe:4x:tfsStripe0.dsk,tfsStripe1.dsk") < 0);
+  CHECK (tfs_mount ("stripe::tfsStripe0.dsk,tfsStripe1.dsk") < 0);
+  CHECK (tfs_mount (STRIPE_DISK) == MOUNT_SUCCESS);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  remove ("tfsStripe0.dsk");
+  remove ("tfsStripe1.dsk");
+}
+
+/* a mirrored disk opened with O_DIRECT formats, mounts and rebuilds a missing member */
+#define MIRROR_DISK "mirror:tfsMirror0.dsk,tfsMirror1.dsk"
+
+void testMirroring ()
+{
+  fileDescriptor FD;
+  FILE *member;
+  unsigned char oldBlocks[4] = { 0, 0, 0, 200 };
+  int direct;
+  fillContent (19);
+  for (direct = 0; direct <= 1; direct++)
+    {
+      CHECK (tfs_setDirectIO (direct) == 1);
+      CHECK (tfs_mkfs (MIRROR_DISK, TEST_DISK_SIZE) == MKFS_SUCCESS);
+      CHECK (tfs_mount (MIRROR_DISK) == MOUNT_SUCCESS);
+      FD = tfs_openFile ("mirrored");
+      CHECK (tfs_writeFile (FD, content, 20000) == 1);
+      CHECK (tfs_writeAt (FD, 19900, content + 5, 300) == 1);
+      CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+      CHECK (system ("./tinyfsck " MIRROR_DISK " > /dev/null") == 0);
+
+      /* each member is rebuilt in turn from the other one */
+      remove ("tfsMirror1.dsk");
+      CHECK (tfs_mount (MIRROR_DISK) == MOUNT_SUCCESS);
+      CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+      remove ("tfsMirror0.dsk");
+      CHECK (tfs_mount (MIRROR_DISK) == MOUNT_SUCCESS);
+      FD = tfs_openFile ("mirrored");
+      CHECK (readsBack (FD, content, 19900));
+      CHECK (readsBack (FD, content + 5, 300));
+      CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+    }
+  CHECK (tfs_setDirectIO (0) == 1);
+
+  /* members written before the disk started on an aligned unit are refused, not misread */
+  for (direct = 0; direct < 2; direct++)
+    {
+      member = fopen (direct == 0 ? "tfsMirror0.dsk" : "tfsMirror1.dsk", "r+b");
+      CHECK (member != NULL);
+      if (member == NULL)
+        continue;
+      fseek (member, 8, SEEK_SET);
+      fwrite (oldBlocks, 1, 4, member);
+      fclose (member);
+    }
+  CHECK (tfs_mount (MIRROR_DISK) < 0);
+  remove ("tfsMirror0.dsk");
+  remove ("tfsMirror1.dsk");
+}
+
+/* every access hint leaves reads returning the same bytes, on the page cache and with
+   O_DIRECT, and bad hints or ranges are refused */
+void testAdvise ()
+{
+  fileDescriptor FD;
+  int direct, advice;
+  fillContent (20);
+  for (direct = 0; direct <= 1; direct++)
+    {
+      CHECK (tfs_setDirectIO (direct) == 1);
+      if (freshDisk (TEST_DISK_SIZE) < 0)
+        break;
+      FD = tfs_openFile ("advised");
+      CHECK (tfs_writeFile (FD, content, 20000) == 1);
+      for (advice = TFS_ADVICE_NORMAL; advice <= TFS_ADVICE_NOREUSE; advice++)
+        {
+          CHECK (tfs_advise (FD, 1000, 5000, advice) == 1);
+          CHECK (tfs_seek (FD, 0) >= 0);
+          CHECK (readsBack (FD, content, 20000));
+        }
+      CHECK (tfs_advise (FD, 0, 0, TFS_ADVICE_WILLNEED) == 1);
+      CHECK (tfs_advise (FD, 0, 0, TFS_ADVICE_NOREUSE + 1) == ADVICE_ERROR);
+      CHECK (tfs_advise (FD, -1, 10, TFS_ADVICE_NORMAL) == RANGE_ERROR);
+      CHECK (tfs_advise (FD, 0, -10, TFS_ADVICE_DONTNEED) == RANGE_ERROR);
+      CHECK (tfs_advise (FD, -1, -10, TFS_ADVICE_NOREUSE + 1) == ADVICE_ERROR);
+      CHECK (tfs_seek (FD, 7000) >= 0);
+      CHECK (readsBack (FD, content + 7000, 13000));
+      CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+    }
+  CHECK (tfs_setDirectIO (0) == 1);
+}
+
+/* a quota caps what an owner's files hold, and a rewrite it cannot take leaves the file
+   and the owner's usage as they were */
+void testQuotas ()
+{
+  fileDescriptor FD;
+  struct iovec iov[3];
+  int used, limit;
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    return;
+  fillContent (21);
+  CHECK (tfs_setOwner (3) == 1);
+  CHECK (tfs_setQuota (3, 10) == 1);
+  FD = tfs_openFile ("capped");
+  CHECK (tfs_writeFile (FD, content, 252 * 8) == 1);
+  CHECK (tfs_quotaUsage (3, &used, &limit) == 1);
+  CHECK (used == 8 && limit == 10);
+  CHECK (tfs_writeFile (FD, content + 1, 3000) == QUOTA_ERROR);
+  CHECK (splitVector (iov, content + 1, 3000, 3) == 3);
+  CHECK (tfs_writev (FD, iov, 3) == QUOTA_ERROR);
+  CHECK (tfs_quotaUsage (3, &used, &limit) == 1);
+  CHECK (used == 8);
+  CHECK (tfs_seek (FD, 0) >= 0);
+  CHECK (readsBack (FD, content, 252 * 8));
+  CHECK (tfs_writeFile (FD, content + 2, 252 * 10) == 1);
+  CHECK (tfs_writeFile (tfs_openFile ("over"), content, 10) == QUOTA_ERROR);
+  CHECK (tfs_quotaUsage (3, &used, &limit) == 1);
+  CHECK (used == 10);
+  CHECK (tfs_setOwner (0) == 1);
+  CHECK (tfs_writeFile (tfs_openFile ("free"), content, 5000) == 1);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  CHECK (tfs_mount (TEST_DISK_NAME) == MOUNT_SUCCESS);
+  CHECK (tfs_quotaUsage (3, &used, &limit) == 1);
+  CHECK (used == 10 && limit == 10);
+  FD = tfs_openFile ("capped");
+  CHECK (readsBack (FD, content + 2, 252 * 10));
+  CHECK (tfs_deleteFile (FD) == DELETE_SUCCESS);
+  CHECK (tfs_quotaUsage (3, &used, &limit) == 1);
+  CHECK (used == 0);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+
+  /* a rewrite the disk has no room for keeps the old content too, and one that only fits
+     where the old content was still goes through */
+  CHECK (freshDisk (TEST_DISK_SIZE) == 0);
+  FD = tfs_openFile ("kept");
+  CHECK (tfs_writeFile (FD, content, 252 * 5) == 1);
+  fillDisk ("filler");
+  CHECK (tfs_writeFile (FD, content + 1, 252 * 40) == FREE_BLOCK_ERROR);
+  CHECK (splitVector (iov, content + 1, 252 * 40, 3) == 3);
+  CHECK (tfs_writev (FD, iov, 3) == FREE_BLOCK_ERROR);
+  CHECK (readsBack (FD, content, 252 * 5));
+  CHECK (tfs_writeFile (FD, content + 2, 252 * 5) == 1);
+  CHECK (readsBack (FD, content + 2, 252 * 5));
+  CHECK (splitVector (iov, content + 3, 252 * 5, 3) == 3);
+  CHECK (tfs_writev (FD, iov, 3) == 1);
+  CHECK (readsBack (FD, content + 3, 252 * 5));
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (fsckClean ());
+}
+
+/* a traced session starts with the trace magic, and tinyfs-replay plays it back onto a
+   fresh image with every call returning what it did when recorded */
+void testTrace ()
+{
+  fileDescriptor FD;
+  char magic[4];
+  FILE *trace;
+  remove ("tfsTest.trace");
+  CHECK (tfs_trace ("tfsTest.trace") == 1);
+  if (freshDisk (TEST_DISK_SIZE) < 0)
+    {
+      tfs_trace (NULL);
+      return;
+    }
+  fillContent (22);
+  FD = tfs_openFile ("traced");
+  CHECK (tfs_writeFile (FD, content, 5000) == 1);
+  CHECK (tfs_writeAt (FD, 4000, content + 3, 2000) == 1);
+  CHECK (readsBack (FD, content, 100));
+  CHECK (tfs_seek (FD, 4000) >= 0);
+  CHECK (readsBack (FD, content + 3, 2000));
+  CHECK (tfs_mkdir ("/logs") == 1);
+  CHECK (tfs_writeFile (tfs_openPath ("/logs/today"), content, 300) == 1);
+  CHECK (tfs_deleteFile (tfs_openFile ("traced")) == DELETE_SUCCESS);
+  CHECK (tfs_unmount () == UNMOUNT_SUCCESS);
+  CHECK (tfs_trace (NULL) == 1);
+
+  trace = fopen ("tfsTest.trace", "rb");
+  CHECK (trace != NULL && fread (magic, 1, 4, trace) == 4 && memcmp (magic, "TFST", 4) == 0);
+  if (trace != NULL)
+    fclose (trace);
+  remove ("tfsReplay.dsk");
+  CHECK (system ("./tinyfs-replay tfsTest.trace tfsReplay.dsk > tfsReplay.out") == 0);
+  CHECK (system ("grep -q 'returned something other' tfsReplay.out") != 0);
+  CHECK (system ("./tinyfsck tfsReplay.dsk > /dev/null") == 0);
+  remove ("tfsTest.trace");
+  remove ("tfsReplay.out");
+  remove ("tfsReplay.dsk");
+}
+
+int
+main ()
+{
+  if (demo () < 0)
+    failures++;
+  testFiles ();
+  testChecksums ();
+  testCompression ();
+  testDedup ();
+  testSnapshots ();
+  testDirectories ();
+  testInodeCache ();
+  testBatches ();
+  testReadahead ();
+  testDurability ();
+  testDirectIO ();
+  testFileEntries ();
+  testLazyMount ();
+  testFsck ();
+  testSparse ();
+  testFallocate ();
+  testHostTransfer ();
+  testRawData ();
+  testVectored ();
+  testStriping ();
+  testMirroring ();
+  testAdvise ();
+  testQuotas ();
+  testTrace ();
+
+  if (failures > 0)
+    {
+      printf ("] %i checks failed.\n", failures);
+      return 1;
+    }
+  printf ("] All checks passed.\n");
+  return 0;
+}
@@ -22,5 +22,7 @@ int main(void) {
     tfs_deleteFile(fd);
     printf("Deleted testfile and then running readdir\n");
     tfs_readdir();
+    // writes are buffered, unmounting puts them on disk
+    tfs_unmount();
     return 1;
 }
\ No newline at end of file
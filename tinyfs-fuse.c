@@ -0,0 +1,732 @@
+// FUSE frontend: serves a TinyFS image at a mount point through the public tfs_* calls.
+// usage: tinyfs-fuse <image> <mountpoint> [FUSE options]
+//   -o direct_io    bypass the kernel page cache, every read and write reaches TinyFS
+//   -o kernel_cache keep cached pages across opens (the default when direct_io is not given)
+//   -s              single threaded loop instead of the default multithreaded one
+// Build with "make fuse", needs the libfuse 3 development files.
+
+#define FUSE_USE_VERSION 31
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fuse.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "libTinyFS.h"
+#include "libDisk.h"
+#include "TinyFS_errno.h"
+
+#define MAX_FILE_SIZE 65535                 // sizes are kept in two bytes of the inode
+#define MAX_DIRECTORY_ENTRIES 124           // 2 byte slots at bytes 4..250 of a directory block
+#define TRANSFER_SIZE (128 * 1024)          // largest read, write and readahead asked of the kernel
+
+// the library keeps a single mount in global state, so the threads of the FUSE loop take turns
+static pthread_mutex_t fsLock = PTHREAD_MUTEX_INITIALIZER;
+static time_t mountTime;
+
+// TinyFS writes whole files, so an open file is served from a copy of its content that is
+// written back with one tfs_writeFile on flush. Opens of the same file share the copy
+typedef struct OpenFile
+{
+    char path[PATH_MAX];
+    fileDescriptor fd;
+    char *data;
+    int size;
+    int dirty;   // data differs from the file on disk
+    int users;   // opens not released yet
+    int deleted; // unlinked while open, dropped on the last release without writing
+    struct OpenFile *next;
+} OpenFile;
+
+static OpenFile *openFiles = NULL;
+
+static int toErrno(int code)
+{
+    switch (code)
+    {
+    case FILE_NOT_FOUND_ERROR:
+        return -ENOENT;
+    case NAME_LENGTH_ERROR:
+        return -ENAMETOOLONG;
+    case DIRECTORY_FULL_ERROR:
+    case FREE_BLOCK_ERROR:
+        return -ENOSPC;
+    case READ_ONLY_ERROR:
+        return -EROFS;
+    case NOT_A_DIRECTORY_ERROR:
+        return -ENOTDIR;
+    case IS_A_DIRECTORY_ERROR:
+        return -EISDIR;
+    case DIRECTORY_NOT_EMPTY_ERROR:
+        return -ENOTEMPTY;
+    case FILE_EXISTS_ERROR:
+        return -EEXIST;
+    default:
+        return -EIO;
+    }
+}
+
+// FUSE paths start at the mount point with a '/', TinyFS paths are relative to the root
+static char *tinyPath(const char *path)
+{
+    while (*path == '/')
+    {
+        path++;
+    }
+    return (char *)path;
+}
+
+static OpenFile *findOpenFile(const char *path)
+{
+    for (OpenFile *file = openFiles; file != NULL; file = file->next)
+    {
+        if (!file->deleted && strcmp(file->path, path) == 0)
+        {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+static OpenFile *findOpenDescriptor(fileDescriptor fd)
+{
+    for (OpenFile *file = openFiles; file != NULL; file = file->next)
+    {
+        if (!file->deleted && file->fd == fd)
+        {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+// close a descriptor opened for a single call, unless an open file still uses it
+static void closeUnlessOpen(fileDescriptor fd)
+{
+    if (findOpenDescriptor(fd) == NULL)
+    {
+        tfs_closeFile(fd);
+    }
+}
+
+// read the whole content of fd into a new buffer of MAX_FILE_SIZE bytes
+static int loadContent(fileDescriptor fd, int size, char **data)
+{
+    *data = (char *)malloc(MAX_FILE_SIZE);
+    if (*data == NULL)
+    {
+        return -ENOMEM;
+    }
+    tfs_seek(fd, 0);
+    for (int i = 0; i < size; i++)
+    {
+        int result = tfs_readByte(fd, *data + i);
+        if (result < 0)
+        {
+            free(*data);
+            *data = NULL;
+            return toErrno(result);
+        }
+    }
+    return 0;
+}
+
+static int writeBack(OpenFile *file)
+{
+    if (!file->dirty || file->deleted)
+    {
+        return 0;
+    }
+    int result = tfs_writeFile(file->fd, file->data, file->size);
+    if (result < 0)
+    {
+        return toErrno(result);
+    }
+    file->dirty = 0;
+    return 0;
+}
+
+static void dropOpenFile(OpenFile *file)
+{
+    OpenFile **link = &openFiles;
+    while (*link != file)
+    {
+        link = &(*link)->next;
+    }
+    *link = file->next;
+    if (!file->deleted)
+    {
+        tfs_closeFile(file->fd);
+    }
+    free(file->data);
+    free(file);
+}
+
+// open path, which must be an existing regular file, and share its content with earlier opens
+static int openContent(const char *path, OpenFile **opened)
+{
+    OpenFile *file = findOpenFile(path);
+    if (file != NULL)
+    {
+        file->users++;
+        *opened = file;
+        return 0;
+    }
+    FileInfo info;
+    int result = tfs_stat(tinyPath(path), &info);
+    if (result < 0)
+    {
+        return toErrno(result);
+    }
+    if (info.isDirectory)
+    {
+        return -EISDIR;
+    }
+    file = (OpenFile *)calloc(1, sizeof(OpenFile));
+    if (file == NULL)
+    {
+        return -ENOMEM;
+    }
+    file->fd = tfs_openFile(tinyPath(path));
+    if (file->fd < 0)
+    {
+        result = file->fd;
+        free(file);
+        return toErrno(result);
+    }
+    result = loadContent(file->fd, info.size, &file->data);
+    if (result < 0)
+    {
+        tfs_closeFile(file->fd);
+        free(file);
+        return result;
+    }
+    snprintf(file->path, sizeof(file->path), "%s", path);
+    file->size = info.size;
+    file->users = 1;
+    file->next = openFiles;
+    openFiles = file;
+    *opened = file;
+    return 0;
+}
+
+static void releaseContent(OpenFile *file)
+{
+    if (--file->users == 0)
+    {
+        writeBack(file);
+        dropOpenFile(file);
+    }
+}
+
+static int resize(OpenFile *file, off_t size)
+{
+    if (size > MAX_FILE_SIZE)
+    {
+        return -EFBIG;
+    }
+    if (size > file->size)
+    {
+        memset(file->data + file->size, 0, size - file->size);
+    }
+    file->size = (int)size;
+    file->dirty = 1;
+    return 0;
+}
+
+static void *tinyInit(struct fuse_conn_info *conn, struct fuse_config *cfg)
+{
+    conn->max_write = TRANSFER_SIZE;
+    conn->max_readahead = TRANSFER_SIZE;
+    // every change goes through this process, so cached pages only go stale when the image
+    // is written by something else while mounted
+    if (!cfg->direct_io)
+    {
+        cfg->kernel_cache = 1;
+    }
+    cfg->use_ino = 0;
+    return NULL;
+}
+
+static void tinyDestroy(void *private_data)
+{
+    (void)private_data;
+    pthread_mutex_lock(&fsLock);
+    while (openFiles != NULL)
+    {
+        writeBack(openFiles);
+        dropOpenFile(openFiles);
+    }
+    tfs_unmount();
+    pthread_mutex_unlock(&fsLock);
+}
+
+static int tinyGetattr(const char *path, struct stat *st, struct fuse_file_info *fi)
+{
+    (void)fi;
+    memset(st, 0, sizeof(struct stat));
+    pthread_mutex_lock(&fsLock);
+    FileInfo info;
+    int result = tfs_stat(tinyPath(path), &info);
+    OpenFile *file = findOpenFile(path);
+    if (result >= 0 && file != NULL)
+    {
+        info.size = file->size; // writes not flushed yet
+    }
+    pthread_mutex_unlock(&fsLock);
+    if (result < 0)
+    {
+        return toErrno(result);
+    }
+    st->st_mode = info.isDirectory ? S_IFDIR | 0755 : S_IFREG | 0644;
+    st->st_nlink = info.isDirectory ? 2 : 1;
+    st->st_size = info.size;
+    st->st_blocks = (info.size + 511) / 512;
+    st->st_blksize = BLOCKSIZE;
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    // inodes only keep the time of day they were created at
+    st->st_atime = st->st_mtime = st->st_ctime = mountTime;
+    return 0;
+}
+
+static int tinyReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
+                       struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+    (void)offset;
+    (void)fi;
+    (void)flags;
+    char names[MAX_DIRECTORY_ENTRIES][MAX_FILENAME_LENGTH + 1];
+    pthread_mutex_lock(&fsLock);
+    int count = tfs_listDirectory(tinyPath(path), names, MAX_DIRECTORY_ENTRIES);
+    pthread_mutex_unlock(&fsLock);
+    if (count < 0)
+    {
+        return toErrno(count);
+    }
+    filler(buf, ".", NULL, 0, 0);
+    filler(buf, "..", NULL, 0, 0);
+    for (int i = 0; i < count && i < MAX_DIRECTORY_ENTRIES; i++)
+    {
+        filler(buf, names[i], NULL, 0, 0);
+    }
+    return 0;
+}
+
+static int tinyOpen(const char *path, struct fuse_file_info *fi)
+{
+    pthread_mutex_lock(&fsLock);
+    OpenFile *file = NULL;
+    int result = openContent(path, &file);
+    if (result == 0 && (fi->flags & O_TRUNC))
+    {
+        resize(file, 0);
+    }
+    pthread_mutex_unlock(&fsLock);
+    if (result == 0)
+    {
+        fi->fh = (uint64_t)(uintptr_t)file;
+    }
+    return result;
+}
+
+static int tinyCreate(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    (void)mode;
+    pthread_mutex_lock(&fsLock);
+    FileInfo info;
+    int result = tfs_stat(tinyPath(path), &info);
+    if (result >= 0 && (fi->flags & O_EXCL))
+    {
+        result = -EEXIST;
+    }
+    else if (result == FILE_NOT_FOUND_ERROR)
+    {
+        // tfs_openFile creates the file, the descriptor is picked up again by openContent
+        fileDescriptor fd = tfs_openFile(tinyPath(path));
+        result = fd < 0 ? toErrno(fd) : 0;
+    }
+    else
+    {
+        result = result < 0 ? toErrno(result) : 0;
+    }
+    OpenFile *file = NULL;
+    if (result == 0)
+    {
+        result = openContent(path, &file);
+    }
+    if (result == 0 && (fi->flags & O_TRUNC))
+    {
+        resize(file, 0);
+    }
+    pthread_mutex_unlock(&fsLock);
+    if (result == 0)
+    {
+        fi->fh = (uint64_t)(uintptr_t)file;
+    }
+    return result;
+}
+
+static int tinyRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    (void)path;
+    OpenFile *file = (OpenFile *)(uintptr_t)fi->fh;
+    pthread_mutex_lock(&fsLock);
+    int length = 0;
+    if (offset < file->size)
+    {
+        length = file->size - offset < (off_t)size ? (int)(file->size - offset) : (int)size;
+        memcpy(buf, file->data + offset, length);
+    }
+    pthread_mutex_unlock(&fsLock);
+    return length;
+}
+
+static int tinyWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    (void)path;
+    OpenFile *file = (OpenFile *)(uintptr_t)fi->fh;
+    pthread_mutex_lock(&fsLock);
+    int result = 0;
+    if (offset + (off_t)size > file->size)
+    {
+        result = resize(file, offset + size);
+    }
+    if (result == 0)
+    {
+        memcpy(file->data + offset, buf, size);
+        file->dirty = 1;
+        result = (int)size;
+    }
+    pthread_mutex_unlock(&fsLock);
+    return result;
+}
+
+static int tinyTruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+    pthread_mutex_lock(&fsLock);
+    int result = 0;
+    OpenFile *file = fi != NULL ? (OpenFile *)(uintptr_t)fi->fh : NULL;
+    if (file != NULL)
+    {
+        result = resize(file, size);
+    }
+    else
+    {
+        result = openContent(path, &file);
+        if (result == 0)
+        {
+            result = resize(file, size);
+            releaseContent(file);
+        }
+    }
+    pthread_mutex_unlock(&fsLock);
+    return result;
+}
+
+static int tinyFlush(const char *path, struct fuse_file_info *fi)
+{
+    (void)path;
+    pthread_mutex_lock(&fsLock);
+    int result = writeBack((OpenFile *)(uintptr_t)fi->fh);
+    pthread_mutex_unlock(&fsLock);
+    return result;
+}
+
+static int tinyFsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    (void)path;
+    (void)datasync;
+    OpenFile *file = (OpenFile *)(uintptr_t)fi->fh;
+    pthread_mutex_lock(&fsLock);
+    int result = writeBack(file);
+    if (result == 0 && !file->deleted && tfs_fsync(file->fd) < 0)
+    {
+        result = -EIO;
+    }
+    pthread_mutex_unlock(&fsLock);
+    return result;
+}
+
+static int tinyRelease(const char *path, struct fuse_file_info *fi)
+{
+    (void)path;
+    pthread_mutex_lock(&fsLock);
+    releaseContent((OpenFile *)(uintptr_t)fi->fh);
+    pthread_mutex_unlock(&fsLock);
+    return 0;
+}
+
+// delete the file or directory at path, which has to be a directory exactly when wantDirectory
+static int removePath(const char *path, int wantDirectory)
+{
+    FileInfo info;
+    int result = tfs_stat(tinyPath(path), &info);
+    if (result < 0)
+    {
+        return toErrno(result);
+    }
+    if (info.isDirectory != wantDirectory)
+    {
+        return wantDirectory ? -ENOTDIR : -EISDIR;
+    }
+    fileDescriptor fd = tfs_openFile(tinyPath(path));
+    if (fd < 0)
+    {
+        return toErrno(fd);
+    }
+    OpenFile *file = findOpenDescriptor(fd);
+    result = tfs_deleteFile(fd);
+    if (result < 0)
+    {
+        closeUnlessOpen(fd);
+        return toErrno(result);
+    }
+    if (file != NULL)
+    {
+        file->deleted = 1; // its descriptor went with the file
+    }
+    return 0;
+}
+
+static int tinyUnlink(const char *path)
+{
+    pthread_mutex_lock(&fsLock);
+    int result = removePath(path, 0);
+    pthread_mutex_unlock(&fsLock);
+    return result;
+}
+
+static int tinyRmdir(const char *path)
+{
+    pthread_mutex_lock(&fsLock);
+    int result = removePath(path, 1);
+    pthread_mutex_unlock(&fsLock);
+    return result;
+}
+
+static int tinyMkdir(const char *path, mode_t mode)
+{
+    (void)mode;
+    pthread_mutex_lock(&fsLock);
+    int result = tfs_mkdir(tinyPath(path));
+    pthread_mutex_unlock(&fsLock);
+    return result < 0 ? toErrno(result) : 0;
+}
+
+// tfs_rename keeps a file in its directory, so only the last component may change
+static int tinyRename(const char *from, const char *to, unsigned int flags)
+{
+    if (flags != 0)
+    {
+        return -EINVAL;
+    }
+    const char *fromLeaf = strrchr(from, '/') + 1;
+    const char *toLeaf = strrchr(to, '/') + 1;
+    if (fromLeaf - from != toLeaf - to || strncmp(from, to, fromLeaf - from) != 0)
+    {
+        return -EXDEV;
+    }
+    pthread_mutex_lock(&fsLock);
+    FileInfo info;
+    FileInfo target;
+    int result = tfs_stat(tinyPath(from), &info);
+    if (result < 0)
+    {
+        result = toErrno(result);
+    }
+    else if (strcmp(from, to) == 0)
+    {
+        result = 0;
+    }
+    else
+    {
+        // an existing target is replaced, as rename(2) does
+        result = 0;
+        if (tfs_stat(tinyPath(to), &target) >= 0)
+        {
+            if (target.isDirectory && !info.isDirectory)
+            {
+                result = -EISDIR;
+            }
+            else if (!target.isDirectory && info.isDirectory)
+            {
+                result = -ENOTDIR;
+            }
+            else
+            {
+                result = removePath(to, target.isDirectory);
+            }
+        }
+        fileDescriptor fd = result == 0 ? tfs_openFile(tinyPath(from)) : 0;
+        if (fd < 0)
+        {
+            result = toErrno(fd);
+        }
+        else if (result == 0)
+        {
+            int renamed = tfs_rename(fd, (char *)toLeaf);
+            closeUnlessOpen(fd);
+            result = renamed < 0 ? toErrno(renamed) : 0;
+        }
+        // open files under the old name, or inside a renamed directory, follow it
+        size_t length = strlen(from);
+        for (OpenFile *file = openFiles; result == 0 && file != NULL; file = file->next)
+        {
+            if (!file->deleted && strncmp(file->path, from, length) == 0 &&
+                (file->path[length] == '\0' || file->path[length] == '/'))
+            {
+                char moved[PATH_MAX];
+                snprintf(moved, sizeof(moved), "%s%s", to, file->path + length);
+                snprintf(file->path, sizeof(file->path), "%s", moved);
+            }
+        }
+    }
+    pthread_mutex_unlock(&fsLock);
+    return result;
+}
+
+// inodes keep no modification times, accepted so touch and cp -p work
+static int tinyUtimens(const char *path, const struct timespec tv[2], struct fuse_file_info *fi)
+{
+    (void)tv;
+    (void)fi;
+    pthread_mutex_lock(&fsLock);
+    FileInfo info;
+    int result = tfs_stat(tinyPath(path), &info);
+    pthread_mutex_unlock(&fsLock);
+    return result < 0 ? toErrno(result) : 0;
+}
+
+static const struct fuse_operations tinyOperations = {
+    .init = tinyInit,
+    .destroy = tinyDestroy,
+    .getattr = tinyGetattr,
+    .readdir = tinyReaddir,
+    .open = tinyOpen,
+    .create = tinyCreate,
+    .read = tinyRead,
+    .write = tinyWrite,
+    .truncate = tinyTruncate,
+    .flush = tinyFlush,
+    .fsync = tinyFsync,
+    .release = tinyRelease,
+    .unlink = tinyUnlink,
+    .rmdir = tinyRmdir,
+    .mkdir = tinyMkdir,
+    .rename = tinyRename,
+    .utimens = tinyUtimens,
+};
+
+static char *imageName = NULL;
+
+// FUSE changes to / when it runs in the background, so every file the image lives in needs an
+// absolute path. Striped and mirrored images list their member files after the prefix (and the
+// unit of a stripe). Those are made absolute one by one without realpath, because a missing
+// mirror member is created again on mount. NULL if a plain image does not exist
+static char *resolveImage(const char *arg)
+{
+    size_t prefix = 0;
+    if (strncmp(arg, DISK_STRIPE_PREFIX, strlen(DISK_STRIPE_PREFIX)) == 0)
+    {
+        const char *unitEnd = strchr(arg + strlen(DISK_STRIPE_PREFIX), ':');
+        if (unitEnd == NULL)
+        {
+            return strdup(arg); // libDisk reports the missing unit
+        }
+        prefix = (size_t)(unitEnd - arg) + 1;
+    }
+    else if (strncmp(arg, DISK_MIRROR_PREFIX, strlen(DISK_MIRROR_PREFIX)) == 0)
+    {
+        prefix = strlen(DISK_MIRROR_PREFIX);
+    }
+    else
+    {
+        return realpath(arg, NULL);
+    }
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        return NULL;
+    }
+    int members = 1;
+    for (const char *c = arg + prefix; *c != '\0'; c++)
+    {
+        members += *c == ',';
+    }
+    char *resolved = (char *)malloc(strlen(arg) + members * (strlen(cwd) + 1) + 1);
+    if (resolved == NULL)
+    {
+        return NULL;
+    }
+    memcpy(resolved, arg, prefix);
+    char *out = resolved + prefix;
+    const char *member = arg + prefix;
+    while (1)
+    {
+        size_t length = strcspn(member, ",");
+        if (member[0] != '/')
+        {
+            out += sprintf(out, "%s/", cwd);
+        }
+        memcpy(out, member, length);
+        out += length;
+        if (member[length] == '\0')
+        {
+            break;
+        }
+        *out++ = ',';
+        member += length + 1;
+    }
+    *out = '\0';
+    return resolved;
+}
+
+// the first argument that is not an option names the image, the rest go to FUSE
+static int takeImage(void *data, const char *arg, int key, struct fuse_args *outargs)
+{
+    (void)data;
+    (void)outargs;
+    if (key == FUSE_OPT_KEY_NONOPT && imageName == NULL)
+    {
+        imageName = resolveImage(arg);
+        if (imageName == NULL)
+        {
+            fprintf(stderr, "Error: Unable to find image %s.\n", arg);
+            exit(1);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    if (fuse_opt_parse(&args, NULL, NULL, takeImage) == -1)
+    {
+        return 1;
+    }
+    if (imageName == NULL)
+    {
+        fprintf(stderr, "usage: %s <image> <mountpoint> [FUSE options]\n", argv[0]);
+        return 1;
+    }
+    if (tfs_mount(imageName) != MOUNT_SUCCESS)
+    {
+        fprintf(stderr, "Error: Unable to mount %s.\n", imageName);
+        return 1;
+    }
+    mountTime = time(NULL);
+    int result = fuse_main(args.argc, args.argv, &tinyOperations, NULL);
+    fuse_opt_free_args(&args);
+    free(imageName);
+    return result;
+}
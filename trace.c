@@ -0,0 +1,556 @@
+// Call tracing
+// compiled into libTinyFS.c after every public call, see the untraced_ names at the top and trace.h
+// for the record layout. Nothing is timed or written while no trace is open, a wrapper then only
+// costs the check of traceFile
+#undef tfs_mkfs
+#undef tfs_mount
+#undef tfs_unmount
+#undef tfs_openFile
+#undef tfs_openPath
+#undef tfs_mkdir
+#undef tfs_createMany
+#undef tfs_deleteMany
+#undef tfs_writeFile
+#undef tfs_deleteFile
+#undef tfs_closeFile
+#undef tfs_fsync
+#undef tfs_sync
+#undef tfs_setDirectIO
+#undef tfs_readdir
+#undef tfs_stat
+#undef tfs_listDirectory
+#undef tfs_readByte
+#undef tfs_seek
+#undef tfs_lseek
+#undef tfs_writeAt
+#undef tfs_truncate
+#undef tfs_fallocate
+#undef tfs_export
+#undef tfs_import
+#undef tfs_setRawData
+#undef tfs_readv
+#undef tfs_writev
+#undef tfs_advise
+#undef tfs_setOwner
+#undef tfs_setQuota
+#undef tfs_quotaUsage
+#undef tfs_setThrottle
+#undef tfs_readFileInfo
+#undef tfs_rename
+#undef tfs_setCompression
+#undef tfs_setFileCompression
+#undef tfs_setDedup
+#undef tfs_snapshot
+#undef tfs_deleteSnapshot
+#undef tfs_mountSnapshot
+
+FILE *traceFile = NULL;          // trace being written, NULL when tracing is off
+int traceEnvChecked = 0;         // TINYFS_TRACE has been looked at
+long long traceLast = 0;         // start of the previous record, microseconds
+int traceThreads = 0;            // threads that have made a traced call
+__thread int traceThread = -1;   // number of the calling thread in the trace
+pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+
+long long traceNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void traceNumber(unsigned long long value)
+{
+    while (value >= 0x80)
+    {
+        putc((int)(value & 0x7F) | 0x80, traceFile);
+        value >>= 7;
+    }
+    putc((int)value, traceFile);
+}
+
+void traceSigned(long long value)
+{
+    traceNumber(((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63));
+}
+
+void traceString(const char *string)
+{
+    if (string == NULL)
+    {
+        traceNumber(0);
+        return;
+    }
+    size_t length = strlen(string);
+    traceNumber(length + 1);
+    fwrite(string, 1, length, traceFile);
+}
+
+void traceClose(void)
+{
+    pthread_mutex_lock(&traceLock);
+    if (traceFile != NULL)
+    {
+        fclose(traceFile);
+        traceFile = NULL;
+    }
+    pthread_mutex_unlock(&traceLock);
+}
+
+int traceOpen(const char *path)
+{
+    static int registered = 0;
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: Unable to create trace file %s.\n", path);
+        return TRACE_ERROR;
+    }
+    traceClose();
+    pthread_mutex_lock(&traceLock);
+    traceFile = file;
+    fwrite(TRACE_MAGIC, 1, 4, traceFile);
+    putc(TRACE_VERSION, traceFile);
+    traceLast = traceNow();
+    pthread_mutex_unlock(&traceLock);
+    if (!registered)
+    {
+        // whatever is still buffered reaches the file when the program exits
+        atexit(traceClose);
+        registered = 1;
+    }
+    return 1;
+}
+
+// start time of a call to trace, -1 when tracing is off. The first call made opens the trace named
+// by TINYFS_TRACE, so a program can be traced without changing it
+long long traceBegin(void)
+{
+    if (traceFile == NULL)
+    {
+        if (traceEnvChecked)
+        {
+            return -1;
+        }
+        traceEnvChecked = 1;
+        char *path = getenv("TINYFS_TRACE");
+        if (path == NULL || path[0] == '\0' || traceOpen(path) < 0)
+        {
+            return -1;
+        }
+    }
+    return traceNow();
+}
+
+// write the record of a finished call, the arguments follow format as listed in traceOps
+void traceEnd(int op, long long start, int result, ...)
+{
+    if (start < 0)
+    {
+        return;
+    }
+    long long end = traceNow();
+    va_list args;
+    va_start(args, result);
+    pthread_mutex_lock(&traceLock);
+    if (traceFile == NULL)
+    {
+        pthread_mutex_unlock(&traceLock);
+        va_end(args);
+        return;
+    }
+    if (traceThread < 0)
+    {
+        traceThread = traceThreads++ % TRACE_MAX_THREADS;
+    }
+    putc(op, traceFile);
+    putc(traceThread, traceFile);
+    traceSigned(start - traceLast);
+    traceNumber((unsigned long long)(end - start));
+    traceSigned(result);
+    traceLast = start;
+    int count = 0;
+    for (const char *format = traceOps[op].format; *format != '\0'; format++)
+    {
+        switch (*format)
+        {
+        case 'i':
+            count = va_arg(args, int);
+            traceSigned(count);
+            break;
+        case 's':
+            traceString(va_arg(args, char *));
+            break;
+        case 'S':
+        {
+            char **strings = va_arg(args, char **);
+            for (int i = 0; i < count; i++)
+            {
+                traceString(strings[i]);
+            }
+            break;
+        }
+        case 'D':
+        {
+            int *numbers = va_arg(args, int *);
+            for (int i = 0; i < count; i++)
+            {
+                traceSigned(numbers[i]);
+            }
+            break;
+        }
+        }
+    }
+    // the trace is complete up to the last point the program asked its data to be durable
+    if (op == TRACE_UNMOUNT || op == TRACE_SYNC || op == TRACE_FSYNC)
+    {
+        fflush(traceFile);
+    }
+    pthread_mutex_unlock(&traceLock);
+    va_end(args);
+}
+
+int tfs_trace(char *path)
+{
+    /* records every public tfs_ call made from now on into the binary trace
+    file path, with its arguments, result, start time and duration, until
+    tfs_trace(NULL) closes the trace. Setting TINYFS_TRACE in the environment
+    does the same from the first call on. tinyfs-replay plays a trace back
+    against a fresh image. */
+    if (path == NULL)
+    {
+        traceClose();
+        return 1;
+    }
+    return traceOpen(path);
+}
+
+int tfs_mkfs(char *filename, int nBytes)
+{
+    long long start = traceBegin();
+    int result = untraced_mkfs(filename, nBytes);
+    traceEnd(TRACE_MKFS, start, result, filename, nBytes);
+    return result;
+}
+
+int tfs_mount(char *diskname)
+{
+    long long start = traceBegin();
+    int result = untraced_mount(diskname);
+    // the size and features of the image let a replay format a matching fresh one
+    int size = result >= 0 ? mountedBitmap->num_blocks * BLOCKSIZE : 0;
+    traceEnd(TRACE_MOUNT, start, result, diskname, size, result >= 0 ? mountedFeatures : 0);
+    return result;
+}
+
+int tfs_unmount(void)
+{
+    long long start = traceBegin();
+    int result = untraced_unmount();
+    traceEnd(TRACE_UNMOUNT, start, result);
+    return result;
+}
+
+fileDescriptor tfs_openFile(char *name)
+{
+    long long start = traceBegin();
+    fileDescriptor result = untraced_openFile(name);
+    traceEnd(TRACE_OPEN_FILE, start, result, name);
+    return result;
+}
+
+fileDescriptor tfs_openPath(char *path)
+{
+    long long start = traceBegin();
+    fileDescriptor result = untraced_openPath(path);
+    traceEnd(TRACE_OPEN_PATH, start, result, path);
+    return result;
+}
+
+int tfs_mkdir(char *path)
+{
+    long long start = traceBegin();
+    int result = untraced_mkdir(path);
+    traceEnd(TRACE_MKDIR, start, result, path);
+    return result;
+}
+
+int tfs_createMany(char *names[], int n, fileDescriptor descriptors[])
+{
+    long long start = traceBegin();
+    int result = untraced_createMany(names, n, descriptors);
+    traceEnd(TRACE_CREATE_MANY, start, result, n, names, result < 0 ? 0 : n, descriptors);
+    return result;
+}
+
+int tfs_deleteMany(fileDescriptor fds[], int n)
+{
+    long long start = traceBegin();
+    int result = untraced_deleteMany(fds, n);
+    traceEnd(TRACE_DELETE_MANY, start, result, n, fds);
+    return result;
+}
+
+int tfs_writeFile(fileDescriptor FD, char *buffer, int size)
+{
+    long long start = traceBegin();
+    int result = untraced_writeFile(FD, buffer, size);
+    traceEnd(TRACE_WRITE_FILE, start, result, FD, size);
+    return result;
+}
+
+int tfs_deleteFile(fileDescriptor FD)
+{
+    long long start = traceBegin();
+    int result = untraced_deleteFile(FD);
+    traceEnd(TRACE_DELETE_FILE, start, result, FD);
+    return result;
+}
+
+int tfs_closeFile(fileDescriptor FD)
+{
+    long long start = traceBegin();
+    int result = untraced_closeFile(FD);
+    traceEnd(TRACE_CLOSE_FILE, start, result, FD);
+    return result;
+}
+
+int tfs_fsync(fileDescriptor FD)
+{
+    long long start = traceBegin();
+    int result = untraced_fsync(FD);
+    traceEnd(TRACE_FSYNC, start, result, FD);
+    return result;
+}
+
+int tfs_sync(void)
+{
+    long long start = traceBegin();
+    int result = untraced_sync();
+    traceEnd(TRACE_SYNC, start, result);
+    return result;
+}
+
+int tfs_setDirectIO(int enabled)
+{
+    long long start = traceBegin();
+    int result = untraced_setDirectIO(enabled);
+    traceEnd(TRACE_SET_DIRECT_IO, start, result, enabled);
+    return result;
+}
+
+int tfs_readdir()
+{
+    long long start = traceBegin();
+    int result = untraced_readdir();
+    traceEnd(TRACE_READDIR, start, result);
+    return result;
+}
+
+int tfs_stat(char *path, FileInfo *info)
+{
+    long long start = traceBegin();
+    int result = untraced_stat(path, info);
+    traceEnd(TRACE_STAT, start, result, path);
+    return result;
+}
+
+int tfs_listDirectory(char *path, char names[][MAX_FILENAME_LENGTH + 1], int max)
+{
+    long long start = traceBegin();
+    int result = untraced_listDirectory(path, names, max);
+    traceEnd(TRACE_LIST_DIRECTORY, start, result, path, max);
+    return result;
+}
+
+int tfs_readByte(fileDescriptor FD, char *buffer)
+{
+    long long start = traceBegin();
+    int result = untraced_readByte(FD, buffer);
+    traceEnd(TRACE_READ_BYTE, start, result, FD);
+    return result;
+}
+
+int tfs_seek(fileDescriptor FD, int offset)
+{
+    long long start = traceBegin();
+    int result = untraced_seek(FD, offset);
+    traceEnd(TRACE_SEEK, start, result, FD, offset);
+    return result;
+}
+
+int tfs_lseek(fileDescriptor FD, int offset, int whence)
+{
+    long long start = traceBegin();
+    int result = untraced_lseek(FD, offset, whence);
+    traceEnd(TRACE_LSEEK, start, result, FD, offset, whence);
+    return result;
+}
+
+int tfs_writeAt(fileDescriptor FD, int offset, char *buffer, int size)
+{
+    long long start = traceBegin();
+    int result = untraced_writeAt(FD, offset, buffer, size);
+    traceEnd(TRACE_WRITE_AT, start, result, FD, offset, size);
+    return result;
+}
+
+int tfs_truncate(fileDescriptor FD, int size)
+{
+    long long start = traceBegin();
+    int result = untraced_truncate(FD, size);
+    traceEnd(TRACE_TRUNCATE, start, result, FD, size);
+    return result;
+}
+
+int tfs_fallocate(fileDescriptor FD, int size, int flags)
+{
+    long long start = traceBegin();
+    int result = untraced_fallocate(FD, size, flags);
+    traceEnd(TRACE_FALLOCATE, start, result, FD, size, flags);
+    return result;
+}
+
+int tfs_export(fileDescriptor FD, int hostfd)
+{
+    long long start = traceBegin();
+    int result = untraced_export(FD, hostfd);
+    traceEnd(TRACE_EXPORT, start, result, FD);
+    return result;
+}
+
+fileDescriptor tfs_import(int hostfd, char *name)
+{
+    long long start = traceBegin();
+    fileDescriptor result = untraced_import(hostfd, name);
+    FileEntry *file = start >= 0 && result >= 0 ? findFileEntryByFD(openFileTable, result) : NULL;
+    traceEnd(TRACE_IMPORT, start, result, name, file != NULL ? file->inode->file_size : 0);
+    return result;
+}
+
+int tfs_setRawData(int enabled)
+{
+    long long start = traceBegin();
+    int result = untraced_setRawData(enabled);
+    traceEnd(TRACE_SET_RAW_DATA, start, result, enabled);
+    return result;
+}
+
+int tfs_readv(fileDescriptor FD, const struct iovec *iov, int iovcnt)
+{
+    long long start = traceBegin();
+    int result = untraced_readv(FD, iov, iovcnt);
+    traceEnd(TRACE_READV, start, result, FD, iovcnt, start >= 0 ? vectorSize(iov, iovcnt) : 0);
+    return result;
+}
+
+int tfs_writev(fileDescriptor FD, const struct iovec *iov, int iovcnt)
+{
+    long long start = traceBegin();
+    int result = untraced_writev(FD, iov, iovcnt);
+    traceEnd(TRACE_WRITEV, start, result, FD, iovcnt, start >= 0 ? vectorSize(iov, iovcnt) : 0);
+    return result;
+}
+
+int tfs_advise(fileDescriptor FD, int offset, int len, int advice)
+{
+    long long start = traceBegin();
+    int result = untraced_advise(FD, offset, len, advice);
+    traceEnd(TRACE_ADVISE, start, result, FD, offset, len, advice);
+    return result;
+}
+
+int tfs_setOwner(int owner)
+{
+    long long start = traceBegin();
+    int result = untraced_setOwner(owner);
+    traceEnd(TRACE_SET_OWNER, start, result, owner);
+    return result;
+}
+
+int tfs_setQuota(int owner, int blocks)
+{
+    long long start = traceBegin();
+    int result = untraced_setQuota(owner, blocks);
+    traceEnd(TRACE_SET_QUOTA, start, result, owner, blocks);
+    return result;
+}
+
+int tfs_quotaUsage(int owner, int *used, int *limit)
+{
+    long long start = traceBegin();
+    int result = untraced_quotaUsage(owner, used, limit);
+    traceEnd(TRACE_QUOTA_USAGE, start, result, owner);
+    return result;
+}
+
+int tfs_setThrottle(int owner, int bytesPerSecond, int burst)
+{
+    long long start = traceBegin();
+    int result = untraced_setThrottle(owner, bytesPerSecond, burst);
+    traceEnd(TRACE_SET_THROTTLE, start, result, owner, bytesPerSecond, burst);
+    return result;
+}
+
+int tfs_readFileInfo(fileDescriptor FD)
+{
+    long long start = traceBegin();
+    int result = untraced_readFileInfo(FD);
+    traceEnd(TRACE_READ_FILE_INFO, start, result, FD);
+    return result;
+}
+
+int tfs_rename(fileDescriptor FD, char *newName)
+{
+    long long start = traceBegin();
+    int result = untraced_rename(FD, newName);
+    traceEnd(TRACE_RENAME, start, result, FD, newName);
+    return result;
+}
+
+int tfs_setCompression(int enabled)
+{
+    long long start = traceBegin();
+    int result = untraced_setCompression(enabled);
+    traceEnd(TRACE_SET_COMPRESSION, start, result, enabled);
+    return result;
+}
+
+int tfs_setFileCompression(fileDescriptor FD, int enabled)
+{
+    long long start = traceBegin();
+    int result = untraced_setFileCompression(FD, enabled);
+    traceEnd(TRACE_SET_FILE_COMPRESSION, start, result, FD, enabled);
+    return result;
+}
+
+int tfs_setDedup(int enabled)
+{
+    long long start = traceBegin();
+    int result = untraced_setDedup(enabled);
+    traceEnd(TRACE_SET_DEDUP, start, result, enabled);
+    return result;
+}
+
+int tfs_snapshot(char *name)
+{
+    long long start = traceBegin();
+    int result = untraced_snapshot(name);
+    traceEnd(TRACE_SNAPSHOT, start, result, name);
+    return result;
+}
+
+int tfs_deleteSnapshot(char *name)
+{
+    long long start = traceBegin();
+    int result = untraced_deleteSnapshot(name);
+    traceEnd(TRACE_DELETE_SNAPSHOT, start, result, name);
+    return result;
+}
+
+int tfs_mountSnapshot(char *diskname, char *name)
+{
+    long long start = traceBegin();
+    int result = untraced_mountSnapshot(diskname, name);
+    traceEnd(TRACE_MOUNT_SNAPSHOT, start, result, diskname, name);
+    return result;
+}
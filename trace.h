@@ -0,0 +1,114 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// binary trace of public tfs_ calls, written by trace.c and read back by tinyfs-replay.
+// The file starts with TRACE_MAGIC and a version byte, then one record per call:
+//   1 byte operation, 1 byte calling thread, start in microseconds after the start of the
+//   previous record, duration in microseconds, result, then the arguments listed in traceOps
+// Numbers are LEB128 varints, signed ones zigzag encoded. Argument formats:
+//   i  a number
+//   s  a string, its length + 1 followed by its bytes, 0 for NULL
+//   S  as many strings as the number before it
+//   D  as many numbers as the number before it
+// Buffers are recorded as their size only, never their content
+
+#define TRACE_MAGIC "TFST"
+#define TRACE_VERSION 1
+#define TRACE_MAX_THREADS 255
+
+#define TRACE_MKFS 1
+#define TRACE_MOUNT 2 // file name, then the size in bytes and features of the mounted image
+#define TRACE_UNMOUNT 3
+#define TRACE_OPEN_FILE 4
+#define TRACE_OPEN_PATH 5
+#define TRACE_MKDIR 6
+#define TRACE_CREATE_MANY 7 // names, then the descriptors handed back
+#define TRACE_DELETE_MANY 8
+#define TRACE_WRITE_FILE 9
+#define TRACE_DELETE_FILE 10
+#define TRACE_CLOSE_FILE 11
+#define TRACE_FSYNC 12
+#define TRACE_SYNC 13
+#define TRACE_SET_DIRECT_IO 14
+#define TRACE_READDIR 15
+#define TRACE_STAT 16
+#define TRACE_LIST_DIRECTORY 17
+#define TRACE_READ_BYTE 18
+#define TRACE_SEEK 19
+#define TRACE_LSEEK 20
+#define TRACE_WRITE_AT 21
+#define TRACE_TRUNCATE 22
+#define TRACE_FALLOCATE 23
+#define TRACE_EXPORT 24
+#define TRACE_IMPORT 25 // name, then the size of the imported file
+#define TRACE_SET_RAW_DATA 26
+#define TRACE_READV 27 // descriptor, number of buffers, their total size
+#define TRACE_WRITEV 28
+#define TRACE_ADVISE 29
+#define TRACE_SET_OWNER 30
+#define TRACE_SET_QUOTA 31
+#define TRACE_QUOTA_USAGE 32
+#define TRACE_SET_THROTTLE 33
+#define TRACE_READ_FILE_INFO 34
+#define TRACE_RENAME 35
+#define TRACE_SET_COMPRESSION 36
+#define TRACE_SET_FILE_COMPRESSION 37
+#define TRACE_SET_DEDUP 38
+#define TRACE_SNAPSHOT 39
+#define TRACE_DELETE_SNAPSHOT 40
+#define TRACE_MOUNT_SNAPSHOT 41
+#define TRACE_OPS 42
+
+// name and argument format of every operation
+typedef struct
+{
+    const char *name;
+    const char *format;
+} TraceOp;
+
+static const TraceOp traceOps[TRACE_OPS] = {
+    {NULL, NULL},
+    {"mkfs", "si"},
+    {"mount", "sii"},
+    {"unmount", ""},
+    {"openFile", "s"},
+    {"openPath", "s"},
+    {"mkdir", "s"},
+    {"createMany", "iSiD"},
+    {"deleteMany", "iD"},
+    {"writeFile", "ii"},
+    {"deleteFile", "i"},
+    {"closeFile", "i"},
+    {"fsync", "i"},
+    {"sync", ""},
+    {"setDirectIO", "i"},
+    {"readdir", ""},
+    {"stat", "s"},
+    {"listDirectory", "si"},
+    {"readByte", "i"},
+    {"seek", "ii"},
+    {"lseek", "iii"},
+    {"writeAt", "iii"},
+    {"truncate", "ii"},
+    {"fallocate", "iii"},
+    {"export", "i"},
+    {"import", "si"},
+    {"setRawData", "i"},
+    {"readv", "iii"},
+    {"writev", "iii"},
+    {"advise", "iiii"},
+    {"setOwner", "i"},
+    {"setQuota", "ii"},
+    {"quotaUsage", "i"},
+    {"setThrottle", "iii"},
+    {"readFileInfo", "i"},
+    {"rename", "is"},
+    {"setCompression", "i"},
+    {"setFileCompression", "ii"},
+    {"setDedup", "i"},
+    {"snapshot", "s"},
+    {"deleteSnapshot", "s"},
+    {"mountSnapshot", "ss"},
+};
+
+#endif // TRACE_H
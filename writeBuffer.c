@@ -0,0 +1,323 @@
+#include <stdlib.h>
+#include <string.h>
+#include "libDisk.h"
+#include "writeBuffer.h"
+
+#define WRITE_BUFFER_SLOTS (2 * WRITE_BUFFER_BLOCKS) // open addressing, kept at most half full
+
+static int bufferBlocks[WRITE_BUFFER_SLOTS]; // block held by each slot, -1 for an empty slot
+static unsigned char bufferDirty[WRITE_BUFFER_SLOTS]; // 0 for a clean copy cached for a direct disk
+static unsigned char bufferData[WRITE_BUFFER_SLOTS][BLOCKSIZE];
+static int bufferCount = 0; // clean and dirty blocks held
+static int bufferReady = 0;
+
+static void clearWriteBuffer(void)
+{
+    for (int i = 0; i < WRITE_BUFFER_SLOTS; i++)
+    {
+        bufferBlocks[i] = -1;
+    }
+    bufferCount = 0;
+    bufferReady = 1;
+}
+
+// blocks per aligned unit of a disk, 1 unless it was opened with DISK_DIRECT
+static int chunkBlocks(int disk)
+{
+    int blocks = diskAlignment(disk) / BLOCKSIZE;
+    return blocks > WRITE_BUFFER_BLOCKS ? 1 : blocks;
+}
+
+// slot holding bNum, or the empty slot where it would go
+static int bufferSlot(int bNum)
+{
+    if (!bufferReady)
+    {
+        clearWriteBuffer();
+    }
+    int slot = bNum % WRITE_BUFFER_SLOTS;
+    while (bufferBlocks[slot] != -1 && bufferBlocks[slot] != bNum)
+    {
+        slot = (slot + 1) % WRITE_BUFFER_SLOTS;
+    }
+    return slot;
+}
+
+static int compareBlocks(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+// forget the clean blocks and every block from first to last - 1, rehashing the dirty ones that
+// stay so no probe chain is left broken
+static void dropBlocks(int first, int last)
+{
+    static int keepBlocks[WRITE_BUFFER_BLOCKS];
+    static unsigned char keepData[WRITE_BUFFER_BLOCKS][BLOCKSIZE];
+    int count = 0;
+    for (int i = 0; i < WRITE_BUFFER_SLOTS; i++)
+    {
+        if (bufferBlocks[i] != -1 && bufferDirty[i] && (bufferBlocks[i] < first || bufferBlocks[i] >= last))
+        {
+            keepBlocks[count] = bufferBlocks[i];
+            memcpy(keepData[count++], bufferData[i], BLOCKSIZE);
+        }
+    }
+    clearWriteBuffer();
+    for (int i = 0; i < count; i++)
+    {
+        int slot = bufferSlot(keepBlocks[i]);
+        bufferBlocks[slot] = keepBlocks[i];
+        bufferDirty[slot] = 1;
+        memcpy(bufferData[slot], keepData[i], BLOCKSIZE);
+    }
+    bufferCount = count;
+}
+
+// make room for one more block: clean copies go first, then the dirty ones are flushed
+static int reserveSlot(int disk)
+{
+    if (bufferCount < WRITE_BUFFER_BLOCKS)
+    {
+        return 0;
+    }
+    dropBlocks(0, 0);
+    if (bufferCount == WRITE_BUFFER_BLOCKS)
+    {
+        if (flushWriteBuffer(disk) == -1)
+        {
+            return -1;
+        }
+        clearWriteBuffer();
+    }
+    return 0;
+}
+
+// read a block, the buffered copy wins over the disk. A direct disk reads the whole aligned unit
+// and keeps its blocks as clean copies, since there is no page cache under it
+int bufferedRead(int disk, int bNum, void *block)
+{
+    static unsigned char unit[WRITE_BUFFER_BLOCKS * BLOCKSIZE];
+    int slot = bufferSlot(bNum);
+    if (bufferBlocks[slot] == bNum)
+    {
+        memcpy(block, bufferData[slot], BLOCKSIZE);
+        return 0;
+    }
+    int chunk = chunkBlocks(disk);
+    if (chunk == 1)
+    {
+        return readBlock(disk, bNum, block);
+    }
+    int first = bNum - bNum % chunk;
+    if (readBlocks(disk, first, chunk, unit) == -1)
+    {
+        return -1;
+    }
+    for (int i = 0; i < chunk; i++)
+    {
+        slot = bufferSlot(first + i);
+        if (bufferBlocks[slot] == first + i)
+        {
+            continue; // a buffered write is newer than the disk
+        }
+        if (reserveSlot(disk) == -1)
+        {
+            return -1;
+        }
+        slot = bufferSlot(first + i);
+        bufferBlocks[slot] = first + i;
+        bufferDirty[slot] = 0;
+        memcpy(bufferData[slot], unit + i * BLOCKSIZE, BLOCKSIZE);
+        bufferCount++;
+    }
+    memcpy(block, unit + (bNum - first) * BLOCKSIZE, BLOCKSIZE); // its clean copy may already be evicted
+    return 0;
+}
+
+// queue a block write, a later write to the same block replaces it in place
+int bufferedWrite(int disk, int bNum, void *block)
+{
+    int slot = bufferSlot(bNum);
+    if (bufferBlocks[slot] != bNum)
+    {
+        if (reserveSlot(disk) == -1)
+        {
+            return -1;
+        }
+        slot = bufferSlot(bNum);
+        bufferBlocks[slot] = bNum;
+        bufferCount++;
+    }
+    bufferDirty[slot] = 1;
+    memcpy(bufferData[slot], block, BLOCKSIZE);
+    return 0;
+}
+
+// read consecutive blocks with one read(), then lay any buffered copies over them
+int bufferedReadRun(int disk, int bNum, int nBlocks, void *blocks)
+{
+    if (readBlocks(disk, bNum, nBlocks, blocks) == -1)
+    {
+        return -1;
+    }
+    for (int i = 0; i < nBlocks && bufferCount > 0; i++)
+    {
+        int slot = bufferSlot(bNum + i);
+        if (bufferBlocks[slot] == bNum + i)
+        {
+            memcpy((unsigned char *)blocks + i * BLOCKSIZE, bufferData[slot], BLOCKSIZE);
+        }
+    }
+    return 0;
+}
+
+int bufferedWriteRun(int disk, int bNum, int nBlocks, void *blocks)
+{
+    for (int i = 0; i < nBlocks; i++)
+    {
+        if (bufferedWrite(disk, bNum + i, (unsigned char *)blocks + i * BLOCKSIZE) == -1)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// copy len bytes of src to where byte offset of the buffers of iov falls
+static void scatterBytes(const struct iovec *iov, int iovcnt, size_t offset, const unsigned char *src, size_t len)
+{
+    for (int i = 0; i < iovcnt && len > 0; i++)
+    {
+        if (offset >= iov[i].iov_len)
+        {
+            offset -= iov[i].iov_len;
+            continue;
+        }
+        size_t count = iov[i].iov_len - offset < len ? iov[i].iov_len - offset : len;
+        memcpy((unsigned char *)iov[i].iov_base + offset, src, count);
+        src += count;
+        len -= count;
+        offset = 0;
+    }
+}
+
+// read consecutive blocks scattered over iov with one preadv(), then lay any buffered copies over
+// the parts of iov they cover
+int bufferedReadRunv(int disk, int bNum, int nBlocks, const struct iovec *iov, int iovcnt)
+{
+    if (readBlocksv(disk, bNum, iov, iovcnt) == -1)
+    {
+        return -1;
+    }
+    for (int i = 0; i < nBlocks && bufferCount > 0; i++)
+    {
+        int slot = bufferSlot(bNum + i);
+        if (bufferBlocks[slot] == bNum + i)
+        {
+            scatterBytes(iov, iovcnt, (size_t)i * BLOCKSIZE, bufferData[slot], BLOCKSIZE);
+        }
+    }
+    return 0;
+}
+
+// write consecutive blocks gathered from iov with one pwritev(), straight to the disk. Buffered
+// copies of those blocks are dropped first, so an older queued write can not land over them
+int bufferedWriteRunv(int disk, int bNum, int nBlocks, const struct iovec *iov, int iovcnt)
+{
+    for (int i = 0; i < nBlocks && bufferCount > 0; i++)
+    {
+        if (bufferBlocks[bufferSlot(bNum + i)] == bNum + i)
+        {
+            dropBlocks(bNum, bNum + nBlocks);
+            break;
+        }
+    }
+    return writeBlocksv(disk, bNum, iov, iovcnt);
+}
+
+// write every dirty block in block order, one writeBlocks() per run of consecutive aligned units.
+// On a direct disk each unit is written whole, filled from clean copies or read once if some
+// of its blocks are not held, so libDisk never has to read around a partial unit.
+int flushWriteBuffer(int disk)
+{
+    static unsigned char run[WRITE_BUFFER_BLOCKS * BLOCKSIZE];
+    static unsigned char unit[WRITE_BUFFER_BLOCKS * BLOCKSIZE];
+    int order[WRITE_BUFFER_BLOCKS];
+    int count = 0;
+    for (int i = 0; i < WRITE_BUFFER_SLOTS; i++)
+    {
+        if (bufferBlocks[i] != -1 && bufferDirty[i])
+        {
+            order[count++] = bufferBlocks[i];
+        }
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+    qsort(order, count, sizeof(int), compareBlocks);
+    int chunk = chunkBlocks(disk);
+    for (int i = 0; i < count;)
+    {
+        int first = order[i] / chunk;
+        int units = 0;
+        while (i < count && order[i] / chunk == first + units && (units + 1) * chunk <= WRITE_BUFFER_BLOCKS)
+        {
+            int base = (first + units) * chunk;
+            int missing = 0;
+            for (int b = 0; b < chunk; b++)
+            {
+                int slot = bufferSlot(base + b);
+                if (bufferBlocks[slot] == base + b)
+                {
+                    memcpy(run + (units * chunk + b) * BLOCKSIZE, bufferData[slot], BLOCKSIZE);
+                }
+                else
+                {
+                    missing = 1;
+                }
+            }
+            if (missing)
+            {
+                if (readBlocks(disk, base, chunk, unit) == -1)
+                {
+                    return -1;
+                }
+                for (int b = 0; b < chunk; b++)
+                {
+                    int slot = bufferSlot(base + b);
+                    if (bufferBlocks[slot] != base + b)
+                    {
+                        memcpy(run + (units * chunk + b) * BLOCKSIZE, unit + b * BLOCKSIZE, BLOCKSIZE);
+                    }
+                }
+            }
+            while (i < count && order[i] / chunk == first + units)
+            {
+                i++;
+            }
+            units++;
+        }
+        if (writeBlocks(disk, first * chunk, units * chunk, run) == -1)
+        {
+            return -1;
+        }
+    }
+    if (chunk == 1)
+    {
+        clearWriteBuffer(); // the page cache already holds what was written
+        return 0;
+    }
+    for (int i = 0; i < WRITE_BUFFER_SLOTS; i++)
+    {
+        bufferDirty[i] = 0;
+    }
+    return 0;
+}
+
+// forget every buffered block without writing it, for a disk that is being closed on an error
+void dropWriteBuffer(void)
+{
+    clearWriteBuffer();
+}
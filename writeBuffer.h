@@ -0,0 +1,19 @@
+#ifndef WRITEBUFFER_H
+#define WRITEBUFFER_H
+
+// dirty blocks of the mounted disk held in memory until a flush. Repeated writes to a block
+// merge, and a flush writes the blocks sorted by number as contiguous runs. On a disk opened
+// with DISK_DIRECT it also keeps clean blocks, so it is the only cache between TinyFS and the disk
+
+#define WRITE_BUFFER_BLOCKS 256 // blocks held before a new one evicts the clean ones or forces a flush
+
+int bufferedRead(int disk, int bNum, void *block);
+int bufferedWrite(int disk, int bNum, void *block);
+int bufferedReadRun(int disk, int bNum, int nBlocks, void *blocks);
+int bufferedWriteRun(int disk, int bNum, int nBlocks, void *blocks);
+int bufferedReadRunv(int disk, int bNum, int nBlocks, const struct iovec *iov, int iovcnt);
+int bufferedWriteRunv(int disk, int bNum, int nBlocks, const struct iovec *iov, int iovcnt);
+int flushWriteBuffer(int disk);
+void dropWriteBuffer(void);
+
+#endif // WRITEBUFFER_H